@@ -0,0 +1,519 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+/*
+ * Flow insertion and deletion benchmark of the rte-lib rule management:
+ * flow builder, flow registry and async session engine.
+ * N rules of each shape are inserted then deleted, with TEID i + 1 and UE
+ * ip 2.0.0.1 + i. For each shape and API the rate, the latency percentiles
+ * of a rule and the memory held per rule are printed.
+ * - decap, encap, rss: GTP-U session rules of the async engine, inserted
+ *   with the template API (async) and with rte_flow_create (sync).
+ * - tag, age, counter, meter: rules built with the flow builder and created
+ *   with vnf_flow_create, spread over --groups groups from --group and
+ *   --priorities priorities, to see the cost of the placement.
+ * With --mock the rules go to the software flow backend, no NIC is needed:
+ * ./build/flow_bench --no-huge -m 1024 --no-pci -- --mock --rules 100000
+ * Otherwise port 0 is used, in the API mode its PMD supports.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include <rte_eal.h>
+#include <rte_common.h>
+#include <rte_malloc.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_flow.h>
+#include <rte_cycles.h>
+#include "main.h"
+
+enum bench_shape {
+	BENCH_DECAP,
+	BENCH_ENCAP,
+	BENCH_RSS,
+	BENCH_TAG,
+	BENCH_AGE,
+	BENCH_COUNTER,
+	BENCH_METER,
+	BENCH_SHAPE_MAX,
+};
+
+static const char * const shape_names[BENCH_SHAPE_MAX] = {
+	"decap", "encap", "rss", "tag", "age", "counter", "meter",
+};
+
+#define BENCH_SESSION_SHAPES \
+	(RTE_BIT32(BENCH_DECAP) | RTE_BIT32(BENCH_ENCAP) | RTE_BIT32(BENCH_RSS))
+#define BENCH_UE_IP_BASE ((2<<24) + 1) /* first UE ip = 2.0.0.1 */
+#define BENCH_OUTER_IP ((3<<24) + (3<<16) + (2<<8) + 1) /* 3.3.2.1 */
+#define BENCH_COOKIE_MASK ((UINT64_C(1) << 56) - 1)
+
+static uint16_t port_id;
+static uint32_t nb_rules = 10000;
+static uint32_t shapes = RTE_BIT32(BENCH_SHAPE_MAX) - 1;
+static uint32_t group_base = 1;
+static uint32_t nb_groups = 1;
+static uint32_t nb_priorities = 1;
+static int use_mock;
+static uint16_t rss_queues[] = { 0 };
+
+/* Start of the operation in flight and latency of each rule, in cycles. */
+static uint64_t *op_start;
+static uint64_t *op_lat;
+static uint32_t op_failed;
+
+/* Completion of a session rule, the cookie is its index. */
+static void
+bench_done(uint64_t cookie, int status)
+{
+	uint32_t i = (uint32_t)(cookie & BENCH_COOKIE_MASK);
+
+	if (i >= nb_rules)
+		return;
+	if (status)
+		op_failed++;
+	op_lat[i] = rte_get_timer_cycles() - op_start[i];
+}
+
+static uint64_t
+heap_used(void)
+{
+	struct rte_malloc_socket_stats st;
+
+	if (rte_malloc_get_socket_stats(rte_socket_id(), &st))
+		return 0;
+	return st.heap_allocsz_bytes;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double
+cycles_to_ns(uint64_t cycles)
+{
+	return (double)cycles * 1E9 / rte_get_timer_hz();
+}
+
+static void
+bench_report(const char *shape, const char *api, const char *op,
+	     uint64_t cycles, int64_t mem)
+{
+	uint32_t n = nb_rules;
+
+	qsort(op_lat, n, sizeof(*op_lat), cmp_u64);
+	printf("%-8s %-5s %-6s %8u %10.0f %8.0f %8.0f %8.0f %8.0f %10.0f",
+	       shape, api, op, n - op_failed,
+	       (double)(n - op_failed) * rte_get_timer_hz() /
+	       (cycles ? cycles : 1),
+	       cycles_to_ns(op_lat[n / 2]), cycles_to_ns(op_lat[n * 9 / 10]),
+	       cycles_to_ns(op_lat[n * 99 / 100]),
+	       cycles_to_ns(op_lat[n * 999 / 1000]),
+	       cycles_to_ns(op_lat[n - 1]));
+	if (mem >= 0)
+		printf(" %9.1f", (double)mem / n);
+	printf("\n");
+}
+
+static void
+bench_header(void)
+{
+	printf("%-8s %-5s %-6s %8s %10s %8s %8s %8s %8s %10s %9s\n",
+	       "shape", "api", "op", "rules", "rules/s", "p50 ns", "p90 ns",
+	       "p99 ns", "p99.9 ns", "max ns", "B/rule");
+}
+
+/* eth / ipv4 src 3.3.2.1 / udp 2152 / gtp teid / ipv4 src UE / end */
+static void
+bench_pattern(struct vnf_flow_builder *fb, uint32_t i)
+{
+	struct rte_flow_item_ipv4 ipv4_mask = {
+		.hdr = { .src_addr = RTE_BE32(0xffffffff) },
+	};
+	struct rte_flow_item_ipv4 ipv4 = {
+		.hdr = { .src_addr = RTE_BE32(BENCH_OUTER_IP) },
+	};
+	struct rte_flow_item_udp udp_mask = {
+		.hdr = { .dst_port = RTE_BE16(0xffff) },
+	};
+	struct rte_flow_item_udp udp = {
+		.hdr = { .dst_port = RTE_BE16(GTP_U_UDP_PORT) },
+	};
+	struct rte_flow_item_gtp gtp_mask = {
+		.teid = RTE_BE32(0xffffffff),
+	};
+	struct rte_flow_item_gtp gtp = {
+		.teid = rte_cpu_to_be_32(i + 1),
+	};
+
+	vnf_flow_builder_init(fb);
+	vnf_flow_item_eth(fb, NULL, NULL);
+	vnf_flow_item_ipv4(fb, &ipv4, &ipv4_mask);
+	vnf_flow_item_udp(fb, &udp, &udp_mask);
+	vnf_flow_item_gtp(fb, &gtp, &gtp_mask);
+	ipv4.hdr.src_addr = rte_cpu_to_be_32(BENCH_UE_IP_BASE + i);
+	vnf_flow_item_ipv4(fb, &ipv4, &ipv4_mask);
+}
+
+static void
+bench_actions(struct vnf_flow_builder *fb, enum bench_shape shape,
+	      uint32_t i, uint32_t group)
+{
+	struct rte_flow_action_age age;
+	struct rte_flow_action_count count;
+	struct rte_flow_action_meter meter = {
+		.mtr_id = NETDEV_DPDK_METER_METER_ID,
+	};
+
+	switch (shape) {
+	case BENCH_TAG:
+		vnf_flow_action_tag(fb, 0, i, UINT32_MAX);
+		vnf_flow_action_jump(fb, group + 1);
+		return;
+	case BENCH_AGE:
+		memset(&age, 0, sizeof(age));
+		age.timeout = 10;
+		vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_AGE, &age,
+				sizeof(age));
+		break;
+	case BENCH_COUNTER:
+		memset(&count, 0, sizeof(count));
+		vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_COUNT, &count,
+				sizeof(count));
+		break;
+	case BENCH_METER:
+		vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_METER, &meter,
+				sizeof(meter));
+		break;
+	default:
+		break;
+	}
+	vnf_flow_action_queue(fb, 0);
+}
+
+/* Rules created with vnf_flow_create, one at a time. */
+static void
+bench_sync_shape(enum bench_shape shape, uint32_t *ids)
+{
+	struct rte_flow_attr attr;
+	struct vnf_flow_builder *fb = vnf_flow_builder_get();
+	struct rte_flow_error error;
+	uint64_t cookie, start, total;
+	int64_t mem;
+	uint32_t i;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ingress = 1;
+	op_failed = 0;
+	mem = -(int64_t)heap_used();
+	total = 0;
+	for (i = 0; i < nb_rules; i++) {
+		attr.group = group_base + i % nb_groups;
+		attr.priority = i % nb_priorities;
+		bench_pattern(fb, i);
+		bench_actions(fb, shape, i, attr.group);
+		cookie = VNF_FLOW_COOKIE(VNF_FLOW_OWNER_APP, i);
+		start = rte_get_timer_cycles();
+		if (vnf_flow_create(port_id, &attr, fb->items, fb->actions,
+				    VNF_FLOW_OWNER_APP, cookie, &error) ==
+		    NULL) {
+			if (!op_failed)
+				printf("%s rule %u: %s\n", shape_names[shape],
+				       i, error.message ? error.message : "");
+			op_failed++;
+		}
+		op_lat[i] = rte_get_timer_cycles() - start;
+		total += op_lat[i];
+		ids[i] = vnf_flow_lookup_cookie(cookie);
+	}
+	mem += heap_used();
+	bench_report(shape_names[shape], "sync", "insert", total, mem);
+	op_failed = 0;
+	total = 0;
+	for (i = 0; i < nb_rules; i++) {
+		start = rte_get_timer_cycles();
+		if (vnf_flow_destroy(ids[i]))
+			op_failed++;
+		op_lat[i] = rte_get_timer_cycles() - start;
+		total += op_lat[i];
+	}
+	bench_report(shape_names[shape], "sync", "delete", total, -1);
+}
+
+/* GTP-U session rules of the async engine, latency up to completion. */
+static void
+bench_session_shape(enum bench_shape shape, uint32_t *ids)
+{
+	const char *api = vnf_async_template_mode(port_id) ? "async" : "sync";
+	struct vnf_async_session session;
+	uint64_t start;
+	int64_t mem;
+	uint32_t i;
+
+	memset(&session, 0, sizeof(session));
+	session.shape = (enum vnf_async_shape)shape;
+	op_failed = 0;
+	mem = -(int64_t)heap_used();
+	start = rte_get_timer_cycles();
+	for (i = 0; i < nb_rules; i++) {
+		session.teid = i + 1;
+		session.ue_ip = BENCH_UE_IP_BASE + i;
+		session.mark = VNF_MARK_FIRST + i;
+		session.cookie = VNF_FLOW_COOKIE(VNF_FLOW_OWNER_SESSION, i);
+		op_start[i] = rte_get_timer_cycles();
+		ids[i] = vnf_async_session_add(port_id, &session);
+		/* The sync fallback reports its failures to bench_done. */
+		if (ids[i] == VNF_FLOW_ID_INVALID &&
+		    vnf_async_template_mode(port_id)) {
+			op_failed++;
+			op_lat[i] = 0;
+		}
+	}
+	vnf_async_flush(port_id);
+	mem += heap_used();
+	bench_report(shape_names[shape], api, "insert",
+		     rte_get_timer_cycles() - start, mem);
+	op_failed = 0;
+	start = rte_get_timer_cycles();
+	for (i = 0; i < nb_rules; i++) {
+		op_start[i] = rte_get_timer_cycles();
+		if (vnf_flow_destroy(ids[i]))
+			op_failed++;
+		/* Only async removals are completed by bench_done. */
+		if (!vnf_async_template_mode(port_id))
+			op_lat[i] = rte_get_timer_cycles() - op_start[i];
+	}
+	vnf_async_flush(port_id);
+	bench_report(shape_names[shape], api, "delete",
+		     rte_get_timer_cycles() - start, -1);
+}
+
+static void
+bench_run(uint32_t *ids)
+{
+	int shape;
+
+	if (vnf_async_start(port_id, RTE_DIM(rss_queues), rss_queues))
+		rte_exit(EXIT_FAILURE, ":: cannot create template tables\n");
+	for (shape = 0; shape < BENCH_SHAPE_MAX; shape++) {
+		if (!(shapes & RTE_BIT32(shape)))
+			continue;
+		if (BENCH_SESSION_SHAPES & RTE_BIT32(shape)) {
+			bench_session_shape((enum bench_shape)shape, ids);
+			continue;
+		}
+		/* mlx5 doesn't mix rte_flow_create with the template API. */
+		if (!use_mock && vnf_async_template_mode(port_id))
+			continue;
+		bench_sync_shape((enum bench_shape)shape, ids);
+	}
+}
+
+/* Rules, tables and flow queues of a run are gone after this. */
+static void
+bench_cleanup(void)
+{
+	struct rte_flow_error error;
+
+	vnf_flow_ops_get(port_id)->flush(port_id, &error);
+	vnf_flow_forget_port(port_id);
+	vnf_async_close(port_id);
+}
+
+static void
+bench_mock(uint32_t *ids)
+{
+	/* Flow queues are set once per port, a new backend per API. */
+	static const uint32_t flags[] = { VNF_FLOW_MOCK_F_NO_TEMPLATE, 0 };
+	uint32_t i;
+
+	for (i = 0; i < RTE_DIM(flags); i++) {
+		if (vnf_flow_mock_attach(port_id, nb_rules + 16, flags[i]) ||
+		    vnf_async_configure(port_id, nb_rules))
+			rte_exit(EXIT_FAILURE, ":: cannot set mock backend\n");
+		bench_run(ids);
+		bench_cleanup();
+		vnf_flow_mock_detach(port_id);
+	}
+}
+
+static void
+bench_port(uint32_t *ids)
+{
+	struct rte_eth_conf port_conf;
+	struct rte_mempool *pool;
+	int ret;
+
+	if (!rte_eth_dev_is_valid_port(port_id))
+		rte_exit(EXIT_FAILURE, ":: no port %u, use --mock\n", port_id);
+	pool = rte_pktmbuf_pool_create("bench_pool", 4096, 128, 0,
+				       RTE_MBUF_DEFAULT_BUF_SIZE,
+				       rte_socket_id());
+	if (pool == NULL)
+		rte_exit(EXIT_FAILURE, ":: cannot init mbuf pool\n");
+	memset(&port_conf, 0, sizeof(port_conf));
+	ret = rte_eth_dev_configure(port_id, 1, 1, &port_conf);
+	if (!ret)
+		ret = rte_eth_rx_queue_setup(port_id, 0, 512,
+					     rte_eth_dev_socket_id(port_id),
+					     NULL, pool);
+	if (!ret)
+		ret = rte_eth_tx_queue_setup(port_id, 0, 512,
+					     rte_eth_dev_socket_id(port_id),
+					     NULL);
+	if (ret)
+		rte_exit(EXIT_FAILURE, ":: cannot configure port %u: %d\n",
+			 port_id, ret);
+	if (vnf_async_configure(port_id, nb_rules))
+		rte_exit(EXIT_FAILURE, ":: cannot configure flow queues\n");
+	ret = rte_eth_dev_start(port_id);
+	if (ret)
+		rte_exit(EXIT_FAILURE, ":: cannot start port %u: %d\n",
+			 port_id, ret);
+	if ((shapes & RTE_BIT32(BENCH_METER)) &&
+	    create_meter_policy_profile_meter(port_id)) {
+		printf(":: no meter on port %u, skip the meter shape\n",
+		       port_id);
+		shapes &= ~RTE_BIT32(BENCH_METER);
+	}
+	bench_run(ids);
+	bench_cleanup();
+	rte_eth_dev_stop(port_id);
+	rte_eth_dev_close(port_id);
+}
+
+static uint32_t
+parse_shapes(char *arg)
+{
+	uint32_t mask = 0;
+	char *name;
+	int shape;
+
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		for (shape = 0; shape < BENCH_SHAPE_MAX; shape++)
+			if (!strcmp(name, shape_names[shape]))
+				break;
+		if (shape == BENCH_SHAPE_MAX)
+			rte_exit(EXIT_FAILURE, ":: unknown shape %s\n", name);
+		mask |= RTE_BIT32(shape);
+	}
+	return mask;
+}
+
+static void
+usage(const char *prgname)
+{
+	printf("%s [EAL options] -- [--mock] [--rules N] [--shapes LIST]\n"
+	       "    [--group G] [--groups N] [--priorities N] [--port PORT]\n"
+	       "  --mock: use the software flow backend, no NIC needed\n"
+	       "  --rules N: rules of each shape, default 10000\n"
+	       "  --shapes LIST: comma separated list of decap, encap, rss,\n"
+	       "                 tag, age, counter, meter, default all\n"
+	       "  --group G: first group of the tag, age, counter and meter\n"
+	       "             rules, default 1\n"
+	       "  --groups N: spread these rules over N groups, default 1\n"
+	       "  --priorities N: and over N priorities, default 1\n"
+	       "  --port PORT: port of the rules, default 0\n",
+	       prgname);
+}
+
+static void
+parse_app_args(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{"mock", no_argument, NULL, 'm'},
+		{"rules", required_argument, NULL, 'r'},
+		{"shapes", required_argument, NULL, 's'},
+		{"group", required_argument, NULL, 'g'},
+		{"groups", required_argument, NULL, 'G'},
+		{"priorities", required_argument, NULL, 'P'},
+		{"port", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0},
+	};
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != EOF) {
+		switch (opt) {
+		case 'm':
+			use_mock = 1;
+			break;
+		case 'r':
+			nb_rules = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			shapes = parse_shapes(optarg);
+			break;
+		case 'g':
+			group_base = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'G':
+			nb_groups = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			nb_priorities = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			port_id = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			rte_exit(EXIT_FAILURE, ":: invalid application arguments\n");
+		}
+	}
+	if (!nb_rules || !nb_groups || !nb_priorities) {
+		usage(argv[0]);
+		rte_exit(EXIT_FAILURE, ":: invalid application arguments\n");
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t *ids;
+	int ret;
+
+	ret = rte_eal_init(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, ":: invalid EAL arguments\n");
+	argc -= ret;
+	argv += ret;
+	parse_app_args(argc, argv);
+
+	/* Session tables hold nb_rules each, plus the root rules. */
+	if (vnf_flow_registry_init(nb_rules + 16))
+		rte_exit(EXIT_FAILURE, "Cannot init flow registry\n");
+	op_start = rte_malloc("bench_start", sizeof(*op_start) * nb_rules, 0);
+	op_lat = rte_malloc("bench_lat", sizeof(*op_lat) * nb_rules, 0);
+	ids = rte_malloc("bench_ids", sizeof(*ids) * nb_rules, 0);
+	if (op_start == NULL || op_lat == NULL || ids == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate %u rules\n", nb_rules);
+	vnf_async_set_done_cb(bench_done);
+
+	printf(":: %u rules per shape, groups %u..%u, %u priorities, %s\n",
+	       nb_rules, group_base, group_base + nb_groups - 1,
+	       nb_priorities, use_mock ? "mock backend" : "rte_flow");
+	bench_header();
+	if (use_mock)
+		bench_mock(ids);
+	else
+		bench_port(ids);
+	vnf_flow_registry_print(0);
+
+	rte_free(ids);
+	rte_free(op_lat);
+	rte_free(op_start);
+	rte_eal_cleanup();
+	return 0;
+}
@@ -28,10 +28,15 @@
 #include <rte_net.h>
 #include <rte_flow.h>
 #include <rte_cycles.h>
-#include <rte_timer.h>
 #include "main.h"
 
 static volatile bool force_quit;
+static volatile bool restart_requested;
+/* The datapath lcores return, e.g. while the ports restart. */
+static volatile bool datapath_stop;
+/* Lcores running the datapath, graph ones have their graph. */
+static bool datapath_lcores[RTE_MAX_LCORE];
+static volatile bool reconcile_requested;
 
 static uint16_t port_id;
 static uint32_t nr_std_queues = 8;
@@ -39,6 +44,41 @@ static uint16_t queues[] = {1, 3, 2, 4, 5, 7, 0, 6};
 struct rte_mempool *mbufPool;
 struct rte_flow *offloaded_flow;
 static uint16_t nr_hairpin_queues = 1;
+static uint16_t port_mtu = RTE_ETHER_MTU;
+static bool per_pkt_dispatch;
+static bool use_graph;
+/* No flow, meter or hairpin, e.g. for net_null or net_pcap ports. */
+static bool no_offload;
+static uint16_t mirror_port = RTE_MAX_ETHPORTS;
+/* GTP-U sessions inserted with the template API, 0 to disable. */
+static uint32_t async_sessions;
+/* Flows run in software on the ports, e.g. net_ring or net_pcap ones. */
+static bool sw_flow;
+/* Rules of a testpmd syntax file, created at startup. */
+static const char *flow_program;
+/* Each harvested counter is queried once per period. */
+static uint32_t counter_period_ms = 1000;
+/* Sessions saved for the next run, restored from the last one. */
+static const char *checkpoint;
+/* PDU sessions established through the session API at startup. */
+static uint32_t pdu_sessions;
+/* UDP port of the PFCP-lite endpoint on the loopback, 0 for none. */
+static uint16_t pfcp_port;
+/* Requests of a window are installed as one batch. */
+static uint32_t pfcp_window_us = 100;
+
+#define MAX_PKT_BURST VNF_DISPATCH_BURST_MAX
+#define GTP_FRAG_MAX_FLOWS 4096 /* datagrams in reassembly per lcore */
+#define GTP_FRAG_TTL_MS 100 /* drop incomplete datagrams after 100ms */
+#define FLOW_REGISTRY_SIZE (1 << 20) /* rules tracked by the registry */
+#define COUNTER_HARVEST_SIZE (1 << 20) /* counters harvested */
+#define GRAPH_STATS_PERIOD_S 10 /* graph node stats every 10s */
+#define METER_STATS_PERIOD_MS 1000 /* each meter read every second */
+#define METER_STATS_POLL_MS 10 /* main lcore loop */
+#define ASYNC_UE_IP_BASE ((2<<24) + 1) /* first UE ip = 2.0.0.1 */
+#define PDU_SESSION_MAX (1 << 15) /* sessions of the session API */
+#define PDU_UE_IP_BASE ((3<<24) + 1) /* first PDU UE ip = 3.0.0.1 */
+#define PDU_TEID_BASE 0x10000 /* first PDU UL and DL TEID */
 
 #define SRC_IP ((0<<24) + (0<<16) + (0<<8) + 0) /* src ip = 0.0.0.0 */
 #define DEST_IP ((192<<24) + (168<<16) + (1<<8) + 1) /* dest ip = 192.168.1.1 */
@@ -81,114 +121,201 @@ dump_pkt_info(struct rte_mbuf *m, uint16_t qi)
 	printf("\n");
 }
 
-static void
-timer_callback(__rte_unused struct rte_timer *tim,
-		__rte_unused void *arg)
+/* Software path of the dispatch layer, print the packet and send it back. */
+static uint16_t
+slow_path_node(struct rte_mbuf **pkts, uint16_t nb_pkts, struct rte_mbuf **tx,
+	       uint16_t queue, __rte_unused void *ctx)
 {
-	uint16_t port_id;
-	RTE_ETH_FOREACH_DEV(port_id) {
-		get_meter_stats(port_id, NETDEV_DPDK_METER_METER_ID);
+	uint16_t j;
+
+	for (j = 0; j < nb_pkts; j++) {
+		dump_pkt_info(pkts[j], queue);
+		tx[j] = pkts[j];
 	}
+	return nb_pkts;
 }
 
 static int
-timer_main_loop(__rte_unused void* arg)
+main_loop(__rte_unused void* arg)
 {
-	printf("timer main loop start\n");
-	struct rte_timer tim;
-	rte_timer_init(&tim);
-	uint64_t hz = rte_get_timer_hz();
-	unsigned lcore_id = rte_lcore_id();
-	//10s
-	int ret = 0;
-	for (int i = 0; i < 10; i++) {
-		ret = rte_timer_reset(&tim, hz * 10, PERIODICAL, lcore_id, timer_callback, &tim);
-		if (ret != 0) {
-			printf("timer reset failed, ret=%d\n", ret);
-			rte_delay_ms(1000);
-		} else {
-			break;
+	struct rte_mbuf *mbufs[MAX_PKT_BURST];
+	uint16_t nb_rx;
+	uint16_t i;
+	printf("main loop start\n");
+	vnf_mark_lcore_online();
+	while (!force_quit && !datapath_stop) {
+		/* No mark entry is held from one round to the next. */
+		vnf_mark_lcore_quiescent();
+		for (i = 0; i < nr_std_queues; i++) {
+			nb_rx = rte_eth_rx_burst(port_id,
+						i, mbufs, MAX_PKT_BURST);
+			if (!nb_rx)
+				continue;
+			/* Headers are parsed once for all the stages. */
+			vnf_parse_burst(mbufs, nb_rx);
+			nb_rx = gtp_u_reassemble_burst(mbufs, nb_rx,
+						       rte_rdtsc());
+			/* Each action runs once on its own part of the burst. */
+			if (per_pkt_dispatch)
+				vnf_dispatch_ab(i, mbufs, nb_rx);
+			else
+				vnf_dispatch_burst(i, mbufs, nb_rx);
 		}
 	}
+	vnf_mark_lcore_offline();
+	if (force_quit)
+		vnf_dispatch_stats_print();
+	return 0;
+}
 
-	while (!force_quit) {
+static int
+graph_main_loop(__rte_unused void* arg)
+{
+	printf("graph main loop start on lcore %u\n", rte_lcore_id());
+	vnf_mark_lcore_online();
+	while (!force_quit && !datapath_stop) {
+		vnf_mark_lcore_quiescent();
+		vnf_graph_walk();
+	}
+	vnf_mark_lcore_offline();
+	return 0;
+}
 
-		/* call the timer handler on each core */
-		ret = rte_timer_manage();
+/*
+ * One graph per worker lcore. The Rx queues are
+ * spread over the workers, each worker sends on the Tx queue of its index.
+ */
+static void
+create_graph_workers(void)
+{
+	struct vnf_graph_conf conf;
+	uint32_t lcore_id;
+	uint16_t nb_workers = 0;
+	uint16_t worker = 0;
+	uint16_t q;
 
-		rte_delay_ms(1000);
+	RTE_LCORE_FOREACH_WORKER(lcore_id)
+		nb_workers++;
+	nb_workers = RTE_MIN(nb_workers, nr_std_queues);
+	if (!nb_workers)
+		rte_exit(EXIT_FAILURE, ":: no lcore left for the graph\n");
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		if (worker == nb_workers)
+			break;
+		memset(&conf, 0, sizeof(conf));
+		conf.port_id = port_id;
+		for (q = worker; q < nr_std_queues &&
+		     conf.nb_rx_queues < VNF_GRAPH_MAX_RX_QUEUES;
+		     q += nb_workers)
+			conf.rx_queues[conf.nb_rx_queues++] = q;
+		conf.tx_queue = worker;
+		conf.mtu = port_mtu;
+		conf.mirror_port = mirror_port;
+		conf.pool = mbufPool;
+		if (vnf_graph_create(lcore_id, &conf))
+			rte_exit(EXIT_FAILURE,
+				":: cannot create graph on lcore %u\n", lcore_id);
+		datapath_lcores[lcore_id] = true;
+		worker++;
 	}
-	return 0;
+	printf(":: %u graph workers created\n", nb_workers);
 }
 
-static int
-main_loop(__rte_unused void* arg)
+static void
+launch_datapath(void)
 {
-	struct rte_mbuf *mbufs[32];
-	struct rte_flow_error error;
-	uint16_t nb_rx;
-	uint16_t nb_tx;
-	uint16_t i;
-	uint16_t j;
-	printf("main loop start\n");
-	while (!force_quit) {
-		for (i = 0; i < nr_std_queues; i++) {
-			nb_rx = rte_eth_rx_burst(port_id,
-						i, mbufs, 32);
-			if (nb_rx) {
-				for (j = 0; j < nb_rx; j++) {
-					struct rte_mbuf *m = mbufs[j];
-
-					dump_pkt_info(m, i);
-				}
-				nb_tx = rte_eth_tx_burst(port_id, i,
-						mbufs, nb_rx);
-			}
-			/* Free any unsent packets. */
-			if (unlikely(nb_tx < nb_rx)) {
-				uint16_t buf;
-				for (buf = nb_tx; buf < nb_rx; buf++)
-					rte_pktmbuf_free(mbufs[buf]);
-			}
-		}
+	uint32_t lcore_id;
+
+	datapath_stop = false;
+	if (!use_graph)
+		datapath_lcores[rte_get_next_lcore(-1, 1, 0)] = true;
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		if (datapath_lcores[lcore_id])
+			rte_eal_remote_launch(use_graph ? graph_main_loop :
+					      main_loop, NULL, lcore_id);
 	}
+}
 
-	/* closing and releasing resources */
-	RTE_ETH_FOREACH_DEV(port_id) {
-		rte_flow_flush(port_id, &error);
+/* Only the datapath ones, a service lcore never returns. */
+static void
+stop_datapath(void)
+{
+	uint32_t lcore_id;
+
+	datapath_stop = true;
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		if (datapath_lcores[lcore_id])
+			rte_eal_wait_lcore(lcore_id);
+	}
+}
+
+static void
+close_ports(void)
+{
+	struct rte_flow_error error;
+	uint16_t port_id;
+
+	if (!no_offload) {
+		/* The flush below must not clear the saved sessions. */
+		vnf_flow_checkpoint_close();
+		vnf_counter_harvest_close();
+		vnf_meter_stats_close();
+		vnf_prio_print();
+		vnf_pfcp_print();
+		vnf_pfcp_close();
+		vnf_session_print();
+		vnf_session_close();
+		RTE_ETH_FOREACH_DEV(port_id) {
+			vnf_flow_swemu_stats_print(port_id);
+			vnf_flow_handle_print(port_id);
+			vnf_flow_vcache_print(port_id);
+			vnf_flow_ops_get(port_id)->flush(port_id, &error);
+			vnf_flow_forget_port(port_id);
+			vnf_flow_handle_flush(port_id);
+			vnf_meter_pool_print(port_id);
+			vnf_meter_pool_close(port_id);
+			vnf_async_close(port_id);
+		}
+		if (2 == rte_eth_dev_count_avail() && nr_hairpin_queues)
+			hairpin_two_ports_unbind();
 	}
-	if ( 2 == rte_eth_dev_count_avail())
-		hairpin_two_ports_unbind();
 
 	RTE_ETH_FOREACH_DEV(port_id) {
 		rte_eth_dev_stop(port_id);
+		vnf_flow_swemu_detach(port_id);
 		rte_eth_dev_close(port_id);
 	}
-	return 0;
 }
 
 #define CHECK_INTERVAL 1000  /* 100ms */
 #define MAX_REPEAT_TIMES 90  /* 9s (90 * 100ms) in total */
 
+/* The links of all the ports come up together, once the rules are in. */
 static void
 assert_link_status(void)
 {
 	struct rte_eth_link link;
 	uint8_t rep_cnt = MAX_REPEAT_TIMES;
 	int link_get_err = -EINVAL;
+	uint16_t pid, nb_down;
 
-	memset(&link, 0, sizeof(link));
 	do {
-		link_get_err = rte_eth_link_get(port_id, &link);
-		if (link_get_err == 0 && link.link_status == RTE_ETH_LINK_UP)
+		nb_down = 0;
+		RTE_ETH_FOREACH_DEV(pid) {
+			memset(&link, 0, sizeof(link));
+			link_get_err = rte_eth_link_get_nowait(pid, &link);
+			if (link_get_err < 0)
+				rte_exit(EXIT_FAILURE,
+					 ":: error: link get is failing: %s\n",
+					 rte_strerror(-link_get_err));
+			nb_down += link.link_status == RTE_ETH_LINK_DOWN;
+		}
+		if (!nb_down)
 			break;
 		rte_delay_ms(CHECK_INTERVAL);
 	} while (--rep_cnt);
 
-	if (link_get_err < 0)
-		rte_exit(EXIT_FAILURE, ":: error: link get is failing: %s\n",
-			 rte_strerror(-link_get_err));
-	if (link.link_status == RTE_ETH_LINK_DOWN)
+	if (nb_down)
 		rte_exit(EXIT_FAILURE, ":: error: link is still down\n");
 }
 
@@ -217,7 +344,17 @@ init_port(uint16_t port_id)
 			port_id, strerror(-ret));
 
 	port_conf.txmode.offloads &= dev_info.tx_offload_capa;
+	/* Virtual devices like net_pcap have only a few queues. */
+	if (nr_std_queues + nr_hairpin_queues > dev_info.max_rx_queues ||
+	    nr_std_queues + nr_hairpin_queues > dev_info.max_tx_queues) {
+		nr_std_queues = RTE_MIN(dev_info.max_rx_queues,
+					dev_info.max_tx_queues) -
+				nr_hairpin_queues;
+		printf(":: port %u, use %u queues\n", port_id, nr_std_queues);
+	}
 	printf(":: initializing port: %d\n", port_id);
+	/* Shapes validated before may not hold after. */
+	vnf_flow_vcache_flush(port_id);
 	ret = rte_eth_dev_configure(port_id,
 				nr_std_queues + nr_hairpin_queues,
 				nr_std_queues + nr_hairpin_queues, &port_conf);
@@ -255,9 +392,21 @@ init_port(uint16_t port_id)
 		}
 	}
 
+	if (sw_flow && vnf_flow_swemu_attach(port_id))
+		rte_exit(EXIT_FAILURE,
+			":: cannot attach software flow, port=%u\n", port_id);
+
+	/* Flow queues are set up while the port is stopped. */
+	if ((async_sessions || pfcp_port || vnf_flow_checkpoint_pending()) &&
+	    vnf_async_configure(port_id, async_sessions + pdu_sessions +
+				(pfcp_port ? PDU_SESSION_MAX : 0) +
+				vnf_flow_checkpoint_pending()))
+		rte_exit(EXIT_FAILURE,
+			":: cannot configure flow queues, port=%u\n", port_id);
+
 #ifndef ISOLATE_ISOLATE_MODE_DEF
 	ret = rte_eth_promiscuous_enable(port_id);
-	if (ret != 0)
+	if (ret != 0 && ret != -ENOTSUP)
 		rte_exit(EXIT_FAILURE,
 			":: promiscuous mode enable failed: err=%s, port=%u\n",
 			rte_strerror(-ret), port_id);
@@ -290,7 +439,10 @@ start_ports(void)
 				"rte_eth_dev_start:err=%d, port=%u\n",
 				ret, port_id);
 		}
-		assert_link_status();
+		if (vnf_parse_init(port_id))
+			rte_exit(EXIT_FAILURE,
+				"Cannot init packet parser, port=%u\n",
+				port_id);
 	}
 
 }
@@ -303,28 +455,229 @@ signal_handler(int signum)
 				signum);
 		force_quit = true;
 	}
+	if (signum == SIGHUP)
+		restart_requested = true;
+	if (signum == SIGUSR1)
+		reconcile_requested = true;
 }
 
+/*
+ * SIGHUP, stop and start again the ports which keep their rules, and
+ * their indirect actions if they have some, across it, the sessions stay
+ * offloaded. The datapath lcores return before the ports stop, none is
+ * in a burst function of a stopped port, and are launched again after.
+ * The rules of the other ports would be gone, they are left running, a
+ * restart of the application with --checkpoint brings their sessions
+ * back.
+ */
 static void
-create_meters()
+restart_ports(void)
 {
-	uint16_t port_id;
-	RTE_ETH_FOREACH_DEV(port_id) {
-		printf(":: create meter policy/profile/meter_id, port_id=%u\n", port_id);
-		if (create_meter_policy_profile_meter(port_id)) {
-			printf("meter policy/profile/meter_id cannot be created\n");
-			rte_exit(EXIT_FAILURE, "error in create_meter_policy_profile_meter");
+	struct rte_eth_dev_info dev_info;
+	uint64_t keep;
+	uint16_t pid;
+	int ret;
+
+	stop_datapath();
+	RTE_ETH_FOREACH_DEV(pid) {
+		keep = RTE_ETH_DEV_CAPA_FLOW_RULE_KEEP;
+		if (vnf_flow_handle_count(pid))
+			keep |= RTE_ETH_DEV_CAPA_FLOW_SHARED_OBJECT_KEEP;
+		if (!no_offload && (rte_eth_dev_info_get(pid, &dev_info) ||
+				    (dev_info.dev_capa & keep) != keep)) {
+			printf(":: port %u doesn't keep its rules, not restarted\n",
+			       pid);
+			continue;
 		}
-		printf("done\n");
-                if (port_id) {
-			printf(":: create offloaded_flow with meter..., port_id=%u\n", port_id);
-			if (create_flow_with_meter_in_transfer(port_id)) {
-				printf("Flow with meter cannot be created\n");
-				rte_exit(EXIT_FAILURE, "error in creating offloaded_flow");
-			}
-			printf("done\n");
+		printf(":: restart port %u\n", pid);
+		ret = rte_eth_dev_stop(pid);
+		if (ret == 0)
+			ret = rte_eth_dev_start(pid);
+		if (ret)
+			printf(":: port %u restart failed: %s\n", pid,
+			       rte_strerror(-ret));
+	}
+	launch_datapath();
+}
+
+/* The meters of one port, an install job of the classify table. */
+static int
+create_port_meters(uint16_t port_id, void *arg)
+{
+	RTE_SET_USED(arg);
+	/* Without, the vnf_meter node of the graph meters the sessions. */
+	if (!vnf_feature_hw(port_id, VNF_FEAT_METER))
+		return 0;
+	/* Software flow meters are made by their first packet. */
+	if (!vnf_flow_swemu_attached(port_id) &&
+	    create_meter_policy_profile_meter(port_id)) {
+		printf(":: port %u meter policy/profile/meter_id cannot be created\n",
+		       port_id);
+		vnf_feature_fallback(port_id, VNF_FEAT_METER);
+		return 0;
+	}
+	if (port_id && vnf_feature_hw(port_id, VNF_FEAT_TRANSFER) &&
+	    create_flow_with_meter_in_transfer(port_id)) {
+		printf(":: port %u flow with meter cannot be created\n",
+		       port_id);
+		vnf_feature_fallback(port_id, VNF_FEAT_METER);
+	}
+	return 0;
+}
+
+/* The root and classify rules of one port, an install job. */
+static int
+create_port_default_flow(uint16_t port_id, void *arg)
+{
+	RTE_SET_USED(arg);
+	/* The packets missing it are dispatched in software. */
+	if (create_default_port_flow(port_id)) {
+		printf(":: port %u default flow failed, software path\n",
+		       port_id);
+		return -1;
+	}
+	return 0;
+}
+
+struct session_range {
+	uint32_t first;
+	uint32_t nb;
+};
+
+static struct session_range session_ranges[RTE_MAX_LCORE];
+static struct session_range pdu_ranges[RTE_MAX_LCORE];
+
+/*
+ * Insert the uplink decap and downlink encap rules of a range of the
+ * sessions, TEID i + 1 and UE ip 2.0.0.1 + i, on the flow queue of the
+ * lcore.
+ */
+static int
+install_session_range(uint16_t port_id, void *arg)
+{
+	const struct session_range *range = (const struct session_range *)arg;
+	struct vnf_async_session session;
+	uint32_t i, failed = 0;
+
+	memset(&session, 0, sizeof(session));
+	for (i = range->first; i < range->first + range->nb; i++) {
+		session.teid = i + 1;
+		session.ue_ip = ASYNC_UE_IP_BASE + i;
+		session.shape = VNF_ASYNC_DECAP;
+		session.cookie = VNF_FLOW_COOKIE(VNF_FLOW_OWNER_SESSION,
+						 i * 2);
+		failed += vnf_async_session_add(port_id, &session) ==
+			  VNF_FLOW_ID_INVALID;
+		session.shape = VNF_ASYNC_ENCAP;
+		session.cookie = VNF_FLOW_COOKIE(VNF_FLOW_OWNER_SESSION,
+						 i * 2 + 1);
+		failed += vnf_async_session_add(port_id, &session) ==
+			  VNF_FLOW_ID_INVALID;
+	}
+	return failed ? -1 : 0;
+}
+
+/*
+ * Establish a range of the PDU sessions through the session API, UL and
+ * DL TEID 0x10000 + i, UE ip 3.0.0.1 + i, no rate nor idle limit.
+ */
+static int
+install_pdu_range(uint16_t port_id, void *arg)
+{
+	const struct session_range *range = (const struct session_range *)arg;
+	struct vnf_session_params params;
+	uint32_t i, failed = 0;
+
+	memset(&params, 0, sizeof(params));
+	params.port_id = port_id;
+	for (i = range->first; i < range->first + range->nb; i++) {
+		params.ul_teid = PDU_TEID_BASE + i;
+		params.dl_teid = PDU_TEID_BASE + i;
+		params.ue_ip = PDU_UE_IP_BASE + i;
+		failed += vnf_session_create(&params) == VNF_SESSION_INVALID;
+	}
+	return failed ? -1 : 0;
+}
+
+/* nb sessions cut in one range per lcore, installed by vnf_install_run(). */
+static void
+add_session_jobs(const char *name, uint32_t nb, vnf_install_job_t fn,
+		 struct session_range *ranges)
+{
+	uint32_t nb_ranges = RTE_MIN(rte_lcore_count(), nb);
+	uint32_t i, first = 0;
+
+	for (i = 0; i < nb_ranges; i++) {
+		ranges[i].first = first;
+		ranges[i].nb = nb / nb_ranges + (i < nb % nb_ranges);
+		first += ranges[i].nb;
+		if (vnf_install_add(name, port_id, fn, &ranges[i]))
+			rte_exit(EXIT_FAILURE, ":: cannot add %s jobs\n",
+				 name);
+	}
+}
+
+/* The sessions of the last run, in bulk through the same engine. */
+static void
+restore_sessions(void)
+{
+	int failed;
+
+	failed = vnf_flow_checkpoint_restore();
+	if (failed < 0)
+		rte_exit(EXIT_FAILURE, ":: cannot restore sessions\n");
+	if (failed)
+		printf(":: %d sessions not restored\n", failed);
+	vnf_async_stats_print(port_id);
+}
+
+/*
+ * The startup rules, cut by port and table, from the main lcore and the
+ * idle workers in parallel; all completed before the workers start.
+ */
+static void
+install_startup_rules(void)
+{
+	int sessions = async_sessions && !no_offload;
+	uint64_t start, cycles;
+	uint16_t pid;
+
+	/* The restored sessions take the place of the inserted ones. */
+	if (!no_offload && vnf_flow_checkpoint_pending()) {
+		restore_sessions();
+		sessions = 0;
+	} else if (sessions) {
+		add_session_jobs("session", async_sessions,
+				 install_session_range, session_ranges);
+	}
+	if (pdu_sessions && !no_offload)
+		add_session_jobs("pdu", pdu_sessions, install_pdu_range,
+				 pdu_ranges);
+	/* The template API and rte_flow_create don't mix on a port. */
+	if (!no_offload && !vnf_async_template_mode(port_id)) {
+		RTE_ETH_FOREACH_DEV(pid) {
+			if (vnf_install_add("root", pid,
+					    create_port_default_flow, NULL) ||
+			    vnf_install_add("classify", pid,
+					    create_port_meters, NULL))
+				rte_exit(EXIT_FAILURE,
+					 ":: cannot add install jobs\n");
 		}
 	}
+	start = rte_get_timer_cycles();
+	vnf_install_run();
+	cycles = rte_get_timer_cycles() - start;
+	if (sessions) {
+		printf(":: %u sessions, %.0f rules/s (%s)\n", async_sessions,
+		       2.0 * async_sessions * rte_get_timer_hz() /
+		       (cycles ? cycles : 1),
+		       vnf_async_template_mode(port_id) ? "async" : "sync");
+		vnf_async_stats_print(port_id);
+	}
+	if (pdu_sessions && !no_offload)
+		printf(":: %u PDU sessions, %.0f sessions/s\n", pdu_sessions,
+		       (double)pdu_sessions * rte_get_timer_hz() /
+		       (cycles ? cycles : 1));
 }
 
 static void
@@ -353,15 +706,161 @@ static void
 bind_two_ports_hairpin(uint16_t nr_ports)
 {
 	int ret;
+	uint16_t port_id;
 	if (nr_ports == 2) {
 		printf(":: %u ports hairpin bind...", nr_ports);
 		ret = hairpin_two_ports_bind();
-		if (ret)
-			rte_exit(EXIT_FAILURE, "Cannot bind two hairpin ports");
+		if (ret) {
+			/* Nothing is sent to the hairpin queues then. */
+			printf("\nCannot bind two hairpin ports\n");
+			hairpin_two_ports_unbind();
+			RTE_ETH_FOREACH_DEV(port_id)
+				vnf_feature_fallback(port_id, VNF_FEAT_HAIRPIN);
+			nr_hairpin_queues = 0;
+			return;
+		}
 		printf("done\n");
 	}
 }
 
+/*
+ * The device capabilities, before the ports are configured. Hairpin
+ * queues are set on all the ports or on none.
+ */
+static void
+probe_ports(void)
+{
+	uint16_t port_id;
+	bool hairpin = nr_hairpin_queues != 0;
+
+	RTE_ETH_FOREACH_DEV(port_id) {
+		vnf_feature_probe_dev(port_id);
+		if (!vnf_feature_hw(port_id, VNF_FEAT_HAIRPIN))
+			hairpin = false;
+	}
+	if (!hairpin) {
+		nr_hairpin_queues = 0;
+		RTE_ETH_FOREACH_DEV(port_id)
+			vnf_feature_fallback(port_id, VNF_FEAT_HAIRPIN);
+	}
+}
+
+/* The rule offloads, on the started ports. */
+static void
+probe_flows(void)
+{
+	uint16_t port_id;
+
+	RTE_ETH_FOREACH_DEV(port_id)
+		vnf_feature_probe_flows(port_id);
+	vnf_feature_print();
+}
+
+static void
+usage(const char *prgname)
+{
+	printf("%s [EAL options] -- [--per-pkt-dispatch] [--graph]\n"
+	       "    [--mirror-port PORT] [--no-offload] [--async-sessions N]\n"
+	       "    [--sw-flow] [--counter-period MS] [--flow-program FILE]\n"
+	       "    [--checkpoint FILE] [--pdu-sessions N] [--pfcp PORT]\n"
+	       "    [--pfcp-window US]\n"
+	       "  --per-pkt-dispatch: run the actions packet by packet and per\n"
+	       "                      action sub-burst in turn, the cycles of\n"
+	       "                      each printed on exit (A/B comparison)\n"
+	       "  --graph: run the datapath as rte_graph nodes, one graph per\n"
+	       "           worker lcore\n"
+	       "  --mirror-port PORT: copy the sessions to PORT, after the\n"
+	       "                      meter in graph mode\n"
+	       "  --no-offload: don't create flows, meters or hairpin queues,\n"
+	       "                to run on net_null or net_pcap ports\n"
+	       "  --async-sessions N: insert N GTP-U sessions with the flow\n"
+	       "                      template API (rte_flow_create if the\n"
+	       "                      PMD lacks it)\n"
+	       "  --sw-flow: run the flows in software, no hairpin queue nor\n"
+	       "             rte_mtr, to test them on net_ring or net_pcap\n"
+	       "             ports\n"
+	       "  --counter-period MS: query each harvested counter every MS\n"
+	       "                       milliseconds (default 1000)\n"
+	       "  --flow-program FILE: create the rules of FILE, written as\n"
+	       "                       testpmd flow create commands, SIGUSR1\n"
+	       "                       applies the changes of FILE\n"
+	       "  --checkpoint FILE: save the sessions in FILE, those saved\n"
+	       "                     by the last run are restored first\n"
+	       "  --pdu-sessions N: establish N PDU sessions through the\n"
+	       "                    session API at startup\n"
+	       "  --pfcp PORT: serve the PDU sessions of a local SMF on UDP\n"
+	       "               PORT of 127.0.0.1, PFCP subset\n"
+	       "  --pfcp-window US: install the PFCP requests of US\n"
+	       "                    microseconds as one batch (default 100)\n",
+	       prgname);
+}
+
+static void
+parse_app_args(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{"per-pkt-dispatch", no_argument, NULL, 'p'},
+		{"graph", no_argument, NULL, 'g'},
+		{"mirror-port", required_argument, NULL, 'm'},
+		{"no-offload", no_argument, NULL, 'n'},
+		{"async-sessions", required_argument, NULL, 'a'},
+		{"sw-flow", no_argument, NULL, 's'},
+		{"counter-period", required_argument, NULL, 'c'},
+		{"flow-program", required_argument, NULL, 'f'},
+		{"checkpoint", required_argument, NULL, 'k'},
+		{"pdu-sessions", required_argument, NULL, 'e'},
+		{"pfcp", required_argument, NULL, 'P'},
+		{"pfcp-window", required_argument, NULL, 'w'},
+		{NULL, 0, NULL, 0},
+	};
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != EOF) {
+		switch (opt) {
+		case 'p':
+			per_pkt_dispatch = true;
+			break;
+		case 'g':
+			use_graph = true;
+			break;
+		case 'm':
+			mirror_port = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			no_offload = true;
+			nr_hairpin_queues = 0;
+			break;
+		case 'a':
+			async_sessions = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			sw_flow = true;
+			nr_hairpin_queues = 0;
+			break;
+		case 'c':
+			counter_period_ms = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			flow_program = optarg;
+			break;
+		case 'k':
+			checkpoint = optarg;
+			break;
+		case 'e':
+			pdu_sessions = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			pfcp_port = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			pfcp_window_us = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			rte_exit(EXIT_FAILURE, ":: invalid application arguments\n");
+		}
+	}
+}
 
 int
 main(int argc, char **argv)
@@ -373,10 +872,15 @@ main(int argc, char **argv)
 	ret = rte_eal_init(argc, argv);
 	if (ret < 0)
 		rte_exit(EXIT_FAILURE, ":: invalid EAL arguments\n");
+	argc -= ret;
+	argv += ret;
+	parse_app_args(argc, argv);
 
 	force_quit = false;
 	signal(SIGINT, signal_handler);
 	signal(SIGTERM, signal_handler);
+	signal(SIGHUP, signal_handler);
+	signal(SIGUSR1, signal_handler);
 
 	nr_ports = rte_eth_dev_count_avail();
 	if (nr_ports == 0)
@@ -391,14 +895,57 @@ main(int argc, char **argv)
 					    rte_socket_id());
 	if (mbufPool == NULL)
 		rte_exit(EXIT_FAILURE, "Cannot init mbuf pool\n");
+	if (gtp_frag_init(mbufPool, GTP_FRAG_MAX_FLOWS, GTP_FRAG_TTL_MS))
+		rte_exit(EXIT_FAILURE, "Cannot init GTP-U fragmentation\n");
+	if (vnf_mark_table_init(VNF_MARK_TABLE_SIZE))
+		rte_exit(EXIT_FAILURE, "Cannot init mark table\n");
+	if (use_graph && vnf_graph_meter_init())
+		rte_exit(EXIT_FAILURE, "Cannot init graph meters\n");
+	vnf_feature_graph_set(use_graph);
+	if (vnf_flow_registry_init(FLOW_REGISTRY_SIZE))
+		rte_exit(EXIT_FAILURE, "Cannot init flow registry\n");
+	/* Before the ports, the flow tables are sized for the sessions. */
+	if (checkpoint && !no_offload &&
+	    vnf_flow_checkpoint_open(checkpoint, FLOW_REGISTRY_SIZE))
+		rte_exit(EXIT_FAILURE, "Cannot open flow checkpoint %s\n",
+			 checkpoint);
+	if (!no_offload &&
+	    vnf_counter_harvest_init(COUNTER_HARVEST_SIZE, counter_period_ms))
+		rte_exit(EXIT_FAILURE, "Cannot init counter harvest\n");
 
 #ifdef ISOLATE_ISOLATE_MODE_DEF
 	enable_isolate_mode_init();
 #endif
+	if (!no_offload)
+		probe_ports();
 	init_ports();
-	set_hairpin_queues(nr_ports);
+	if (nr_hairpin_queues)
+		set_hairpin_queues(nr_ports);
 	start_ports();
-	bind_two_ports_hairpin(nr_ports);
+	if (nr_hairpin_queues)
+		bind_two_ports_hairpin(nr_ports);
+	if (!no_offload)
+		probe_flows();
+	if (rte_eth_dev_get_mtu(port_id, &port_mtu))
+		printf(":: warn: can't get MTU of port %u, use %u\n",
+			port_id, port_mtu);
+	if (vnf_dispatch_init(port_mtu))
+		rte_exit(EXIT_FAILURE, "Cannot init burst dispatch\n");
+	vnf_dispatch_set_node(VNF_NEXT_SLOW, slow_path_node, NULL);
+	if (!use_graph && mirror_port < RTE_MAX_ETHPORTS)
+		vnf_dispatch_set_mirror(mirror_port, mbufPool);
+	if (!no_offload &&
+	    (async_sessions || pfcp_port || vnf_flow_checkpoint_pending()) &&
+	    vnf_async_start(port_id, nr_std_queues, queues))
+		rte_exit(EXIT_FAILURE, ":: cannot create template tables\n");
+	/* Its tables are declared before the jumps to them are installed. */
+	if (!no_offload &&
+	    vnf_session_init(PDU_SESSION_MAX, nr_std_queues, queues))
+		rte_exit(EXIT_FAILURE, ":: cannot init the PDU sessions\n");
+	install_startup_rules();
+	if (pfcp_port && !no_offload &&
+	    vnf_pfcp_init(port_id, pfcp_port, pfcp_window_us, PDU_SESSION_MAX))
+		rte_exit(EXIT_FAILURE, ":: cannot open the PFCP endpoint\n");
 	
 	// printf(":: create hairpin flows...");
 	// if (nr_ports == 2)
@@ -412,12 +959,7 @@ main(int argc, char **argv)
 	// }
 	// printf("done\n");
 
-	printf(":: create default flow");
-	if (create_default_flow()) {
-		printf("\n create default flow failed\n");
-		rte_exit(EXIT_FAILURE, "error in create_default_flow");
-	}
-	printf("done\n");
+	vnf_table_print();
 	
 	// printf(":: create offloaded_flow with symmetric RSS action...");
 	// if (create_symmetric_rss_flow(port_id, nr_std_queues, queues)){
@@ -426,7 +968,11 @@ main(int argc, char **argv)
 	// }
 	// printf("done\n");
 
-	create_meters();
+	/* Before the workers are launched, they install the rules too. */
+	if (flow_program && !no_offload &&
+	    vnf_flow_program_load(flow_program) < 0)
+		rte_exit(EXIT_FAILURE, "Cannot load flow program %s\n",
+			 flow_program);
 
 	// printf(":: create GRE RSS offloaded_flow ..");
 	// offloaded_flow = create_gre_decap_rss_flow(port_id, nr_std_queues, queues);
@@ -469,13 +1015,48 @@ main(int argc, char **argv)
 	// 	rte_exit(EXIT_FAILURE, "error to sync flows");
 	// }
 	// printf("done\n");
-	rte_timer_subsystem_init();
-	uint32_t lcore_1 = rte_get_next_lcore(-1, 1, 0);
-	uint32_t lcore_2 = rte_get_next_lcore(lcore_1, 1, 0);
-	rte_eal_remote_launch(main_loop, NULL, lcore_1);
-	rte_eal_remote_launch(timer_main_loop, NULL, lcore_2);
+	assert_link_status();
+	/* Meter stats only exist with offloads. */
+	if (!no_offload && !sw_flow &&
+	    vnf_meter_stats_init(METER_STATS_PERIOD_MS))
+		rte_exit(EXIT_FAILURE, "Cannot init meter stats\n");
+	if (use_graph)
+		create_graph_workers();
+	launch_datapath();
 
+	/* The main lcore runs the stats, without a service lcore. */
+	uint64_t period = rte_get_timer_hz() * GRAPH_STATS_PERIOD_S;
+	uint64_t next_stats = rte_get_timer_cycles() + period;
+	while (!force_quit) {
+		/* The PFCP requests are served while waiting. */
+		if (!pfcp_port || no_offload ||
+		    vnf_pfcp_wait(METER_STATS_POLL_MS) < 0)
+			rte_delay_ms(METER_STATS_POLL_MS);
+		vnf_meter_stats_poll();
+		vnf_counter_harvest_poll();
+		vnf_mark_poll();
+		if (restart_requested) {
+			restart_requested = false;
+			restart_ports();
+		}
+		/* Only the rules changed in the file, traffic running. */
+		if (reconcile_requested) {
+			reconcile_requested = false;
+			if (flow_program && !no_offload)
+				vnf_flow_program_reconcile(flow_program);
+		}
+		if (!use_graph || rte_get_timer_cycles() < next_stats)
+			continue;
+		vnf_graph_stats_print();
+		next_stats += period;
+	}
 	rte_eal_mp_wait_lcore();
+	vnf_flow_registry_print(0);
+	if (use_graph) {
+		vnf_graph_stats_print();
+		vnf_graph_destroy();
+	}
+	close_ports();
 
 	return 0;
 }
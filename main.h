@@ -1 +1 @@
-#include "rte-lib/vnf_examples.h"
\ No newline at end of file
+#include "rte-lib/vnf_examples.h"
@@ -0,0 +1,388 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Action grouped processing of a received burst, in the way of the next
+ * node arrays of the graph library. Each packet is classified once, then
+ * put in the bucket of its action, and each action node runs on its whole
+ * sub-burst. The packets to send are buffered per destination port and go
+ * out in one Tx burst per port.
+ * vnf_dispatch_per_pkt runs the same nodes one packet at a time, it is kept
+ * as the reference for A/B comparison: vnf_dispatch_ab alternates both
+ * modes burst by burst on the same traffic and the cycles of each mode are
+ * kept apart.
+ */
+
+struct vnf_node {
+	vnf_node_fn fn;
+	void *ctx;
+};
+
+enum dispatch_mode {
+	DISPATCH_BURST,
+	DISPATCH_PER_PKT,
+	DISPATCH_MODE_MAX,
+};
+
+/* Per lcore accounting, to compare both dispatch modes. */
+struct vnf_dispatch_stats {
+	uint64_t cycles[DISPATCH_MODE_MAX];
+	uint64_t pkts[DISPATCH_MODE_MAX];
+	uint64_t bursts[DISPATCH_MODE_MAX];
+	uint64_t classes[VNF_NEXT_MAX]; /* Packets per action. */
+	uint64_t ab; /* Bursts of vnf_dispatch_ab, the parity picks the mode. */
+} __rte_cache_aligned;
+
+static const char * const next_names[VNF_NEXT_MAX] = {
+	[VNF_NEXT_SLOW] = "slow",
+	[VNF_NEXT_SESSION] = "session",
+	[VNF_NEXT_DECAP] = "decap",
+	[VNF_NEXT_ENCAP] = "encap",
+	[VNF_NEXT_HAIRPIN] = "hairpin",
+	[VNF_NEXT_MIRROR] = "mirror",
+	[VNF_NEXT_DROP] = "drop",
+};
+
+static struct vnf_node nodes[VNF_NEXT_MAX];
+static struct rte_eth_dev_tx_buffer *tx_buffers[RTE_MAX_LCORE][RTE_MAX_ETHPORTS];
+static struct vnf_dispatch_stats dispatch_stats[RTE_MAX_LCORE];
+static uint16_t dispatch_mtu;
+static uint16_t mirror_port = RTE_MAX_ETHPORTS;
+static struct rte_mempool *mirror_pool;
+
+/*
+ * Bad checksums are dropped, the hairpin mark forwarded when the port has
+ * no hairpin queue, the sessions mirrored with a mirror port set by
+ * vnf_dispatch_set_mirror(), only for the burst dispatch.
+ */
+enum vnf_next
+vnf_dispatch_classify(struct rte_mbuf *m)
+{
+	const struct vnf_parse_meta *meta = VNF_PARSE_META(m);
+
+	if ((m->ol_flags & RTE_MBUF_F_RX_IP_CKSUM_MASK) ==
+	    RTE_MBUF_F_RX_IP_CKSUM_BAD ||
+	    (m->ol_flags & RTE_MBUF_F_RX_L4_CKSUM_MASK) ==
+	    RTE_MBUF_F_RX_L4_CKSUM_BAD)
+		return VNF_NEXT_DROP;
+	if (m->ol_flags & RTE_MBUF_F_RX_FDIR_ID) {
+		if (m->hash.fdir.hi == HAIRPIN_FLOW_MARK)
+			return VNF_NEXT_HAIRPIN;
+		if (m->hash.fdir.hi >= VNF_MARK_FIRST)
+			return mirror_port < RTE_MAX_ETHPORTS ?
+			       VNF_NEXT_MIRROR : VNF_NEXT_SESSION;
+	}
+	if (meta->flags & VNF_PARSE_F_GTPU)
+		return VNF_NEXT_DECAP;
+	if (gtp_u_encap_match(m) >= 0)
+		return VNF_NEXT_ENCAP;
+	return VNF_NEXT_SLOW;
+}
+
+/* Default software path, send the packets back as they are. */
+static uint16_t
+slow_node(struct rte_mbuf **pkts, uint16_t nb_pkts, struct rte_mbuf **tx,
+	  uint16_t queue, void *ctx)
+{
+	RTE_SET_USED(queue);
+	RTE_SET_USED(ctx);
+	memcpy(tx, pkts, sizeof(*pkts) * nb_pkts);
+	return nb_pkts;
+}
+
+static uint16_t
+session_node(struct rte_mbuf **pkts, uint16_t nb_pkts, struct rte_mbuf **tx,
+	     uint16_t queue, void *ctx)
+{
+	struct rte_mbuf *slow[VNF_DISPATCH_BURST_MAX];
+	uint16_t i, n = 0, nb_slow = 0;
+
+	RTE_SET_USED(ctx);
+	for (i = 0; i < nb_pkts; i++) {
+		if (vnf_mark_dispatch(pkts[i]) == 0)
+			tx[n++] = pkts[i];
+		else
+			slow[nb_slow++] = pkts[i];
+	}
+	/* Unknown mark, the software has to classify it. */
+	if (nb_slow)
+		n += nodes[VNF_NEXT_SLOW].fn(slow, nb_slow, &tx[n], queue,
+					     nodes[VNF_NEXT_SLOW].ctx);
+	return n;
+}
+
+/* The hairpin queue in software, back out of the port as they are. */
+static uint16_t
+hairpin_node(struct rte_mbuf **pkts, uint16_t nb_pkts, struct rte_mbuf **tx,
+	     uint16_t queue, void *ctx)
+{
+	RTE_SET_USED(queue);
+	RTE_SET_USED(ctx);
+	memcpy(tx, pkts, sizeof(*pkts) * nb_pkts);
+	return nb_pkts;
+}
+
+/* The sessions, and a copy of each to the mirror port. */
+static uint16_t
+mirror_node(struct rte_mbuf **pkts, uint16_t nb_pkts, struct rte_mbuf **tx,
+	    uint16_t queue, void *ctx)
+{
+	struct rte_mbuf *copy;
+	uint16_t i, n = 0;
+
+	RTE_SET_USED(ctx);
+	for (i = 0; i < nb_pkts; i++) {
+		copy = rte_pktmbuf_copy(pkts[i], mirror_pool, 0, UINT32_MAX);
+		if (copy != NULL) {
+			copy->port = mirror_port;
+			tx[n++] = copy;
+		}
+	}
+	return n + session_node(pkts, nb_pkts, &tx[n], queue, NULL);
+}
+
+static uint16_t
+decap_node(struct rte_mbuf **pkts, uint16_t nb_pkts, struct rte_mbuf **tx,
+	   uint16_t queue, void *ctx)
+{
+	uint16_t i;
+
+	RTE_SET_USED(queue);
+	RTE_SET_USED(ctx);
+	for (i = 0; i < nb_pkts; i++) {
+		gtp_u_sw_decap(pkts[i]);
+		tx[i] = pkts[i];
+	}
+	return nb_pkts;
+}
+
+static uint16_t
+encap_node(struct rte_mbuf **pkts, uint16_t nb_pkts, struct rte_mbuf **tx,
+	   uint16_t queue, void *ctx)
+{
+	uint16_t mtu = *(uint16_t *)ctx;
+	uint16_t i, n = 0;
+
+	RTE_SET_USED(queue);
+	for (i = 0; i < nb_pkts; i++)
+		n += gtp_u_encap_fragment(pkts[i], mtu, &tx[n],
+					  GTP_FRAG_MAX_FRAGS);
+	return n;
+}
+
+static uint16_t
+drop_node(struct rte_mbuf **pkts, uint16_t nb_pkts, struct rte_mbuf **tx,
+	  uint16_t queue, void *ctx)
+{
+	RTE_SET_USED(tx);
+	RTE_SET_USED(queue);
+	RTE_SET_USED(ctx);
+	rte_pktmbuf_free_bulk(pkts, nb_pkts);
+	return 0;
+}
+
+int
+vnf_dispatch_init(uint16_t mtu)
+{
+	struct rte_eth_dev_tx_buffer *buffer;
+	unsigned int lcore_id;
+	uint16_t port_id;
+
+	dispatch_mtu = mtu;
+	vnf_dispatch_set_node(VNF_NEXT_SLOW, slow_node, NULL);
+	vnf_dispatch_set_node(VNF_NEXT_SESSION, session_node, NULL);
+	vnf_dispatch_set_node(VNF_NEXT_DECAP, decap_node, NULL);
+	vnf_dispatch_set_node(VNF_NEXT_ENCAP, encap_node, &dispatch_mtu);
+	vnf_dispatch_set_node(VNF_NEXT_HAIRPIN, hairpin_node, NULL);
+	vnf_dispatch_set_node(VNF_NEXT_MIRROR, mirror_node, NULL);
+	vnf_dispatch_set_node(VNF_NEXT_DROP, drop_node, NULL);
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		RTE_ETH_FOREACH_DEV(port_id) {
+			buffer = rte_zmalloc_socket("vnf_tx_buffer",
+				RTE_ETH_TX_BUFFER_SIZE(VNF_DISPATCH_BURST_MAX),
+				RTE_CACHE_LINE_SIZE,
+				rte_lcore_to_socket_id(lcore_id));
+			if (buffer == NULL) {
+				printf("Cannot allocate Tx buffer, lcore %u port %u\n",
+				       lcore_id, port_id);
+				return -1;
+			}
+			/* Unsent packets are freed by the default callback. */
+			rte_eth_tx_buffer_init(buffer, VNF_DISPATCH_BURST_MAX);
+			tx_buffers[lcore_id][port_id] = buffer;
+		}
+	}
+	return 0;
+}
+
+void
+vnf_dispatch_set_node(enum vnf_next next, vnf_node_fn fn, void *ctx)
+{
+	nodes[next].fn = fn;
+	nodes[next].ctx = ctx;
+}
+
+/* Copy the sessions to port_id, copies from pool, RTE_MAX_ETHPORTS to stop. */
+void
+vnf_dispatch_set_mirror(uint16_t port_id, struct rte_mempool *pool)
+{
+	mirror_pool = pool;
+	mirror_port = port_id;
+}
+
+/* Buffer the packets per destination port, return the number queued. */
+static uint16_t
+vnf_dispatch_tx(struct rte_eth_dev_tx_buffer **buffers, uint16_t queue,
+		struct rte_mbuf **tx, uint16_t nb_tx, uint64_t *ports)
+{
+	uint16_t i;
+
+	for (i = 0; i < nb_tx; i++) {
+		rte_eth_tx_buffer(tx[i]->port, queue, buffers[tx[i]->port],
+				  tx[i]);
+		*ports |= RTE_BIT64(tx[i]->port);
+	}
+	return nb_tx;
+}
+
+static void
+vnf_dispatch_flush(struct rte_eth_dev_tx_buffer **buffers, uint16_t queue,
+		   uint64_t ports)
+{
+	uint16_t port_id;
+
+	while (ports) {
+		port_id = rte_bsf64(ports);
+		ports &= ports - 1;
+		rte_eth_tx_buffer_flush(port_id, queue, buffers[port_id]);
+	}
+}
+
+static void
+dispatch_account(unsigned int lcore_id, enum dispatch_mode mode,
+		 uint64_t start, uint16_t nb_pkts)
+{
+	struct vnf_dispatch_stats *st = &dispatch_stats[lcore_id];
+
+	st->cycles[mode] += rte_rdtsc() - start;
+	st->pkts[mode] += nb_pkts;
+	st->bursts[mode]++;
+}
+
+uint16_t
+vnf_dispatch_burst(uint16_t queue, struct rte_mbuf **pkts, uint16_t nb_pkts)
+{
+	struct rte_mbuf *buckets[VNF_NEXT_MAX][VNF_DISPATCH_BURST_MAX];
+	struct rte_mbuf *tx[VNF_DISPATCH_BURST_MAX * GTP_FRAG_MAX_FRAGS];
+	unsigned int lcore_id = rte_lcore_id();
+	struct rte_eth_dev_tx_buffer **buffers = tx_buffers[lcore_id];
+	uint64_t *classes = dispatch_stats[lcore_id].classes;
+	uint16_t nb_bucket[VNF_NEXT_MAX] = { 0 };
+	uint64_t start = rte_rdtsc();
+	uint64_t ports = 0;
+	uint16_t i, nb_tx, nb_sent = 0;
+	enum vnf_next next;
+
+	/* Classify only, no action code runs in this loop. */
+	for (i = 0; i < nb_pkts; i++) {
+		next = vnf_dispatch_classify(pkts[i]);
+		buckets[next][nb_bucket[next]++] = pkts[i];
+	}
+	for (next = VNF_NEXT_SLOW; next < VNF_NEXT_MAX; next++) {
+		if (!nb_bucket[next])
+			continue;
+		classes[next] += nb_bucket[next];
+		nb_tx = nodes[next].fn(buckets[next], nb_bucket[next], tx,
+				       queue, nodes[next].ctx);
+		nb_sent += vnf_dispatch_tx(buffers, queue, tx, nb_tx, &ports);
+	}
+	vnf_dispatch_flush(buffers, queue, ports);
+	dispatch_account(lcore_id, DISPATCH_BURST, start, nb_pkts);
+	return nb_sent;
+}
+
+uint16_t
+vnf_dispatch_per_pkt(uint16_t queue, struct rte_mbuf **pkts,
+		     uint16_t nb_pkts)
+{
+	struct rte_mbuf *tx[GTP_FRAG_MAX_FRAGS];
+	unsigned int lcore_id = rte_lcore_id();
+	struct rte_eth_dev_tx_buffer **buffers = tx_buffers[lcore_id];
+	uint64_t *classes = dispatch_stats[lcore_id].classes;
+	uint64_t start = rte_rdtsc();
+	uint64_t ports = 0;
+	uint16_t i, nb_tx, nb_sent = 0;
+	enum vnf_next next;
+
+	for (i = 0; i < nb_pkts; i++) {
+		next = vnf_dispatch_classify(pkts[i]);
+		classes[next]++;
+		nb_tx = nodes[next].fn(&pkts[i], 1, tx, queue,
+				       nodes[next].ctx);
+		nb_sent += vnf_dispatch_tx(buffers, queue, tx, nb_tx, &ports);
+	}
+	vnf_dispatch_flush(buffers, queue, ports);
+	dispatch_account(lcore_id, DISPATCH_PER_PKT, start, nb_pkts);
+	return nb_sent;
+}
+
+/* Both modes in turn, one burst each, for the A/B comparison. */
+uint16_t
+vnf_dispatch_ab(uint16_t queue, struct rte_mbuf **pkts, uint16_t nb_pkts)
+{
+	if (dispatch_stats[rte_lcore_id()].ab++ & 1)
+		return vnf_dispatch_per_pkt(queue, pkts, nb_pkts);
+	return vnf_dispatch_burst(queue, pkts, nb_pkts);
+}
+
+void
+vnf_dispatch_stats_print(void)
+{
+	static const char * const mode_names[DISPATCH_MODE_MAX] = {
+		[DISPATCH_BURST] = "burst",
+		[DISPATCH_PER_PKT] = "per-pkt",
+	};
+	const struct vnf_dispatch_stats *st;
+	double per_pkt[DISPATCH_MODE_MAX];
+	unsigned int lcore_id;
+	int mode, next;
+
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		st = &dispatch_stats[lcore_id];
+		if (!st->pkts[DISPATCH_BURST] && !st->pkts[DISPATCH_PER_PKT])
+			continue;
+		for (mode = 0; mode < DISPATCH_MODE_MAX; mode++) {
+			per_pkt[mode] = st->pkts[mode] ?
+				(double)st->cycles[mode] / st->pkts[mode] : 0;
+			if (!st->bursts[mode])
+				continue;
+			printf("lcore %u dispatch %s: %"PRIu64" pkts, %"PRIu64
+			       " bursts, %.1f cycles/pkt, %.0f cycles/burst\n",
+			       lcore_id, mode_names[mode], st->pkts[mode],
+			       st->bursts[mode], per_pkt[mode],
+			       (double)st->cycles[mode] / st->bursts[mode]);
+		}
+		if (per_pkt[DISPATCH_BURST] && per_pkt[DISPATCH_PER_PKT])
+			printf("lcore %u dispatch per-pkt/burst: %.2f\n",
+			       lcore_id, per_pkt[DISPATCH_PER_PKT] /
+			       per_pkt[DISPATCH_BURST]);
+		printf("lcore %u dispatch actions:", lcore_id);
+		for (next = 0; next < VNF_NEXT_MAX; next++)
+			printf(" %s %"PRIu64, next_names[next],
+			       st->classes[next]);
+		printf("\n");
+	}
+}
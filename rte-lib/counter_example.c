@@ -8,83 +8,44 @@
 
 #include "vnf_examples.h"
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
- */
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
-struct rte_flow_action_count shared_counter = {
-	.id = 100,
-};
+/* testpmd action_id of the counter shared by the first two flows. */
+#define SHARED_COUNTER_ACTION_ID 101
 
 struct rte_flow_action_count dedicated_counter = {
 	.id = 0,
 };
 
-struct rte_flow *flow1, *flow2, *flow3, *flow4;
+/* The flows are found again in the registry by their cookie. */
+#define COUNTER_FLOW_COOKIE(n) VNF_FLOW_COOKIE(VNF_FLOW_OWNER_COUNTER, n)
+
+/* Harvested counters: the shared one, flow3's and flow4's. */
+static uint32_t counters[3];
+
+static uint32_t
+counter_flow_register(int n)
+{
+	return vnf_counter_register_flow(
+			vnf_flow_lookup_cookie(COUNTER_FLOW_COOKIE(n)), 0);
+}
+
+/* eth / ipv4 src is <ipv4_spec> / tcp */
+static void
+counter_flow_pattern(struct vnf_flow_builder *fb,
+		     const struct rte_flow_item_ipv4 *ipv4_spec,
+		     const struct rte_flow_item_ipv4 *ipv4_mask)
+{
+	vnf_flow_builder_init(fb);
+	vnf_flow_item_eth(fb, NULL, NULL);
+	vnf_flow_item_ipv4(fb, ipv4_spec, ipv4_mask);
+	vnf_flow_item_tcp(fb, NULL, NULL);
+}
 
 int
 create_flow_with_counter(uint16_t port)
 {
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
+	struct rte_flow *flow;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
@@ -92,10 +53,14 @@ create_flow_with_counter(uint16_t port)
 	struct rte_flow_action_queue queue = {
 		.index = 0,
 	};
+	struct rte_flow_action count = {
+		.type = RTE_FLOW_ACTION_TYPE_COUNT,
+	};
+	struct rte_flow_indir_action_conf indir_conf = { .ingress = 1 };
+	struct rte_flow_action_handle *shared_counter;
 	struct rte_flow_action actions[] = {
-			[0] = { /* Shared counter. */
-				.type = RTE_FLOW_ACTION_TYPE_COUNT,
-				.conf = &shared_counter },
+			[0] = { /* Shared counter, set below. */
+				.type = RTE_FLOW_ACTION_TYPE_INDIRECT },
 			[1] = {
 				.type = RTE_FLOW_ACTION_TYPE_QUEUE,
 				.conf = &queue},
@@ -113,86 +78,97 @@ create_flow_with_counter(uint16_t port)
 			.src_addr = RTE_BE32(UINT32_MAX),
 		},
 	};
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_spec;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_TCP;
+	/*
+	 * testpmd> flow indirect_action 0 create action_id 101 ingress
+	 *          action count / end
+	 */
+	shared_counter = vnf_flow_handle_create(port, SHARED_COUNTER_ACTION_ID,
+						&indir_conf, &count);
+	if (shared_counter == NULL)
+		return -1;
+	actions[0].conf = shared_counter;
+	counter_flow_pattern(&fb, &ipv4_spec, &ipv4_mask);
 	/* Create the flow. */
-	flow1 = rte_flow_create(port, &attr, pattern, actions, &error);
-	if (!flow1) {
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_COUNTER, COUNTER_FLOW_COOKIE(1),
+				       &error);
+	if (!flow) {
 		printf("Can't create first flow with shared count. %s\n",
 		       error.message);
 		return -1;
 	}
 	ipv4_spec.hdr.src_addr = RTE_BE32(RTE_IPV4(1, 1, 1, 2));
-	flow2 = rte_flow_create(port, &attr, pattern, actions, &error);
-	if (!flow2) {
+	counter_flow_pattern(&fb, &ipv4_spec, &ipv4_mask);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_COUNTER, COUNTER_FLOW_COOKIE(2),
+				       &error);
+	if (!flow) {
 		printf("Can't create second flow with shared count. %s\n",
 		       error.message);
 		return -1;
 	}
+	counters[0] = vnf_counter_register_handle(port,
+			SHARED_COUNTER_ACTION_ID, COUNTER_FLOW_COOKIE(1));
+	actions[0].type = RTE_FLOW_ACTION_TYPE_COUNT;
 	actions[0].conf = &dedicated_counter;
 	ipv4_spec.hdr.src_addr = RTE_BE32(RTE_IPV4(1, 1, 1, 3));
-	flow3 = rte_flow_create(port, &attr, pattern, actions, &error);
-	if (!flow3) {
+	counter_flow_pattern(&fb, &ipv4_spec, &ipv4_mask);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_COUNTER, COUNTER_FLOW_COOKIE(3),
+				       &error);
+	if (!flow) {
 		printf("Can't create third flow with dedicated count. %s\n",
 		       error.message);
 		return -1;
 	}
 	actions[0].conf = &dedicated_counter;
 	ipv4_spec.hdr.src_addr = RTE_BE32(RTE_IPV4(1, 1, 1, 4));
-	flow4 = rte_flow_create(port, &attr, pattern, actions, &error);
-	if (!flow4) {
+	counter_flow_pattern(&fb, &ipv4_spec, &ipv4_mask);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_COUNTER, COUNTER_FLOW_COOKIE(4),
+				       &error);
+	if (!flow) {
 		printf("Can't create third flow with dedicated count. %s\n",
 		       error.message);
 		return -1;
 	}
+	counters[1] = counter_flow_register(3);
+	counters[2] = counter_flow_register(4);
 	return 0;
 }
 
-int
-query_counters(uint16_t port)
+static int
+print_counter(const char *name, uint32_t counter)
 {
-	struct rte_flow_query_count query_counter;
-	struct rte_flow_error error;
-	struct rte_flow_action action = {.type = RTE_FLOW_ACTION_TYPE_COUNT};
-	struct rte_flow_action actions[2];
-	actions[1].type = RTE_FLOW_ACTION_TYPE_END;
-	actions[0].type = RTE_FLOW_ACTION_TYPE_COUNT;
-	actions[0].conf = &shared_counter;
-	if (rte_flow_query(port, flow1, actions, &query_counter, &error)) {
-		printf("Can't query flow1's counter, msg: %s\n", error.message);
-		return -1;
-	}
-	printf("flow1 counter: hits_set[%u], bytes_set[%u], hits[%"PRIu64"], "
-			"bytes[%"PRIu64"]\n", query_counter.hits_set,
-			query_counter.bytes_set, query_counter.hits,
-			query_counter.bytes);
-	if (rte_flow_query(port, flow2, actions, &query_counter, &error)) {
-		printf("Can't query flow2's counter, msg: %s\n", error.message);
-		return -1;
-	}
-	printf("flow2 counter: hits_set[%u], bytes_set[%u], hits[%"PRIu64"], "
-			"bytes[%"PRIu64"]\n", query_counter.hits_set,
-			query_counter.bytes_set, query_counter.hits,
-			query_counter.bytes);
-	actions[0].conf = &dedicated_counter;
-	if (rte_flow_query(port, flow3, actions, &query_counter, &error)) {
-		printf("Can't query flow3's counter, msg: %s\n", error.message);
+	struct vnf_counter_stats cs;
+
+	/* Harvested in the background, refreshed here for the print. */
+	if (vnf_counter_get(counter, &cs, 1)) {
+		printf("Can't query %s counter\n", name);
 		return -1;
 	}
-	printf("flow3 counter: hits_set[%u], bytes_set[%u], hits[%"PRIu64"], "
-			"bytes[%"PRIu64"]\n", query_counter.hits_set,
-			query_counter.bytes_set, query_counter.hits,
-			query_counter.bytes);
-	if (rte_flow_query(port, flow4, actions, &query_counter, &error)) {
-		printf("Can't query flow4's counter, msg: %s\n", error.message);
+	printf("%s counter: hits[%"PRIu64"], bytes[%"PRIu64"], "
+	       "hits/s[%"PRIu64"], bytes/s[%"PRIu64"]\n", name, cs.hits,
+	       cs.bytes, cs.hits_rate, cs.bytes_rate);
+	return 0;
+}
+
+int
+query_counters(uint16_t port)
+{
+	RTE_SET_USED(port);
+	/* flow1 and flow2 count in the indirect action they share. */
+	if (print_counter("flow1 and flow2 shared", counters[0]) ||
+	    print_counter("flow3", counters[1]) ||
+	    print_counter("flow4", counters[2]))
 		return -1;
-	}
-	printf("flow4 counter: hits_set[%u], bytes_set[%u], hits[%"PRIu64"], "
-			"bytes[%"PRIu64"]\n", query_counter.hits_set,
-			query_counter.bytes_set, query_counter.hits,
-			query_counter.bytes);
 	return 0;
 }
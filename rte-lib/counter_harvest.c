@@ -0,0 +1,491 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
+#include <rte_service.h>
+#include <rte_service_component.h>
+#include <rte_spinlock.h>
+#include <rte_telemetry.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Harvesting of the rule counters, e.g. per session bytes and packets for
+ * charging. A counter is a rule of the flow registry with a COUNT action,
+ * or an indirect COUNT action counting many rules in one query.
+ * rte_flow has no bulk query, so instead of querying all the counters at
+ * once, which takes seconds with a million of them, an EAL service queries
+ * the next slice of the table every HARVEST_TICK_MS, sized for the whole
+ * table to be done once per cycle. As the meter stats, it runs on a
+ * service lcore when the EAL has one, else the main lcore runs it from its
+ * loop with vnf_counter_harvest_poll(). The slice is picked under the
+ * harvest lock and queried without it, the results kept if the counters
+ * are still the same. Each query keeps its delta in a small ring of the
+ * counter, the rate is taken over the ring.
+ * Counters of a rule gone from the registry are released by the harvest.
+ */
+
+#define HARVEST_TICK_MS 10
+#define HARVEST_TICK_MAX 4096 /* Queries per tick, bounds a tick time. */
+
+enum harvest_kind {
+	HARVEST_FREE,
+	HARVEST_FLOW, /* Rule of the registry. */
+	HARVEST_HANDLE, /* Indirect COUNT action. */
+};
+
+/* Delta of one query. */
+struct harvest_sample {
+	uint32_t ms; /* Since the previous query. */
+	uint32_t hits;
+	uint64_t bytes;
+};
+
+struct harvest_counter {
+	uint64_t key; /* Session of the user, the rule cookie by default. */
+	uint64_t hits;
+	uint64_t bytes;
+	uint64_t tsc; /* Last query. */
+	uint32_t id; /* Flow ID, or handle id; next free when free. */
+	uint16_t port_id;
+	uint8_t kind;
+	uint8_t head; /* Next sample. */
+	uint32_t gen; /* Bumped on release, for the queries in flight. */
+	struct harvest_sample history[VNF_COUNTER_HISTORY];
+};
+
+/* Query of a counter, made without the harvest lock. */
+struct harvest_job {
+	uint32_t counter;
+	uint32_t gen;
+	uint32_t id;
+	uint16_t port_id;
+	uint8_t kind;
+	int ret;
+	struct rte_flow_query_count query;
+};
+
+struct harvest_stats {
+	uint64_t cycles; /* Whole table done. */
+	uint64_t queries;
+	uint64_t errors;
+	uint64_t released; /* Rule gone. */
+	uint64_t last_cycle_ms;
+	uint64_t max_tick_us;
+};
+
+static struct harvest_counter *counters;
+static uint32_t max_counters;
+static uint32_t nb_counters;
+static uint32_t free_head; /* Counter 0 is never used. */
+static uint32_t next_unused = 1;
+static uint32_t cursor = 1;
+static uint32_t cycle_ms;
+static uint64_t cycle_start;
+static uint64_t next_tick;
+static struct harvest_stats stats;
+static struct harvest_job jobs[HARVEST_TICK_MAX]; /* Of the running tick. */
+static uint32_t harvest_service_id;
+static int harvest_registered;
+static int harvest_on_app_lcore; /* No service lcore, polled. */
+static uint32_t harvest_lcore = RTE_MAX_LCORE; /* Service lcore. */
+static rte_spinlock_t harvest_lock = RTE_SPINLOCK_INITIALIZER;
+
+static struct harvest_counter *
+harvest_counter_get(uint32_t counter)
+{
+	if (counters == NULL || !counter || counter >= next_unused ||
+	    counters[counter].kind == HARVEST_FREE)
+		return NULL;
+	return &counters[counter];
+}
+
+static void
+harvest_counter_release(uint32_t counter)
+{
+	uint32_t gen = counters[counter].gen + 1;
+
+	memset(&counters[counter], 0, sizeof(counters[counter]));
+	counters[counter].gen = gen;
+	counters[counter].id = free_head;
+	free_head = counter;
+	nb_counters--;
+}
+
+/* Harvest lock held, the query of the counter to make. */
+static void
+harvest_job_init(struct harvest_job *j, uint32_t counter)
+{
+	const struct harvest_counter *c = &counters[counter];
+
+	j->counter = counter;
+	j->gen = c->gen;
+	j->id = c->id;
+	j->port_id = c->port_id;
+	j->kind = c->kind;
+}
+
+/* Without the harvest lock. Return -ENOENT when the rule is gone. */
+static int
+harvest_query(struct harvest_job *j)
+{
+	static const struct rte_flow_action count[] = {
+		{ .type = RTE_FLOW_ACTION_TYPE_COUNT },
+		{ .type = RTE_FLOW_ACTION_TYPE_END },
+	};
+	struct rte_flow_error error;
+	struct rte_flow *flow;
+
+	memset(&j->query, 0, sizeof(j->query));
+	if (j->kind == HARVEST_HANDLE)
+		return vnf_flow_handle_query(j->port_id, j->id, &j->query);
+	flow = vnf_flow_lookup(j->id, NULL);
+	if (flow == NULL)
+		return -ENOENT;
+	return vnf_flow_ops_get(j->port_id)->query(j->port_id, flow, count,
+						   &j->query, &error);
+}
+
+/*
+ * Harvest lock held, the result of a query made at now to the counter if
+ * it is still the one queried. Return -ENOENT when it is gone.
+ */
+static int
+harvest_update(const struct harvest_job *j, uint64_t now)
+{
+	struct harvest_counter *c = &counters[j->counter];
+	struct harvest_sample *s;
+
+	if (c->kind == HARVEST_FREE || c->gen != j->gen)
+		return -ENOENT;
+	if (j->ret == -ENOENT) {
+		harvest_counter_release(j->counter);
+		stats.released++;
+		return -ENOENT;
+	}
+	stats.queries++;
+	if (j->ret) {
+		stats.errors++;
+		return j->ret;
+	}
+	/* The counters only grow, unless reset, as a rule re-created. */
+	if (j->query.hits < c->hits || j->query.bytes < c->bytes) {
+		c->hits = 0;
+		c->bytes = 0;
+	}
+	if (c->tsc) {
+		s = &c->history[c->head];
+		s->ms = (now - c->tsc) * MS_PER_S / rte_get_tsc_hz();
+		s->hits = j->query.hits - c->hits;
+		s->bytes = j->query.bytes - c->bytes;
+		c->head = (c->head + 1) % VNF_COUNTER_HISTORY;
+	}
+	c->hits = j->query.hits;
+	c->bytes = j->query.bytes;
+	c->tsc = now;
+	return 0;
+}
+
+/* Service callback, the next slice of the table when due. */
+static int32_t
+harvest_run(void *arg)
+{
+	uint64_t start = rte_get_tsc_cycles(), us;
+	uint32_t budget, ticks, n, nb = 0;
+
+	RTE_SET_USED(arg);
+	if (start < next_tick)
+		return -EAGAIN;
+	next_tick = start + rte_get_tsc_hz() * HARVEST_TICK_MS / MS_PER_S;
+	rte_spinlock_lock(&harvest_lock);
+	if (counters == NULL) {
+		rte_spinlock_unlock(&harvest_lock);
+		return 0;
+	}
+	/* One pass over the used part of the table per cycle. */
+	ticks = RTE_MAX(cycle_ms / HARVEST_TICK_MS, 1u);
+	budget = (next_unused - 1 + ticks - 1) / ticks;
+	budget = RTE_MIN(RTE_MAX(budget, 1u), (uint32_t)HARVEST_TICK_MAX);
+	for (n = 0; n < budget; n++) {
+		if (cursor >= next_unused) {
+			stats.cycles++;
+			stats.last_cycle_ms = (start - cycle_start) *
+					      MS_PER_S / rte_get_tsc_hz();
+			cycle_start = start;
+			cursor = 1;
+			if (next_unused == 1)
+				break;
+		}
+		if (counters[cursor].kind != HARVEST_FREE)
+			harvest_job_init(&jobs[nb++], cursor);
+		cursor++;
+	}
+	rte_spinlock_unlock(&harvest_lock);
+	for (n = 0; n < nb; n++)
+		jobs[n].ret = harvest_query(&jobs[n]);
+	rte_spinlock_lock(&harvest_lock);
+	for (n = 0; n < nb; n++)
+		harvest_update(&jobs[n], start);
+	us = (rte_get_tsc_cycles() - start) * US_PER_S / rte_get_tsc_hz();
+	if (us > stats.max_tick_us)
+		stats.max_tick_us = us;
+	rte_spinlock_unlock(&harvest_lock);
+	return 0;
+}
+
+/* From the loop of the main lcore, runs the service without service lcore. */
+void
+vnf_counter_harvest_poll(void)
+{
+	if (harvest_on_app_lcore)
+		rte_service_run_iter_on_app_lcore(harvest_service_id, 0);
+}
+
+static uint32_t
+harvest_counter_add(enum harvest_kind kind, uint16_t port_id, uint32_t id,
+		    uint64_t key)
+{
+	struct harvest_counter *c;
+	uint32_t counter, gen;
+
+	if (counters == NULL)
+		return VNF_COUNTER_INVALID;
+	rte_spinlock_lock(&harvest_lock);
+	if (free_head) {
+		counter = free_head;
+		free_head = counters[counter].id;
+	} else if (next_unused <= max_counters) {
+		counter = next_unused++;
+	} else {
+		rte_spinlock_unlock(&harvest_lock);
+		printf("Counter harvest is full, %u counters\n",
+		       max_counters);
+		return VNF_COUNTER_INVALID;
+	}
+	c = &counters[counter];
+	gen = c->gen;
+	memset(c, 0, sizeof(*c));
+	c->gen = gen;
+	c->kind = kind;
+	c->port_id = port_id;
+	c->id = id;
+	c->key = key;
+	nb_counters++;
+	rte_spinlock_unlock(&harvest_lock);
+	return counter;
+}
+
+/* The rule must have a COUNT action, key is the rule cookie if 0. */
+uint32_t
+vnf_counter_register_flow(uint32_t flow_id, uint64_t key)
+{
+	struct vnf_flow_info info;
+
+	if (vnf_flow_lookup(flow_id, &info) == NULL) {
+		printf("Flow 0x%08x to count is not registered\n", flow_id);
+		return VNF_COUNTER_INVALID;
+	}
+	return harvest_counter_add(HARVEST_FLOW, info.port_id, flow_id,
+				   key ? key : info.cookie);
+}
+
+/* Indirect COUNT action id of the port, see vnf_flow_handle_create(). */
+uint32_t
+vnf_counter_register_handle(uint16_t port_id, uint32_t handle_id,
+			    uint64_t key)
+{
+	if (vnf_flow_handle_get(port_id, handle_id) == NULL) {
+		printf("No indirect action %u to count on port %u\n",
+		       handle_id, port_id);
+		return VNF_COUNTER_INVALID;
+	}
+	return harvest_counter_add(HARVEST_HANDLE, port_id, handle_id, key);
+}
+
+void
+vnf_counter_unregister(uint32_t counter)
+{
+	rte_spinlock_lock(&harvest_lock);
+	if (harvest_counter_get(counter))
+		harvest_counter_release(counter);
+	rte_spinlock_unlock(&harvest_lock);
+}
+
+/*
+ * Totals and rates of the last queries, refresh queries the counter now
+ * instead of waiting for the harvest.
+ */
+int
+vnf_counter_get(uint32_t counter, struct vnf_counter_stats *cs, int refresh)
+{
+	const struct harvest_sample *s;
+	struct harvest_counter *c;
+	struct harvest_job j;
+	uint64_t hits = 0, bytes = 0, ms = 0;
+	int i, ret = 0;
+
+	rte_spinlock_lock(&harvest_lock);
+	c = harvest_counter_get(counter);
+	if (c == NULL) {
+		rte_spinlock_unlock(&harvest_lock);
+		return -ENOENT;
+	}
+	if (refresh) {
+		harvest_job_init(&j, counter);
+		rte_spinlock_unlock(&harvest_lock);
+		j.ret = harvest_query(&j);
+		rte_spinlock_lock(&harvest_lock);
+		ret = harvest_update(&j, rte_get_tsc_cycles());
+		if (ret == -ENOENT) {
+			rte_spinlock_unlock(&harvest_lock);
+			return ret;
+		}
+	}
+	for (i = 0; i < VNF_COUNTER_HISTORY; i++) {
+		s = &c->history[i];
+		hits += s->hits;
+		bytes += s->bytes;
+		ms += s->ms;
+	}
+	cs->key = c->key;
+	cs->hits = c->hits;
+	cs->bytes = c->bytes;
+	cs->hits_rate = ms ? hits * MS_PER_S / ms : 0;
+	cs->bytes_rate = ms ? bytes * MS_PER_S / ms : 0;
+	cs->age_ms = c->tsc ? (rte_get_tsc_cycles() - c->tsc) * MS_PER_S /
+			      rte_get_tsc_hz() : UINT64_MAX;
+	rte_spinlock_unlock(&harvest_lock);
+	return ret;
+}
+
+static int
+harvest_telemetry(const char *cmd, const char *params, struct rte_tel_data *d)
+{
+	struct harvest_stats hs;
+	uint32_t nb;
+
+	RTE_SET_USED(cmd);
+	RTE_SET_USED(params);
+	rte_spinlock_lock(&harvest_lock);
+	hs = stats;
+	nb = nb_counters;
+	rte_spinlock_unlock(&harvest_lock);
+	rte_tel_data_start_dict(d);
+	rte_tel_data_add_dict_u64(d, "counters", nb);
+	rte_tel_data_add_dict_u64(d, "cycle_ms", cycle_ms);
+	rte_tel_data_add_dict_u64(d, "cycles", hs.cycles);
+	rte_tel_data_add_dict_u64(d, "last_cycle_ms", hs.last_cycle_ms);
+	rte_tel_data_add_dict_u64(d, "max_tick_us", hs.max_tick_us);
+	rte_tel_data_add_dict_u64(d, "queries", hs.queries);
+	rte_tel_data_add_dict_u64(d, "errors", hs.errors);
+	rte_tel_data_add_dict_u64(d, "released", hs.released);
+	return 0;
+}
+
+static int
+harvest_counter_telemetry(const char *cmd, const char *params,
+			  struct rte_tel_data *d)
+{
+	struct vnf_counter_stats cs;
+
+	RTE_SET_USED(cmd);
+	if (params == NULL ||
+	    vnf_counter_get(strtoul(params, NULL, 0), &cs, 0))
+		return -EINVAL;
+	rte_tel_data_start_dict(d);
+	rte_tel_data_add_dict_u64(d, "key", cs.key);
+	rte_tel_data_add_dict_u64(d, "hits", cs.hits);
+	rte_tel_data_add_dict_u64(d, "bytes", cs.bytes);
+	rte_tel_data_add_dict_u64(d, "hits_rate", cs.hits_rate);
+	rte_tel_data_add_dict_u64(d, "bytes_rate", cs.bytes_rate);
+	rte_tel_data_add_dict_u64(d, "age_ms", cs.age_ms);
+	return 0;
+}
+
+/*
+ * Each counter is queried once per period_ms, spread over the period.
+ * Stats are in telemetry as /vnf/counters and /vnf/counter,<counter>.
+ */
+int
+vnf_counter_harvest_init(uint32_t nb, uint32_t period_ms)
+{
+	struct rte_service_spec service;
+	uint32_t lcore_id;
+
+	if (counters || !nb || !period_ms) {
+		printf("Can't init counter harvest of %u counters\n", nb);
+		return -1;
+	}
+	counters = rte_zmalloc("vnf_counters", sizeof(*counters) * (nb + 1),
+			       RTE_CACHE_LINE_SIZE);
+	if (counters == NULL) {
+		printf("Cannot allocate %u counters\n", nb);
+		return -1;
+	}
+	max_counters = nb;
+	cycle_ms = period_ms;
+	cycle_start = rte_get_tsc_cycles();
+	memset(&service, 0, sizeof(service));
+	snprintf(service.name, sizeof(service.name), "vnf_counter_harvest");
+	service.callback = harvest_run;
+	service.socket_id = rte_socket_id();
+	if (rte_service_component_register(&service, &harvest_service_id)) {
+		printf("Cannot register counter harvest service\n");
+		rte_free(counters);
+		counters = NULL;
+		return -1;
+	}
+	harvest_registered = 1;
+	rte_service_component_runstate_set(harvest_service_id, 1);
+	rte_service_runstate_set(harvest_service_id, 1);
+	if (rte_service_lcore_list(&lcore_id, 1) > 0 &&
+	    rte_service_map_lcore_set(harvest_service_id, lcore_id, 1) == 0) {
+		rte_service_lcore_start(lcore_id);
+		harvest_lcore = lcore_id;
+		printf(":: counter harvest on service lcore %u\n", lcore_id);
+	} else {
+		harvest_on_app_lcore = 1;
+		rte_service_set_runstate_mapped_check(harvest_service_id, 0);
+	}
+	rte_telemetry_register_cmd("/vnf/counters", harvest_telemetry,
+			"Counter harvest stats. Takes no parameters");
+	rte_telemetry_register_cmd("/vnf/counter", harvest_counter_telemetry,
+			"Harvested counter. Parameters: int counter");
+	return 0;
+}
+
+void
+vnf_counter_harvest_close(void)
+{
+	if (harvest_registered) {
+		rte_service_runstate_set(harvest_service_id, 0);
+		rte_service_component_runstate_set(harvest_service_id, 0);
+		while (rte_service_may_be_active(harvest_service_id) == 1)
+			rte_pause();
+		if (harvest_lcore != RTE_MAX_LCORE)
+			rte_service_map_lcore_set(harvest_service_id,
+						  harvest_lcore, 0);
+		rte_service_component_unregister(harvest_service_id);
+		harvest_registered = 0;
+		harvest_lcore = RTE_MAX_LCORE;
+	}
+	harvest_on_app_lcore = 0;
+	rte_spinlock_lock(&harvest_lock);
+	rte_free(counters);
+	counters = NULL;
+	nb_counters = 0;
+	free_head = 0;
+	next_unused = 1;
+	cursor = 1;
+	rte_spinlock_unlock(&harvest_lock);
+}
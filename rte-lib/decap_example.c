@@ -9,69 +9,6 @@
 
 #include "vnf_examples.h"
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
- */
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
 /* Decap GTP-U type traffic and do RSS based on the inner IPv4 src. */
 struct rte_flow *
 create_gtp_u_decap_rss_flow(uint16_t port, uint32_t nb_queues,
@@ -79,12 +16,12 @@ create_gtp_u_decap_rss_flow(uint16_t port, uint32_t nb_queues,
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
-				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
-				.priority = 0, }; /* add priority to rule
-				to give the Decap rule higher priority since
-				it is more specific than RSS */
+				.priority = VNF_FLOW_PRIO_AUTO, }; /* placed
+				before the RSS rule since it is more
+				specific */
 	struct rte_flow_item_gtp gtp_spec = {
 			.teid = rte_cpu_to_be_32(1234), /* Set the teid */
 			.msg_type = 255 , /* The expected value. */
@@ -180,26 +117,22 @@ create_gtp_u_decap_rss_flow(uint16_t port, uint32_t nb_queues,
 	 * testpmd> set raw_decap 0 eth / ipv4 / udp / gtp / end_set
 	 * testpmd> set raw_encap 0 eth dst is 01:02:03:04:05:06
 	 *          src is 06:05:04:03:02:01 type is 0x0800 / end_set
-	 * testpmd> flow create 0 ingress group 0 pattern eth / ipv4 / udp /
-	 *          gtp teid is 1234 msg_type is 255
+	 * testpmd> flow create 0 ingress group 1 pattern eth /
+	 *          ipv4 fragment_offset spec 0 fragment_offset mask 0x3fff /
+	 *          udp / gtp teid is 1234 msg_type is 255
 	 *          v_pt_rsv_flags spec 0x2 v_pt_rsv_flags mask 0x7 /
 	 *          ipv4 src is 10.10.10.10 / udp dst is 4000 / end actions
 	 *          raw_decap index 0 / raw_encap index 0 /
 	 *          set_ipv4_src ipv4_addr 14.14.14.14 /
 	 *          rss types ip l3-src-only end / end
 	 */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_GTP;
-	pattern[TUNNEL].spec = &gtp_spec;
-	pattern[TUNNEL].mask = &gtp_mask;
-	pattern[L3_INNER].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3_INNER].spec = &ipv4_inner;
-	pattern[L3_INNER].mask = &ipv4_mask;
-	pattern[L4_INNER].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[L4_INNER].spec = &udp_inner;
-	pattern[L4_INNER].mask = &udp_mask;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4_unfragmented(&fb);
+	vnf_flow_item_udp(&fb, NULL, NULL);
+	vnf_flow_item_gtp(&fb, &gtp_spec, &gtp_mask);
+	vnf_flow_item_ipv4(&fb, &ipv4_inner, &ipv4_mask);
+	vnf_flow_item_udp(&fb, &udp_inner, &udp_mask);
 
 	/* Configure the buffer for the decap action.
 	   The important part is the size of the buffer*/
@@ -217,7 +150,10 @@ create_gtp_u_decap_rss_flow(uint16_t port, uint32_t nb_queues,
 	memcpy(bptr, &eth, sizeof(eth));
 
 	/* Create the flow. */
-	flow = rte_flow_create(port, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_table_flow_create(port, "classify", &attr, fb.items,
+					     actions, VNF_FLOW_OWNER_DECAP, 0, &error);
 	if (!flow)
 		printf("Can't create decap flow. %s\n", error.message);
 	
@@ -231,7 +167,8 @@ create_gtp_u_decap_rss_flow(uint16_t port, uint32_t nb_queues,
  * testpmd> set raw_decap 0 eth / ipv4 / gre / end_set
  * testpmd> set raw_encap 0 eth src is 01:02:03:04:05:06
  * 	    dst is 06:05:04:03:02:01 type is 0x0800 / end_set
- * testpmd> flow create 0 ingress pattern eth / ipv4 / gre /
+ * testpmd> flow create 0 group 1 ingress pattern eth /
+ *          ipv4 fragment_offset spec 0 fragment_offset mask 0x3fff / gre /
  *          ipv4 src is 10.10.11.11 / udp dst is 4001 / end
  *          actions raw_decap index 0 / raw_encap index 0 /
  *          rss queues 0 1 2 3 end types ipv4 l3-src-only end / end
@@ -242,12 +179,12 @@ create_gre_decap_rss_flow(uint16_t port, uint32_t nb_queues,
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
-				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
-				.priority = 0, }; /* add priority to rule
-				to give the Decap rule higher priority since
-				it is more specific than RSS */
+				.priority = VNF_FLOW_PRIO_AUTO, }; /* placed
+				before the RSS rule since it is more
+				specific */
 	struct rte_flow_action_rss rss = {
 			.level = 0, /* Since the RSS will be done after decap
 			which mean there will be only outer layer. */
@@ -319,18 +256,12 @@ create_gre_decap_rss_flow(uint16_t port, uint32_t nb_queues,
 	 * make sure that all of the packets from a given user (inner source
 	 * ip) will be routed to the same core.
 	 */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_VOID;
-	pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_GRE;
-	pattern[TUNNEL].mask = NULL;
-	pattern[TUNNEL].spec = NULL;
-	pattern[L3_INNER].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3_INNER].spec = &ipv4_inner;
-	pattern[L3_INNER].mask = &ipv4_mask;
-	pattern[L4_INNER].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[L4_INNER].spec = &udp_inner;
-	pattern[L4_INNER].mask = &udp_mask;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4_unfragmented(&fb);
+	vnf_flow_item_gre(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_inner, &ipv4_mask);
+	vnf_flow_item_udp(&fb, &udp_inner, &udp_mask);
 
 	/* Configure the buffer for the decap action.
 	   The important part is the size of the buffer*/
@@ -346,7 +277,10 @@ create_gre_decap_rss_flow(uint16_t port, uint32_t nb_queues,
 	memcpy(bptr, &eth, sizeof(eth));
 
 	/* Create the flow. */
-	flow = rte_flow_create(port, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_table_flow_create(port, "classify", &attr, fb.items,
+					     actions, VNF_FLOW_OWNER_DECAP, 0, &error);
 	if (!flow)
 		printf("Can't create decap flow. %s\n", error.message);
 	
@@ -4,133 +4,6 @@
 
 #include "vnf_examples.h"
 
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
-static int
-create_jump_to_group_first(uint16_t port_id)
-{
-    struct rte_flow *flow;
-	struct rte_flow_error error;
-	struct rte_flow_attr attr = { /* holds the flow attributes. */
-				.group = 0, /* set the rule on the main group. */
-				.transfer = 1,/* rx flow. */
-				.priority = MIN_FLOW_PRIORITY, }; /* add priority to rule
-				to give the decap rule higher priority since
-				it is more specific */
-
-	struct rte_flow_action_jump jump = {.group = FIRST_TABLE};
-	struct rte_flow_action root_actions[] = {
-		[0] = {
-			.type = RTE_FLOW_ACTION_TYPE_JUMP,
-			.conf = &jump,
-		},
-		[1] = {
-			.type = RTE_FLOW_ACTION_TYPE_END,
-		},
-	};
-
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_END;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
-	if (!flow) {
-		printf("can't create default transfer jump flow on root table,port id:%u, error: %s\n", port_id, error.message);
-		return -1;
-	}
-	attr.ingress = 1;
-	attr.transfer = 0;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
-	if (!flow) {
-		printf("can't create default transfer jump flow on root table,port id:%u, error: %s\n", port_id, error.message);
-		return -1;
-	}
-    return 0;
-}
-
-static int
-create_miss_table(uint16_t port_id)
-{
-    struct rte_flow *flow;
-	struct rte_flow_error error;
-	struct rte_flow_attr attr = { /* holds the flow attributes. */
-				.group = 1, /* set the rule on the main group. */
-				.transfer = 1,/* rx flow. */
-				.priority = MAX_FLOW_PRIORITY, }; /* add priority to rule
-				to give the decap rule higher priority since
-				it is more specific */
-
-	struct rte_flow_action_jump jump = {.group = MISS_TABLE_ID};
-	struct rte_flow_action root_actions[] = {
-		[0] = {
-			.type = RTE_FLOW_ACTION_TYPE_JUMP,
-			.conf = &jump,
-		},
-		[1] = {
-			.type = RTE_FLOW_ACTION_TYPE_END,
-		},
-	};
-
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_END;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
-	if (!flow) {
-		printf("can't create default miss flow on first table,port id:%u, error: %s\n", port_id, error.message);
-		return -1;
-	}
-    return 0;
-}
-
 static int
 create_hairpin_flow_table(uint16_t port_id)
 {
@@ -142,8 +15,8 @@ create_hairpin_flow_table(uint16_t port_id)
 				" %u\n", port_id);
     struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* holds the flow attributes. */
-				.group = 1, /* set the rule on the main group. */
 				.ingress = 1,/* rx flow. */
 				.priority = MIN_FLOW_PRIORITY, }; /* add priority to rule
 				to give the decap rule higher priority since
@@ -159,13 +32,14 @@ create_hairpin_flow_table(uint16_t port_id)
 			.type = RTE_FLOW_ACTION_TYPE_END,
 		},
 	};
-    struct rte_flow_item_mark hp_mark;
 
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_MARK;
-    pattern[L2].spec = &hp_mark;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_END;
-    hp_mark.id = HAIRPIN_FLOW_MARK;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_mark(&fb, HAIRPIN_FLOW_MARK);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_table_flow_create(port_id, "classify", &attr, fb.items,
+					     root_actions, VNF_FLOW_OWNER_DEFAULT, 0,
+					     &error);
 	if (!flow) {
 		printf("can't create default hairpin flow on root table,port id:%u, error: %s\n", port_id, error.message);
 		return -1;
@@ -173,32 +47,36 @@ create_hairpin_flow_table(uint16_t port_id)
     return 0;
 }
 
+/* The default rules of one port, the ports are independent. */
 int
-create_default_flow()
+create_default_port_flow(uint16_t port_id)
 {
-    uint16_t port_id;
-
 #ifdef ISOLATE_ISOLATE_MODE_DEF
-	dpdk_isolate_flows_init();
+	dpdk_isolate_port_flows_init(port_id);
+	if (vnf_table_install(port_id, 0))
+		return -1;
 #else
-	RTE_ETH_FOREACH_DEV(port_id) {
-        if(create_jump_to_group_first(port_id)) {
-            return -1;
-        }
-    }
+	/* Root jumps to classify, classify misses to the miss table. */
+	if (vnf_table_install(port_id, 1))
+		return -1;
 #endif
 
-    RTE_ETH_FOREACH_DEV(port_id) {
-        if(create_miss_table(port_id)) {
-            return -1;
-        }
-    }
+	/* Without hairpin queue the graph forwards the marked packets. */
+	if (vnf_feature_hw(port_id, VNF_FEAT_HAIRPIN) &&
+	    create_hairpin_flow_table(port_id))
+		return -1;
+	return 0;
+}
+
+int
+create_default_flow()
+{
+    uint16_t port_id;
 
-    RTE_ETH_FOREACH_DEV(port_id) {
-        if(create_hairpin_flow_table(port_id)) {
+	RTE_ETH_FOREACH_DEV(port_id) {
+        if (create_default_port_flow(port_id)) {
             return -1;
         }
     }
-    
     return 0;
-}
\ No newline at end of file
+}
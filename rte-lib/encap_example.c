@@ -12,89 +12,25 @@
 
 #include "vnf_examples.h"
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
+/*
+ * Build the outer headers used to encapsulate GTP-U traffic:
+ * eth / ipv4 src is 12.12.12.12 dst is 13.13.13.13 / udp dst is 2152 /
+ * gtp teid is 1234 msg_type is 255 [/ gtp_psc qfi is 9 pdu_t is 1]
+ * The same buffer is used by the raw_encap action of the encap flows and by
+ * the software encap path, so both produce identical packets.
+ * Return the number of bytes written to buf, which must hold at least
+ * GTP_U_ENCAP_HDR_MAX_LEN bytes.
  */
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
-/* Encap GTP-U type traffic. */
-struct rte_flow *
-create_gtp_u_encap_flow(uint16_t port)
+size_t
+gtp_u_encap_hdr_build(uint8_t *buf, int psc)
 {
-	struct rte_flow *flow;
-	struct rte_flow_error error;
-	struct rte_flow_attr attr = { /* Holds the flow attributes. */
-				.group = 0, /* set the rule on the main group. */
-				.egress = 1, };/* Tx flow. */
-	/* Create the items that will be needed for the encap. */
-	struct rte_gtp_hdr gtp = {
-			.teid = rte_cpu_to_be_32(1234), /* Set the teid */
-			.msg_type = 255 , /* The expected value. */
-			.s = 1 }; /*Set Sequence Number flag = 1*/
 	struct rte_ether_hdr eth = {
 			.ether_type = RTE_BE16(RTE_ETHER_TYPE_IPV4),
 			.dst_addr.addr_bytes = "\x01\x02\x03\x04\x05\x06",
 			.src_addr.addr_bytes = "\x06\x05\x04\x03\x02\x01" };
 	struct rte_ipv4_hdr ipv4 = {
 			.version_ihl = 0x45,
+			.time_to_live = 64,
 			.src_addr = rte_cpu_to_be_32(0x0C0C0C0C),
 			/* Set src address 12.12.12.12 */
 			.dst_addr = rte_cpu_to_be_32(0x0D0D0D0D),
@@ -103,6 +39,62 @@ create_gtp_u_encap_flow(uint16_t port)
 	struct rte_udp_hdr udp = {
 			.dst_port = rte_cpu_to_be_16(2152) };
 			/* Set dst port of GTP-U */
+	struct rte_gtp_hdr gtp = {
+			.teid = rte_cpu_to_be_32(1234), /* Set the teid */
+			.msg_type = 255 , /* The expected value. */
+			.s = 1 }; /*Set Sequence Number flag = 1*/
+	struct rte_gtp_hdr gtp_psc_hdr = {
+			.teid = rte_cpu_to_be_32(1234), /* Set the teid */
+			.msg_type = 255, /* The expected value. */
+			.ver = 1, /* Set Version Flag = 1 */
+			.pt =1, /* Set Protocol Type Flag = 1 */
+			.e = 1 };  /* Set Extension Header Flag= 1 */
+	struct rte_gtp_hdr_ext_word gtp_extra_word = {
+			.next_ext = 0x85 };
+			/* Next extension header type  PDU session container */
+	struct {
+			uint8_t len;
+			uint8_t type_flags;
+			uint8_t qfi;
+			uint8_t reserved;
+	} gtp_psc;
+	uint8_t *bptr = buf; /* Used to copy the headers to the buffer. */
+
+	memcpy(bptr, &eth, sizeof(eth));
+	bptr += sizeof(eth);
+	memcpy(bptr, &ipv4, sizeof(ipv4));
+	bptr += sizeof(ipv4);
+	memcpy(bptr, &udp, sizeof(udp));
+	bptr += sizeof(udp);
+	if (!psc) {
+		memcpy(bptr, &gtp, sizeof(gtp));
+		bptr += sizeof(gtp);
+		return bptr - buf;
+	}
+	gtp_psc.len = 1;
+	gtp_psc.type_flags = 0x10;
+	/* Type is 1 for UL PDU Session information. */
+	gtp_psc.qfi = 9;
+	gtp_psc.reserved = 0;
+	memcpy(bptr, &gtp_psc_hdr, sizeof(gtp_psc_hdr));
+	bptr += sizeof(gtp_psc_hdr);
+	memcpy(bptr, &gtp_extra_word, sizeof(gtp_extra_word));
+	bptr += sizeof(gtp_extra_word);
+	memcpy(bptr, &gtp_psc, sizeof(gtp_psc));
+	bptr += sizeof(gtp_psc);
+	return bptr - buf;
+}
+
+/* Encap GTP-U type traffic. */
+struct rte_flow *
+create_gtp_u_encap_flow(uint16_t port)
+{
+	struct rte_flow *flow;
+	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
+	struct rte_flow_attr attr = { /* Holds the flow attributes. */
+				.group = 0, /* set the rule on the main group. */
+				.egress = 1, };/* Tx flow. */
 	/* Create the items that will be needed for the matching. */
 	struct rte_flow_item_ipv4 ipv4_spec = {
 			.hdr = {
@@ -121,13 +113,10 @@ create_gtp_u_encap_flow(uint16_t port)
 	struct rte_flow_item_udp udp_mask = {
 			.hdr = {
 				.dst_port = RTE_BE16(0xffff) }};
-;
-	size_t encap_size = sizeof(eth) + sizeof(ipv4) + sizeof(udp) +
-				sizeof(gtp);
-	size_t decap_size = sizeof(eth);
+	size_t decap_size = sizeof(struct rte_ether_hdr);
 	uint8_t decap_buf[decap_size];
-	uint8_t encap_buf[encap_size];
-	uint8_t *bptr; /* Used to copy the headers to the buffer. */
+	uint8_t encap_buf[GTP_U_ENCAP_HDR_MAX_LEN];
+	size_t encap_size = gtp_u_encap_hdr_build(encap_buf, 0);
 
 	struct rte_flow_action_raw_decap decap = {
 			.size = decap_size ,
@@ -164,30 +153,19 @@ create_gtp_u_encap_flow(uint16_t port)
 	 *          udp dst is 4000 / end actions
 	 *          raw_decap index 0 / raw_encap index 0 / end 
 	 */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_spec;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[L4].spec = &udp_spec;
-	pattern[L4].mask = &udp_mask;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_spec, &ipv4_mask);
+	vnf_flow_item_udp(&fb, &udp_spec, &udp_mask);
 
 	/* Configure the buffer for the decap action. needs to remove L2. */
-	bptr = decap_buf;
-	memcpy(bptr, &eth, sizeof(eth));
-	/* Configure the buffer for the encap action.*/
-	bptr = encap_buf;
-	memcpy(bptr, &eth, sizeof(eth));
-	bptr += sizeof(eth);
-	memcpy(bptr, &ipv4, sizeof(ipv4));
-	bptr += sizeof(ipv4);
-	memcpy(bptr, &udp, sizeof(udp));
-	bptr += sizeof(udp);
-	memcpy(bptr, &gtp, sizeof(gtp));
-
+	memcpy(decap_buf, encap_buf, decap_size);
 
 	/* Create the flow. */
-	flow = rte_flow_create(port, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_ENCAP, 0, &error);
 	if (!flow)
 		printf("Can't create encap flow. %s\n", error.message);
 
@@ -200,6 +178,7 @@ create_gtp_u_psc_encap_flow(uint16_t port)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 			.group = 0, /* set the rule on group 1. */
 			.egress = 1, };/* Tx flow. */
@@ -222,47 +201,10 @@ create_gtp_u_psc_encap_flow(uint16_t port)
 			.hdr = {
 				.dst_port = RTE_BE16(0xffff) }};
 
-	/* Create the items that will be needed for the encap. */
-	struct rte_ether_hdr eth = {
-			.ether_type = RTE_BE16(RTE_ETHER_TYPE_IPV4),
-			.dst_addr.addr_bytes = "\x01\x02\x03\x04\x05\x06",
-			.src_addr.addr_bytes = "\x06\x05\x04\x03\x02\x01" };
-	struct rte_ipv4_hdr ipv4 = {
-			.version_ihl = 0x45,
-			.src_addr = rte_cpu_to_be_32(0x0C0C0C0C),
-			/* Set src address 12.12.12.12 */
-			.dst_addr = rte_cpu_to_be_32(0x0D0D0D0D),
-			/* Set dst address 13.13.13.13 */
-			.next_proto_id = IPPROTO_UDP };
-	struct rte_udp_hdr udp = {
-			.dst_port = rte_cpu_to_be_16(2152) };
-			/* Set dst port of GTP-U */
-	struct rte_gtp_hdr gtp = {
-			.teid = rte_cpu_to_be_32(1234), /* Set the teid */
-			.msg_type = 255, /* The expected value. */
-			.ver = 1, /* Set Version Flag = 1 */
-			.pt =1, /* Set Protocol Type Flag = 1 */
-			.e = 1 };  /* Set Extension Header Flag= 1 */
-	struct rte_gtp_hdr_ext_word gtp_extra_word = {
-			.next_ext = 0x85 };
-			/* Next extension header type  PDU session container */
-	struct {
-			uint8_t len;
-			uint8_t type_flags;
-			uint8_t qfi;
-			uint8_t reserved;
-	} gtp_psc;
-	gtp_psc.len = 1;
-	gtp_psc.type_flags = 0x10;
-	/* Type is 1 for UL PDU Session information. */
-	gtp_psc.qfi = 9;
-	size_t encap_size = sizeof(eth) + sizeof(ipv4) + sizeof(udp) +
-			    sizeof(gtp) + sizeof(gtp_extra_word) +
-			    sizeof(gtp_psc);
-	size_t decap_size = sizeof(eth);
+	size_t decap_size = sizeof(struct rte_ether_hdr);
 	uint8_t decap_buf[decap_size];
-	uint8_t encap_buf[encap_size];
-	uint8_t *bptr; /* Used to copy the headers to the buffer. */
+	uint8_t encap_buf[GTP_U_ENCAP_HDR_MAX_LEN];
+	size_t encap_size = gtp_u_encap_hdr_build(encap_buf, 1);
 
 	struct rte_flow_action_raw_decap decap = {
 			.size = decap_size ,
@@ -300,33 +242,19 @@ create_gtp_u_psc_encap_flow(uint16_t port)
 	 *          udp dst is 4000 / end actions
 	 *          raw_decap index 0 / raw_encap index 0 / end
 	 */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_spec;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[L4].spec = &udp_spec;
-	pattern[L4].mask = &udp_mask;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_spec, &ipv4_mask);
+	vnf_flow_item_udp(&fb, &udp_spec, &udp_mask);
 
 	/* Configure the buffer for the decap action. needs to remove L2. */
-	bptr = decap_buf;
-	memcpy(bptr, &eth, sizeof(eth));
-	/* Configure the buffer for the encap action.*/
-	bptr = encap_buf;
-	memcpy(bptr, &eth, sizeof(eth));
-	bptr += sizeof(eth);
-	memcpy(bptr, &ipv4, sizeof(ipv4));
-	bptr += sizeof(ipv4);
-	memcpy(bptr, &udp, sizeof(udp));
-	bptr += sizeof(udp);
-	memcpy(bptr, &gtp, sizeof(gtp));
-	bptr += sizeof(gtp);
-	memcpy(bptr, &gtp_extra_word, sizeof(gtp_extra_word));
-	bptr += sizeof(gtp_extra_word);
-	memcpy(bptr, &gtp_psc, sizeof(gtp_psc));
+	memcpy(decap_buf, encap_buf, decap_size);
 
 	/* Create the flow. */
-	flow = rte_flow_create(port, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_ENCAP, 0, &error);
 	if (!flow)
 		printf("Can't create encap flow. %s\n", error.message);
 
@@ -351,6 +279,7 @@ create_gre_encap_flow(uint16_t port)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.egress = 1, };/* Tx flow. */
@@ -415,13 +344,10 @@ create_gre_encap_flow(uint16_t port)
 	 * ipv4 src addr is 10.10.11.11 dst addr is 11.11.12.12 /
 	 *  udp proto is 4001.
 	 */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_spec;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[L4].spec = &udp_spec;
-	pattern[L4].mask = &udp_mask;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_spec, &ipv4_mask);
+	vnf_flow_item_udp(&fb, &udp_spec, &udp_mask);
 
 	/* Configure the buffer for the decap action. needs to remove L2. */
 	bptr = decap_buf;
@@ -436,7 +362,10 @@ create_gre_encap_flow(uint16_t port)
 
 
 	/* Create the flow. */
-	flow = rte_flow_create(port, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_ENCAP, 0, &error);
 	if (!flow)
 		printf("Can't create encap flow. %s\n", error.message);
 
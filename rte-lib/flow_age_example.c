@@ -2,76 +2,15 @@
  * Copyright 2020 Mellanox Technologies, Ltd
  */
 
+#include <errno.h>
+
 #include <rte_net.h>
 #include <rte_ethdev.h>
 #include <rte_flow.h>
-#include <rte_ethdev.h>
+#include <rte_ring.h>
 
 #include "vnf_examples.h"
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
- */
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
 enum direction {
 	UL, /* Uplink. */
 	DL, /* Downlink. */
@@ -81,77 +20,146 @@ struct flow_meta {
 	uint64_t ue; /* UE index. */
 	uint64_t pdu; /* PDU session index. */
 	uint64_t flow_idx; /* flow idx in this PDU session. */
-	struct rte_flow *flow; /* The handler of rte flow. */
+	uint32_t flow_id; /* ID of the flow in the registry. */
+	uint32_t mark; /* Mark set by the flow, index in the mark table. */
+	uint64_t pkts; /* Packets seen by the software. */
+	uint64_t bytes; /* Bytes seen by the software. */
 };
 
-#define MAX_USER_FLOWS 4
+#define MAX_USER_FLOWS 4096 /* power of 2 */
+#define AGED_BATCH 64 /* aged contexts released at a time */
 
 static struct flow_meta user_flows[MAX_USER_FLOWS];
+/* Free slots, taken by the flow creation and given back by the reclaim. */
+static struct rte_ring *free_user_flows;
+/* Slots of the flows which removal is not completed yet. */
+static struct rte_ring *removing_user_flows;
 
+/* Packets of a user flow, found by mark without any parsing. */
 static void
-flow_aged_callback(void *arg)
+user_flow_mark_handler(struct rte_mbuf *m, void *ctx)
 {
-	uint16_t port_id = (intptr_t)arg;
-	void **contexts;
-	int nb_context, total = 0, idx;
-	struct rte_flow_error error;
-	struct flow_meta *user_flow;
+	struct flow_meta *user_flow = ctx;
+
+	__atomic_fetch_add(&user_flow->pkts, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&user_flow->bytes, m->pkt_len, __ATOMIC_RELAXED);
+}
 
-	total = rte_flow_get_aged_flows(port_id, NULL, 0, &error);
-	if (total == 0)
-		return;
-	contexts = malloc(sizeof(void *) * total);
-	if (contexts == NULL) {
-		printf("Cannot allocate contexts for aged flow\n");
-		return;
+static int
+user_flows_init(void)
+{
+	unsigned int i;
+
+	if (free_user_flows)
+		return 0;
+	free_user_flows = rte_ring_create("vnf_free_user_flows",
+					  MAX_USER_FLOWS, rte_socket_id(),
+					  RING_F_EXACT_SZ);
+	removing_user_flows = rte_ring_create("vnf_removing_user_flows",
+					      MAX_USER_FLOWS, rte_socket_id(),
+					      RING_F_EXACT_SZ);
+	if (free_user_flows == NULL || removing_user_flows == NULL) {
+		printf("Cannot create user flow rings\n");
+		rte_ring_free(free_user_flows);
+		rte_ring_free(removing_user_flows);
+		free_user_flows = NULL;
+		removing_user_flows = NULL;
+		return -1;
 	}
-	nb_context = rte_flow_get_aged_flows(port_id, contexts, total, &error);
-	if (nb_context != total) {
-		printf("Port:%d get aged flows count(%d) != total(%d)\n",
-			port_id, nb_context, total);
-		free(contexts);
-		return;
+	for (i = 0; i < MAX_USER_FLOWS; i++) {
+		user_flows[i].flow_id = VNF_FLOW_ID_INVALID;
+		user_flows[i].mark = INVALID_FLOW_MARK;
+		rte_ring_enqueue(free_user_flows, &user_flows[i]);
 	}
-	total = 0;
-	for (idx = 0; idx < nb_context; idx++) {
-		if (!contexts[idx]) {
-			printf("Error: get Null context in port %u\n", port_id);
-			continue;
-		}
-		user_flow = (struct flow_meta *)contexts[idx];
-		printf("UE: %lu, Session: %lu, flow idx: %lu is aged, deleting...",
-				user_flow->ue, user_flow->pdu,
-				user_flow->flow_idx);
-		if (user_flow->flow &&
-				rte_flow_destroy(port_id,
-					user_flow->flow, &error))
-			printf("Error: can't destroy aged flow!\n");
-		user_flow->flow = NULL;
-		printf("done\n");
+	return 0;
+}
+
+static void
+user_flow_free(struct flow_meta *user_flow)
+{
+	user_flow->flow_id = VNF_FLOW_ID_INVALID;
+	rte_ring_enqueue(free_user_flows, user_flow);
+}
+
+/* The slot of a freed mark, once no worker counts in it any more. */
+static void
+user_flow_release(void *ctx)
+{
+	struct flow_meta *user_flow = ctx;
+
+	if (vnf_flow_lookup(user_flow->flow_id, NULL))
+		rte_ring_enqueue(removing_user_flows, user_flow);
+	else
+		user_flow_free(user_flow);
+}
+
+/* Slots which flow is gone at last go back to the free ones. */
+static void
+user_flows_removed(void)
+{
+	void *slots[AGED_BATCH];
+	struct flow_meta *user_flow;
+	unsigned int n, i;
+
+	n = rte_ring_dequeue_burst(removing_user_flows, slots, AGED_BATCH,
+				   NULL);
+	for (i = 0; i < n; i++) {
+		user_flow = slots[i];
+		if (vnf_flow_lookup(user_flow->flow_id, NULL))
+			rte_ring_enqueue(removing_user_flows, user_flow);
+		else
+			user_flow_free(user_flow);
 	}
-	free(contexts);
 }
 
-/* This callback is in intr thread, we need to finish it as soon as possible. */
-static int
-aged_event_callback(uint16_t port_id, enum rte_eth_event_type type,
-		void *param, void *ret_param)
+/*
+ * Aged flows of a batch. An async rule is only queued for removal by
+ * vnf_flow_destroy, its slot is kept until the registry forgot it, so a
+ * late report of the rule can't hit the next flow of the slot.
+ */
+static uint16_t
+reclaim_user_flows(uint16_t port_id, void *contexts[], uint16_t nb,
+		   void *arg)
 {
-	RTE_SET_USED(param);
-	RTE_SET_USED(ret_param);
-	if (type == RTE_ETH_EVENT_FLOW_AGED) {
-		if (rte_eal_alarm_set(1000,
-				flow_aged_callback, (void *)(intptr_t)port_id))
-			printf("Could not set up deffered delete aged flow");
+	struct flow_meta *user_flow;
+	uint16_t i, done = 0;
+	uint32_t mark;
+	int ret;
+
+	RTE_SET_USED(arg);
+	user_flows_removed();
+	for (i = 0; i < nb; i++) {
+		user_flow = contexts[i];
+		if (user_flow == NULL ||
+		    user_flow->flow_id == VNF_FLOW_ID_INVALID)
+			continue;
+		ret = vnf_flow_destroy(user_flow->flow_id);
+		if (ret == -EINPROGRESS)
+			continue;
+		if (ret && ret != -ENOENT) {
+			printf("Error: can't destroy aged flow %lu of UE %lu "
+			       "on port %u\n", user_flow->flow_idx,
+			       user_flow->ue, port_id);
+			continue;
+		}
+		mark = user_flow->mark;
+		user_flow->mark = INVALID_FLOW_MARK;
+		done++;
+		if (mark == INVALID_FLOW_MARK)
+			user_flow_release(user_flow);
+		else
+			vnf_mark_free(mark, user_flow_release);
 	}
-	return 0;
+	return done;
 }
 
 int
 register_aged_event(uint16_t port_id)
 {
-	return rte_eth_dev_callback_register(port_id, RTE_ETH_EVENT_FLOW_AGED,
-			aged_event_callback, NULL);
+	if (user_flows_init())
+		return -1;
+	return vnf_flow_reclaim_init(port_id, AGED_BATCH, reclaim_user_flows,
+				     NULL);
 }
 
 /*
@@ -161,19 +169,22 @@ register_aged_event(uint16_t port_id)
  *          gtp teid is 1234 msg_type is 255 / end actions jump group 1 / end
  * testpmd> flow create 0 group 1 ingress pattern eth / ipv4 src is 3.3.2.1 / udp /
  *          gtp teid is 1234 msg_type is 255 / ipv4 src is 2.0.0.1 / tcp / end
- *          actions age  timeout 10 / mark id 0x0201 / queue index 0 / end
+ *          actions age  timeout 10 / mark id <mark> / queue index 0 / end
  * testpmd> flow create 0 group 1 ingress pattern eth / ipv4 src is 3.3.2.1 / udp /
  *          gtp teid is 1234 msg_type is 255 / ipv4 src is 2.0.0.2 / tcp / end
- *          actions age  timeout 20 / mark id 0x0202 / queue index 0 / end
+ *          actions age  timeout 20 / mark id <mark> / queue index 0 / end
  * testpmd> flow create 0 group 1 ingress pattern eth / ipv4 src is 3.3.2.1 / udp /
  *          gtp teid is 1234 msg_type is 255 / ipv4 src is 2.0.0.3 / tcp / end
- *          actions age  timeout 30 / mark id 0x0203 / queue index 0 / end
+ *          actions age  timeout 30 / mark id <mark> / queue index 0 / end
+ * Each mark is allocated from the mark table so the worker finds the
+ * user flow with a direct lookup.
  */
 int
 create_flow_with_age(uint16_t port_id)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
@@ -207,20 +218,20 @@ create_flow_with_age(uint16_t port_id)
 		printf("can't register for aged event!\n");
 		return -1;
 	}
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_spec;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_GTP;
-	pattern[TUNNEL].spec = &gtp_spec;
-	pattern[TUNNEL].mask = &gtp_mask;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_spec, &ipv4_mask);
+	vnf_flow_item_udp(&fb, NULL, NULL);
+	vnf_flow_item_gtp(&fb, &gtp_spec, &gtp_mask);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, root_actions,
+				       VNF_FLOW_OWNER_AGE, 0, &error);
 	if (!flow) {
 		printf("can't create jump flow on root table\n");
 		return -1;
 	}
-	struct rte_flow_action_mark mark = {.id = 0x0201};
+	struct rte_flow_action_mark mark = {.id = INVALID_FLOW_MARK};
 	struct rte_flow_action_queue queue = {.index = 0};
 	struct rte_flow_action_age age;
 	struct rte_flow_action actions[] = {
@@ -245,30 +256,52 @@ create_flow_with_age(uint16_t port_id)
 				.src_addr = rte_cpu_to_be_32(0x02000001),
 				/* Match on 2.0.0.1 src address */
 				.next_proto_id = IPPROTO_TCP }};
-	pattern[L3_INNER].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3_INNER].spec = &ipv4_inner;
-	pattern[L3_INNER].mask = &ipv4_mask;
-	pattern[L4_INNER].type = RTE_FLOW_ITEM_TYPE_TCP;
 	/* Let's create three flows. */
 	attr.group = 1; /* must be in non-root table. */
+	struct flow_meta *user_flow;
+	uint64_t cookie;
 	uint8_t i;
 	for (i = 0; i < 3; i++) {
+		if (rte_ring_dequeue(free_user_flows, (void **)&user_flow)) {
+			printf("no free user flow slot\n");
+			return -1;
+		}
 		ipv4_inner.hdr.src_addr = RTE_BE32(0x02000001 + i);
-		mark.id = 0x0201 + i;
+		/* Same outer headers as the root flow, plus the UE. */
+		vnf_flow_builder_init(&fb);
+		vnf_flow_item_eth(&fb, NULL, NULL);
+		vnf_flow_item_ipv4(&fb, &ipv4_spec, &ipv4_mask);
+		vnf_flow_item_udp(&fb, NULL, NULL);
+		vnf_flow_item_gtp(&fb, &gtp_spec, &gtp_mask);
+		vnf_flow_item_ipv4(&fb, &ipv4_inner, &ipv4_mask);
+		vnf_flow_item_tcp(&fb, NULL, NULL);
+		mark.id = vnf_mark_alloc(user_flow_mark_handler, user_flow);
+		if (mark.id == INVALID_FLOW_MARK) {
+			user_flow_free(user_flow);
+			return -1;
+		}
 		/* When flow aged, context will pass back to us so we can know which flow. */
-		age.context = &user_flows[i];
+		age.context = user_flow;
 		age.timeout = 10 + i * 10; /* 10s, 20s, 30s. */
-		flow = rte_flow_create(port_id, &attr, pattern, actions,
-				&error);
+		cookie = VNF_FLOW_COOKIE(VNF_FLOW_OWNER_AGE,
+					 user_flow - user_flows + 1);
+		flow = NULL;
+		if (!vnf_flow_builder_check(&fb, &error))
+			flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+					       VNF_FLOW_OWNER_AGE, cookie, &error);
 		if (!flow) {
 			printf("can't create flow with action age on port: %u, group: %u\n",
 					port_id, attr.group);
+			vnf_mark_free(mark.id, user_flow_release);
 			return -1;
 		}
-		user_flows[i].flow = flow;
-		user_flows[i].flow_idx = i;
-		user_flows[i].pdu = i;
-		user_flows[i].ue = i;
+		user_flow->flow_id = vnf_flow_lookup_cookie(cookie);
+		user_flow->mark = mark.id;
+		user_flow->flow_idx = i;
+		user_flow->pdu = i;
+		user_flow->ue = i;
+		user_flow->pkts = 0;
+		user_flow->bytes = 0;
 	}
 	return 0;
 }
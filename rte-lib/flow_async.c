@@ -0,0 +1,706 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_pause.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_gtp.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Session rules inserted with the template API.
+ * Each session shape (GTP-U decap, GTP-U encap, inner IP RSS) has one
+ * pattern template, one actions template and one template table in
+ * the "session" table of the topology, reached from the root table by a
+ * jump. Only the fields
+ * which differ between sessions (TEID, UE IP, mark, TEID of the encap
+ * header) are given per rule, everything else is fixed in the templates.
+ * Rules are enqueued with rte_flow_async_create on the flow queue of the
+ * calling lcore, pushed to the NIC every VNF_ASYNC_PUSH_BURST rules and
+ * their completions pulled with rte_flow_pull, so no lock is taken and the
+ * insertion never waits for the hardware.
+ * Session rules are in the flow registry, pending until their completion,
+ * and the registry ID is the user_data of the operations. The root rules
+ * have no ID and are not reported.
+ *
+ * If the PMD doesn't implement the template API (rte_flow_info_get or
+ * rte_flow_configure fails), the same pattern and actions are created with
+ * rte_flow_create in group 0 and completed on the spot.
+ *
+ * testpmd equivalent of the decap shape:
+ * testpmd> flow configure 0 queues_number 4 queues_size 1024
+ * testpmd> flow pattern_template 0 create ingress pattern_template_id 0
+ *          template eth / ipv4 / udp dst mask 0xffff /
+ *          gtp teid mask 0xffffffff msg_type mask 0xff /
+ *          ipv4 src mask 255.255.255.255 / end
+ * testpmd> flow actions_template 0 create ingress actions_template_id 0
+ *          template raw_decap index 0 / raw_encap index 1 / mark /
+ *          rss types ip l3-src-only end / end
+ *          mask raw_decap index 0 / raw_encap index 1 / mark id 0 /
+ *          rss types ip l3-src-only end / end
+ * testpmd> flow template_table 0 create table_id 0 group 1 ingress
+ *          rules_number 65536 pattern_template 0 actions_template 0
+ * testpmd> flow queue 0 create 0 template_table 0 pattern_template 0
+ *          actions_template 0 postpone yes pattern eth / ipv4 /
+ *          udp dst is 2152 / gtp teid is 1 msg_type is 255 /
+ *          ipv4 src is 2.0.0.1 / end actions raw_decap index 0 /
+ *          raw_encap index 1 / mark id 2 / rss / end
+ * testpmd> flow push 0 queue 0
+ * testpmd> flow pull 0 queue 0
+ */
+
+#define VNF_ASYNC_QUEUE_SIZE 1024
+#define VNF_ASYNC_PUSH_BURST 64
+#define VNF_ASYNC_PULL_BURST 64
+#define VNF_ASYNC_MAX_RSS_QUEUES 64
+
+/* Session tables, then the two root tables jumping to the session group. */
+enum {
+	ASYNC_TABLE_ROOT_RX = VNF_ASYNC_SHAPE_MAX,
+	ASYNC_TABLE_ROOT_TX,
+	ASYNC_TABLE_MAX,
+};
+
+/* One per lcore, only touched by its own lcore. */
+struct vnf_async_queue {
+	uint32_t pending; /* Enqueued, not pushed yet. */
+	uint32_t inflight; /* Enqueued, completion not pulled yet. */
+	uint64_t done;
+	uint64_t failed;
+} __rte_cache_aligned;
+
+struct vnf_async_port {
+	const struct vnf_flow_ops *ops; /* Flow API of the port. */
+	int template_mode; /* 0 when falling back to rte_flow_create. */
+	uint32_t nb_queues;
+	uint32_t queue_size;
+	uint32_t nb_flows; /* Rules per session table. */
+	uint32_t group; /* Of the session table of the topology. */
+	struct rte_flow_pattern_template *pattern_templates[ASYNC_TABLE_MAX];
+	struct rte_flow_actions_template *actions_templates[ASYNC_TABLE_MAX];
+	struct rte_flow_template_table *tables[ASYNC_TABLE_MAX];
+	struct rte_flow *root_flows[2];
+	uint8_t encap_hdr[GTP_U_ENCAP_HDR_MAX_LEN];
+	size_t encap_hdr_len;
+	uint16_t rss_queues[VNF_ASYNC_MAX_RSS_QUEUES];
+	struct rte_flow_action_rss decap_rss; /* RSS after decap. */
+	struct rte_flow_action_rss inner_rss; /* RSS on the inner header. */
+	struct vnf_async_queue queues[RTE_MAX_LCORE];
+};
+
+static struct vnf_async_port *async_ports[RTE_MAX_ETHPORTS];
+static vnf_async_done_t async_done_cb;
+
+/* Group 0 attributes of the synchronous fallback, as in the examples. */
+static const struct rte_flow_attr sync_attr[VNF_ASYNC_SHAPE_MAX] = {
+	[VNF_ASYNC_DECAP] = { .group = 0, .priority = 0, .ingress = 1 },
+	[VNF_ASYNC_ENCAP] = { .group = 0, .priority = 0, .egress = 1 },
+	[VNF_ASYNC_RSS] = { .group = 0, .priority = 1, .ingress = 1 },
+};
+
+/* The root rules of the engine jump to it, it is no entry table. */
+static struct vnf_table_decl session_table = {
+	.name = "session",
+	.purpose = "GTP-U session rules, template tables",
+	.flags = VNF_TABLE_F_INGRESS | VNF_TABLE_F_EGRESS,
+};
+
+static const struct rte_flow_item_udp udp_dst_mask = {
+	.hdr = { .dst_port = RTE_BE16(0xffff) },
+};
+static const struct rte_flow_item_gtp gtp_teid_mask = {
+	.teid = RTE_BE32(0xffffffff),
+	.msg_type = 0xff,
+};
+static const struct rte_flow_item_ipv4 ipv4_src_mask = {
+	.hdr = { .src_addr = RTE_BE32(0xffffffff) },
+};
+static const struct rte_flow_item_ipv4 ipv4_dst_mask = {
+	.hdr = { .dst_addr = RTE_BE32(0xffffffff) },
+};
+
+/*
+ * Build the pattern of a session. Without session, build the pattern
+ * template: the masks give the fields which are set per rule.
+ */
+static void
+async_pattern_build(struct vnf_flow_builder *fb, enum vnf_async_shape shape,
+		    const struct vnf_async_session *s)
+{
+	struct rte_flow_item_udp udp = {
+		.hdr = { .dst_port = RTE_BE16(GTP_U_UDP_PORT) },
+	};
+	struct rte_flow_item_gtp gtp = { .msg_type = 255 };
+	struct rte_flow_item_ipv4 ipv4;
+
+	memset(&ipv4, 0, sizeof(ipv4));
+	vnf_flow_builder_init(fb);
+	vnf_flow_item_eth(fb, NULL, NULL);
+	if (shape == VNF_ASYNC_ENCAP) {
+		/* Downlink, to the UE. */
+		if (s)
+			ipv4.hdr.dst_addr = rte_cpu_to_be_32(s->ue_ip);
+		vnf_flow_item_ipv4(fb, s ? &ipv4 : &ipv4_dst_mask,
+				   &ipv4_dst_mask);
+		return;
+	}
+	vnf_flow_item_ipv4_unfragmented(fb);
+	vnf_flow_item_udp(fb, s ? &udp : &udp_dst_mask, &udp_dst_mask);
+	if (s)
+		gtp.teid = rte_cpu_to_be_32(s->teid);
+	vnf_flow_item_gtp(fb, s ? &gtp : &gtp_teid_mask, &gtp_teid_mask);
+	if (s)
+		ipv4.hdr.src_addr = rte_cpu_to_be_32(s->ue_ip);
+	vnf_flow_item_ipv4(fb, s ? &ipv4 : &ipv4_src_mask, &ipv4_src_mask);
+}
+
+/*
+ * Append the actions of a session, or of the actions template when s is
+ * NULL. With mask set, the actions set per rule have no conf, which is how
+ * the actions template masks tell them apart from the fixed ones.
+ */
+static void
+async_actions_build(struct vnf_flow_builder *fb,
+		    const struct vnf_async_port *ap,
+		    enum vnf_async_shape shape,
+		    const struct vnf_async_session *s, int mask)
+{
+	struct rte_flow_action_mark mark = { .id = s ? s->mark : 0 };
+	uint8_t encap_hdr[GTP_U_ENCAP_HDR_MAX_LEN];
+	struct rte_gtp_hdr *gtp;
+
+	switch (shape) {
+	case VNF_ASYNC_DECAP:
+		/* Remove eth / ipv4 / udp / gtp, then put back L2. */
+		vnf_flow_action_raw_decap(fb, ap->encap_hdr,
+					  ap->encap_hdr_len);
+		vnf_flow_action_raw_encap(fb, ap->encap_hdr,
+					  sizeof(struct rte_ether_hdr));
+		vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_MARK,
+				mask ? NULL : &mark, sizeof(mark));
+		vnf_flow_action_rss(fb, &ap->decap_rss);
+		break;
+	case VNF_ASYNC_ENCAP:
+		vnf_flow_action_raw_decap(fb, ap->encap_hdr,
+					  sizeof(struct rte_ether_hdr));
+		if (mask) {
+			vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_RAW_ENCAP,
+					NULL, 0);
+			break;
+		}
+		/* Same outer headers as the encap example, with its TEID. */
+		memcpy(encap_hdr, ap->encap_hdr, ap->encap_hdr_len);
+		gtp = (struct rte_gtp_hdr *)(encap_hdr +
+					     sizeof(struct rte_ether_hdr) +
+					     sizeof(struct rte_ipv4_hdr) +
+					     sizeof(struct rte_udp_hdr));
+		gtp->teid = rte_cpu_to_be_32(s ? s->teid : 0);
+		vnf_flow_action_raw_encap(fb, encap_hdr, ap->encap_hdr_len);
+		break;
+	case VNF_ASYNC_RSS:
+		vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_MARK,
+				mask ? NULL : &mark, sizeof(mark));
+		vnf_flow_action_rss(fb, &ap->inner_rss);
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+async_queue_get(const struct vnf_async_port *ap)
+{
+	int q = rte_lcore_index(-1);
+
+	/* Flow queues are not thread safe, one per EAL lcore. */
+	if (q < 0 || (uint32_t)q >= ap->nb_queues) {
+		printf("No flow queue for lcore %u\n", rte_lcore_id());
+		return -1;
+	}
+	return q;
+}
+
+static void
+async_complete(struct vnf_async_queue *aq, uint32_t id, int status)
+{
+	uint64_t cookie;
+
+	if (status)
+		aq->failed++;
+	else
+		aq->done++;
+	if (id == VNF_FLOW_ID_INVALID)
+		return;
+	cookie = vnf_flow_complete(id, status);
+	if (async_done_cb)
+		async_done_cb(cookie, status);
+}
+
+/* Push what was enqueued and pull the completions, return their number. */
+static int
+async_queue_drain(uint16_t port_id, struct vnf_async_port *ap, uint32_t q)
+{
+	struct rte_flow_op_result res[VNF_ASYNC_PULL_BURST];
+	struct vnf_async_queue *aq = &ap->queues[q];
+	struct rte_flow_error error;
+	int n, i;
+
+	if (aq->pending) {
+		if (ap->ops->push(port_id, q, &error)) {
+			printf("Can't push flow queue %u of port %u: %s\n",
+			       q, port_id, error.message ? error.message : "");
+			return -1;
+		}
+		aq->pending = 0;
+	}
+	n = ap->ops->pull(port_id, q, res, RTE_DIM(res), &error);
+	if (n < 0) {
+		printf("Can't pull flow queue %u of port %u: %s\n",
+		       q, port_id, error.message ? error.message : "");
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		async_complete(aq, (uint32_t)(uintptr_t)res[i].user_data,
+			       res[i].status == RTE_FLOW_OP_SUCCESS ? 0 : -1);
+	aq->inflight -= n;
+	return n;
+}
+
+/* Each operation holds a queue slot until its completion is pulled. */
+static int
+async_queue_reserve(uint16_t port_id, struct vnf_async_port *ap, uint32_t q)
+{
+	int n;
+
+	while (ap->queues[q].inflight >= ap->queue_size) {
+		n = async_queue_drain(port_id, ap, q);
+		if (n < 0)
+			return -1;
+		if (!n)
+			rte_pause();
+	}
+	return 0;
+}
+
+static void
+async_queue_enqueued(uint16_t port_id, struct vnf_async_port *ap, uint32_t q)
+{
+	struct vnf_async_queue *aq = &ap->queues[q];
+
+	aq->inflight++;
+	if (++aq->pending >= VNF_ASYNC_PUSH_BURST)
+		async_queue_drain(port_id, ap, q);
+}
+
+int
+vnf_async_configure(uint16_t port_id, uint32_t nb_flows)
+{
+	const struct rte_flow_queue_attr *queue_attrs[RTE_MAX_LCORE];
+	struct rte_flow_queue_attr queue_attr;
+	struct rte_flow_port_info port_info;
+	struct rte_flow_queue_info queue_info;
+	struct rte_flow_port_attr port_attr;
+	struct rte_flow_error error;
+	struct vnf_async_port *ap;
+	uint32_t i;
+
+	ap = rte_zmalloc("vnf_async_port", sizeof(*ap), RTE_CACHE_LINE_SIZE);
+	if (ap == NULL) {
+		printf("Cannot allocate flow queues of port %u\n", port_id);
+		return -1;
+	}
+	async_ports[port_id] = ap;
+	ap->ops = vnf_flow_ops_get(port_id);
+	ap->nb_queues = rte_lcore_count();
+	ap->nb_flows = nb_flows;
+	memset(&port_info, 0, sizeof(port_info));
+	memset(&queue_info, 0, sizeof(queue_info));
+	memset(&error, 0, sizeof(error));
+	if (ap->ops->info_get(port_id, &port_info, &queue_info, &error) ||
+	    !port_info.max_nb_queues) {
+		printf(":: port %u has no template API (%s), use rte_flow_create\n",
+		       port_id, error.message ? error.message : "no flow queue");
+		return 0;
+	}
+	ap->nb_queues = RTE_MIN(ap->nb_queues, port_info.max_nb_queues);
+	ap->queue_size = VNF_ASYNC_QUEUE_SIZE;
+	if (queue_info.max_size)
+		ap->queue_size = RTE_MIN(ap->queue_size, queue_info.max_size);
+	memset(&port_attr, 0, sizeof(port_attr));
+	queue_attr.size = ap->queue_size;
+	for (i = 0; i < ap->nb_queues; i++)
+		queue_attrs[i] = &queue_attr;
+	/* Must be done before the port is started. */
+	if (ap->ops->configure(port_id, &port_attr, ap->nb_queues, queue_attrs,
+			       &error)) {
+		printf(":: port %u can't configure flow queues (%s), use rte_flow_create\n",
+		       port_id, error.message ? error.message : "");
+		ap->nb_queues = rte_lcore_count();
+		return 0;
+	}
+	ap->template_mode = 1;
+	printf(":: port %u, %u flow queues of %u operations\n",
+	       port_id, ap->nb_queues, ap->queue_size);
+	return 0;
+}
+
+static int
+async_table_create(uint16_t port_id, struct vnf_async_port *ap, int idx,
+		   const struct rte_flow_attr *attr, uint32_t nb_flows,
+		   const struct vnf_flow_builder *pattern,
+		   const struct vnf_flow_builder *actions,
+		   const struct vnf_flow_builder *masks)
+{
+	struct rte_flow_pattern_template_attr pt_attr;
+	struct rte_flow_actions_template_attr at_attr;
+	struct rte_flow_template_table_attr table_attr;
+	struct rte_flow_error error;
+
+	if (pattern->error || actions->error || masks->error) {
+		printf("Flow template %d of port %u is too big\n", idx, port_id);
+		return -1;
+	}
+	memset(&pt_attr, 0, sizeof(pt_attr));
+	pt_attr.ingress = attr->ingress;
+	pt_attr.egress = attr->egress;
+	ap->pattern_templates[idx] = ap->ops->pattern_template_create(port_id,
+			&pt_attr, pattern->items, &error);
+	if (ap->pattern_templates[idx] == NULL) {
+		printf("Can't create pattern template %d on port %u: %s\n",
+		       idx, port_id, error.message);
+		return -1;
+	}
+	memset(&at_attr, 0, sizeof(at_attr));
+	at_attr.ingress = attr->ingress;
+	at_attr.egress = attr->egress;
+	ap->actions_templates[idx] = ap->ops->actions_template_create(port_id,
+			&at_attr, actions->actions, masks->actions, &error);
+	if (ap->actions_templates[idx] == NULL) {
+		printf("Can't create actions template %d on port %u: %s\n",
+		       idx, port_id, error.message);
+		return -1;
+	}
+	memset(&table_attr, 0, sizeof(table_attr));
+	table_attr.flow_attr = *attr;
+	table_attr.nb_flows = nb_flows;
+	ap->tables[idx] = ap->ops->template_table_create(port_id, &table_attr,
+			&ap->pattern_templates[idx], 1,
+			&ap->actions_templates[idx], 1, &error);
+	if (ap->tables[idx] == NULL) {
+		printf("Can't create template table %d on port %u: %s\n",
+		       idx, port_id, error.message);
+		return -1;
+	}
+	return 0;
+}
+
+/* Root table of one direction, with the rule jumping to the sessions. */
+static int
+async_root_create(uint16_t port_id, struct vnf_async_port *ap, int egress)
+{
+	struct rte_flow_op_attr op_attr = { .postpone = 0 };
+	struct rte_flow_attr attr = { .group = 0 };
+	struct vnf_flow_builder *fb = vnf_flow_builder_get();
+	int idx = egress ? ASYNC_TABLE_ROOT_TX : ASYNC_TABLE_ROOT_RX;
+	struct rte_flow_error error;
+	int q = async_queue_get(ap);
+
+	if (q < 0)
+		return -1;
+	attr.ingress = !egress;
+	attr.egress = egress;
+	vnf_flow_item_eth(fb, NULL, NULL);
+	vnf_flow_action_jump(fb, ap->group);
+	/* The jump target is the same for all rules, all is fixed. */
+	if (async_table_create(port_id, ap, idx, &attr, 1, fb, fb, fb))
+		return -1;
+	if (async_queue_reserve(port_id, ap, q))
+		return -1;
+	ap->root_flows[egress] = ap->ops->async_create(port_id, q, &op_attr,
+			ap->tables[idx], fb->items, 0, fb->actions, 0,
+			NULL, &error);
+	if (ap->root_flows[egress] == NULL) {
+		printf("Can't create root jump rule on port %u: %s\n",
+		       port_id, error.message);
+		return -1;
+	}
+	ap->queues[q].inflight++;
+	return vnf_async_flush(port_id);
+}
+
+int
+vnf_async_start(uint16_t port_id, uint32_t nb_queues, const uint16_t *queues)
+{
+	struct vnf_async_port *ap = async_ports[port_id];
+	struct vnf_flow_builder pattern, actions, masks;
+	struct rte_flow_attr attr;
+	int shape;
+
+	if (ap == NULL)
+		return -1;
+	ap->encap_hdr_len = gtp_u_encap_hdr_build(ap->encap_hdr, 0);
+	nb_queues = RTE_MIN(nb_queues, VNF_ASYNC_MAX_RSS_QUEUES);
+	memcpy(ap->rss_queues, queues, sizeof(*queues) * nb_queues);
+	memset(&ap->decap_rss, 0, sizeof(ap->decap_rss));
+	ap->decap_rss.level = 0; /* Only the inner header is left. */
+	ap->decap_rss.types = RTE_ETH_RSS_IP | RTE_ETH_RSS_L3_SRC_ONLY;
+	ap->decap_rss.queue = ap->rss_queues;
+	ap->decap_rss.queue_num = nb_queues;
+	ap->inner_rss = ap->decap_rss;
+	ap->inner_rss.level = 2;
+	if (!ap->template_mode)
+		return 0;
+	session_table.size = ap->nb_flows * VNF_ASYNC_SHAPE_MAX;
+	ap->group = vnf_table_declare(&session_table);
+	if (ap->group == VNF_TABLE_INVALID)
+		return -1;
+	for (shape = 0; shape < VNF_ASYNC_SHAPE_MAX; shape++) {
+		attr = sync_attr[shape];
+		attr.group = ap->group;
+		async_pattern_build(&pattern, (enum vnf_async_shape)shape,
+				    NULL);
+		vnf_flow_builder_init(&actions);
+		async_actions_build(&actions, ap, (enum vnf_async_shape)shape,
+				    NULL, 0);
+		vnf_flow_builder_init(&masks);
+		async_actions_build(&masks, ap, (enum vnf_async_shape)shape,
+				    NULL, 1);
+		if (async_table_create(port_id, ap, shape, &attr, ap->nb_flows,
+				       &pattern, &actions, &masks))
+			return -1;
+	}
+	if (async_root_create(port_id, ap, 0) ||
+	    async_root_create(port_id, ap, 1))
+		return -1;
+	return 0;
+}
+
+int
+vnf_async_template_mode(uint16_t port_id)
+{
+	const struct vnf_async_port *ap = async_ports[port_id];
+
+	return ap ? ap->template_mode : 0;
+}
+
+void
+vnf_async_set_done_cb(vnf_async_done_t cb)
+{
+	async_done_cb = cb;
+}
+
+/* The session layer makes its rules, the others are checkpointed. */
+static enum vnf_flow_owner
+async_owner(const struct vnf_async_session *s)
+{
+	return VNF_FLOW_COOKIE_OWNER(s->cookie) == VNF_FLOW_OWNER_PDU ?
+	       VNF_FLOW_OWNER_PDU : VNF_FLOW_OWNER_SESSION;
+}
+
+static uint32_t
+async_sync_add(uint16_t port_id, struct vnf_async_port *ap, int q,
+	       const struct vnf_flow_builder *fb,
+	       const struct vnf_async_session *s)
+{
+	const struct rte_flow_attr *attr = &sync_attr[s->shape];
+	uint32_t id = VNF_FLOW_ID_INVALID;
+	struct rte_flow_error error;
+	struct rte_flow *flow;
+
+	flow = vnf_flow_builder_create(port_id, attr, fb, &error);
+	if (flow == NULL) {
+		printf("Can't create session rule, TEID %u: %s\n",
+		       s->teid, error.message);
+	} else {
+		id = vnf_flow_register(port_id, attr, flow, async_owner(s),
+				       s->cookie, 0);
+		if (id == VNF_FLOW_ID_INVALID)
+			ap->ops->destroy(port_id, flow, NULL);
+		else if (async_owner(s) == VNF_FLOW_OWNER_SESSION)
+			vnf_flow_checkpoint_save(port_id, id, s);
+	}
+	/* Completed on the spot, reported the same way. */
+	ap->queues[q].done += id != VNF_FLOW_ID_INVALID;
+	ap->queues[q].failed += id == VNF_FLOW_ID_INVALID;
+	if (async_done_cb)
+		async_done_cb(s->cookie, id != VNF_FLOW_ID_INVALID ? 0 : -1);
+	return id;
+}
+
+uint32_t
+vnf_async_session_add(uint16_t port_id, const struct vnf_async_session *s)
+{
+	struct rte_flow_op_attr op_attr = { .postpone = 1 };
+	struct vnf_async_port *ap = async_ports[port_id];
+	struct rte_flow_attr attr;
+	struct vnf_flow_builder *fb;
+	struct rte_flow_error error;
+	struct rte_flow *flow;
+	uint32_t id;
+	int q;
+
+	if (ap == NULL || s->shape >= VNF_ASYNC_SHAPE_MAX)
+		return VNF_FLOW_ID_INVALID;
+	q = async_queue_get(ap);
+	if (q < 0)
+		return VNF_FLOW_ID_INVALID;
+	fb = vnf_flow_builder_get();
+	async_pattern_build(fb, s->shape, s);
+	async_actions_build(fb, ap, s->shape, s, 0);
+	if (!ap->template_mode)
+		return async_sync_add(port_id, ap, q, fb, s);
+	if (fb->error || async_queue_reserve(port_id, ap, q))
+		return VNF_FLOW_ID_INVALID;
+	attr = sync_attr[s->shape];
+	attr.group = ap->group;
+	/* Registered first, the ID is needed by the completion. */
+	id = vnf_flow_register(port_id, &attr, NULL, async_owner(s),
+			       s->cookie,
+			       VNF_FLOW_F_ASYNC | VNF_FLOW_F_PENDING);
+	if (id == VNF_FLOW_ID_INVALID)
+		return VNF_FLOW_ID_INVALID;
+	flow = ap->ops->async_create(port_id, q, &op_attr,
+				     ap->tables[s->shape], fb->items, 0,
+				     fb->actions, 0, (void *)(uintptr_t)id,
+				     &error);
+	if (flow == NULL) {
+		printf("Can't enqueue session rule, TEID %u: %s\n",
+		       s->teid, error.message);
+		vnf_flow_unregister(id);
+		return VNF_FLOW_ID_INVALID;
+	}
+	vnf_flow_attach(id, flow);
+	/* Dropped again by the registry if the insertion fails. */
+	if (async_owner(s) == VNF_FLOW_OWNER_SESSION)
+		vnf_flow_checkpoint_save(port_id, id, s);
+	async_queue_enqueued(port_id, ap, q);
+	return id;
+}
+
+int
+vnf_async_session_del(uint16_t port_id, uint32_t id)
+{
+	struct rte_flow_op_attr op_attr = { .postpone = 1 };
+	struct vnf_async_port *ap = async_ports[port_id];
+	struct rte_flow_error error;
+	struct rte_flow *flow;
+	int q;
+
+	if (ap == NULL || !ap->template_mode)
+		return -1;
+	flow = vnf_flow_lookup(id, NULL);
+	if (flow == NULL)
+		return -1;
+	q = async_queue_get(ap);
+	if (q < 0 || async_queue_reserve(port_id, ap, q))
+		return -1;
+	if (ap->ops->async_destroy(port_id, q, &op_attr, flow,
+				   (void *)(uintptr_t)id, &error)) {
+		printf("Can't enqueue session rule removal: %s\n",
+		       error.message);
+		return -1;
+	}
+	async_queue_enqueued(port_id, ap, q);
+	return 0;
+}
+
+int
+vnf_async_poll(uint16_t port_id)
+{
+	struct vnf_async_port *ap = async_ports[port_id];
+	int q;
+
+	if (ap == NULL || !ap->template_mode)
+		return 0;
+	q = async_queue_get(ap);
+	if (q < 0)
+		return -1;
+	if (!ap->queues[q].inflight)
+		return 0;
+	return async_queue_drain(port_id, ap, q);
+}
+
+int
+vnf_async_flush(uint16_t port_id)
+{
+	struct vnf_async_port *ap = async_ports[port_id];
+	int q, n;
+
+	if (ap == NULL || !ap->template_mode)
+		return 0;
+	q = async_queue_get(ap);
+	if (q < 0)
+		return -1;
+	while (ap->queues[q].inflight) {
+		n = async_queue_drain(port_id, ap, q);
+		if (n < 0)
+			return -1;
+		if (!n)
+			rte_pause();
+	}
+	return 0;
+}
+
+/* The lcores of index below it add sessions on the port, 0 without engine. */
+uint32_t
+vnf_async_nb_queues(uint16_t port_id)
+{
+	const struct vnf_async_port *ap = async_ports[port_id];
+
+	return ap == NULL ? 0 : ap->nb_queues;
+}
+
+void
+vnf_async_stats_print(uint16_t port_id)
+{
+	const struct vnf_async_port *ap = async_ports[port_id];
+	const struct vnf_async_queue *aq;
+	uint32_t q;
+
+	if (ap == NULL)
+		return;
+	for (q = 0; q < ap->nb_queues; q++) {
+		aq = &ap->queues[q];
+		if (!aq->done && !aq->failed)
+			continue;
+		printf("port %u flow queue %u: %"PRIu64" done, %"PRIu64" failed, "
+		       "%u in flight\n", port_id, q, aq->done, aq->failed,
+		       aq->inflight);
+	}
+}
+
+/* Release the tables, the rules must have been flushed. */
+void
+vnf_async_close(uint16_t port_id)
+{
+	struct vnf_async_port *ap = async_ports[port_id];
+	struct rte_flow_error error;
+	int i;
+
+	if (ap == NULL)
+		return;
+	for (i = 0; i < ASYNC_TABLE_MAX; i++) {
+		if (ap->tables[i])
+			ap->ops->template_table_destroy(port_id,
+							ap->tables[i], &error);
+		if (ap->actions_templates[i])
+			ap->ops->actions_template_destroy(port_id,
+					ap->actions_templates[i], &error);
+		if (ap->pattern_templates[i])
+			ap->ops->pattern_template_destroy(port_id,
+					ap->pattern_templates[i], &error);
+	}
+	rte_free(ap);
+	async_ports[port_id] = NULL;
+}
@@ -0,0 +1,347 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_per_lcore.h>
+#include <rte_flow.h>
+
+#include "vnf_examples.h"
+
+/*
+ * The builder copies every spec, mask and action conf into its own data
+ * area, so a pattern never points to the stack frame of a caller which has
+ * returned, and nothing is shared between two rules being built at the
+ * same time. Items and actions lists are always terminated by END.
+ */
+
+/* Scratch builder of the calling thread, EAL lcore or control thread. */
+static RTE_DEFINE_PER_LCORE(struct vnf_flow_builder, flow_builder);
+
+void
+vnf_flow_builder_init(struct vnf_flow_builder *fb)
+{
+	fb->nb_items = 0;
+	fb->nb_actions = 0;
+	fb->data_len = 0;
+	fb->error = 0;
+	fb->items[0].type = RTE_FLOW_ITEM_TYPE_END;
+	fb->actions[0].type = RTE_FLOW_ACTION_TYPE_END;
+}
+
+struct vnf_flow_builder *
+vnf_flow_builder_get(void)
+{
+	struct vnf_flow_builder *fb = &RTE_PER_LCORE(flow_builder);
+
+	vnf_flow_builder_init(fb);
+	return fb;
+}
+
+void *
+vnf_flow_builder_data(struct vnf_flow_builder *fb, const void *src,
+		      size_t size)
+{
+	/* Keep every object 8 bytes aligned. */
+	size_t len = RTE_ALIGN_CEIL(size, sizeof(uint64_t));
+	uint8_t *dst;
+
+	if (fb->data_len + len > sizeof(fb->data)) {
+		fb->error = ENOSPC;
+		return NULL;
+	}
+	dst = (uint8_t *)fb->data + fb->data_len;
+	fb->data_len += len;
+	if (src)
+		memcpy(dst, src, size);
+	else
+		memset(dst, 0, size);
+	return dst;
+}
+
+int
+vnf_flow_item(struct vnf_flow_builder *fb, enum rte_flow_item_type type,
+	      const void *spec, const void *mask, size_t size)
+{
+	struct rte_flow_item *item;
+
+	if (fb->nb_items + 1 >= VNF_FLOW_MAX_ITEMS) {
+		fb->error = ENOSPC;
+		return -1;
+	}
+	item = &fb->items[fb->nb_items];
+	memset(item, 0, sizeof(*item));
+	item->type = type;
+	if (spec) {
+		item->spec = vnf_flow_builder_data(fb, spec, size);
+		if (item->spec == NULL)
+			return -1;
+	}
+	/* No mask means the default mask of the item. */
+	if (spec && mask) {
+		item->mask = vnf_flow_builder_data(fb, mask, size);
+		if (item->mask == NULL)
+			return -1;
+	}
+	fb->items[++fb->nb_items].type = RTE_FLOW_ITEM_TYPE_END;
+	return 0;
+}
+
+int
+vnf_flow_item_eth(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_eth *spec,
+		  const struct rte_flow_item_eth *mask)
+{
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_ETH, spec, mask,
+			     sizeof(*spec));
+}
+
+int
+vnf_flow_item_ipv4(struct vnf_flow_builder *fb,
+		   const struct rte_flow_item_ipv4 *spec,
+		   const struct rte_flow_item_ipv4 *mask)
+{
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_IPV4, spec, mask,
+			     sizeof(*spec));
+}
+
+/*
+ * Outer IPv4 of a tunnel which is not a fragment, MF and the offset clear:
+ * the first fragment carries the tunnel headers too, the decap rules leave
+ * it to the software reassembly with the others.
+ */
+int
+vnf_flow_item_ipv4_unfragmented(struct vnf_flow_builder *fb)
+{
+	static const struct rte_flow_item_ipv4 spec = {
+		.hdr = { .fragment_offset = 0 },
+	};
+	static const struct rte_flow_item_ipv4 mask = {
+		.hdr = { .fragment_offset = RTE_BE16(0x3fff) },
+	};
+
+	return vnf_flow_item_ipv4(fb, &spec, &mask);
+}
+
+int
+vnf_flow_item_udp(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_udp *spec,
+		  const struct rte_flow_item_udp *mask)
+{
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_UDP, spec, mask,
+			     sizeof(*spec));
+}
+
+int
+vnf_flow_item_tcp(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_tcp *spec,
+		  const struct rte_flow_item_tcp *mask)
+{
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_TCP, spec, mask,
+			     sizeof(*spec));
+}
+
+int
+vnf_flow_item_gtp(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_gtp *spec,
+		  const struct rte_flow_item_gtp *mask)
+{
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_GTP, spec, mask,
+			     sizeof(*spec));
+}
+
+int
+vnf_flow_item_gtp_psc(struct vnf_flow_builder *fb,
+		      const struct rte_flow_item_gtp_psc *spec,
+		      const struct rte_flow_item_gtp_psc *mask)
+{
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_GTP_PSC, spec, mask,
+			     sizeof(*spec));
+}
+
+int
+vnf_flow_item_gre(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_gre *spec,
+		  const struct rte_flow_item_gre *mask)
+{
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_GRE, spec, mask,
+			     sizeof(*spec));
+}
+
+int
+vnf_flow_item_tag(struct vnf_flow_builder *fb, uint8_t index, uint32_t data,
+		  uint32_t data_mask)
+{
+	struct rte_flow_item_tag spec = { .data = data, .index = index };
+	struct rte_flow_item_tag mask = { .data = data_mask, .index = 0xff };
+
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_TAG, &spec, &mask,
+			     sizeof(spec));
+}
+
+int
+vnf_flow_item_mark(struct vnf_flow_builder *fb, uint32_t id)
+{
+	struct rte_flow_item_mark spec = { .id = id };
+
+	return vnf_flow_item(fb, RTE_FLOW_ITEM_TYPE_MARK, &spec, NULL,
+			     sizeof(spec));
+}
+
+int
+vnf_flow_action(struct vnf_flow_builder *fb, enum rte_flow_action_type type,
+		const void *conf, size_t size)
+{
+	struct rte_flow_action *action;
+
+	if (fb->nb_actions + 1 >= VNF_FLOW_MAX_ACTIONS) {
+		fb->error = ENOSPC;
+		return -1;
+	}
+	action = &fb->actions[fb->nb_actions];
+	action->type = type;
+	action->conf = NULL;
+	if (conf) {
+		action->conf = vnf_flow_builder_data(fb, conf, size);
+		if (action->conf == NULL)
+			return -1;
+	}
+	fb->actions[++fb->nb_actions].type = RTE_FLOW_ACTION_TYPE_END;
+	return 0;
+}
+
+int
+vnf_flow_action_mark(struct vnf_flow_builder *fb, uint32_t id)
+{
+	struct rte_flow_action_mark mark = { .id = id };
+
+	return vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_MARK, &mark,
+			       sizeof(mark));
+}
+
+int
+vnf_flow_action_tag(struct vnf_flow_builder *fb, uint8_t index,
+		    uint32_t data, uint32_t mask)
+{
+	struct rte_flow_action_set_tag tag = {
+		.data = data,
+		.mask = mask,
+		.index = index,
+	};
+
+	return vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_SET_TAG, &tag,
+			       sizeof(tag));
+}
+
+int
+vnf_flow_action_jump(struct vnf_flow_builder *fb, uint32_t group)
+{
+	struct rte_flow_action_jump jump = { .group = group };
+
+	return vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_JUMP, &jump,
+			       sizeof(jump));
+}
+
+int
+vnf_flow_action_queue(struct vnf_flow_builder *fb, uint16_t index)
+{
+	struct rte_flow_action_queue queue = { .index = index };
+
+	return vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_QUEUE, &queue,
+			       sizeof(queue));
+}
+
+/* The queue list and the key are copied too. */
+int
+vnf_flow_action_rss(struct vnf_flow_builder *fb,
+		    const struct rte_flow_action_rss *rss)
+{
+	struct rte_flow_action_rss conf = *rss;
+
+	if (rss->queue_num) {
+		conf.queue = vnf_flow_builder_data(fb, rss->queue,
+				sizeof(*rss->queue) * rss->queue_num);
+		if (conf.queue == NULL)
+			return -1;
+	}
+	if (rss->key_len) {
+		conf.key = vnf_flow_builder_data(fb, rss->key, rss->key_len);
+		if (conf.key == NULL)
+			return -1;
+	}
+	return vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_RSS, &conf,
+			       sizeof(conf));
+}
+
+int
+vnf_flow_action_raw_decap(struct vnf_flow_builder *fb, const uint8_t *data,
+			  size_t size)
+{
+	struct rte_flow_action_raw_decap decap = { .size = size };
+
+	decap.data = vnf_flow_builder_data(fb, data, size);
+	if (decap.data == NULL)
+		return -1;
+	return vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_RAW_DECAP, &decap,
+			       sizeof(decap));
+}
+
+int
+vnf_flow_action_raw_encap(struct vnf_flow_builder *fb, const uint8_t *data,
+			  size_t size)
+{
+	struct rte_flow_action_raw_encap encap = { .size = size };
+
+	encap.data = vnf_flow_builder_data(fb, data, size);
+	if (encap.data == NULL)
+		return -1;
+	return vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_RAW_ENCAP, &encap,
+			       sizeof(encap));
+}
+
+/* The handle itself is the conf, nothing is copied. */
+int
+vnf_flow_action_indirect(struct vnf_flow_builder *fb,
+			 const struct rte_flow_action_handle *handle)
+{
+	if (vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_INDIRECT, NULL, 0))
+		return -1;
+	fb->actions[fb->nb_actions - 1].conf = handle;
+	return 0;
+}
+
+int
+vnf_flow_builder_check(const struct vnf_flow_builder *fb,
+		       struct rte_flow_error *error)
+{
+	if (!fb->error)
+		return 0;
+	return rte_flow_error_set(error, fb->error,
+				  RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				  "flow builder is out of room");
+}
+
+int
+vnf_flow_builder_validate(uint16_t port, const struct rte_flow_attr *attr,
+			  const struct vnf_flow_builder *fb,
+			  struct rte_flow_error *error)
+{
+	if (vnf_flow_builder_check(fb, error))
+		return -fb->error;
+	return vnf_flow_ops_get(port)->validate(port, attr, fb->items,
+						fb->actions, error);
+}
+
+struct rte_flow *
+vnf_flow_builder_create(uint16_t port, const struct rte_flow_attr *attr,
+			const struct vnf_flow_builder *fb,
+			struct rte_flow_error *error)
+{
+	if (vnf_flow_builder_check(fb, error))
+		return NULL;
+	return vnf_flow_ops_get(port)->create(port, attr, fb->items,
+					      fb->actions, error);
+}
@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_cycles.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Checkpoint of the session rules, restored in bulk by the next run.
+ * The file is mapped shared and holds one 32 bytes record per registry
+ * entry, at the index of the flow ID, so a session is saved by filling
+ * its record and forgotten by clearing it, no write(2) nor lookup. The
+ * kernel writes the pages back, a crash or kill loses nothing already
+ * saved. The flow ID is stored last, a record is only valid with it.
+ * The checkpoint is closed before the rules are flushed at exit, the
+ * flush doesn't clear it, the next run finds the sessions of the last.
+ */
+
+#define CKPT_MAGIC 0x3154504b43464e56ull /* "VNFCKPT1" */
+#define CKPT_VERSION 1
+
+struct ckpt_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t nb_records;
+	uint32_t reserved[3];
+};
+
+struct ckpt_record {
+	uint32_t flow_id; /* VNF_FLOW_ID_INVALID for a free record. */
+	uint32_t teid;
+	uint32_t ue_ip;
+	uint32_t mark;
+	uint64_t cookie;
+	uint16_t port_id;
+	uint8_t shape;
+	uint8_t reserved[5];
+};
+
+static struct ckpt_header *ckpt;
+static struct ckpt_record *records;
+static size_t ckpt_size;
+static uint32_t nb_records;
+static uint32_t nb_restore; /* Valid records found at open. */
+
+static struct ckpt_record *
+ckpt_record_get(uint32_t flow_id)
+{
+	uint32_t idx = VNF_FLOW_ID_IDX(flow_id);
+
+	if (records == NULL || !idx || idx >= nb_records)
+		return NULL;
+	return &records[idx];
+}
+
+/*
+ * Map the checkpoint file, created for nb registry entries if missing or
+ * not of this layout. Sessions saved by the last run are counted for
+ * vnf_flow_checkpoint_restore().
+ */
+int
+vnf_flow_checkpoint_open(const char *path, uint32_t nb)
+{
+	struct ckpt_header hdr;
+	struct stat st;
+	uint32_t idx;
+	int fd, reset = 0;
+
+	if (ckpt)
+		return -1;
+	nb++; /* Entry 0 of the registry is never used. */
+	ckpt_size = sizeof(hdr) + (size_t)nb * sizeof(struct ckpt_record);
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		printf("Cannot open flow checkpoint %s: %s\n", path,
+		       strerror(errno));
+		return -1;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memset(&st, 0, sizeof(st));
+	if (fstat(fd, &st) || (size_t)st.st_size != ckpt_size ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    hdr.magic != CKPT_MAGIC || hdr.version != CKPT_VERSION ||
+	    hdr.record_size != sizeof(struct ckpt_record) ||
+	    hdr.nb_records != nb) {
+		if (st.st_size)
+			printf(":: flow checkpoint %s is not of this layout, reset\n",
+			       path);
+		/* A sparse file, only the pages of sessions take room. */
+		if (ftruncate(fd, 0) || ftruncate(fd, ckpt_size)) {
+			printf("Cannot size flow checkpoint %s: %s\n", path,
+			       strerror(errno));
+			close(fd);
+			return -1;
+		}
+		reset = 1;
+	}
+	ckpt = mmap(NULL, ckpt_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		    0);
+	close(fd);
+	if (ckpt == MAP_FAILED) {
+		printf("Cannot map flow checkpoint %s: %s\n", path,
+		       strerror(errno));
+		ckpt = NULL;
+		return -1;
+	}
+	records = (struct ckpt_record *)(ckpt + 1);
+	nb_records = nb;
+	if (reset) {
+		ckpt->version = CKPT_VERSION;
+		ckpt->record_size = sizeof(struct ckpt_record);
+		ckpt->nb_records = nb;
+		/* The header is valid once the magic is there. */
+		__atomic_store_n(&ckpt->magic, CKPT_MAGIC, __ATOMIC_RELEASE);
+	}
+	nb_restore = 0;
+	for (idx = 1; idx < nb_records; idx++)
+		nb_restore += records[idx].flow_id != VNF_FLOW_ID_INVALID;
+	printf(":: flow checkpoint %s, %u sessions to restore\n", path,
+	       nb_restore);
+	return 0;
+}
+
+/* Sessions to restore, to size the flow tables. */
+uint32_t
+vnf_flow_checkpoint_pending(void)
+{
+	return nb_restore;
+}
+
+/* Session rule created, flow_id from the registry. */
+void
+vnf_flow_checkpoint_save(uint16_t port_id, uint32_t flow_id,
+			 const struct vnf_async_session *s)
+{
+	struct ckpt_record *r = ckpt_record_get(flow_id);
+
+	if (r == NULL)
+		return;
+	__atomic_store_n(&r->flow_id, VNF_FLOW_ID_INVALID, __ATOMIC_RELAXED);
+	r->teid = s->teid;
+	r->ue_ip = s->ue_ip;
+	r->mark = s->mark;
+	r->cookie = s->cookie;
+	r->port_id = port_id;
+	r->shape = s->shape;
+	__atomic_store_n(&r->flow_id, flow_id, __ATOMIC_RELEASE);
+}
+
+/* Session rule released by the registry. */
+void
+vnf_flow_checkpoint_drop(uint32_t flow_id)
+{
+	struct ckpt_record *r = ckpt_record_get(flow_id);
+
+	if (r && r->flow_id == flow_id)
+		__atomic_store_n(&r->flow_id, VNF_FLOW_ID_INVALID,
+				 __ATOMIC_RELEASE);
+}
+
+/*
+ * Create again the sessions of the last run, through the session engine
+ * of each port started with vnf_async_start(), template tables when the
+ * port has them. The flow IDs change, the cookies are kept. Return how
+ * many could not be restored.
+ */
+int
+vnf_flow_checkpoint_restore(void)
+{
+	struct vnf_async_session s;
+	struct ckpt_record *saved;
+	uint64_t start, cycles;
+	uint32_t idx, nb = 0, failed = 0;
+	uint16_t port_id;
+
+	if (records == NULL || !nb_restore)
+		return 0;
+	saved = rte_malloc("vnf_flow_checkpoint", sizeof(*saved) * nb_restore,
+			   0);
+	if (saved == NULL) {
+		printf("Cannot allocate %u sessions to restore\n", nb_restore);
+		return -1;
+	}
+	/* Their records are taken by the new flow IDs. */
+	for (idx = 1; idx < nb_records && nb < nb_restore; idx++) {
+		if (records[idx].flow_id == VNF_FLOW_ID_INVALID)
+			continue;
+		/* PDU sessions of an older file, unknown to the session layer. */
+		if (VNF_FLOW_COOKIE_OWNER(records[idx].cookie) !=
+		    VNF_FLOW_OWNER_PDU)
+			saved[nb++] = records[idx];
+		records[idx].flow_id = VNF_FLOW_ID_INVALID;
+	}
+	printf(":: restore %u sessions...", nb);
+	start = rte_get_timer_cycles();
+	for (idx = 0; idx < nb; idx++) {
+		memset(&s, 0, sizeof(s));
+		s.shape = (enum vnf_async_shape)saved[idx].shape;
+		s.teid = saved[idx].teid;
+		s.ue_ip = saved[idx].ue_ip;
+		s.mark = saved[idx].mark;
+		s.cookie = saved[idx].cookie;
+		if (!rte_eth_dev_is_valid_port(saved[idx].port_id) ||
+		    vnf_async_session_add(saved[idx].port_id, &s) ==
+		    VNF_FLOW_ID_INVALID)
+			failed++;
+	}
+	RTE_ETH_FOREACH_DEV(port_id)
+		vnf_async_flush(port_id);
+	cycles = rte_get_timer_cycles() - start;
+	printf("done, %.0f rules/s, %u failed\n",
+	       1.0 * nb * rte_get_timer_hz() / (cycles ? cycles : 1), failed);
+	rte_free(saved);
+	nb_restore = 0;
+	return failed;
+}
+
+/* Before the rules are flushed at exit, they stay in the file. */
+void
+vnf_flow_checkpoint_close(void)
+{
+	if (ckpt == NULL)
+		return;
+	msync(ckpt, ckpt_size, MS_SYNC);
+	munmap(ckpt, ckpt_size);
+	ckpt = NULL;
+	records = NULL;
+	nb_records = 0;
+}
@@ -0,0 +1,298 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_spinlock.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Indirect actions (RSS, counters, meters, age...) of the ports. A rule
+ * refers to the handle instead of carrying the action, the PMD has it once
+ * for all the rules, and an update, e.g. new RSS queues, is seen by all of
+ * them at once without any rule change.
+ */
+
+#define HANDLE_RSS_KEY_MAX 64
+
+struct flow_handle {
+	struct rte_flow_action_handle *handle;
+	enum rte_flow_action_type type;
+	struct rte_flow_indir_action_conf conf;
+	uint32_t updates;
+	/* RSS conf, but the queues, to update only these. */
+	struct rte_flow_action_rss rss;
+	uint8_t rss_key[HANDLE_RSS_KEY_MAX];
+};
+
+static struct flow_handle *port_handles[RTE_MAX_ETHPORTS];
+static rte_spinlock_t handle_lock = RTE_SPINLOCK_INITIALIZER;
+
+static struct flow_handle *
+flow_handle_entry(uint16_t port_id, uint32_t id)
+{
+	if (port_id >= RTE_MAX_ETHPORTS || id >= VNF_FLOW_HANDLE_MAX ||
+	    port_handles[port_id] == NULL)
+		return NULL;
+	return &port_handles[port_id][id];
+}
+
+static const char *
+flow_handle_type_name(enum rte_flow_action_type type)
+{
+	const char *name = "unknown";
+
+	rte_flow_conv(RTE_FLOW_CONV_OP_ACTION_NAME_PTR, &name, sizeof(name),
+		      (void *)(uintptr_t)type, NULL);
+	return name;
+}
+
+/*
+ * The testpmd command, for an RSS one:
+ * testpmd> flow indirect_action 0 create action_id <id> ingress
+ *          action rss level 2 types ip end / end
+ */
+struct rte_flow_action_handle *
+vnf_flow_handle_create(uint16_t port_id, uint32_t id,
+		       const struct rte_flow_indir_action_conf *conf,
+		       const struct rte_flow_action *action)
+{
+	const struct rte_flow_action_rss *rss;
+	struct rte_flow_error error;
+	struct flow_handle *e;
+
+	if (port_id >= RTE_MAX_ETHPORTS || id >= VNF_FLOW_HANDLE_MAX) {
+		printf("Invalid indirect action %u on port %u\n", id, port_id);
+		return NULL;
+	}
+	rte_spinlock_lock(&handle_lock);
+	if (port_handles[port_id] == NULL)
+		port_handles[port_id] = rte_zmalloc("vnf_flow_handles",
+				sizeof(struct flow_handle) *
+				VNF_FLOW_HANDLE_MAX, 0);
+	e = flow_handle_entry(port_id, id);
+	if (e == NULL || e->handle) {
+		rte_spinlock_unlock(&handle_lock);
+		printf("Cannot create indirect action %u on port %u: %s\n",
+		       id, port_id, e ? "already exists" : "no memory");
+		return NULL;
+	}
+	if (action->type == RTE_FLOW_ACTION_TYPE_RSS) {
+		rss = action->conf;
+		if (rss->key_len > HANDLE_RSS_KEY_MAX) {
+			rte_spinlock_unlock(&handle_lock);
+			printf("RSS key of indirect action %u too long\n", id);
+			return NULL;
+		}
+		e->rss = *rss;
+		e->rss.queue = NULL;
+		e->rss.queue_num = 0;
+		if (rss->key_len) {
+			memcpy(e->rss_key, rss->key, rss->key_len);
+			e->rss.key = e->rss_key;
+		}
+	}
+	e->handle = vnf_flow_ops_get(port_id)->action_handle_create(port_id,
+			conf, action, &error);
+	if (e->handle == NULL) {
+		rte_spinlock_unlock(&handle_lock);
+		printf("Cannot create indirect %s action %u on port %u: %s\n",
+		       flow_handle_type_name(action->type), id, port_id,
+		       error.message ? error.message : "(no stated reason)");
+		return NULL;
+	}
+	e->type = action->type;
+	e->conf = *conf;
+	e->updates = 0;
+	rte_spinlock_unlock(&handle_lock);
+	return e->handle;
+}
+
+struct rte_flow_action_handle *
+vnf_flow_handle_get(uint16_t port_id, uint32_t id)
+{
+	struct flow_handle *e;
+	struct rte_flow_action_handle *handle = NULL;
+
+	rte_spinlock_lock(&handle_lock);
+	e = flow_handle_entry(port_id, id);
+	if (e)
+		handle = e->handle;
+	rte_spinlock_unlock(&handle_lock);
+	return handle;
+}
+
+/* update is what the PMD takes for the action type, see rte_flow.h. */
+int
+vnf_flow_handle_update(uint16_t port_id, uint32_t id, const void *update)
+{
+	struct rte_flow_error error;
+	struct flow_handle *e;
+	int ret = -ENOENT;
+
+	rte_spinlock_lock(&handle_lock);
+	e = flow_handle_entry(port_id, id);
+	if (e && e->handle) {
+		ret = vnf_flow_ops_get(port_id)->action_handle_update(port_id,
+				e->handle, update, &error);
+		if (ret)
+			printf("Cannot update indirect action %u on port %u:"
+			       " %s\n", id, port_id, error.message ?
+			       error.message : "(no stated reason)");
+		else
+			e->updates++;
+	}
+	rte_spinlock_unlock(&handle_lock);
+	return ret;
+}
+
+/*
+ * New queues for an RSS indirect action, the rules using it spread over
+ * them at once.
+ * testpmd> flow indirect_action 0 update <id> action rss queues 0 1 end
+ *          / end
+ */
+int
+vnf_flow_handle_rss_update(uint16_t port_id, uint32_t id,
+			   const uint16_t *queues, uint32_t nb_queues)
+{
+	struct rte_flow_action_rss rss;
+	struct rte_flow_action update = {
+		.type = RTE_FLOW_ACTION_TYPE_RSS,
+		.conf = &rss,
+	};
+	struct flow_handle *e;
+
+	rte_spinlock_lock(&handle_lock);
+	e = flow_handle_entry(port_id, id);
+	if (e == NULL || e->handle == NULL ||
+	    e->type != RTE_FLOW_ACTION_TYPE_RSS) {
+		rte_spinlock_unlock(&handle_lock);
+		return -ENOENT;
+	}
+	rss = e->rss;
+	rte_spinlock_unlock(&handle_lock);
+	rss.queue = queues;
+	rss.queue_num = nb_queues;
+	return vnf_flow_handle_update(port_id, id, &update);
+}
+
+/* New timeout of an indirect age, the rules using it restart aging. */
+int
+vnf_flow_handle_age_update(uint16_t port_id, uint32_t id, uint32_t timeout)
+{
+	struct rte_flow_update_age age = {
+		.timeout = timeout,
+		.timeout_valid = 1,
+		.touch = 1,
+	};
+
+	return vnf_flow_handle_update(port_id, id, &age);
+}
+
+int
+vnf_flow_handle_query(uint16_t port_id, uint32_t id, void *data)
+{
+	struct rte_flow_error error;
+	struct flow_handle *e;
+	int ret = -ENOENT;
+
+	rte_spinlock_lock(&handle_lock);
+	e = flow_handle_entry(port_id, id);
+	if (e && e->handle) {
+		ret = vnf_flow_ops_get(port_id)->action_handle_query(port_id,
+				e->handle, data, &error);
+		if (ret)
+			printf("Cannot query indirect action %u on port %u:"
+			       " %s\n", id, port_id, error.message ?
+			       error.message : "(no stated reason)");
+	}
+	rte_spinlock_unlock(&handle_lock);
+	return ret;
+}
+
+/* Fails, EBUSY for mlx5, while a rule still refers to it. */
+int
+vnf_flow_handle_destroy(uint16_t port_id, uint32_t id)
+{
+	struct rte_flow_error error;
+	struct flow_handle *e;
+	int ret = -ENOENT;
+
+	rte_spinlock_lock(&handle_lock);
+	e = flow_handle_entry(port_id, id);
+	if (e && e->handle) {
+		ret = vnf_flow_ops_get(port_id)->action_handle_destroy(port_id,
+				e->handle, &error);
+		if (ret == 0)
+			memset(e, 0, sizeof(*e));
+	}
+	rte_spinlock_unlock(&handle_lock);
+	return ret;
+}
+
+/* After the rules of the port are gone. */
+void
+vnf_flow_handle_flush(uint16_t port_id)
+{
+	uint32_t id;
+
+	if (port_id >= RTE_MAX_ETHPORTS || port_handles[port_id] == NULL)
+		return;
+	for (id = 0; id < VNF_FLOW_HANDLE_MAX; id++)
+		if (port_handles[port_id][id].handle &&
+		    vnf_flow_handle_destroy(port_id, id))
+			printf("Cannot destroy indirect action %u on port "
+			       "%u\n", id, port_id);
+	rte_spinlock_lock(&handle_lock);
+	rte_free(port_handles[port_id]);
+	port_handles[port_id] = NULL;
+	rte_spinlock_unlock(&handle_lock);
+}
+
+/* Indirect actions alive on the port. */
+uint32_t
+vnf_flow_handle_count(uint16_t port_id)
+{
+	const struct flow_handle *e;
+	uint32_t id, n = 0;
+
+	rte_spinlock_lock(&handle_lock);
+	for (id = 0; id < VNF_FLOW_HANDLE_MAX; id++) {
+		e = flow_handle_entry(port_id, id);
+		if (e == NULL)
+			break;
+		n += e->handle != NULL;
+	}
+	rte_spinlock_unlock(&handle_lock);
+	return n;
+}
+
+void
+vnf_flow_handle_print(uint16_t port_id)
+{
+	const struct flow_handle *e;
+	uint32_t id;
+
+	rte_spinlock_lock(&handle_lock);
+	for (id = 0; id < VNF_FLOW_HANDLE_MAX; id++) {
+		e = flow_handle_entry(port_id, id);
+		if (e == NULL)
+			break;
+		if (e->handle == NULL)
+			continue;
+		printf(":: port %u indirect action %u: %s%s%s%s, %u updates\n",
+		       port_id, id, flow_handle_type_name(e->type),
+		       e->conf.ingress ? " ingress" : "",
+		       e->conf.egress ? " egress" : "",
+		       e->conf.transfer ? " transfer" : "", e->updates);
+	}
+	rte_spinlock_unlock(&handle_lock);
+}
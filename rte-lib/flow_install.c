@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_lcore.h>
+#include <rte_launch.h>
+#include <rte_cycles.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Startup installation of the rules on all the lcores. The rules are cut
+ * in jobs by port and table, the main lcore and the idle workers take the
+ * next job until none is left. A job creates its rules with the builder
+ * and the flow queue of the lcore running it (vnf_flow_builder_get(),
+ * vnf_async_session_add()), nothing is shared but the registry, so the
+ * time goes down with the number of lcores as long as the PMD inserts in
+ * parallel. The lcore drains its flow queue on the port once the job is
+ * done, every rule is completed when vnf_install_run() returns, before
+ * the workers start the datapath.
+ * Only the lcores with a flow queue on every port with template tables
+ * take part.
+ */
+
+#define INSTALL_JOB_MAX 256
+
+struct install_job {
+	const char *name; /* The table. */
+	vnf_install_job_t fn;
+	void *arg;
+	uint64_t cycles;
+	int status;
+	unsigned int lcore_id;
+	uint16_t port_id;
+};
+
+static struct install_job jobs[INSTALL_JOB_MAX];
+static uint32_t nb_jobs;
+static uint32_t next_job;
+
+/* Run later by vnf_install_run(), in any order with the other jobs. */
+int
+vnf_install_add(const char *name, uint16_t port_id, vnf_install_job_t fn,
+		void *arg)
+{
+	struct install_job *job;
+
+	if (nb_jobs == INSTALL_JOB_MAX) {
+		printf("Cannot add install job %s of port %u, %u jobs\n",
+		       name, port_id, INSTALL_JOB_MAX);
+		return -1;
+	}
+	job = &jobs[nb_jobs++];
+	memset(job, 0, sizeof(*job));
+	job->name = name;
+	job->port_id = port_id;
+	job->fn = fn;
+	job->arg = arg;
+	return 0;
+}
+
+static int
+install_lcore(void *arg)
+{
+	struct install_job *job;
+	uint64_t start;
+	uint32_t idx;
+
+	RTE_SET_USED(arg);
+	while ((idx = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) <
+	       nb_jobs) {
+		job = &jobs[idx];
+		job->lcore_id = rte_lcore_id();
+		start = rte_get_timer_cycles();
+		job->status = job->fn(job->port_id, job->arg);
+		/* The completions of the job, on the queue of this lcore. */
+		if (vnf_async_flush(job->port_id) && !job->status)
+			job->status = -1;
+		job->cycles = rte_get_timer_cycles() - start;
+	}
+	return 0;
+}
+
+/* Lcores of an index below it have a flow queue on all the ports. */
+static uint32_t
+install_max_index(void)
+{
+	uint32_t max = RTE_MAX_LCORE, nb;
+	uint16_t port_id;
+
+	RTE_ETH_FOREACH_DEV(port_id) {
+		nb = vnf_async_nb_queues(port_id);
+		if (nb)
+			max = RTE_MIN(max, nb);
+	}
+	return max;
+}
+
+/*
+ * Run the jobs added so far and wait for all of them, the worker lcores
+ * must be idle. Return how many failed.
+ */
+int
+vnf_install_run(void)
+{
+	uint32_t i, failed = 0, nb_lcores = 1, max_index;
+	uint64_t start, cycles;
+	unsigned int lcore_id;
+
+	if (!nb_jobs)
+		return 0;
+	start = rte_get_timer_cycles();
+	next_job = 0;
+	max_index = install_max_index();
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		if (nb_lcores == nb_jobs)
+			break;
+		if ((uint32_t)rte_lcore_index(lcore_id) >= max_index ||
+		    rte_eal_get_lcore_state(lcore_id) != WAIT ||
+		    rte_eal_remote_launch(install_lcore, NULL, lcore_id))
+			continue;
+		nb_lcores++;
+	}
+	install_lcore(NULL);
+	rte_eal_mp_wait_lcore();
+	cycles = rte_get_timer_cycles() - start;
+	for (i = 0; i < nb_jobs; i++) {
+		if (jobs[i].status == 0)
+			continue;
+		printf(":: install of %s on port %u failed on lcore %u\n",
+		       jobs[i].name, jobs[i].port_id, jobs[i].lcore_id);
+		failed++;
+	}
+	printf(":: %u install jobs on %u lcores in %.3fs, %u failed\n",
+	       nb_jobs, nb_lcores, (double)cycles / rte_get_timer_hz(),
+	       failed);
+	nb_jobs = 0;
+	return failed;
+}
@@ -3,60 +3,7 @@
 #include <rte_net.h>
 #include <rte_gre.h>
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
+#include "vnf_examples.h"
 
 /*
  * create hairpin rx flow by using set_meta action
@@ -80,6 +27,7 @@ create_hairpin_meta_flow(void)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
@@ -167,13 +115,14 @@ create_hairpin_meta_flow(void)
         struct rte_flow_item_udp udp_mask = {
                 .hdr = {
                         .dst_port = RTE_BE16(0xFFFF)}};
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_spec;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-        pattern[L4].spec = &udp_spec;
-        pattern[L4].mask = &udp_mask;
-	flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_spec, &ipv4_mask);
+	vnf_flow_item_udp(&fb, &udp_spec, &udp_mask);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_META, 0, &error);
 	if (!flow) {
 		printf("Can't create hairpin flows on port: %u\n", port_id);
                 return -1;
@@ -190,12 +139,9 @@ create_hairpin_meta_flow(void)
                 .data = 0x1234};
         struct rte_flow_item_meta meta_mask = {
                 .data = 0xFFFF};
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_META;
-	pattern[L2].spec = &meta_spec;
-        pattern[L2].mask = &meta_mask;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_VOID;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_VOID;
-	pattern[END].type = RTE_FLOW_ITEM_TYPE_END;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item(&fb, RTE_FLOW_ITEM_TYPE_META, &meta_spec, &meta_mask,
+		      sizeof(meta_spec));
 	/* create actions. */
 	actions[0].type = RTE_FLOW_ACTION_TYPE_RAW_DECAP;
 	actions[0].conf = &decap;
@@ -204,8 +150,10 @@ create_hairpin_meta_flow(void)
 	actions[2].type = RTE_FLOW_ACTION_TYPE_END;
 	attr.egress = 1;
 	attr.ingress = 0;
-	flow = rte_flow_create(pair_port_list[0], &attr, pattern, actions,
-			&error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(pair_port_list[0], &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_META, 0, &error);
 	if (!flow)
 		printf("Can't create hairpin flows on pair port: %u, "
 			"error: %s\n", pair_port_list[0], error.message);
@@ -0,0 +1,769 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_spinlock.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Software stand-in for the rte_flow API of a port, to run the rule
+ * management code (builder, registry, async engine) without a NIC.
+ * A rule is deep copied with rte_flow_conv, as a PMD translates it, and
+ * kept in a hash keyed by its attributes and masked pattern. The same rule
+ * twice is refused with EEXIST like mlx5 does. Template tables are bounded
+ * to their nb_flows. Async operations are done at enqueue time and their
+ * results are given back by rte_flow_pull once pushed, or at once without
+ * postpone. Nothing is matched, no packet goes through these rules.
+ */
+
+#define MOCK_ITEM_MAX_SIZE 256
+
+struct mock_table {
+	struct rte_flow_attr attr;
+	uint32_t nb_flows;
+	uint32_t nb_rules;
+};
+
+struct mock_rule {
+	uint64_t key;
+	struct mock_table *table; /* NULL for rte_flow_create rules. */
+	size_t size;
+	/* Followed by the rte_flow_conv copy of the rule. */
+};
+
+struct mock_op {
+	void *user_data;
+	enum rte_flow_op_status status;
+};
+
+struct mock_queue {
+	struct mock_op *ops;
+	uint32_t size;
+	uint32_t head; /* Next result to pull. */
+	uint32_t ready; /* Results pushed. */
+	uint32_t tail; /* Next operation. */
+} __rte_cache_aligned;
+
+/* Templates and tables, freed on detach. */
+struct mock_object {
+	struct mock_object *next;
+	/* Followed by the object itself. */
+};
+
+struct mock_port {
+	struct rte_hash *rules;
+	rte_spinlock_t lock;
+	uint32_t flags;
+	uint32_t nb_rules;
+	uint64_t bytes; /* Held by the rules. */
+	struct mock_object *objects;
+	uint16_t nb_queues;
+	struct mock_queue *queues;
+};
+
+static struct mock_port *mock_ports[RTE_MAX_ETHPORTS];
+
+static struct mock_port *
+mock_port_get(uint16_t port_id, struct rte_flow_error *error)
+{
+	struct mock_port *mp = NULL;
+
+	if (port_id < RTE_MAX_ETHPORTS)
+		mp = mock_ports[port_id];
+	if (mp == NULL)
+		rte_flow_error_set(error, ENODEV,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "no mock flow backend on port");
+	return mp;
+}
+
+/* Hash of the attributes and of each masked item. */
+static uint64_t
+mock_rule_key(const struct rte_flow_attr *attr,
+	      const struct rte_flow_item *pattern)
+{
+	uint8_t spec[MOCK_ITEM_MAX_SIZE], mask[MOCK_ITEM_MAX_SIZE];
+	uint32_t lo, hi;
+	int len, i;
+
+	lo = rte_hash_crc_4byte(attr->group, attr->priority);
+	lo = rte_hash_crc_4byte(attr->ingress | attr->egress << 1 |
+				attr->transfer << 2, lo);
+	hi = ~lo;
+	for (; pattern->type != RTE_FLOW_ITEM_TYPE_END; pattern++) {
+		lo = rte_hash_crc_4byte(pattern->type, lo);
+		hi = rte_hash_crc_4byte(pattern->type, hi);
+		if (pattern->spec == NULL)
+			continue;
+		len = rte_flow_conv(RTE_FLOW_CONV_OP_ITEM, spec, sizeof(spec),
+				    pattern, NULL);
+		if (len <= 0)
+			continue;
+		len = RTE_MIN(len, (int)sizeof(spec));
+		if (pattern->mask &&
+		    rte_flow_conv(RTE_FLOW_CONV_OP_ITEM_MASK, mask,
+				  sizeof(mask), pattern, NULL) > 0) {
+			for (i = 0; i < len; i++)
+				spec[i] &= mask[i];
+		}
+		lo = rte_hash_crc(spec, len, lo);
+		hi = rte_hash_crc(spec, len, hi);
+	}
+	return (uint64_t)hi << 32 | lo;
+}
+
+static struct mock_rule *
+mock_rule_add(struct mock_port *mp, struct mock_table *table,
+	      const struct rte_flow_attr *attr,
+	      const struct rte_flow_item pattern[],
+	      const struct rte_flow_action actions[],
+	      struct rte_flow_error *error)
+{
+	struct rte_flow_conv_rule conv;
+	struct mock_rule *rule;
+	uint64_t key;
+	int size;
+
+	memset(&conv, 0, sizeof(conv));
+	conv.attr_ro = attr;
+	conv.pattern_ro = pattern;
+	conv.actions_ro = actions;
+	size = rte_flow_conv(RTE_FLOW_CONV_OP_RULE, NULL, 0, &conv, error);
+	if (size < 0)
+		return NULL;
+	key = mock_rule_key(attr, pattern);
+	rte_spinlock_lock(&mp->lock);
+	if (table && table->nb_rules >= table->nb_flows) {
+		rte_flow_error_set(error, ENOSPC,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "template table is full");
+		goto fail;
+	}
+	if (rte_hash_lookup(mp->rules, &key) >= 0) {
+		rte_flow_error_set(error, EEXIST,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "same rule already exists");
+		goto fail;
+	}
+	rule = rte_malloc("vnf_mock_rule", sizeof(*rule) + size, 0);
+	if (rule == NULL) {
+		rte_flow_error_set(error, ENOMEM,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "cannot allocate rule");
+		goto fail;
+	}
+	rte_flow_conv(RTE_FLOW_CONV_OP_RULE, rule + 1, size, &conv, NULL);
+	rule->key = key;
+	rule->table = table;
+	rule->size = sizeof(*rule) + size;
+	if (rte_hash_add_key_data(mp->rules, &key, rule)) {
+		rte_free(rule);
+		rte_flow_error_set(error, ENOSPC,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "mock flow backend is full");
+		goto fail;
+	}
+	if (table)
+		table->nb_rules++;
+	mp->nb_rules++;
+	mp->bytes += rule->size;
+	rte_spinlock_unlock(&mp->lock);
+	return rule;
+fail:
+	rte_spinlock_unlock(&mp->lock);
+	return NULL;
+}
+
+static int
+mock_rule_del(struct mock_port *mp, struct mock_rule *rule,
+	      struct rte_flow_error *error)
+{
+	rte_spinlock_lock(&mp->lock);
+	if (rule == NULL || rte_hash_del_key(mp->rules, &rule->key) < 0) {
+		rte_spinlock_unlock(&mp->lock);
+		return -rte_flow_error_set(error, ENOENT,
+					   RTE_FLOW_ERROR_TYPE_HANDLE, NULL,
+					   "unknown rule");
+	}
+	if (rule->table)
+		rule->table->nb_rules--;
+	mp->nb_rules--;
+	mp->bytes -= rule->size;
+	rte_spinlock_unlock(&mp->lock);
+	rte_free(rule);
+	return 0;
+}
+
+static void *
+mock_object_alloc(struct mock_port *mp, size_t size,
+		  struct rte_flow_error *error)
+{
+	struct mock_object *obj;
+
+	obj = rte_zmalloc("vnf_mock_object", sizeof(*obj) + size, 0);
+	if (obj == NULL) {
+		rte_flow_error_set(error, ENOMEM,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "cannot allocate template");
+		return NULL;
+	}
+	rte_spinlock_lock(&mp->lock);
+	obj->next = mp->objects;
+	mp->objects = obj;
+	rte_spinlock_unlock(&mp->lock);
+	return obj + 1;
+}
+
+static int
+mock_object_free(uint16_t port_id, void *data, struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+	struct mock_object **prev, *obj;
+
+	if (mp == NULL)
+		return -ENODEV;
+	obj = (struct mock_object *)data - 1;
+	rte_spinlock_lock(&mp->lock);
+	for (prev = &mp->objects; *prev; prev = &(*prev)->next) {
+		if (*prev == obj) {
+			*prev = obj->next;
+			rte_spinlock_unlock(&mp->lock);
+			rte_free(obj);
+			return 0;
+		}
+	}
+	rte_spinlock_unlock(&mp->lock);
+	return -rte_flow_error_set(error, ENOENT,
+				   RTE_FLOW_ERROR_TYPE_HANDLE, NULL,
+				   "unknown template");
+}
+
+static int
+mock_validate(uint16_t port_id, const struct rte_flow_attr *attr,
+	      const struct rte_flow_item pattern[],
+	      const struct rte_flow_action actions[],
+	      struct rte_flow_error *error)
+{
+	struct rte_flow_conv_rule conv;
+	int ret;
+
+	if (mock_port_get(port_id, error) == NULL)
+		return -ENODEV;
+	memset(&conv, 0, sizeof(conv));
+	conv.attr_ro = attr;
+	conv.pattern_ro = pattern;
+	conv.actions_ro = actions;
+	ret = rte_flow_conv(RTE_FLOW_CONV_OP_RULE, NULL, 0, &conv, error);
+	return ret < 0 ? ret : 0;
+}
+
+static struct rte_flow *
+mock_create(uint16_t port_id, const struct rte_flow_attr *attr,
+	    const struct rte_flow_item pattern[],
+	    const struct rte_flow_action actions[],
+	    struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+
+	if (mp == NULL)
+		return NULL;
+	return (struct rte_flow *)mock_rule_add(mp, NULL, attr, pattern,
+						actions, error);
+}
+
+static int
+mock_destroy(uint16_t port_id, struct rte_flow *flow,
+	     struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+
+	if (mp == NULL)
+		return -ENODEV;
+	return mock_rule_del(mp, (struct mock_rule *)flow, error);
+}
+
+static int
+mock_flush(uint16_t port_id, struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+	struct mock_rule *rule;
+	const void *key;
+	uint32_t next = 0;
+	void *data;
+
+	if (mp == NULL)
+		return -ENODEV;
+	rte_spinlock_lock(&mp->lock);
+	while (rte_hash_iterate(mp->rules, &key, &data, &next) >= 0) {
+		rule = data;
+		if (rule->table)
+			rule->table->nb_rules--;
+		rte_free(rule);
+	}
+	rte_hash_reset(mp->rules);
+	mp->nb_rules = 0;
+	mp->bytes = 0;
+	rte_spinlock_unlock(&mp->lock);
+	return 0;
+}
+
+static int
+mock_info_get(uint16_t port_id, struct rte_flow_port_info *port_info,
+	      struct rte_flow_queue_info *queue_info,
+	      struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+
+	if (mp == NULL)
+		return -ENODEV;
+	if (mp->flags & VNF_FLOW_MOCK_F_NO_TEMPLATE)
+		return -rte_flow_error_set(error, ENOTSUP,
+					   RTE_FLOW_ERROR_TYPE_UNSPECIFIED,
+					   NULL, "template API disabled");
+	memset(port_info, 0, sizeof(*port_info));
+	memset(queue_info, 0, sizeof(*queue_info));
+	port_info->max_nb_queues = RTE_MAX_LCORE;
+	queue_info->max_size = UINT16_MAX;
+	return 0;
+}
+
+static int
+mock_configure(uint16_t port_id, const struct rte_flow_port_attr *port_attr,
+	       uint16_t nb_queue, const struct rte_flow_queue_attr *queue_attr[],
+	       struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+	struct mock_queue *queues;
+	uint16_t q;
+
+	RTE_SET_USED(port_attr);
+	if (mp == NULL)
+		return -ENODEV;
+	if (mp->queues)
+		return -rte_flow_error_set(error, EBUSY,
+					   RTE_FLOW_ERROR_TYPE_UNSPECIFIED,
+					   NULL, "flow queues already set");
+	queues = rte_zmalloc("vnf_mock_queues", sizeof(*queues) * nb_queue,
+			     RTE_CACHE_LINE_SIZE);
+	if (queues == NULL)
+		goto nomem;
+	for (q = 0; q < nb_queue; q++) {
+		queues[q].size = queue_attr[q]->size;
+		queues[q].ops = rte_zmalloc("vnf_mock_ops",
+				sizeof(struct mock_op) * queues[q].size, 0);
+		if (queues[q].ops == NULL)
+			goto nomem;
+	}
+	mp->queues = queues;
+	mp->nb_queues = nb_queue;
+	return 0;
+nomem:
+	if (queues) {
+		for (q = 0; q < nb_queue; q++)
+			rte_free(queues[q].ops);
+		rte_free(queues);
+	}
+	return -rte_flow_error_set(error, ENOMEM,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "cannot allocate flow queues");
+}
+
+static struct rte_flow_pattern_template *
+mock_pattern_template_create(uint16_t port_id,
+			     const struct rte_flow_pattern_template_attr *attr,
+			     const struct rte_flow_item pattern[],
+			     struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+
+	RTE_SET_USED(attr);
+	RTE_SET_USED(pattern);
+	if (mp == NULL)
+		return NULL;
+	return mock_object_alloc(mp, sizeof(uint64_t), error);
+}
+
+static int
+mock_pattern_template_destroy(uint16_t port_id,
+			      struct rte_flow_pattern_template *pattern_template,
+			      struct rte_flow_error *error)
+{
+	return mock_object_free(port_id, pattern_template, error);
+}
+
+static struct rte_flow_actions_template *
+mock_actions_template_create(uint16_t port_id,
+			     const struct rte_flow_actions_template_attr *attr,
+			     const struct rte_flow_action actions[],
+			     const struct rte_flow_action masks[],
+			     struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+
+	RTE_SET_USED(attr);
+	RTE_SET_USED(actions);
+	RTE_SET_USED(masks);
+	if (mp == NULL)
+		return NULL;
+	return mock_object_alloc(mp, sizeof(uint64_t), error);
+}
+
+static int
+mock_actions_template_destroy(uint16_t port_id,
+			      struct rte_flow_actions_template *actions_template,
+			      struct rte_flow_error *error)
+{
+	return mock_object_free(port_id, actions_template, error);
+}
+
+static struct rte_flow_template_table *
+mock_template_table_create(uint16_t port_id,
+			   const struct rte_flow_template_table_attr *table_attr,
+			   struct rte_flow_pattern_template *pattern_templates[],
+			   uint8_t nb_pattern_templates,
+			   struct rte_flow_actions_template *actions_templates[],
+			   uint8_t nb_actions_templates,
+			   struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+	struct mock_table *table;
+
+	RTE_SET_USED(pattern_templates);
+	RTE_SET_USED(actions_templates);
+	if (mp == NULL)
+		return NULL;
+	if (!nb_pattern_templates || !nb_actions_templates) {
+		rte_flow_error_set(error, EINVAL,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "table without template");
+		return NULL;
+	}
+	table = mock_object_alloc(mp, sizeof(*table), error);
+	if (table == NULL)
+		return NULL;
+	table->attr = table_attr->flow_attr;
+	table->nb_flows = table_attr->nb_flows;
+	return (struct rte_flow_template_table *)table;
+}
+
+static int
+mock_template_table_destroy(uint16_t port_id,
+			    struct rte_flow_template_table *template_table,
+			    struct rte_flow_error *error)
+{
+	const struct mock_table *table =
+		(const struct mock_table *)template_table;
+
+	if (table->nb_rules)
+		return -rte_flow_error_set(error, EBUSY,
+					   RTE_FLOW_ERROR_TYPE_UNSPECIFIED,
+					   NULL, "template table not empty");
+	return mock_object_free(port_id, template_table, error);
+}
+
+static struct mock_queue *
+mock_queue_get(uint16_t port_id, uint32_t queue_id,
+	       struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+
+	if (mp == NULL)
+		return NULL;
+	if (queue_id >= mp->nb_queues) {
+		rte_flow_error_set(error, EINVAL,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "invalid flow queue");
+		return NULL;
+	}
+	return &mp->queues[queue_id];
+}
+
+static int
+mock_queue_enqueue(struct mock_queue *mq,
+		   const struct rte_flow_op_attr *op_attr, void *user_data)
+{
+	struct mock_op *op = &mq->ops[mq->tail % mq->size];
+
+	op->user_data = user_data;
+	op->status = RTE_FLOW_OP_SUCCESS;
+	mq->tail++;
+	if (!op_attr->postpone)
+		mq->ready = mq->tail;
+	return 0;
+}
+
+static struct rte_flow *
+mock_async_create(uint16_t port_id, uint32_t queue_id,
+		  const struct rte_flow_op_attr *op_attr,
+		  struct rte_flow_template_table *template_table,
+		  const struct rte_flow_item pattern[],
+		  uint8_t pattern_template_index,
+		  const struct rte_flow_action actions[],
+		  uint8_t actions_template_index,
+		  void *user_data, struct rte_flow_error *error)
+{
+	struct mock_table *table = (struct mock_table *)template_table;
+	struct mock_queue *mq = mock_queue_get(port_id, queue_id, error);
+	struct mock_rule *rule;
+
+	RTE_SET_USED(pattern_template_index);
+	RTE_SET_USED(actions_template_index);
+	if (mq == NULL)
+		return NULL;
+	if (mq->tail - mq->head >= mq->size) {
+		rte_flow_error_set(error, EAGAIN,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "flow queue is full");
+		return NULL;
+	}
+	rule = mock_rule_add(mock_ports[port_id], table, &table->attr,
+			     pattern, actions, error);
+	if (rule == NULL)
+		return NULL;
+	mock_queue_enqueue(mq, op_attr, user_data);
+	return (struct rte_flow *)rule;
+}
+
+static int
+mock_async_destroy(uint16_t port_id, uint32_t queue_id,
+		   const struct rte_flow_op_attr *op_attr,
+		   struct rte_flow *flow, void *user_data,
+		   struct rte_flow_error *error)
+{
+	struct mock_queue *mq = mock_queue_get(port_id, queue_id, error);
+	int ret;
+
+	if (mq == NULL)
+		return -ENODEV;
+	if (mq->tail - mq->head >= mq->size)
+		return -rte_flow_error_set(error, EAGAIN,
+					   RTE_FLOW_ERROR_TYPE_UNSPECIFIED,
+					   NULL, "flow queue is full");
+	ret = mock_rule_del(mock_ports[port_id], (struct mock_rule *)flow,
+			    error);
+	if (ret)
+		return ret;
+	return mock_queue_enqueue(mq, op_attr, user_data);
+}
+
+static int
+mock_push(uint16_t port_id, uint32_t queue_id, struct rte_flow_error *error)
+{
+	struct mock_queue *mq = mock_queue_get(port_id, queue_id, error);
+
+	if (mq == NULL)
+		return -ENODEV;
+	mq->ready = mq->tail;
+	return 0;
+}
+
+static int
+mock_pull(uint16_t port_id, uint32_t queue_id, struct rte_flow_op_result res[],
+	  uint16_t n_res, struct rte_flow_error *error)
+{
+	struct mock_queue *mq = mock_queue_get(port_id, queue_id, error);
+	const struct mock_op *op;
+	uint16_t n;
+
+	if (mq == NULL)
+		return -ENODEV;
+	for (n = 0; n < n_res && mq->head != mq->ready; n++, mq->head++) {
+		op = &mq->ops[mq->head % mq->size];
+		res[n].status = op->status;
+		res[n].user_data = op->user_data;
+	}
+	return n;
+}
+
+/* Nothing goes through the rules, there is nothing to count or age. */
+static int
+mock_query(uint16_t port_id, struct rte_flow *flow,
+	   const struct rte_flow_action *action, void *data,
+	   struct rte_flow_error *error)
+{
+	RTE_SET_USED(flow);
+	RTE_SET_USED(data);
+	if (mock_port_get(port_id, error) == NULL)
+		return -ENODEV;
+	return -rte_flow_error_set(error, ENOTSUP, RTE_FLOW_ERROR_TYPE_ACTION,
+				   action, "no query in mock backend");
+}
+
+static int
+mock_get_aged_flows(uint16_t port_id, void **contexts, uint32_t nb_contexts,
+		    struct rte_flow_error *error)
+{
+	RTE_SET_USED(contexts);
+	RTE_SET_USED(nb_contexts);
+	if (mock_port_get(port_id, error) == NULL)
+		return -ENODEV;
+	return 0;
+}
+
+static int
+mock_callback_register(uint16_t port_id, enum rte_eth_event_type event,
+		       rte_eth_dev_cb_fn cb_fn, void *cb_arg)
+{
+	RTE_SET_USED(event);
+	RTE_SET_USED(cb_fn);
+	RTE_SET_USED(cb_arg);
+	return mock_port_get(port_id, NULL) ? 0 : -ENODEV;
+}
+
+static struct rte_flow_action_handle *
+mock_action_handle_create(uint16_t port_id,
+			  const struct rte_flow_indir_action_conf *conf,
+			  const struct rte_flow_action *action,
+			  struct rte_flow_error *error)
+{
+	struct mock_port *mp = mock_port_get(port_id, error);
+
+	RTE_SET_USED(conf);
+	RTE_SET_USED(action);
+	if (mp == NULL)
+		return NULL;
+	return mock_object_alloc(mp, sizeof(uint64_t), error);
+}
+
+static int
+mock_action_handle_destroy(uint16_t port_id,
+			   struct rte_flow_action_handle *handle,
+			   struct rte_flow_error *error)
+{
+	return mock_object_free(port_id, handle, error);
+}
+
+static int
+mock_action_handle_update(uint16_t port_id,
+			  struct rte_flow_action_handle *handle,
+			  const void *update, struct rte_flow_error *error)
+{
+	RTE_SET_USED(handle);
+	RTE_SET_USED(update);
+	return mock_port_get(port_id, error) ? 0 : -ENODEV;
+}
+
+static int
+mock_action_handle_query(uint16_t port_id,
+			 const struct rte_flow_action_handle *handle,
+			 void *data, struct rte_flow_error *error)
+{
+	RTE_SET_USED(handle);
+	RTE_SET_USED(data);
+	if (mock_port_get(port_id, error) == NULL)
+		return -ENODEV;
+	return -rte_flow_error_set(error, ENOTSUP, RTE_FLOW_ERROR_TYPE_HANDLE,
+				   NULL, "no query in mock backend");
+}
+
+static const struct vnf_flow_ops mock_flow_ops = {
+	.name = "mock",
+	.validate = mock_validate,
+	.create = mock_create,
+	.destroy = mock_destroy,
+	.flush = mock_flush,
+	.info_get = mock_info_get,
+	.configure = mock_configure,
+	.pattern_template_create = mock_pattern_template_create,
+	.pattern_template_destroy = mock_pattern_template_destroy,
+	.actions_template_create = mock_actions_template_create,
+	.actions_template_destroy = mock_actions_template_destroy,
+	.template_table_create = mock_template_table_create,
+	.template_table_destroy = mock_template_table_destroy,
+	.async_create = mock_async_create,
+	.async_destroy = mock_async_destroy,
+	.push = mock_push,
+	.pull = mock_pull,
+	.query = mock_query,
+	.get_aged_flows = mock_get_aged_flows,
+	.callback_register = mock_callback_register,
+	.action_handle_create = mock_action_handle_create,
+	.action_handle_destroy = mock_action_handle_destroy,
+	.action_handle_update = mock_action_handle_update,
+	.action_handle_query = mock_action_handle_query,
+};
+
+int
+vnf_flow_mock_attach(uint16_t port_id, uint32_t max_rules, uint32_t flags)
+{
+	struct rte_hash_parameters params;
+	char name[RTE_HASH_NAMESIZE];
+	struct mock_port *mp;
+
+	if (port_id >= RTE_MAX_ETHPORTS || mock_ports[port_id]) {
+		printf("Can't attach mock flow backend to port %u\n", port_id);
+		return -1;
+	}
+	mp = rte_zmalloc("vnf_mock_port", sizeof(*mp), RTE_CACHE_LINE_SIZE);
+	if (mp == NULL) {
+		printf("Cannot allocate mock flow backend of port %u\n",
+		       port_id);
+		return -1;
+	}
+	snprintf(name, sizeof(name), "vnf_mock_rules_%u", port_id);
+	memset(&params, 0, sizeof(params));
+	params.name = name;
+	params.entries = max_rules;
+	params.key_len = sizeof(uint64_t);
+	params.hash_func = rte_hash_crc;
+	params.socket_id = rte_socket_id();
+	params.extra_flag = RTE_HASH_EXTRA_FLAGS_EXT_TABLE;
+	mp->rules = rte_hash_create(&params);
+	if (mp->rules == NULL) {
+		printf("Cannot create mock rule hash of port %u\n", port_id);
+		rte_free(mp);
+		return -1;
+	}
+	rte_spinlock_init(&mp->lock);
+	mp->flags = flags;
+	mock_ports[port_id] = mp;
+	vnf_flow_ops_set(port_id, &mock_flow_ops);
+	return 0;
+}
+
+/* Free what is left and give the port back to rte_flow. */
+void
+vnf_flow_mock_detach(uint16_t port_id)
+{
+	struct mock_port *mp = mock_ports[port_id];
+	struct mock_object *obj;
+	uint16_t q;
+
+	if (mp == NULL)
+		return;
+	mock_flush(port_id, NULL);
+	while (mp->objects) {
+		obj = mp->objects;
+		mp->objects = obj->next;
+		rte_free(obj);
+	}
+	for (q = 0; q < mp->nb_queues; q++)
+		rte_free(mp->queues[q].ops);
+	rte_free(mp->queues);
+	rte_hash_free(mp->rules);
+	rte_free(mp);
+	mock_ports[port_id] = NULL;
+	vnf_flow_ops_set(port_id, NULL);
+}
+
+int
+vnf_flow_mock_stats(uint16_t port_id, uint32_t *nb_rules, uint64_t *bytes)
+{
+	const struct mock_port *mp = mock_ports[port_id];
+
+	if (mp == NULL)
+		return -1;
+	*nb_rules = mp->nb_rules;
+	*bytes = mp->bytes;
+	return 0;
+}
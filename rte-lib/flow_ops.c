@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Flow API used for the rules of a port. By default it is rte_flow, a
+ * benchmark or a test can put a software backend instead, so the rule
+ * management code runs the same without a NIC able to offload.
+ */
+
+static const struct vnf_flow_ops rte_flow_backend = {
+	.name = "rte_flow",
+	.validate = rte_flow_validate,
+	.create = rte_flow_create,
+	.destroy = rte_flow_destroy,
+	.flush = rte_flow_flush,
+	.info_get = rte_flow_info_get,
+	.configure = rte_flow_configure,
+	.pattern_template_create = rte_flow_pattern_template_create,
+	.pattern_template_destroy = rte_flow_pattern_template_destroy,
+	.actions_template_create = rte_flow_actions_template_create,
+	.actions_template_destroy = rte_flow_actions_template_destroy,
+	.template_table_create = rte_flow_template_table_create,
+	.template_table_destroy = rte_flow_template_table_destroy,
+	.async_create = rte_flow_async_create,
+	.async_destroy = rte_flow_async_destroy,
+	.push = rte_flow_push,
+	.pull = rte_flow_pull,
+	.query = rte_flow_query,
+	.get_aged_flows = rte_flow_get_aged_flows,
+	.callback_register = rte_eth_dev_callback_register,
+	.action_handle_create = rte_flow_action_handle_create,
+	.action_handle_destroy = rte_flow_action_handle_destroy,
+	.action_handle_update = rte_flow_action_handle_update,
+	.action_handle_query = rte_flow_action_handle_query,
+};
+
+static const struct vnf_flow_ops *port_flow_ops[RTE_MAX_ETHPORTS];
+
+const struct vnf_flow_ops *
+vnf_flow_ops_get(uint16_t port_id)
+{
+	const struct vnf_flow_ops *ops = NULL;
+
+	if (port_id < RTE_MAX_ETHPORTS)
+		ops = port_flow_ops[port_id];
+	return ops ? ops : &rte_flow_backend;
+}
+
+/* NULL goes back to rte_flow. No rule may exist on the port. */
+void
+vnf_flow_ops_set(uint16_t port_id, const struct vnf_flow_ops *ops)
+{
+	if (port_id < RTE_MAX_ETHPORTS) {
+		port_flow_ops[port_id] = ops;
+		vnf_flow_vcache_flush(port_id);
+	}
+}
@@ -0,0 +1,468 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_spinlock.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Priorities of the table rules. Each rule created in a table is kept
+ * with its masked items, and a new one is checked in software against
+ * the rules of the same group and domain it overlaps: the packets both
+ * match, when their items agree on the bits both mask. A rule inside
+ * another one, matching a subset of its packets, must be before it, or
+ * the PMD takes the wider rule and the narrow one never hits, its
+ * traffic goes to the software path without any error.
+ * A rule created with priority VNF_FLOW_PRIO_AUTO is placed by its
+ * specificity (masked bits plus a few per item, more is lower) and then
+ * moved between the rules it overlaps. A rule with a given priority is
+ * refused when it shadows or is shadowed, and so is the same match
+ * twice. Rules with the same actions may overlap in any order. Existing
+ * rules are never moved, a rule with no room left is refused.
+ * Meta items (mark, tag, meta, port) are compared by type, the header
+ * items by position, an item with a range is taken by its type only.
+ * The check walks the rules of the port, tables hold control rules only,
+ * the sessions go through the template tables and are not checked.
+ * Room in the hash of the kept rules is taken by the check, a rule past
+ * PRIO_HASH_SIZE is refused before it is created rather than created and
+ * left out of the checks.
+ */
+
+#define PRIO_LEVELS MAX_FLOW_PRIORITY /* The miss rules take the last one. */
+#define PRIO_ITEM_MAX 8
+#define PRIO_ITEM_SIZE 48
+#define PRIO_ITEM_BITS 8 /* An item matches at least a protocol. */
+#define PRIO_TIER_BITS 16 /* Specificity of one priority level. */
+#define PRIO_HASH_SIZE 4096
+
+struct prio_item {
+	enum rte_flow_item_type type;
+	uint8_t meta; /* Compared by type, not position. */
+	uint8_t pos; /* Header position. */
+	uint8_t len; /* 0 when the item matches its type only. */
+	uint8_t spec[PRIO_ITEM_SIZE]; /* Masked. */
+	uint8_t mask[PRIO_ITEM_SIZE];
+};
+
+struct vnf_prio_rule {
+	struct vnf_prio_rule *prev;
+	struct vnf_prio_rule *next;
+	struct rte_flow *flow; /* NULL while it is created. */
+	uint32_t group;
+	uint32_t priority;
+	uint32_t bits;
+	uint32_t actions; /* Hash of the actions. */
+	uint16_t port_id;
+	uint8_t domains;
+	uint8_t nb_items;
+	struct prio_item items[PRIO_ITEM_MAX];
+};
+
+enum prio_relation {
+	PRIO_DISJOINT,
+	PRIO_SAME, /* Same packets. */
+	PRIO_INSIDE, /* The new rule matches a subset of the other. */
+	PRIO_AROUND, /* The new rule matches a superset of the other. */
+	PRIO_CROSS, /* Neither. */
+};
+
+struct prio_item_info {
+	size_t size;
+	const void *mask; /* Default mask. */
+	int meta;
+};
+
+static const struct prio_item_info item_info[] = {
+	[RTE_FLOW_ITEM_TYPE_ETH] = { sizeof(struct rte_flow_item_eth),
+				     &rte_flow_item_eth_mask, 0 },
+	[RTE_FLOW_ITEM_TYPE_VLAN] = { sizeof(struct rte_flow_item_vlan),
+				      &rte_flow_item_vlan_mask, 0 },
+	[RTE_FLOW_ITEM_TYPE_IPV4] = { sizeof(struct rte_flow_item_ipv4),
+				      &rte_flow_item_ipv4_mask, 0 },
+	[RTE_FLOW_ITEM_TYPE_IPV6] = { sizeof(struct rte_flow_item_ipv6),
+				      &rte_flow_item_ipv6_mask, 0 },
+	[RTE_FLOW_ITEM_TYPE_UDP] = { sizeof(struct rte_flow_item_udp),
+				     &rte_flow_item_udp_mask, 0 },
+	[RTE_FLOW_ITEM_TYPE_TCP] = { sizeof(struct rte_flow_item_tcp),
+				     &rte_flow_item_tcp_mask, 0 },
+	[RTE_FLOW_ITEM_TYPE_GTP] = { sizeof(struct rte_flow_item_gtp),
+				     &rte_flow_item_gtp_mask, 0 },
+	[RTE_FLOW_ITEM_TYPE_GTP_PSC] = { sizeof(struct rte_flow_item_gtp_psc),
+					 &rte_flow_item_gtp_psc_mask, 0 },
+	[RTE_FLOW_ITEM_TYPE_MARK] = { sizeof(struct rte_flow_item_mark),
+				      &rte_flow_item_mark_mask, 1 },
+	[RTE_FLOW_ITEM_TYPE_TAG] = { sizeof(struct rte_flow_item_tag),
+				     &rte_flow_item_tag_mask, 1 },
+	[RTE_FLOW_ITEM_TYPE_META] = { sizeof(struct rte_flow_item_meta),
+				      &rte_flow_item_meta_mask, 1 },
+	[RTE_FLOW_ITEM_TYPE_PORT_ID] = { sizeof(struct rte_flow_item_port_id),
+					 &rte_flow_item_port_id_mask, 1 },
+};
+
+static struct vnf_prio_rule *prio_rules[RTE_MAX_ETHPORTS];
+static struct vnf_prio_rule prio_unchecked; /* Rules not kept. */
+static struct rte_hash *prio_flows; /* Flow handle to its rule. */
+static rte_spinlock_t prio_lock = RTE_SPINLOCK_INITIALIZER;
+static uint64_t nb_placed; /* Auto rules. */
+static uint64_t nb_moved; /* Auto rules off their specificity level. */
+static uint64_t nb_refused;
+static uint32_t nb_kept; /* Rules in the hash or being created. */
+static uint64_t nb_untracked; /* Created but not kept, a bug. */
+
+/* Items without VOID, masked spec, false for a rule which can't be kept. */
+static int
+prio_parse_items(struct vnf_prio_rule *r, const struct rte_flow_item pattern[])
+{
+	const struct prio_item_info *info;
+	const uint8_t *spec, *mask;
+	struct prio_item *it;
+	uint8_t pos = 0;
+	size_t i;
+
+	for (; pattern->type != RTE_FLOW_ITEM_TYPE_END; pattern++) {
+		if (pattern->type == RTE_FLOW_ITEM_TYPE_VOID)
+			continue;
+		if (r->nb_items == PRIO_ITEM_MAX)
+			return 0;
+		it = &r->items[r->nb_items++];
+		it->type = pattern->type;
+		info = (size_t)pattern->type < RTE_DIM(item_info) ?
+		       &item_info[pattern->type] : NULL;
+		it->meta = info && info->meta;
+		if (!it->meta)
+			it->pos = pos++;
+		r->bits += PRIO_ITEM_BITS;
+		if (info == NULL || !info->size || info->size > PRIO_ITEM_SIZE ||
+		    pattern->spec == NULL || pattern->last)
+			continue;
+		spec = pattern->spec;
+		mask = pattern->mask ? pattern->mask : info->mask;
+		it->len = info->size;
+		for (i = 0; i < info->size; i++) {
+			it->mask[i] = mask[i];
+			it->spec[i] = spec[i] & mask[i];
+			r->bits += __builtin_popcount(mask[i]);
+		}
+	}
+	return 1;
+}
+
+/* Rules with the same actions may overlap, the order doesn't matter. */
+static uint32_t
+prio_hash_actions(const struct rte_flow_action actions[])
+{
+	uint32_t hash = 0, conf;
+
+	for (; actions->type != RTE_FLOW_ACTION_TYPE_END; actions++) {
+		switch (actions->conf ? actions->type :
+			RTE_FLOW_ACTION_TYPE_VOID) {
+		case RTE_FLOW_ACTION_TYPE_VOID:
+			conf = 0;
+			break;
+		case RTE_FLOW_ACTION_TYPE_QUEUE:
+			conf = ((const struct rte_flow_action_queue *)
+				actions->conf)->index;
+			break;
+		case RTE_FLOW_ACTION_TYPE_JUMP:
+			conf = ((const struct rte_flow_action_jump *)
+				actions->conf)->group;
+			break;
+		case RTE_FLOW_ACTION_TYPE_MARK:
+			conf = ((const struct rte_flow_action_mark *)
+				actions->conf)->id;
+			break;
+		default:
+			/* Same configuration object, same action. */
+			conf = (uint32_t)(uintptr_t)actions->conf;
+			break;
+		}
+		hash = rte_hash_crc_4byte(actions->type, hash);
+		hash = rte_hash_crc_4byte(conf, hash);
+	}
+	return hash;
+}
+
+/* The item of r on the same header position or of the same meta type. */
+static const struct prio_item *
+prio_item_peer(const struct vnf_prio_rule *r, const struct prio_item *it)
+{
+	int i;
+
+	for (i = 0; i < r->nb_items; i++) {
+		if (it->meta ? r->items[i].type == it->type :
+		    !r->items[i].meta && r->items[i].pos == it->pos)
+			return &r->items[i];
+	}
+	return NULL;
+}
+
+/* Every packet of a matches b: each item of b is in a, masked as much. */
+static int
+prio_covers(const struct vnf_prio_rule *b, const struct vnf_prio_rule *a)
+{
+	const struct prio_item *ib, *ia;
+	int i, j;
+
+	for (i = 0; i < b->nb_items; i++) {
+		ib = &b->items[i];
+		ia = prio_item_peer(a, ib);
+		if (ia == NULL || ia->type != ib->type)
+			return 0;
+		for (j = 0; j < ib->len; j++)
+			if (ib->mask[j] & ~(j < ia->len ? ia->mask[j] : 0))
+				return 0;
+	}
+	return 1;
+}
+
+static enum prio_relation
+prio_relation(const struct vnf_prio_rule *n, const struct vnf_prio_rule *e)
+{
+	const struct prio_item *in, *ie;
+	int i, j, len, inside, around;
+
+	for (i = 0; i < n->nb_items; i++) {
+		in = &n->items[i];
+		ie = prio_item_peer(e, in);
+		if (ie == NULL)
+			continue;
+		if (ie->type != in->type)
+			return PRIO_DISJOINT;
+		len = RTE_MIN(in->len, ie->len);
+		for (j = 0; j < len; j++)
+			if ((in->spec[j] ^ ie->spec[j]) & in->mask[j] &
+			    ie->mask[j])
+				return PRIO_DISJOINT;
+	}
+	inside = prio_covers(e, n);
+	around = prio_covers(n, e);
+	if (inside && around)
+		return PRIO_SAME;
+	if (inside)
+		return PRIO_INSIDE;
+	return around ? PRIO_AROUND : PRIO_CROSS;
+}
+
+static void
+prio_unlink(struct vnf_prio_rule *r)
+{
+	if (r->prev)
+		r->prev->next = r->next;
+	else
+		prio_rules[r->port_id] = r->next;
+	if (r->next)
+		r->next->prev = r->prev;
+}
+
+static int
+prio_refuse(struct rte_flow_error *error, int code, const char *message)
+{
+	nb_refused++;
+	return rte_flow_error_set(error, code,
+				  RTE_FLOW_ERROR_TYPE_ATTR_PRIORITY, NULL,
+				  message);
+}
+
+/*
+ * Priority of n against the rules of its port, n->priority is set for an
+ * auto rule. Prio lock held.
+ */
+static int
+prio_place(struct vnf_prio_rule *n, int automatic,
+	   struct rte_flow_error *error)
+{
+	const struct vnf_prio_rule *e;
+	enum prio_relation rel;
+	int64_t lo = 0, hi = PRIO_LEVELS - 1, tier;
+
+	for (e = prio_rules[n->port_id]; e; e = e->next) {
+		if (e->group != n->group || !(e->domains & n->domains))
+			continue;
+		rel = prio_relation(n, e);
+		if (rel == PRIO_DISJOINT)
+			continue;
+		if (rel == PRIO_SAME)
+			return prio_refuse(error, EEXIST,
+					   "same match already in the table");
+		if (e->actions == n->actions)
+			continue;
+		if (rel == PRIO_CROSS) {
+			if (!automatic && n->priority == e->priority)
+				return prio_refuse(error, EEXIST,
+						   "overlapping rule of the same priority");
+			if (!automatic)
+				continue;
+			/* The more specific first, a new one after on a tie. */
+			rel = n->bits > e->bits ? PRIO_INSIDE : PRIO_AROUND;
+		}
+		if (rel == PRIO_INSIDE) {
+			if (!automatic && n->priority >= e->priority)
+				return prio_refuse(error, EEXIST,
+						   "shadowed by a wider rule");
+			hi = RTE_MIN(hi, (int64_t)e->priority - 1);
+		} else {
+			if (!automatic && n->priority <= e->priority)
+				return prio_refuse(error, EEXIST,
+						   "shadows a narrower rule");
+			lo = RTE_MAX(lo, (int64_t)e->priority + 1);
+		}
+	}
+	if (!automatic)
+		return 0;
+	if (lo > hi)
+		return prio_refuse(error, ENOSPC,
+				   "no priority left between the overlapping rules");
+	tier = PRIO_LEVELS - 1 -
+	       RTE_MIN(PRIO_LEVELS - 1, n->bits / PRIO_TIER_BITS);
+	n->priority = RTE_MIN(RTE_MAX(tier, lo), hi);
+	nb_placed++;
+	nb_moved += n->priority != tier;
+	return 0;
+}
+
+static int
+prio_hash_init(void)
+{
+	struct rte_hash_parameters params;
+
+	if (prio_flows)
+		return 0;
+	memset(&params, 0, sizeof(params));
+	params.name = "vnf_prio_flows";
+	params.entries = PRIO_HASH_SIZE;
+	params.key_len = sizeof(struct rte_flow *);
+	params.hash_func = rte_hash_crc;
+	params.socket_id = rte_socket_id();
+	params.extra_flag = RTE_HASH_EXTRA_FLAGS_EXT_TABLE;
+	prio_flows = rte_hash_create(&params);
+	return prio_flows ? 0 : -1;
+}
+
+/*
+ * Before a rule is created in its table: check it against the rules of
+ * the port and resolve an auto priority in attr. The rule is held until
+ * vnf_prio_commit(), the checks running meanwhile see it. NULL with error
+ * set when it is refused.
+ */
+struct vnf_prio_rule *
+vnf_prio_check(uint16_t port_id, struct rte_flow_attr *attr,
+	       const struct rte_flow_item pattern[],
+	       const struct rte_flow_action actions[],
+	       struct rte_flow_error *error)
+{
+	int automatic = attr->priority == VNF_FLOW_PRIO_AUTO;
+	struct vnf_prio_rule *r;
+
+	if (port_id >= RTE_MAX_ETHPORTS) {
+		rte_flow_error_set(error, EINVAL, RTE_FLOW_ERROR_TYPE_ATTR,
+				   NULL, "invalid port");
+		return NULL;
+	}
+	r = rte_zmalloc("vnf_prio_rule", sizeof(*r), 0);
+	if (r == NULL) {
+		rte_flow_error_set(error, ENOMEM,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "cannot allocate the priority of the rule");
+		return NULL;
+	}
+	r->port_id = port_id;
+	r->group = attr->group;
+	r->priority = attr->priority;
+	r->domains = attr->ingress | attr->egress << 1 | attr->transfer << 2;
+	r->actions = prio_hash_actions(actions);
+	if (!prio_parse_items(r, pattern)) {
+		/* Too many items to compare, created as is. */
+		if (automatic)
+			attr->priority = PRIO_LEVELS - 1;
+		rte_free(r);
+		return &prio_unchecked;
+	}
+	rte_spinlock_lock(&prio_lock);
+	if (prio_hash_init() ||
+	    (nb_kept >= PRIO_HASH_SIZE ?
+	     prio_refuse(error, ENOSPC, "too many rules to check") :
+	     prio_place(r, automatic, error))) {
+		if (prio_flows == NULL)
+			rte_flow_error_set(error, ENOMEM,
+					   RTE_FLOW_ERROR_TYPE_UNSPECIFIED,
+					   NULL, "cannot create priority hash");
+		rte_spinlock_unlock(&prio_lock);
+		rte_free(r);
+		return NULL;
+	}
+	/* The extendable hash holds all its entries, the add can't fail. */
+	nb_kept++;
+	r->next = prio_rules[port_id];
+	if (r->next)
+		r->next->prev = r;
+	prio_rules[port_id] = r;
+	rte_spinlock_unlock(&prio_lock);
+	attr->priority = r->priority;
+	return r;
+}
+
+/* The rule of vnf_prio_check() is created, flow NULL if it failed. */
+void
+vnf_prio_commit(struct vnf_prio_rule *r, struct rte_flow *flow)
+{
+	if (r == NULL || r == &prio_unchecked)
+		return;
+	rte_spinlock_lock(&prio_lock);
+	r->flow = flow;
+	if (flow && rte_hash_add_key_data(prio_flows, &flow, r) < 0) {
+		printf(":: rule of port %u group %u left out of the priority "
+		       "checks\n", r->port_id, r->group);
+		nb_untracked++;
+		flow = NULL;
+	}
+	if (flow == NULL) {
+		nb_kept--;
+		prio_unlink(r);
+		rte_free(r);
+	}
+	rte_spinlock_unlock(&prio_lock);
+}
+
+/* The rule is destroyed, called by the flow registry. */
+void
+vnf_prio_forget(struct rte_flow *flow)
+{
+	struct vnf_prio_rule *r;
+	void *data;
+
+	if (prio_flows == NULL || flow == NULL)
+		return;
+	rte_spinlock_lock(&prio_lock);
+	if (rte_hash_lookup_data(prio_flows, &flow, &data) >= 0) {
+		r = data;
+		rte_hash_del_key(prio_flows, &flow);
+		nb_kept--;
+		prio_unlink(r);
+		rte_free(r);
+	}
+	rte_spinlock_unlock(&prio_lock);
+}
+
+void
+vnf_prio_print(void)
+{
+	if (!nb_placed && !nb_refused && !nb_untracked)
+		return;
+	printf(":: flow priorities: %" PRIu64 " placed, %" PRIu64
+	       " moved for an overlap, %" PRIu64 " refused, %" PRIu64
+	       " not checked\n", nb_placed, nb_moved, nb_refused,
+	       nb_untracked);
+}
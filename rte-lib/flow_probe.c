@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_mtr.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Which of the offloads the app uses each port takes. The device ones
+ * (hairpin, meter, template API) are read from the capabilities before
+ * the ports are configured, the rule ones are tried with a validate of
+ * the kind of rule the app creates once the port is started, through the
+ * flow ops of the port so an emulated port reports what it emulates.
+ * A feature the port doesn't take runs in its software equivalent, a
+ * hardware one which fails later is moved there with
+ * vnf_feature_fallback(), nothing exits for a missing offload. The
+ * graph nodes only run with the graph, without it their features have no
+ * software path, printed as none.
+ */
+
+struct feature_info {
+	const char *name;
+	const char *sw; /* The software equivalent. */
+	uint8_t graph; /* The software equivalent is in the graph. */
+};
+
+static const struct feature_info features[VNF_FEAT_MAX] = {
+	[VNF_FEAT_GTP_MATCH] = { "gtp_match", "vnf_parse", 1 },
+	[VNF_FEAT_RAW_DECAP] = { "raw_decap", "vnf_gtpu_decap", 1 },
+	[VNF_FEAT_RAW_ENCAP] = { "raw_encap", "vnf_gtpu_encap", 1 },
+	[VNF_FEAT_HAIRPIN] = { "hairpin", "graph forwarding", 1 },
+	[VNF_FEAT_SAMPLE] = { "sample", "vnf_mirror", 1 },
+	[VNF_FEAT_METER] = { "meter", "vnf_meter", 1 },
+	[VNF_FEAT_AGE] = { "age", "no aging", 0 },
+	[VNF_FEAT_MODIFY_FIELD] = { "modify_field", "vnf_gtpu_encap", 1 },
+	[VNF_FEAT_TEMPLATE] = { "template", "rte_flow_create", 0 },
+	[VNF_FEAT_TRANSFER] = { "transfer", "ingress rules", 0 },
+};
+
+static const char * const path_names[] = {
+	[VNF_PATH_SW] = "sw",
+	[VNF_PATH_HW] = "hw",
+	[VNF_PATH_EMU] = "emu",
+};
+
+struct feature_port {
+	uint8_t probed;
+	uint8_t path[VNF_FEAT_MAX];
+};
+
+static struct feature_port feature_ports[RTE_MAX_ETHPORTS];
+static int feature_graph; /* The graph runs. */
+
+/* Whether the graph, and so the software path of its features, runs. */
+void
+vnf_feature_graph_set(int on)
+{
+	feature_graph = on;
+}
+
+static const char *
+feature_sw(enum vnf_feature feat)
+{
+	if (features[feat].graph && !feature_graph)
+		return "none";
+	return features[feat].sw;
+}
+
+static void
+feature_set(uint16_t port_id, enum vnf_feature feat, int ok)
+{
+	if (!ok)
+		feature_ports[port_id].path[feat] = VNF_PATH_SW;
+	else if (vnf_flow_swemu_attached(port_id))
+		feature_ports[port_id].path[feat] = VNF_PATH_EMU;
+	else
+		feature_ports[port_id].path[feat] = VNF_PATH_HW;
+}
+
+/*
+ * Before the port is configured, hairpin queues are counted in the
+ * configuration so they must be known first.
+ */
+int
+vnf_feature_probe_dev(uint16_t port_id)
+{
+	struct rte_eth_hairpin_cap hairpin_cap;
+	struct rte_mtr_capabilities mtr_cap;
+	struct rte_mtr_error mtr_error;
+	struct rte_flow_port_info port_info;
+	struct rte_flow_queue_info queue_info;
+	struct rte_flow_error error;
+	const struct vnf_flow_ops *ops;
+
+	if (!rte_eth_dev_is_valid_port(port_id))
+		return -1;
+	memset(&hairpin_cap, 0, sizeof(hairpin_cap));
+	feature_set(port_id, VNF_FEAT_HAIRPIN,
+		    !rte_eth_dev_hairpin_capability_get(port_id, &hairpin_cap) &&
+		    hairpin_cap.max_nb_queues > 0);
+	memset(&mtr_cap, 0, sizeof(mtr_cap));
+	feature_set(port_id, VNF_FEAT_METER,
+		    !rte_mtr_capabilities_get(port_id, &mtr_cap, &mtr_error) &&
+		    mtr_cap.n_max > 0);
+	ops = vnf_flow_ops_get(port_id);
+	memset(&port_info, 0, sizeof(port_info));
+	feature_set(port_id, VNF_FEAT_TEMPLATE, ops->info_get &&
+		    !ops->info_get(port_id, &port_info, &queue_info, &error) &&
+		    port_info.max_nb_queues > 0);
+	feature_ports[port_id].probed = 1;
+	return 0;
+}
+
+/* eth / ipv4 / udp / gtp teid is 1234 */
+static void
+probe_gtp_pattern(struct vnf_flow_builder *fb)
+{
+	struct rte_flow_item_gtp gtp_spec = { .teid = RTE_BE32(1234) };
+	struct rte_flow_item_gtp gtp_mask = { .teid = RTE_BE32(0xffffffff) };
+
+	vnf_flow_builder_init(fb);
+	vnf_flow_item_eth(fb, NULL, NULL);
+	vnf_flow_item_ipv4(fb, NULL, NULL);
+	vnf_flow_item_udp(fb, NULL, NULL);
+	vnf_flow_item_gtp(fb, &gtp_spec, &gtp_mask);
+}
+
+static int
+probe_validate(uint16_t port_id, const struct rte_flow_attr *attr,
+	       struct vnf_flow_builder *fb)
+{
+	struct rte_flow_error error;
+
+	return vnf_flow_builder_validate(port_id, attr, fb, &error) == 0;
+}
+
+/*
+ * On the started port, the flow ops of the port validate a rule of each
+ * kind, nothing is created.
+ */
+int
+vnf_feature_probe_flows(uint16_t port_id)
+{
+	struct rte_flow_attr ingress = { .group = 1, .ingress = 1 };
+	struct rte_flow_attr egress = { .group = 0, .egress = 1 };
+	struct rte_flow_attr transfer = { .group = 0, .transfer = 1 };
+	struct rte_flow_action_queue queue = { .index = 0 };
+	struct rte_flow_action sample_actions[] = {
+		[0] = {
+			.type = RTE_FLOW_ACTION_TYPE_QUEUE,
+			.conf = &queue,
+		},
+		[1] = {
+			.type = RTE_FLOW_ACTION_TYPE_END,
+		},
+	};
+	struct rte_flow_action_sample sample = {
+		.ratio = 1,
+		.actions = sample_actions,
+	};
+	struct rte_flow_action_age age = { .timeout = 10 };
+	struct rte_flow_action_modify_field modify = {
+		.operation = RTE_FLOW_MODIFY_SET,
+		.dst = { .field = RTE_FLOW_FIELD_GTP_TEID },
+		.src = { .field = RTE_FLOW_FIELD_VALUE },
+		.width = 32,
+	};
+	struct rte_ether_hdr eth = {
+		.ether_type = RTE_BE16(RTE_ETHER_TYPE_IPV4),
+	};
+	uint8_t gtp_hdr[GTP_U_ENCAP_HDR_MAX_LEN];
+	size_t gtp_size = gtp_u_encap_hdr_build(gtp_hdr, 0);
+	struct vnf_flow_builder fb;
+
+	if (!feature_ports[port_id].probed && vnf_feature_probe_dev(port_id))
+		return -1;
+	/* The emulation meters by itself and has no hairpin queue. */
+	if (vnf_flow_swemu_attached(port_id)) {
+		feature_set(port_id, VNF_FEAT_HAIRPIN, 0);
+		feature_set(port_id, VNF_FEAT_METER, 1);
+	}
+
+	/* testpmd> flow validate 0 group 1 ingress pattern eth / ipv4 / udp /
+	 * gtp teid is 1234 / end actions queue index 0 / end
+	 */
+	probe_gtp_pattern(&fb);
+	vnf_flow_action_queue(&fb, 0);
+	feature_set(port_id, VNF_FEAT_GTP_MATCH,
+		    probe_validate(port_id, &ingress, &fb));
+
+	/* ... actions raw_decap index 0 / raw_encap index 1 / queue index 0 */
+	probe_gtp_pattern(&fb);
+	vnf_flow_action_raw_decap(&fb, gtp_hdr, gtp_size);
+	vnf_flow_action_raw_encap(&fb, (const uint8_t *)&eth, sizeof(eth));
+	vnf_flow_action_queue(&fb, 0);
+	feature_set(port_id, VNF_FEAT_RAW_DECAP,
+		    probe_validate(port_id, &ingress, &fb));
+
+	/* testpmd> flow validate 0 egress pattern eth / ipv4 / end
+	 * actions raw_decap index 0 / raw_encap index 1 / end
+	 */
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	vnf_flow_action_raw_decap(&fb, (const uint8_t *)&eth, sizeof(eth));
+	vnf_flow_action_raw_encap(&fb, gtp_hdr, gtp_size);
+	feature_set(port_id, VNF_FEAT_RAW_ENCAP,
+		    probe_validate(port_id, &egress, &fb));
+
+	/* ... pattern eth / end actions sample ratio 1 index 0 / queue index 0 */
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_action(&fb, RTE_FLOW_ACTION_TYPE_SAMPLE, &sample,
+			sizeof(sample));
+	vnf_flow_action_queue(&fb, 0);
+	feature_set(port_id, VNF_FEAT_SAMPLE,
+		    probe_validate(port_id, &ingress, &fb));
+
+	/* ... pattern eth / ipv4 / end actions age timeout 10 / queue index 0 */
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	vnf_flow_action(&fb, RTE_FLOW_ACTION_TYPE_AGE, &age, sizeof(age));
+	vnf_flow_action_queue(&fb, 0);
+	feature_set(port_id, VNF_FEAT_AGE,
+		    probe_validate(port_id, &ingress, &fb));
+
+	/* ... actions modify_field op set dst_type gtp_teid src_type value
+	 * width 32 / queue index 0
+	 */
+	probe_gtp_pattern(&fb);
+	vnf_flow_action(&fb, RTE_FLOW_ACTION_TYPE_MODIFY_FIELD, &modify,
+			sizeof(modify));
+	vnf_flow_action_queue(&fb, 0);
+	feature_set(port_id, VNF_FEAT_MODIFY_FIELD,
+		    probe_validate(port_id, &ingress, &fb));
+
+	/* testpmd> flow validate 0 transfer pattern eth / end
+	 * actions jump group 1 / end
+	 */
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_action_jump(&fb, vnf_table_group("classify"));
+	feature_set(port_id, VNF_FEAT_TRANSFER,
+		    probe_validate(port_id, &transfer, &fb));
+	return 0;
+}
+
+enum vnf_path
+vnf_feature_path(uint16_t port_id, enum vnf_feature feat)
+{
+	if (port_id >= RTE_MAX_ETHPORTS || feat >= VNF_FEAT_MAX)
+		return VNF_PATH_SW;
+	return feature_ports[port_id].path[feat];
+}
+
+/* The rules of the feature are taken by the port, NIC or emulation. */
+int
+vnf_feature_hw(uint16_t port_id, enum vnf_feature feat)
+{
+	return vnf_feature_path(port_id, feat) != VNF_PATH_SW;
+}
+
+/* A hardware feature which failed past the probe, run it in software. */
+void
+vnf_feature_fallback(uint16_t port_id, enum vnf_feature feat)
+{
+	if (!vnf_feature_hw(port_id, feat))
+		return;
+	feature_ports[port_id].path[feat] = VNF_PATH_SW;
+	printf(":: port %u %s falls back to %s\n", port_id,
+	       features[feat].name, feature_sw(feat));
+}
+
+void
+vnf_feature_print(void)
+{
+	uint16_t port_id;
+	int feat, unserved = 0;
+
+	printf(":: capability matrix\n%-14s", "feature");
+	RTE_ETH_FOREACH_DEV(port_id)
+		printf(" port %-3u", port_id);
+	printf(" software path\n");
+	for (feat = 0; feat < VNF_FEAT_MAX; feat++) {
+		printf("%-14s", features[feat].name);
+		RTE_ETH_FOREACH_DEV(port_id) {
+			printf(" %-8s", path_names[vnf_feature_path(port_id,
+							feat)]);
+			if (!vnf_feature_hw(port_id, feat) &&
+			    features[feat].graph && !feature_graph)
+				unserved = 1;
+		}
+		printf(" %s\n", feature_sw(feat));
+	}
+	if (unserved)
+		printf(":: warn: the sw features with no software path need "
+		       "--graph\n");
+}
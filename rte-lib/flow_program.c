@@ -0,0 +1,1354 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_errno.h>
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_lcore.h>
+#include <rte_launch.h>
+#include <rte_cycles.h>
+#include <rte_hash_crc.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Flow program: the rules of a text file in the testpmd syntax the
+ * examples document, one "flow create" command per rule, on one or more
+ * lines, # starting a comment:
+ *
+ * flow create 0 table classify priority 1 ingress
+ *      pattern eth / ipv4 / udp dst is 2152 / gtp teid is 1234 / end
+ *      actions count / raw_decap gtp_u / raw_encap eth / queue index 0 / end
+ *
+ * "table <name>" puts the rule in the group of a table of flow_table.c,
+ * whose jump vnf_table_install() made, "group <n>" is taken as is.
+ *
+ * Indirect actions the rules refer to may be declared before them:
+ *
+ * flow indirect_action 0 create action_id 100 ingress
+ *      action rss level 2 types ip end / end
+ *
+ * The whole file is parsed first, a syntax error stops the load before
+ * any rule is created. Each rule is then validated and created, the idle
+ * lcores sharing the rules. A rejected rule is reported with its line and
+ * the others are kept. Rules are registered as VNF_FLOW_OWNER_PROGRAM,
+ * their cookie is a hash of their text, the match part above the actions
+ * part, so the same rule in the next version of the file has the same
+ * cookie wherever it is.
+ *
+ * vnf_flow_program_reconcile() applies the next version to the running
+ * rules: only the new rules are created and the rules gone from the file
+ * destroyed, the indirect actions declared with another configuration are
+ * updated in place. A rule with the same match as a gone one replaces it
+ * make before break: a copy one priority level before it first, the old
+ * rule removed, the rule at its own priority, then the copy removed, the
+ * packets always hit one of them.
+ */
+
+#define PROG_CONF_MAX 64 /* Largest item spec or action conf. */
+#define PROG_RSS_QUEUES_MAX 64
+#define PROG_MATCH_BITS 31
+#define PROG_ACTIONS_BITS 24
+#define PROG_COOKIE_COPY (1ull << (PROG_MATCH_BITS + PROG_ACTIONS_BITS))
+#define PROG_COOKIE(match, actions) \
+	VNF_FLOW_COOKIE(VNF_FLOW_OWNER_PROGRAM, \
+		((uint64_t)((match) & ((1u << PROG_MATCH_BITS) - 1)) << \
+		 PROG_ACTIONS_BITS) | \
+		((actions) & ((1u << PROG_ACTIONS_BITS) - 1)))
+#define PROG_COOKIE_MATCH(cookie) \
+	(((cookie) >> PROG_ACTIONS_BITS) & ((1u << PROG_MATCH_BITS) - 1))
+
+struct prog_tok {
+	const char *s;
+	uint32_t line;
+};
+
+struct prog_rule;
+
+struct prog_parser {
+	const char *path;
+	struct prog_tok *toks;
+	uint32_t nb_toks;
+	uint32_t cur;
+	/* Indirect actions of the file not created yet are taken. */
+	int dry_run;
+	const struct prog_rule *rules; /* Parsed so far. */
+	uint32_t nb_rules;
+};
+
+/* A rule, or the declaration of an indirect action. */
+struct prog_rule {
+	struct vnf_flow_builder fb;
+	struct rte_flow_attr attr;
+	uint64_t cookie; /* Hash of the text for an indirect action. */
+	uint32_t line;
+	uint32_t handle_id;
+	uint16_t port_id;
+	uint8_t is_handle;
+	uint8_t created;
+	int status; /* Of the validation, or of the creation. */
+	const char *message;
+};
+
+/* The text of the indirect actions the program created, 0 for none. */
+static uint64_t prog_handles[RTE_MAX_ETHPORTS][VNF_FLOW_HANDLE_MAX];
+
+enum prog_kind {
+	PROG_CPU, /* Integer in CPU order. */
+	PROG_BE, /* Integer in network order. */
+	PROG_IPV4,
+	PROG_IPV6,
+	PROG_MAC,
+	PROG_QFI, /* Bit fields. */
+	PROG_PDU_TYPE,
+	PROG_AGE_TIMEOUT,
+};
+
+struct prog_field {
+	const char *name;
+	uint16_t off;
+	uint8_t size;
+	uint8_t kind;
+};
+
+#define PROG_FIELD(n, s, f, k) \
+	{ n, offsetof(s, f), sizeof(((s *)0)->f), k }
+
+static const struct prog_field eth_fields[] = {
+	PROG_FIELD("dst", struct rte_flow_item_eth, dst, PROG_MAC),
+	PROG_FIELD("src", struct rte_flow_item_eth, src, PROG_MAC),
+	PROG_FIELD("type", struct rte_flow_item_eth, type, PROG_BE),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field vlan_fields[] = {
+	PROG_FIELD("tci", struct rte_flow_item_vlan, tci, PROG_BE),
+	PROG_FIELD("inner_type", struct rte_flow_item_vlan, inner_type,
+		   PROG_BE),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field ipv4_fields[] = {
+	PROG_FIELD("src", struct rte_flow_item_ipv4, hdr.src_addr, PROG_IPV4),
+	PROG_FIELD("dst", struct rte_flow_item_ipv4, hdr.dst_addr, PROG_IPV4),
+	PROG_FIELD("proto", struct rte_flow_item_ipv4, hdr.next_proto_id,
+		   PROG_BE),
+	PROG_FIELD("tos", struct rte_flow_item_ipv4, hdr.type_of_service,
+		   PROG_BE),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field ipv6_fields[] = {
+	PROG_FIELD("src", struct rte_flow_item_ipv6, hdr.src_addr, PROG_IPV6),
+	PROG_FIELD("dst", struct rte_flow_item_ipv6, hdr.dst_addr, PROG_IPV6),
+	PROG_FIELD("proto", struct rte_flow_item_ipv6, hdr.proto, PROG_BE),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field udp_fields[] = {
+	PROG_FIELD("src", struct rte_flow_item_udp, hdr.src_port, PROG_BE),
+	PROG_FIELD("dst", struct rte_flow_item_udp, hdr.dst_port, PROG_BE),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field tcp_fields[] = {
+	PROG_FIELD("src", struct rte_flow_item_tcp, hdr.src_port, PROG_BE),
+	PROG_FIELD("dst", struct rte_flow_item_tcp, hdr.dst_port, PROG_BE),
+	PROG_FIELD("flags", struct rte_flow_item_tcp, hdr.tcp_flags, PROG_BE),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field gtp_fields[] = {
+	PROG_FIELD("teid", struct rte_flow_item_gtp, teid, PROG_BE),
+	PROG_FIELD("msg_type", struct rte_flow_item_gtp, msg_type, PROG_BE),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field gtp_psc_fields[] = {
+	{ "qfi", 0, 1, PROG_QFI },
+	{ "pdu_t", 0, 1, PROG_PDU_TYPE },
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field gre_fields[] = {
+	PROG_FIELD("protocol", struct rte_flow_item_gre, protocol, PROG_BE),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field tag_fields[] = {
+	PROG_FIELD("data", struct rte_flow_item_tag, data, PROG_CPU),
+	PROG_FIELD("index", struct rte_flow_item_tag, index, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field mark_fields[] = {
+	PROG_FIELD("id", struct rte_flow_item_mark, id, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field meta_fields[] = {
+	PROG_FIELD("data", struct rte_flow_item_meta, data, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+struct prog_item {
+	const char *name;
+	enum rte_flow_item_type type;
+	size_t size;
+	const struct prog_field *fields;
+};
+
+static const struct prog_item prog_items[] = {
+	{ "eth", RTE_FLOW_ITEM_TYPE_ETH, sizeof(struct rte_flow_item_eth),
+	  eth_fields },
+	{ "vlan", RTE_FLOW_ITEM_TYPE_VLAN, sizeof(struct rte_flow_item_vlan),
+	  vlan_fields },
+	{ "ipv4", RTE_FLOW_ITEM_TYPE_IPV4, sizeof(struct rte_flow_item_ipv4),
+	  ipv4_fields },
+	{ "ipv6", RTE_FLOW_ITEM_TYPE_IPV6, sizeof(struct rte_flow_item_ipv6),
+	  ipv6_fields },
+	{ "udp", RTE_FLOW_ITEM_TYPE_UDP, sizeof(struct rte_flow_item_udp),
+	  udp_fields },
+	{ "tcp", RTE_FLOW_ITEM_TYPE_TCP, sizeof(struct rte_flow_item_tcp),
+	  tcp_fields },
+	{ "gtp", RTE_FLOW_ITEM_TYPE_GTP, sizeof(struct rte_flow_item_gtp),
+	  gtp_fields },
+	{ "gtpu", RTE_FLOW_ITEM_TYPE_GTPU, sizeof(struct rte_flow_item_gtp),
+	  gtp_fields },
+	{ "gtp_psc", RTE_FLOW_ITEM_TYPE_GTP_PSC,
+	  sizeof(struct rte_flow_item_gtp_psc), gtp_psc_fields },
+	{ "gre", RTE_FLOW_ITEM_TYPE_GRE, sizeof(struct rte_flow_item_gre),
+	  gre_fields },
+	{ "tag", RTE_FLOW_ITEM_TYPE_TAG, sizeof(struct rte_flow_item_tag),
+	  tag_fields },
+	{ "mark", RTE_FLOW_ITEM_TYPE_MARK, sizeof(struct rte_flow_item_mark),
+	  mark_fields },
+	{ "meta", RTE_FLOW_ITEM_TYPE_META, sizeof(struct rte_flow_item_meta),
+	  meta_fields },
+};
+
+static const struct prog_field queue_fields[] = {
+	PROG_FIELD("index", struct rte_flow_action_queue, index, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field mark_action_fields[] = {
+	PROG_FIELD("id", struct rte_flow_action_mark, id, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field jump_fields[] = {
+	PROG_FIELD("group", struct rte_flow_action_jump, group, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field set_tag_fields[] = {
+	PROG_FIELD("data", struct rte_flow_action_set_tag, data, PROG_CPU),
+	PROG_FIELD("mask", struct rte_flow_action_set_tag, mask, PROG_CPU),
+	PROG_FIELD("index", struct rte_flow_action_set_tag, index, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field set_meta_fields[] = {
+	PROG_FIELD("data", struct rte_flow_action_set_meta, data, PROG_CPU),
+	PROG_FIELD("mask", struct rte_flow_action_set_meta, mask, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field meter_fields[] = {
+	PROG_FIELD("mtr_id", struct rte_flow_action_meter, mtr_id, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field age_fields[] = {
+	{ "timeout", 0, 4, PROG_AGE_TIMEOUT },
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field port_id_fields[] = {
+	PROG_FIELD("id", struct rte_flow_action_port_id, id, PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+static const struct prog_field ethdev_fields[] = {
+	PROG_FIELD("ethdev_port_id", struct rte_flow_action_ethdev, port_id,
+		   PROG_CPU),
+	{ NULL, 0, 0, 0 },
+};
+
+struct prog_parser;
+struct prog_action;
+
+typedef int (*prog_action_parse_t)(struct prog_parser *p,
+				   struct prog_rule *rule,
+				   const struct prog_action *pa);
+
+struct prog_action {
+	const char *name;
+	enum rte_flow_action_type type;
+	size_t size; /* 0 for no conf. */
+	const struct prog_field *fields;
+	prog_action_parse_t parse; /* Instead of the fields. */
+};
+
+static int prog_parse_rss(struct prog_parser *p, struct prog_rule *rule,
+			  const struct prog_action *pa);
+static int prog_parse_raw(struct prog_parser *p, struct prog_rule *rule,
+			  const struct prog_action *pa);
+static int prog_parse_indirect(struct prog_parser *p, struct prog_rule *rule,
+			       const struct prog_action *pa);
+
+static const struct prog_action prog_actions[] = {
+	{ "drop", RTE_FLOW_ACTION_TYPE_DROP, 0, NULL, NULL },
+	{ "count", RTE_FLOW_ACTION_TYPE_COUNT, 0, NULL, NULL },
+	{ "queue", RTE_FLOW_ACTION_TYPE_QUEUE,
+	  sizeof(struct rte_flow_action_queue), queue_fields, NULL },
+	{ "mark", RTE_FLOW_ACTION_TYPE_MARK,
+	  sizeof(struct rte_flow_action_mark), mark_action_fields, NULL },
+	{ "jump", RTE_FLOW_ACTION_TYPE_JUMP,
+	  sizeof(struct rte_flow_action_jump), jump_fields, NULL },
+	{ "set_tag", RTE_FLOW_ACTION_TYPE_SET_TAG,
+	  sizeof(struct rte_flow_action_set_tag), set_tag_fields, NULL },
+	{ "set_meta", RTE_FLOW_ACTION_TYPE_SET_META,
+	  sizeof(struct rte_flow_action_set_meta), set_meta_fields, NULL },
+	{ "meter", RTE_FLOW_ACTION_TYPE_METER,
+	  sizeof(struct rte_flow_action_meter), meter_fields, NULL },
+	{ "age", RTE_FLOW_ACTION_TYPE_AGE,
+	  sizeof(struct rte_flow_action_age), age_fields, NULL },
+	{ "port_id", RTE_FLOW_ACTION_TYPE_PORT_ID,
+	  sizeof(struct rte_flow_action_port_id), port_id_fields, NULL },
+	{ "represented_port", RTE_FLOW_ACTION_TYPE_REPRESENTED_PORT,
+	  sizeof(struct rte_flow_action_ethdev), ethdev_fields, NULL },
+	{ "rss", RTE_FLOW_ACTION_TYPE_RSS, 0, NULL, prog_parse_rss },
+	{ "raw_decap", RTE_FLOW_ACTION_TYPE_RAW_DECAP, 0, NULL,
+	  prog_parse_raw },
+	{ "raw_encap", RTE_FLOW_ACTION_TYPE_RAW_ENCAP, 0, NULL,
+	  prog_parse_raw },
+	{ "indirect", RTE_FLOW_ACTION_TYPE_INDIRECT, 0, NULL,
+	  prog_parse_indirect },
+};
+
+static const struct {
+	const char *name;
+	uint64_t types;
+} prog_rss_types[] = {
+	{ "ip", RTE_ETH_RSS_IP },
+	{ "ipv4", RTE_ETH_RSS_IPV4 },
+	{ "ipv6", RTE_ETH_RSS_IPV6 },
+	{ "udp", RTE_ETH_RSS_UDP },
+	{ "tcp", RTE_ETH_RSS_TCP },
+	{ "gtpu", RTE_ETH_RSS_GTPU },
+	{ "l3-src-only", RTE_ETH_RSS_L3_SRC_ONLY },
+	{ "l3-dst-only", RTE_ETH_RSS_L3_DST_ONLY },
+	{ "l4-src-only", RTE_ETH_RSS_L4_SRC_ONLY },
+	{ "l4-dst-only", RTE_ETH_RSS_L4_DST_ONLY },
+};
+
+static int
+prog_error(const struct prog_parser *p, const char *fmt, ...)
+{
+	uint32_t cur = RTE_MIN(p->cur, p->nb_toks - 1);
+	va_list ap;
+
+	printf("%s:%u: ", p->path, p->nb_toks ? p->toks[cur].line : 0);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+	return -1;
+}
+
+static const char *
+prog_peek(const struct prog_parser *p)
+{
+	return p->cur < p->nb_toks ? p->toks[p->cur].s : NULL;
+}
+
+/* The next token, "" at the end of the file. */
+static const char *
+prog_next(struct prog_parser *p)
+{
+	const char *s = prog_peek(p);
+
+	if (s == NULL)
+		return "";
+	p->cur++;
+	return s;
+}
+
+static int
+prog_expect(struct prog_parser *p, const char *s)
+{
+	const char *tok = prog_next(p);
+
+	if (strcmp(tok, s))
+		return prog_error(p, "expected \"%s\", got \"%s\"", s, tok);
+	return 0;
+}
+
+static int
+prog_u64(struct prog_parser *p, const char *tok, uint64_t max, uint64_t *v)
+{
+	char *end;
+
+	errno = 0;
+	*v = strtoull(tok, &end, 0);
+	if (!*tok || *end || errno || *v > max)
+		return prog_error(p, "\"%s\" is not a number up to %"PRIu64,
+				  tok, max);
+	return 0;
+}
+
+/* Field of buf from the token, or all its bits for a full mask. */
+static int
+prog_field_set(struct prog_parser *p, const struct prog_field *f,
+	       uint8_t *buf, const char *tok)
+{
+	struct rte_flow_item_gtp_psc *psc = (void *)buf;
+	struct rte_flow_action_age *age = (void *)buf;
+	uint8_t *dst = buf + f->off;
+	uint64_t v;
+
+	switch (f->kind) {
+	case PROG_CPU:
+	case PROG_BE:
+		if (tok == NULL) {
+			memset(dst, 0xff, f->size);
+			return 0;
+		}
+		if (prog_u64(p, tok, f->size == 8 ? UINT64_MAX :
+			     (1ULL << (f->size * 8)) - 1, &v))
+			return -1;
+		if (f->size == 1)
+			*dst = v;
+		else if (f->size == 2)
+			*(uint16_t *)dst = f->kind == PROG_BE ?
+					   rte_cpu_to_be_16(v) : v;
+		else if (f->size == 4)
+			*(uint32_t *)dst = f->kind == PROG_BE ?
+					   rte_cpu_to_be_32(v) : v;
+		else
+			*(uint64_t *)dst = f->kind == PROG_BE ?
+					   rte_cpu_to_be_64(v) : v;
+		return 0;
+	case PROG_IPV4:
+	case PROG_IPV6:
+		if (tok == NULL) {
+			memset(dst, 0xff, f->size);
+			return 0;
+		}
+		if (inet_pton(f->kind == PROG_IPV4 ? AF_INET : AF_INET6, tok,
+			      dst) != 1)
+			return prog_error(p, "\"%s\" is not an IP address",
+					  tok);
+		return 0;
+	case PROG_MAC:
+		if (tok == NULL) {
+			memset(dst, 0xff, f->size);
+			return 0;
+		}
+		if (rte_ether_unformat_addr(tok, (struct rte_ether_addr *)dst))
+			return prog_error(p, "\"%s\" is not a MAC address",
+					  tok);
+		return 0;
+	case PROG_QFI:
+		if (tok && prog_u64(p, tok, 0x3f, &v))
+			return -1;
+		psc->hdr.qfi = tok ? v : 0x3f;
+		return 0;
+	case PROG_PDU_TYPE:
+		if (tok && prog_u64(p, tok, 0xf, &v))
+			return -1;
+		psc->hdr.type = tok ? v : 0xf;
+		return 0;
+	case PROG_AGE_TIMEOUT:
+		if (prog_u64(p, tok ? tok : "", 0xffffff, &v))
+			return -1;
+		age->timeout = v;
+		return 0;
+	}
+	return -1;
+}
+
+static const struct prog_field *
+prog_field_find(const struct prog_field *fields, const char *name)
+{
+	for (; fields && fields->name; fields++)
+		if (!strcmp(fields->name, name))
+			return fields;
+	return NULL;
+}
+
+/* <item> [<field> is|spec|mask <value>]... / */
+static int
+prog_parse_item(struct prog_parser *p, struct prog_rule *rule,
+		const char *name)
+{
+	uint64_t spec[PROG_CONF_MAX / sizeof(uint64_t)] = {0};
+	uint64_t mask[PROG_CONF_MAX / sizeof(uint64_t)] = {0};
+	const struct prog_item *pi = NULL;
+	const struct prog_field *f;
+	int has_spec = 0, has_mask = 0;
+	const char *tok, *op;
+	unsigned int i;
+
+	for (i = 0; i < RTE_DIM(prog_items); i++)
+		if (!strcmp(prog_items[i].name, name))
+			pi = &prog_items[i];
+	if (pi == NULL)
+		return prog_error(p, "unknown item \"%s\"", name);
+	while (strcmp(tok = prog_next(p), "/")) {
+		f = prog_field_find(pi->fields, tok);
+		if (f == NULL)
+			return prog_error(p, "unknown field \"%s\" of %s", tok,
+					  name);
+		op = prog_next(p);
+		if (!strcmp(op, "is")) {
+			if (prog_field_set(p, f, (uint8_t *)spec,
+					   prog_next(p)) ||
+			    prog_field_set(p, f, (uint8_t *)mask, NULL))
+				return -1;
+			has_spec = has_mask = 1;
+		} else if (!strcmp(op, "spec")) {
+			if (prog_field_set(p, f, (uint8_t *)spec,
+					   prog_next(p)))
+				return -1;
+			has_spec = 1;
+		} else if (!strcmp(op, "mask")) {
+			if (prog_field_set(p, f, (uint8_t *)mask,
+					   prog_next(p)))
+				return -1;
+			has_mask = 1;
+		} else {
+			return prog_error(p, "expected is, spec or mask after "
+					  "\"%s\", got \"%s\"", tok, op);
+		}
+	}
+	/* Without a mask the item takes its default one. */
+	if (vnf_flow_item(&rule->fb, pi->type, has_spec ? spec : NULL,
+			  has_mask ? mask : NULL, pi->size))
+		return prog_error(p, "too many items");
+	return 0;
+}
+
+/* rss [level <n>] [types <type>... end] [queues <queue>... end] / */
+static int
+prog_parse_rss(struct prog_parser *p, struct prog_rule *rule,
+	       const struct prog_action *pa)
+{
+	struct rte_flow_action_rss rss;
+	uint16_t queues[PROG_RSS_QUEUES_MAX];
+	const char *tok;
+	unsigned int i;
+	uint64_t v;
+
+	RTE_SET_USED(pa);
+	memset(&rss, 0, sizeof(rss));
+	rss.queue = queues;
+	while (strcmp(tok = prog_next(p), "/")) {
+		if (!strcmp(tok, "level")) {
+			if (prog_u64(p, prog_next(p), 2, &v))
+				return -1;
+			rss.level = v;
+		} else if (!strcmp(tok, "types")) {
+			while (strcmp(tok = prog_next(p), "end")) {
+				for (i = 0; i < RTE_DIM(prog_rss_types); i++)
+					if (!strcmp(prog_rss_types[i].name,
+						    tok))
+						break;
+				if (i == RTE_DIM(prog_rss_types))
+					return prog_error(p, "unknown RSS type"
+							  " \"%s\"", tok);
+				rss.types |= prog_rss_types[i].types;
+			}
+		} else if (!strcmp(tok, "queues")) {
+			while (strcmp(tok = prog_next(p), "end")) {
+				if (rss.queue_num == PROG_RSS_QUEUES_MAX)
+					return prog_error(p, "too many RSS "
+							  "queues");
+				if (prog_u64(p, tok, UINT16_MAX, &v))
+					return -1;
+				queues[rss.queue_num++] = v;
+			}
+		} else {
+			return prog_error(p, "unknown rss field \"%s\"", tok);
+		}
+	}
+	if (vnf_flow_action_rss(&rule->fb, &rss))
+		return prog_error(p, "too many actions");
+	return 0;
+}
+
+/* raw_decap|raw_encap eth|gtp_u|gtp_u_psc / */
+static int
+prog_parse_raw(struct prog_parser *p, struct prog_rule *rule,
+	       const struct prog_action *pa)
+{
+	uint8_t buf[GTP_U_ENCAP_HDR_MAX_LEN];
+	const char *tok = prog_next(p);
+	size_t size;
+	int ret;
+
+	memset(buf, 0, sizeof(buf));
+	if (!strcmp(tok, "eth"))
+		size = sizeof(struct rte_ether_hdr);
+	else if (!strcmp(tok, "gtp_u"))
+		size = gtp_u_encap_hdr_build(buf, 0);
+	else if (!strcmp(tok, "gtp_u_psc"))
+		size = gtp_u_encap_hdr_build(buf, 1);
+	else
+		return prog_error(p, "%s takes eth, gtp_u or gtp_u_psc, not "
+				  "\"%s\"", pa->name, tok);
+	if (pa->type == RTE_FLOW_ACTION_TYPE_RAW_DECAP)
+		ret = vnf_flow_action_raw_decap(&rule->fb, buf, size);
+	else
+		ret = vnf_flow_action_raw_encap(&rule->fb, buf, size);
+	if (ret)
+		return prog_error(p, "too many actions");
+	return prog_expect(p, "/");
+}
+
+/* Declared above in the file, created once the file is parsed. */
+static int
+prog_handle_declared(const struct prog_parser *p, uint16_t port_id,
+		     uint32_t id)
+{
+	uint32_t i;
+
+	for (i = 0; i < p->nb_rules; i++)
+		if (p->rules[i].is_handle && p->rules[i].port_id == port_id &&
+		    p->rules[i].handle_id == id)
+			return 1;
+	return 0;
+}
+
+/* indirect <action_id> / */
+static int
+prog_parse_indirect(struct prog_parser *p, struct prog_rule *rule,
+		    const struct prog_action *pa)
+{
+	struct rte_flow_action_handle *handle;
+	uint64_t id;
+
+	RTE_SET_USED(pa);
+	if (rule->is_handle)
+		return prog_error(p, "indirect action of an indirect action");
+	if (prog_u64(p, prog_next(p), VNF_FLOW_HANDLE_MAX - 1, &id))
+		return -1;
+	handle = vnf_flow_handle_get(rule->port_id, id);
+	if (handle == NULL &&
+	    !(p->dry_run && prog_handle_declared(p, rule->port_id, id)))
+		return prog_error(p, "no indirect action %"PRIu64" on port "
+				  "%u", id, rule->port_id);
+	if (vnf_flow_action_indirect(&rule->fb, handle))
+		return prog_error(p, "too many actions");
+	return prog_expect(p, "/");
+}
+
+/* <action> [<field> <value>]... / */
+static int
+prog_parse_action(struct prog_parser *p, struct prog_rule *rule,
+		  const char *name)
+{
+	uint64_t conf[PROG_CONF_MAX / sizeof(uint64_t)] = {0};
+	const struct prog_action *pa = NULL;
+	struct rte_flow_action_set_tag *tag = (void *)conf;
+	struct rte_flow_action_set_meta *meta = (void *)conf;
+	const struct prog_field *f;
+	const char *tok;
+	unsigned int i;
+
+	for (i = 0; i < RTE_DIM(prog_actions); i++)
+		if (!strcmp(prog_actions[i].name, name))
+			pa = &prog_actions[i];
+	if (pa == NULL)
+		return prog_error(p, "unknown action \"%s\"", name);
+	if (pa->parse)
+		return pa->parse(p, rule, pa);
+	/* The whole mask by default. */
+	if (pa->type == RTE_FLOW_ACTION_TYPE_SET_TAG)
+		tag->mask = UINT32_MAX;
+	else if (pa->type == RTE_FLOW_ACTION_TYPE_SET_META)
+		meta->mask = UINT32_MAX;
+	while (strcmp(tok = prog_next(p), "/")) {
+		f = prog_field_find(pa->fields, tok);
+		if (f == NULL)
+			return prog_error(p, "unknown field \"%s\" of %s", tok,
+					  name);
+		if (prog_field_set(p, f, (uint8_t *)conf, prog_next(p)))
+			return -1;
+	}
+	if (vnf_flow_action(&rule->fb, pa->type, pa->size ? conf : NULL,
+			    pa->size))
+		return prog_error(p, "too many actions");
+	return 0;
+}
+
+/* CRC of the tokens from first to last, the spacing doesn't matter. */
+static uint32_t
+prog_hash_text(const struct prog_parser *p, uint32_t first, uint32_t last,
+	       uint32_t hash)
+{
+	for (; first < last; first++)
+		hash = rte_hash_crc(p->toks[first].s,
+				    strlen(p->toks[first].s) + 1, hash);
+	return hash;
+}
+
+/*
+ * flow indirect_action <port> create action_id <id> [ingress|egress|transfer]
+ *      action <action> / end
+ */
+static int
+prog_parse_handle(struct prog_parser *p, struct prog_rule *rule,
+		  uint32_t first)
+{
+	const char *tok;
+	uint64_t v;
+
+	rule->is_handle = 1;
+	if (prog_u64(p, prog_next(p), RTE_MAX_ETHPORTS - 1, &v))
+		return -1;
+	rule->port_id = v;
+	if (prog_expect(p, "create") || prog_expect(p, "action_id") ||
+	    prog_u64(p, prog_next(p), VNF_FLOW_HANDLE_MAX - 1, &v))
+		return -1;
+	rule->handle_id = v;
+	while (strcmp(tok = prog_next(p), "action")) {
+		if (!strcmp(tok, "ingress"))
+			rule->attr.ingress = 1;
+		else if (!strcmp(tok, "egress"))
+			rule->attr.egress = 1;
+		else if (!strcmp(tok, "transfer"))
+			rule->attr.transfer = 1;
+		else
+			return prog_error(p, "unknown attribute \"%s\"", tok);
+	}
+	tok = prog_next(p);
+	if (!*tok || prog_parse_action(p, rule, tok) ||
+	    prog_expect(p, "end"))
+		return -1;
+	/* Never 0, the value of no indirect action. */
+	rule->cookie = prog_hash_text(p, first, p->cur, 0) | 1;
+	return 0;
+}
+
+/*
+ * flow create <port> [group <n>|table <name>] [priority <n>]
+ *      ingress|egress|transfer
+ *      pattern <item> / ... / end actions <action> / ... / end
+ */
+static int
+prog_parse_rule(struct prog_parser *p, struct prog_rule *rule)
+{
+	uint32_t first, actions;
+	const char *tok;
+	uint64_t v;
+
+	if (!strcmp(prog_peek(p), "testpmd>"))
+		p->cur++;
+	if (p->cur == p->nb_toks)
+		return prog_error(p, "rule expected");
+	rule->line = p->toks[p->cur].line;
+	first = p->cur;
+	vnf_flow_builder_init(&rule->fb);
+	if (prog_expect(p, "flow"))
+		return -1;
+	if (!strcmp(prog_peek(p), "indirect_action")) {
+		p->cur++;
+		return prog_parse_handle(p, rule, first);
+	}
+	if (prog_expect(p, "create") ||
+	    prog_u64(p, prog_next(p), RTE_MAX_ETHPORTS - 1, &v))
+		return -1;
+	rule->port_id = v;
+	while (strcmp(tok = prog_next(p), "pattern")) {
+		if (!strcmp(tok, "group")) {
+			if (prog_u64(p, prog_next(p), UINT32_MAX, &v))
+				return -1;
+			rule->attr.group = v;
+		} else if (!strcmp(tok, "table")) {
+			tok = prog_next(p);
+			rule->attr.group = vnf_table_group(tok);
+			if (rule->attr.group == VNF_TABLE_INVALID)
+				return prog_error(p, "unknown table \"%s\"",
+						  tok);
+		} else if (!strcmp(tok, "priority")) {
+			if (prog_u64(p, prog_next(p), UINT32_MAX, &v))
+				return -1;
+			rule->attr.priority = v;
+		} else if (!strcmp(tok, "ingress")) {
+			rule->attr.ingress = 1;
+		} else if (!strcmp(tok, "egress")) {
+			rule->attr.egress = 1;
+		} else if (!strcmp(tok, "transfer")) {
+			rule->attr.transfer = 1;
+		} else {
+			return prog_error(p, "unknown attribute \"%s\"", tok);
+		}
+	}
+	while (strcmp(tok = prog_next(p), "end"))
+		if (!*tok || prog_parse_item(p, rule, tok))
+			return *tok ? -1 : prog_error(p, "pattern not ended");
+	actions = p->cur;
+	if (prog_expect(p, "actions"))
+		return -1;
+	while (strcmp(tok = prog_next(p), "end"))
+		if (!*tok || prog_parse_action(p, rule, tok))
+			return *tok ? -1 : prog_error(p, "actions not ended");
+	rule->cookie = PROG_COOKIE(prog_hash_text(p, first, actions, 0),
+				   prog_hash_text(p, actions, p->cur, 0));
+	return 0;
+}
+
+/* Split the text in tokens, in place. */
+static int
+prog_tokenize(struct prog_parser *p, char *text)
+{
+	uint32_t line = 1, size = 0;
+	struct prog_tok *toks;
+	char *c = text;
+
+	while (*c) {
+		if (*c == '\n')
+			line++;
+		if (*c == '#') {
+			while (*c && *c != '\n')
+				*c++ = '\0';
+			continue;
+		}
+		if (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n' ||
+		    *c == '\\') {
+			*c++ = '\0';
+			continue;
+		}
+		if (p->nb_toks == size) {
+			size = size ? size * 2 : 1024;
+			toks = realloc(p->toks, size * sizeof(*toks));
+			if (toks == NULL) {
+				printf("Cannot allocate tokens of %s\n",
+				       p->path);
+				return -1;
+			}
+			p->toks = toks;
+		}
+		p->toks[p->nb_toks].s = c;
+		p->toks[p->nb_toks].line = line;
+		p->nb_toks++;
+		while (*c && *c != ' ' && *c != '\t' && *c != '\r' &&
+		       *c != '\n' && *c != '#')
+			c++;
+	}
+	return 0;
+}
+
+static char *
+prog_read(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char *text = NULL;
+	long size;
+
+	if (f == NULL) {
+		printf("Cannot open flow program %s: %s\n", path,
+		       strerror(errno));
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET))
+		goto out;
+	text = malloc(size + 1);
+	if (text == NULL)
+		goto out;
+	if (fread(text, 1, size, f) != (size_t)size) {
+		free(text);
+		text = NULL;
+		goto out;
+	}
+	text[size] = '\0';
+out:
+	if (text == NULL)
+		printf("Cannot read flow program %s\n", path);
+	fclose(f);
+	return text;
+}
+
+struct prog_file {
+	struct prog_parser p;
+	char *text;
+	struct prog_rule *rules;
+	uint32_t nb;
+	uint32_t handles_created;
+	uint32_t handles_updated;
+};
+
+/* To the next command. */
+static void
+prog_skip(struct prog_parser *p)
+{
+	while (p->cur < p->nb_toks && strcmp(prog_peek(p), "flow") &&
+	       strcmp(prog_peek(p), "testpmd>"))
+		p->cur++;
+}
+
+/*
+ * All the commands of the file. A dry run stops at the first syntax
+ * error of each command and tells how many. The run after it keeps the
+ * indirect actions the dry run parsed, a rule which can't be parsed, its
+ * indirect action failed, is kept rejected.
+ */
+static int
+prog_parse_all(struct prog_file *f, int dry_run)
+{
+	struct prog_parser *p = &f->p;
+	struct prog_rule *rule;
+	int errors = 0;
+
+	p->cur = 0;
+	p->dry_run = dry_run;
+	p->rules = f->rules;
+	p->nb_rules = 0;
+	f->nb = 0;
+	while (p->cur < p->nb_toks) {
+		rule = &f->rules[f->nb];
+		if (!dry_run && rule->is_handle) {
+			p->nb_rules = ++f->nb;
+			if (!strcmp(prog_peek(p), "testpmd>"))
+				p->cur++;
+			p->cur++;
+			prog_skip(p);
+			continue;
+		}
+		memset(rule, 0, sizeof(*rule));
+		if (prog_parse_rule(p, rule) == 0) {
+			p->nb_rules = ++f->nb;
+			continue;
+		}
+		errors++;
+		if (dry_run) {
+			memset(rule, 0, sizeof(*rule));
+		} else {
+			rule->status = -EINVAL;
+			rule->message = "cannot be parsed";
+			p->nb_rules = ++f->nb;
+		}
+		prog_skip(p);
+	}
+	return errors;
+}
+
+/* Create the indirect actions of the file, update the changed ones. */
+static void
+prog_handles_apply(struct prog_file *f)
+{
+	struct rte_flow_indir_action_conf conf;
+	struct prog_rule *rule;
+	uint64_t *text;
+	uint32_t i;
+
+	for (i = 0; i < f->nb; i++) {
+		rule = &f->rules[i];
+		if (!rule->is_handle)
+			continue;
+		text = &prog_handles[rule->port_id][rule->handle_id];
+		memset(&conf, 0, sizeof(conf));
+		conf.ingress = rule->attr.ingress;
+		conf.egress = rule->attr.egress;
+		conf.transfer = rule->attr.transfer;
+		if (vnf_flow_handle_get(rule->port_id, rule->handle_id) ==
+		    NULL) {
+			if (vnf_flow_handle_create(rule->port_id,
+						   rule->handle_id, &conf,
+						   &rule->fb.actions[0]) ==
+			    NULL) {
+				rule->status = -EINVAL;
+				rule->message = "cannot be created";
+				continue;
+			}
+			f->handles_created++;
+		} else if (*text != rule->cookie) {
+			/* The rules using it see the new one at once. */
+			if (vnf_flow_handle_update(rule->port_id,
+						   rule->handle_id,
+						   &rule->fb.actions[0])) {
+				rule->status = -EINVAL;
+				rule->message = "cannot be updated";
+				continue;
+			}
+			f->handles_updated++;
+		}
+		*text = rule->cookie;
+		rule->created = 1;
+	}
+}
+
+static void
+prog_close(struct prog_file *f)
+{
+	rte_free(f->rules);
+	free(f->p.toks);
+	free(f->text);
+}
+
+/*
+ * Parse the file, nothing is done on a syntax error, then create or
+ * update its indirect actions and parse the rules again with them.
+ */
+static int
+prog_open(struct prog_file *f, const char *path)
+{
+	uint32_t i, nb = 0;
+	int errors;
+
+	memset(f, 0, sizeof(*f));
+	f->p.path = path;
+	f->text = prog_read(path);
+	if (f->text == NULL)
+		return -1;
+	if (prog_tokenize(&f->p, f->text))
+		goto error;
+	for (i = 0; i < f->p.nb_toks; i++)
+		nb += !strcmp(f->p.toks[i].s, "flow");
+	f->rules = rte_zmalloc("vnf_flow_program",
+			       sizeof(*f->rules) * (nb + 1),
+			       RTE_CACHE_LINE_SIZE);
+	if (f->rules == NULL) {
+		printf("Cannot allocate %u rules of %s\n", nb, path);
+		goto error;
+	}
+	/* All the errors of the file, then the next rule. */
+	errors = prog_parse_all(f, 1);
+	if (errors) {
+		printf("%s: %d errors, no rule created\n", path, errors);
+		goto error;
+	}
+	prog_handles_apply(f);
+	prog_parse_all(f, 0);
+	return 0;
+error:
+	prog_close(f);
+	return -1;
+}
+
+/* Validated then created, rule->status set. */
+static struct rte_flow *
+prog_rule_create(struct prog_rule *rule, const struct rte_flow_attr *attr,
+		 uint64_t cookie, struct rte_flow_error *error)
+{
+	struct rte_flow *flow = NULL;
+
+	memset(error, 0, sizeof(*error));
+	/* Most rules of a program share a few shapes. */
+	rule->status = rule->fb.error ?
+		vnf_flow_builder_validate(rule->port_id, attr, &rule->fb,
+					  error) :
+		vnf_flow_validate_cached(rule->port_id, attr, rule->fb.items,
+					 rule->fb.actions, error);
+	if (rule->status == 0) {
+		flow = vnf_flow_create(rule->port_id, attr, rule->fb.items,
+				       rule->fb.actions,
+				       VNF_FLOW_OWNER_PROGRAM, cookie, error);
+		if (flow == NULL)
+			rule->status = -rte_errno;
+	}
+	rule->message = error->message;
+	return flow;
+}
+
+/* The rules not created, with their line. */
+static uint32_t
+prog_report(const struct prog_file *f)
+{
+	const struct prog_rule *rule;
+	uint32_t i, failed = 0;
+
+	for (i = 0; i < f->nb; i++) {
+		rule = &f->rules[i];
+		if (rule->created)
+			continue;
+		printf("%s:%u: %s rejected by port %u: %s\n", f->p.path,
+		       rule->line, rule->is_handle ? "indirect action" : "rule",
+		       rule->port_id, rule->message ? rule->message :
+		       rte_strerror(-rule->status));
+		failed++;
+	}
+	return failed;
+}
+
+static struct {
+	struct prog_rule *rules;
+	uint32_t nb;
+	uint32_t next;
+} prog_install;
+
+/* On each lcore taking part, until no rule is left. */
+static int
+prog_install_lcore(void *arg)
+{
+	struct rte_flow_error error;
+	struct prog_rule *rule;
+	uint32_t idx;
+
+	RTE_SET_USED(arg);
+	while ((idx = __atomic_fetch_add(&prog_install.next, 1,
+					 __ATOMIC_RELAXED)) <
+	       prog_install.nb) {
+		rule = &prog_install.rules[idx];
+		if (rule->is_handle || rule->status)
+			continue;
+		if (prog_rule_create(rule, &rule->attr, rule->cookie,
+				     &error))
+			rule->created = 1;
+	}
+	return 0;
+}
+
+/*
+ * Create the rules of the program file, return how many were rejected,
+ * -1 if the file can't be parsed. The worker lcores must be idle.
+ */
+int
+vnf_flow_program_load(const char *path)
+{
+	uint32_t failed, nb_lcores = 1;
+	struct prog_file f;
+	unsigned int lcore_id;
+	uint64_t start, cycles;
+
+	if (prog_open(&f, path))
+		return -1;
+	start = rte_get_timer_cycles();
+	prog_install.rules = f.rules;
+	prog_install.nb = f.nb;
+	prog_install.next = 0;
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		if (rte_eal_get_lcore_state(lcore_id) != WAIT ||
+		    rte_eal_remote_launch(prog_install_lcore, NULL, lcore_id))
+			continue;
+		nb_lcores++;
+	}
+	prog_install_lcore(NULL);
+	rte_eal_mp_wait_lcore();
+	cycles = rte_get_timer_cycles() - start;
+	failed = prog_report(&f);
+	printf(":: %u rules of %s created, %u rejected, in %.3fs on %u "
+	       "lcores\n", f.nb - failed, path, failed,
+	       (double)cycles / rte_get_timer_hz(), nb_lcores);
+	prog_close(&f);
+	return failed;
+}
+
+/* A rule by its cookie, of the file or of the registry. */
+struct prog_ref {
+	uint64_t cookie;
+	uint32_t ref; /* Index of the rule, or flow ID. */
+	uint8_t done; /* Kept, or replaced. */
+};
+
+static int
+prog_ref_cmp(const void *a, const void *b)
+{
+	const struct prog_ref *ra = a, *rb = b;
+
+	return ra->cookie < rb->cookie ? -1 : ra->cookie > rb->cookie;
+}
+
+/* The running rules of the program, sorted by cookie. */
+static struct prog_ref *
+prog_running(uint32_t *nb)
+{
+	struct vnf_flow_info info;
+	struct prog_ref *refs;
+	uint32_t *ids, i, n;
+
+	n = vnf_flow_owner_ids(VNF_FLOW_OWNER_PROGRAM, NULL, 0);
+	ids = malloc(sizeof(*ids) * (n + 1));
+	refs = malloc(sizeof(*refs) * (n + 1));
+	if (ids == NULL || refs == NULL) {
+		free(ids);
+		free(refs);
+		return NULL;
+	}
+	n = RTE_MIN(n, vnf_flow_owner_ids(VNF_FLOW_OWNER_PROGRAM, ids, n));
+	*nb = 0;
+	for (i = 0; i < n; i++) {
+		if (vnf_flow_lookup(ids[i], &info) == NULL || !info.cookie)
+			continue;
+		refs[*nb].cookie = info.cookie;
+		refs[*nb].ref = ids[i];
+		refs[*nb].done = 0;
+		(*nb)++;
+	}
+	free(ids);
+	qsort(refs, *nb, sizeof(*refs), prog_ref_cmp);
+	return refs;
+}
+
+/*
+ * Replace the running rule old by the rule, make before break. A copy of
+ * the rule goes before old and takes the traffic while the rule is created
+ * at the priority of old, then old and the copy are removed. At priority 0
+ * the rule goes next to old, which is removed once the rule is in. On
+ * failure old is kept, without the copy.
+ */
+static int
+prog_replace(struct prog_rule *rule, uint32_t old)
+{
+	struct rte_flow_attr attr = rule->attr;
+	struct rte_flow_error error;
+	uint32_t copy;
+
+	if (!attr.priority) {
+		if (prog_rule_create(rule, &attr, rule->cookie, &error) ==
+		    NULL)
+			return -1;
+		vnf_flow_destroy(old);
+		return 0;
+	}
+	attr.priority--;
+	if (prog_rule_create(rule, &attr, rule->cookie | PROG_COOKIE_COPY,
+			     &error) == NULL)
+		return -1;
+	copy = vnf_flow_lookup_cookie(rule->cookie | PROG_COOKIE_COPY);
+	if (prog_rule_create(rule, &rule->attr, rule->cookie, &error) ==
+	    NULL) {
+		vnf_flow_destroy(copy);
+		return -1;
+	}
+	vnf_flow_destroy(old);
+	vnf_flow_destroy(copy);
+	return 0;
+}
+
+/*
+ * Apply the program file to the running rules of the program: create the
+ * new rules, replace the changed ones and destroy the ones gone, update
+ * the indirect actions changed. Return how many commands were rejected,
+ * -1 if the file can't be parsed, the running rules are then untouched.
+ * The program rules are in the thousands, not the sessions.
+ */
+int
+vnf_flow_program_reconcile(const char *path)
+{
+	uint32_t nb_have = 0, nb_want = 0, i, j, first;
+	uint32_t kept = 0, created = 0, replaced = 0, removed = 0;
+	uint32_t handles_removed = 0, failed;
+	struct prog_ref *have, *want = NULL;
+	struct prog_rule *rule;
+	struct rte_flow_error error;
+	uint64_t start, cycles;
+	struct prog_file f;
+	uint16_t port_id;
+
+	if (prog_open(&f, path))
+		return -1;
+	start = rte_get_timer_cycles();
+	have = prog_running(&nb_have);
+	if (have)
+		want = malloc(sizeof(*want) * (f.nb + 1));
+	if (want == NULL) {
+		printf("Cannot allocate the rules to reconcile with %s\n",
+		       path);
+		free(have);
+		prog_close(&f);
+		return -1;
+	}
+	for (i = 0; i < f.nb; i++) {
+		if (f.rules[i].is_handle || f.rules[i].status)
+			continue;
+		want[nb_want].cookie = f.rules[i].cookie;
+		want[nb_want].ref = i;
+		want[nb_want].done = 0;
+		nb_want++;
+	}
+	qsort(want, nb_want, sizeof(*want), prog_ref_cmp);
+	/* The rules both in the file and running stay. */
+	for (i = 0, j = 0; i < nb_want; i++) {
+		rule = &f.rules[want[i].ref];
+		if (i && want[i].cookie == want[i - 1].cookie) {
+			rule->status = -EEXIST;
+			rule->message = "same rule twice in the file";
+			want[i].done = 1;
+			continue;
+		}
+		while (j < nb_have && have[j].cookie < want[i].cookie)
+			j++;
+		if (j < nb_have && have[j].cookie == want[i].cookie) {
+			have[j].done = want[i].done = 1;
+			rule->created = 1;
+			kept++;
+		}
+	}
+	/* The new rules, in place of a gone rule of the same match. */
+	for (i = 0; i < nb_want; i++) {
+		if (want[i].done)
+			continue;
+		rule = &f.rules[want[i].ref];
+		for (first = 0; first < nb_have; first++)
+			if (!have[first].done &&
+			    PROG_COOKIE_MATCH(have[first].cookie) ==
+			    PROG_COOKIE_MATCH(rule->cookie))
+				break;
+		if (first == nb_have) {
+			if (prog_rule_create(rule, &rule->attr, rule->cookie,
+					     &error)) {
+				rule->created = 1;
+				created++;
+			}
+			continue;
+		}
+		if (prog_replace(rule, have[first].ref) == 0) {
+			rule->created = 1;
+			replaced++;
+		}
+		/* Gone or holding the traffic of the rule, either way. */
+		have[first].done = 1;
+	}
+	for (i = 0; i < nb_have; i++) {
+		if (have[i].done)
+			continue;
+		if (vnf_flow_destroy(have[i].ref) == 0)
+			removed++;
+	}
+	/* The indirect actions gone from the file, once no rule uses them. */
+	RTE_ETH_FOREACH_DEV(port_id) {
+		for (i = 0; i < VNF_FLOW_HANDLE_MAX; i++) {
+			if (!prog_handles[port_id][i])
+				continue;
+			for (j = 0; j < f.nb; j++)
+				if (f.rules[j].is_handle &&
+				    f.rules[j].port_id == port_id &&
+				    f.rules[j].handle_id == i)
+					break;
+			if (j < f.nb)
+				continue;
+			if (vnf_flow_handle_destroy(port_id, i) == 0)
+				handles_removed++;
+			prog_handles[port_id][i] = 0;
+		}
+	}
+	cycles = rte_get_timer_cycles() - start;
+	failed = prog_report(&f);
+	printf(":: %s reconciled in %.3fs: %u rules kept, %u created, "
+	       "%u replaced, %u removed, indirect actions %u created, "
+	       "%u updated, %u removed, %u rejected\n", path,
+	       (double)cycles / rte_get_timer_hz(), kept, created, replaced,
+	       removed, f.handles_created, f.handles_updated,
+	       handles_removed, failed);
+	free(want);
+	free(have);
+	prog_close(&f);
+	return failed;
+}
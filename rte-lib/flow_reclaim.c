@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_errno.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_alarm.h>
+#include <rte_cycles.h>
+#include <rte_telemetry.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Reclamation of aged rules. RTE_ETH_EVENT_FLOW_AGED only arms an alarm,
+ * the alarm drains the aged contexts of the port in batches into a buffer
+ * allocated once, and hands each batch to the owner of the rules. A run is
+ * bounded to RECLAIM_MAX_BATCHES so a mass idle-out doesn't hold the
+ * interrupt thread, the rest is taken by the next run. The PMD reports an
+ * aged rule until it is gone, so contexts the owner could not release yet
+ * (async removal in flight) come back and are retried later.
+ */
+
+#define RECLAIM_DELAY_US 100 /* From the event to the first run. */
+#define RECLAIM_RETRY_US 1000 /* Nothing released, wait for removals. */
+#define RECLAIM_MAX_BATCHES 64 /* Per run. */
+
+struct reclaim_port {
+	uint16_t port_id;
+	uint16_t batch;
+	vnf_flow_reclaim_t fn;
+	void *arg;
+	uint32_t pending; /* An alarm is armed. */
+	uint64_t first_event; /* TSC of the event which armed it. */
+	uint64_t cycles; /* Spent in the runs. */
+	struct vnf_flow_reclaim_stats stats;
+	void *contexts[];
+};
+
+static struct reclaim_port *reclaim_ports[RTE_MAX_ETHPORTS];
+
+static void reclaim_run(void *arg);
+
+static void
+reclaim_arm(struct reclaim_port *rp, uint64_t us)
+{
+	if (rte_eal_alarm_set(us, reclaim_run, rp)) {
+		printf("Cannot arm aged flow reclamation of port %u\n",
+		       rp->port_id);
+		__atomic_store_n(&rp->pending, 0, __ATOMIC_RELEASE);
+	}
+}
+
+static void
+reclaim_run(void *arg)
+{
+	struct reclaim_port *rp = arg;
+	const struct vnf_flow_ops *ops = vnf_flow_ops_get(rp->port_id);
+	uint64_t start = rte_get_tsc_cycles(), end;
+	struct rte_flow_error error;
+	uint16_t done = 0, batches;
+	int n = 0;
+
+	/* Events from now on arm another run. */
+	__atomic_store_n(&rp->pending, 0, __ATOMIC_RELEASE);
+	rp->stats.runs++;
+	for (batches = 0; batches < RECLAIM_MAX_BATCHES; batches++) {
+		n = ops->get_aged_flows(rp->port_id, rp->contexts, rp->batch,
+					&error);
+		if (n <= 0)
+			break;
+		done = rp->fn(rp->port_id, rp->contexts, n, rp->arg);
+		rp->stats.batches++;
+		rp->stats.reclaimed += done;
+		rp->stats.busy += n - done;
+		if (done == 0 || n < rp->batch)
+			break;
+	}
+	end = rte_get_tsc_cycles();
+	rp->cycles += end - start;
+	if (rp->cycles)
+		rp->stats.rate = rp->stats.reclaimed * rte_get_tsc_hz() /
+				 rp->cycles;
+	if (n < 0)
+		printf("Cannot get aged flows of port %u: %s\n", rp->port_id,
+		       error.message ? error.message : "(no stated reason)");
+	if (n > 0 && (n == rp->batch || done < n)) {
+		/* More to do, or removals to wait for. */
+		if (__atomic_exchange_n(&rp->pending, 1, __ATOMIC_ACQ_REL))
+			return;
+		reclaim_arm(rp, done ? RECLAIM_DELAY_US : RECLAIM_RETRY_US);
+		return;
+	}
+	rp->stats.last_latency_us = (end - rp->first_event) * US_PER_S /
+				    rte_get_tsc_hz();
+	if (rp->stats.last_latency_us > rp->stats.max_latency_us)
+		rp->stats.max_latency_us = rp->stats.last_latency_us;
+}
+
+/* In the interrupt thread, only arm the run. */
+static int
+reclaim_event(uint16_t port_id, enum rte_eth_event_type type, void *param,
+	      void *ret_param)
+{
+	struct reclaim_port *rp = reclaim_ports[port_id];
+
+	RTE_SET_USED(param);
+	RTE_SET_USED(ret_param);
+	if (rp == NULL || type != RTE_ETH_EVENT_FLOW_AGED)
+		return 0;
+	rp->stats.events++;
+	if (__atomic_exchange_n(&rp->pending, 1, __ATOMIC_ACQ_REL))
+		return 0;
+	rp->first_event = rte_get_tsc_cycles();
+	reclaim_arm(rp, RECLAIM_DELAY_US);
+	return 0;
+}
+
+static int
+reclaim_telemetry(const char *cmd, const char *params, struct rte_tel_data *d)
+{
+	struct vnf_flow_reclaim_stats stats;
+	unsigned long port_id;
+
+	RTE_SET_USED(cmd);
+	if (params == NULL)
+		return -EINVAL;
+	port_id = strtoul(params, NULL, 0);
+	if (port_id >= RTE_MAX_ETHPORTS ||
+	    vnf_flow_reclaim_stats(port_id, &stats))
+		return -EINVAL;
+	rte_tel_data_start_dict(d);
+	rte_tel_data_add_dict_u64(d, "events", stats.events);
+	rte_tel_data_add_dict_u64(d, "runs", stats.runs);
+	rte_tel_data_add_dict_u64(d, "batches", stats.batches);
+	rte_tel_data_add_dict_u64(d, "reclaimed", stats.reclaimed);
+	rte_tel_data_add_dict_u64(d, "busy", stats.busy);
+	rte_tel_data_add_dict_u64(d, "last_latency_us",
+				  stats.last_latency_us);
+	rte_tel_data_add_dict_u64(d, "max_latency_us", stats.max_latency_us);
+	rte_tel_data_add_dict_u64(d, "rate", stats.rate);
+	return 0;
+}
+
+/*
+ * Release the aged rules of a port with fn, batch contexts at a time.
+ * Stats are in telemetry as /vnf/flow_reclaim,<port>.
+ */
+int
+vnf_flow_reclaim_init(uint16_t port_id, uint16_t batch, vnf_flow_reclaim_t fn,
+		      void *arg)
+{
+	static int telemetry_done;
+	struct reclaim_port *rp;
+	int ret;
+
+	if (port_id >= RTE_MAX_ETHPORTS || reclaim_ports[port_id] ||
+	    batch == 0 || fn == NULL) {
+		printf("Can't set aged flow reclamation on port %u\n",
+		       port_id);
+		return -1;
+	}
+	rp = rte_zmalloc("vnf_flow_reclaim",
+			 sizeof(*rp) + batch * sizeof(rp->contexts[0]),
+			 RTE_CACHE_LINE_SIZE);
+	if (rp == NULL) {
+		printf("Cannot allocate aged flow reclamation of port %u\n",
+		       port_id);
+		return -1;
+	}
+	rp->port_id = port_id;
+	rp->batch = batch;
+	rp->fn = fn;
+	rp->arg = arg;
+	reclaim_ports[port_id] = rp;
+	ret = vnf_flow_ops_get(port_id)->callback_register(port_id,
+			RTE_ETH_EVENT_FLOW_AGED, reclaim_event, NULL);
+	if (ret) {
+		printf("Cannot register aged event of port %u: %s\n",
+		       port_id, rte_strerror(-ret));
+		reclaim_ports[port_id] = NULL;
+		rte_free(rp);
+		return -1;
+	}
+	if (!telemetry_done) {
+		rte_telemetry_register_cmd("/vnf/flow_reclaim",
+				reclaim_telemetry,
+				"Aged flow reclamation. Parameters: int port_id");
+		telemetry_done = 1;
+	}
+	return 0;
+}
+
+/* Events may still come, they are ignored without the port. */
+void
+vnf_flow_reclaim_close(uint16_t port_id)
+{
+	struct reclaim_port *rp;
+
+	if (port_id >= RTE_MAX_ETHPORTS || reclaim_ports[port_id] == NULL)
+		return;
+	rp = reclaim_ports[port_id];
+	reclaim_ports[port_id] = NULL;
+	rte_eal_alarm_cancel(reclaim_run, rp);
+	rte_free(rp);
+}
+
+int
+vnf_flow_reclaim_stats(uint16_t port_id, struct vnf_flow_reclaim_stats *stats)
+{
+	const struct reclaim_port *rp;
+
+	if (port_id >= RTE_MAX_ETHPORTS || reclaim_ports[port_id] == NULL)
+		return -1;
+	rp = reclaim_ports[port_id];
+	*stats = rp->stats;
+	return 0;
+}
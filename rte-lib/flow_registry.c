@@ -0,0 +1,494 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_cycles.h>
+#include <rte_spinlock.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Record of every rule created by the application: port, group, priority,
+ * owner module, user cookie and creation time.
+ * Entries live in one array allocated at init, 24 bytes of attributes plus
+ * the handle and the cookie, no allocation per rule. A flow ID is the index
+ * of its entry with a generation in the top 8 bits, so a stale ID never
+ * resolves to a reused entry. Lookup by ID is an array access, lookup by
+ * cookie goes through a hash of the non-zero cookies.
+ * The entries of an owner are linked together, so an owner is torn down
+ * without walking the others. Destroying a group walks the array.
+ * Control path only, a recursive lock protects everything since destroying
+ * an async rule pulls completions which come back here.
+ */
+
+#define FLOW_ID_IDX_BITS VNF_FLOW_ID_IDX_BITS
+#define FLOW_ID_IDX_MASK ((1u << FLOW_ID_IDX_BITS) - 1)
+#define FLOW_ID(gen, idx) (((uint32_t)(gen) << FLOW_ID_IDX_BITS) | (idx))
+#define FLOW_F_USED (1 << 7)
+
+/* Entry 0 is the end of the lists and is never used. */
+struct flow_entry {
+	struct rte_flow *flow;
+	uint64_t cookie;
+	uint32_t group;
+	uint32_t ctime; /* Seconds since the registry init. */
+	uint32_t prev; /* Owner list. */
+	uint32_t next; /* Owner list, or free list. */
+	uint16_t port_id;
+	uint16_t priority;
+	uint8_t owner;
+	uint8_t flags; /* VNF_FLOW_F_* and FLOW_F_USED. */
+	uint8_t gen;
+};
+
+static struct flow_entry *entries;
+static uint32_t max_entries;
+static uint32_t nb_used;
+static uint32_t free_head; /* Released entries. */
+static uint32_t next_unused = 1; /* Entries above were never used. */
+static uint32_t owner_head[VNF_FLOW_OWNER_MAX];
+static uint32_t owner_count[VNF_FLOW_OWNER_MAX];
+static struct rte_hash *cookie_hash;
+static uint64_t start_cycles;
+static rte_spinlock_recursive_t registry_lock =
+	RTE_SPINLOCK_RECURSIVE_INITIALIZER;
+
+static const char * const owner_names[VNF_FLOW_OWNER_MAX] = {
+	[VNF_FLOW_OWNER_APP] = "app",
+	[VNF_FLOW_OWNER_DEFAULT] = "default",
+	[VNF_FLOW_OWNER_DECAP] = "decap",
+	[VNF_FLOW_OWNER_ENCAP] = "encap",
+	[VNF_FLOW_OWNER_RSS] = "rss",
+	[VNF_FLOW_OWNER_HAIRPIN] = "hairpin",
+	[VNF_FLOW_OWNER_TAG] = "tag",
+	[VNF_FLOW_OWNER_META] = "meta",
+	[VNF_FLOW_OWNER_MIRROR] = "mirror",
+	[VNF_FLOW_OWNER_METER] = "meter",
+	[VNF_FLOW_OWNER_QFI] = "qfi",
+	[VNF_FLOW_OWNER_AGE] = "age",
+	[VNF_FLOW_OWNER_COUNTER] = "counter",
+	[VNF_FLOW_OWNER_TEID] = "teid",
+	[VNF_FLOW_OWNER_ISOLATE] = "isolate",
+	[VNF_FLOW_OWNER_SESSION] = "session",
+	[VNF_FLOW_OWNER_PROGRAM] = "program",
+	[VNF_FLOW_OWNER_PDU] = "pdu",
+};
+
+int
+vnf_flow_registry_init(uint32_t max_flows)
+{
+	struct rte_hash_parameters params;
+
+	if (!max_flows || max_flows >= FLOW_ID_IDX_MASK) {
+		printf("Flow registry size must be below %u\n",
+		       FLOW_ID_IDX_MASK);
+		return -1;
+	}
+	entries = rte_zmalloc("vnf_flow_registry",
+			      sizeof(*entries) * (max_flows + 1),
+			      RTE_CACHE_LINE_SIZE);
+	if (entries == NULL) {
+		printf("Cannot allocate flow registry of %u entries\n",
+		       max_flows);
+		return -1;
+	}
+	memset(&params, 0, sizeof(params));
+	params.name = "vnf_flow_cookies";
+	params.entries = max_flows;
+	params.key_len = sizeof(uint64_t);
+	params.hash_func = rte_hash_crc;
+	params.socket_id = rte_socket_id();
+	/* Never fail an insertion because of a full bucket. */
+	params.extra_flag = RTE_HASH_EXTRA_FLAGS_EXT_TABLE;
+	cookie_hash = rte_hash_create(&params);
+	if (cookie_hash == NULL) {
+		printf("Cannot create flow cookie hash\n");
+		rte_free(entries);
+		entries = NULL;
+		return -1;
+	}
+	max_entries = max_flows;
+	start_cycles = rte_get_timer_cycles();
+	return 0;
+}
+
+/* Entry of a valid ID, NULL otherwise. Registry lock held. */
+static struct flow_entry *
+flow_entry_get(uint32_t id)
+{
+	uint32_t idx = id & FLOW_ID_IDX_MASK;
+	struct flow_entry *e;
+
+	if (entries == NULL || !idx || idx > max_entries)
+		return NULL;
+	e = &entries[idx];
+	if (!(e->flags & FLOW_F_USED) || e->gen != id >> FLOW_ID_IDX_BITS)
+		return NULL;
+	return e;
+}
+
+static void
+flow_entry_release(uint32_t idx)
+{
+	struct flow_entry *e = &entries[idx];
+
+	if (e->prev)
+		entries[e->prev].next = e->next;
+	else
+		owner_head[e->owner] = e->next;
+	if (e->next)
+		entries[e->next].prev = e->prev;
+	owner_count[e->owner]--;
+	if (e->owner == VNF_FLOW_OWNER_SESSION)
+		vnf_flow_checkpoint_drop(FLOW_ID(e->gen, idx));
+	if (e->cookie)
+		rte_hash_del_key(cookie_hash, &e->cookie);
+	vnf_prio_forget(e->flow);
+	e->flow = NULL;
+	e->flags = 0;
+	e->gen++; /* Outstanding IDs of this entry are now stale. */
+	e->next = free_head;
+	free_head = idx;
+	nb_used--;
+}
+
+uint32_t
+vnf_flow_register(uint16_t port_id, const struct rte_flow_attr *attr,
+		  struct rte_flow *flow, enum vnf_flow_owner owner,
+		  uint64_t cookie, uint8_t flags)
+{
+	struct flow_entry *e;
+	uint32_t idx, id = VNF_FLOW_ID_INVALID;
+
+	if (entries == NULL || owner >= VNF_FLOW_OWNER_MAX)
+		return VNF_FLOW_ID_INVALID;
+	rte_spinlock_recursive_lock(&registry_lock);
+	if (cookie && rte_hash_lookup(cookie_hash, &cookie) >= 0) {
+		printf("Flow cookie 0x%"PRIx64" is already registered\n",
+		       cookie);
+		goto out;
+	}
+	if (free_head) {
+		idx = free_head;
+		free_head = entries[idx].next;
+	} else if (next_unused <= max_entries) {
+		idx = next_unused++;
+	} else {
+		printf("Flow registry is full, %u flows\n", max_entries);
+		goto out;
+	}
+	e = &entries[idx];
+	if (cookie && rte_hash_add_key_data(cookie_hash, &cookie,
+					    (void *)(uintptr_t)idx)) {
+		e->next = free_head;
+		free_head = idx;
+		goto out;
+	}
+	e->flow = flow;
+	e->cookie = cookie;
+	e->group = attr->group;
+	e->priority = attr->priority;
+	e->port_id = port_id;
+	e->owner = owner;
+	e->flags = flags | FLOW_F_USED;
+	e->ctime = (rte_get_timer_cycles() - start_cycles) /
+		   rte_get_timer_hz();
+	e->prev = 0;
+	e->next = owner_head[owner];
+	if (e->next)
+		entries[e->next].prev = idx;
+	owner_head[owner] = idx;
+	owner_count[owner]++;
+	nb_used++;
+	id = FLOW_ID(e->gen, idx);
+out:
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return id;
+}
+
+int
+vnf_flow_attach(uint32_t id, struct rte_flow *flow)
+{
+	struct flow_entry *e;
+
+	rte_spinlock_recursive_lock(&registry_lock);
+	e = flow_entry_get(id);
+	if (e)
+		e->flow = flow;
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return e ? 0 : -ENOENT;
+}
+
+int
+vnf_flow_unregister(uint32_t id)
+{
+	struct flow_entry *e;
+
+	rte_spinlock_recursive_lock(&registry_lock);
+	e = flow_entry_get(id);
+	if (e)
+		flow_entry_release(id & FLOW_ID_IDX_MASK);
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return e ? 0 : -ENOENT;
+}
+
+uint64_t
+vnf_flow_complete(uint32_t id, int status)
+{
+	struct flow_entry *e;
+	uint64_t cookie = 0;
+
+	rte_spinlock_recursive_lock(&registry_lock);
+	e = flow_entry_get(id);
+	if (e == NULL)
+		goto out;
+	cookie = e->cookie;
+	/* A queue completes in order, insertion first. */
+	if (e->flags & VNF_FLOW_F_PENDING) {
+		/* Keep the rule only if the NIC took it. */
+		if (status)
+			flow_entry_release(id & FLOW_ID_IDX_MASK);
+		else
+			e->flags &= ~VNF_FLOW_F_PENDING;
+	} else if (e->flags & VNF_FLOW_F_REMOVING) {
+		if (status)
+			e->flags &= ~VNF_FLOW_F_REMOVING;
+		else
+			flow_entry_release(id & FLOW_ID_IDX_MASK);
+	}
+out:
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return cookie;
+}
+
+struct rte_flow *
+vnf_flow_create(uint16_t port_id, const struct rte_flow_attr *attr,
+		const struct rte_flow_item pattern[],
+		const struct rte_flow_action actions[],
+		enum vnf_flow_owner owner, uint64_t cookie,
+		struct rte_flow_error *error)
+{
+	const struct vnf_flow_ops *ops = vnf_flow_ops_get(port_id);
+	struct rte_flow *flow;
+
+	flow = ops->create(port_id, attr, pattern, actions, error);
+	if (flow == NULL || entries == NULL)
+		return flow;
+	if (vnf_flow_register(port_id, attr, flow, owner, cookie, 0) ==
+	    VNF_FLOW_ID_INVALID) {
+		/* A rule nobody can find again is a leak. */
+		ops->destroy(port_id, flow, NULL);
+		rte_flow_error_set(error, ENOSPC,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "flow can't be registered");
+		return NULL;
+	}
+	return flow;
+}
+
+struct rte_flow *
+vnf_flow_lookup(uint32_t id, struct vnf_flow_info *info)
+{
+	struct rte_flow *flow = NULL;
+	struct flow_entry *e;
+
+	rte_spinlock_recursive_lock(&registry_lock);
+	e = flow_entry_get(id);
+	if (e) {
+		flow = e->flow;
+		if (info) {
+			info->flow = e->flow;
+			info->cookie = e->cookie;
+			info->group = e->group;
+			info->priority = e->priority;
+			info->ctime = e->ctime;
+			info->port_id = e->port_id;
+			info->owner = (enum vnf_flow_owner)e->owner;
+			info->flags = e->flags & ~FLOW_F_USED;
+		}
+	}
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return flow;
+}
+
+uint32_t
+vnf_flow_lookup_cookie(uint64_t cookie)
+{
+	uint32_t id = VNF_FLOW_ID_INVALID;
+	void *data;
+
+	if (entries == NULL || !cookie)
+		return VNF_FLOW_ID_INVALID;
+	rte_spinlock_recursive_lock(&registry_lock);
+	if (rte_hash_lookup_data(cookie_hash, &cookie, &data) >= 0)
+		id = FLOW_ID(entries[(uintptr_t)data].gen, (uintptr_t)data);
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return id;
+}
+
+/* Registry lock held. */
+static int
+flow_entry_destroy(uint32_t idx)
+{
+	struct flow_entry *e = &entries[idx];
+	struct rte_flow_error error;
+	int ret;
+
+	if (e->flags & VNF_FLOW_F_REMOVING)
+		return -EINPROGRESS;
+	if (e->flags & VNF_FLOW_F_ASYNC) {
+		/* Released when the removal completes. */
+		e->flags |= VNF_FLOW_F_REMOVING;
+		ret = vnf_async_session_del(e->port_id, FLOW_ID(e->gen, idx));
+		if (ret)
+			e->flags &= ~VNF_FLOW_F_REMOVING;
+		return ret;
+	}
+	ret = vnf_flow_ops_get(e->port_id)->destroy(e->port_id, e->flow,
+						    &error);
+	if (ret) {
+		printf("Can't destroy %s flow of port %u group %u: %s\n",
+		       owner_names[e->owner], e->port_id, e->group,
+		       error.message ? error.message : "");
+		return ret;
+	}
+	flow_entry_release(idx);
+	return 0;
+}
+
+int
+vnf_flow_destroy(uint32_t id)
+{
+	int ret = -ENOENT;
+
+	rte_spinlock_recursive_lock(&registry_lock);
+	if (flow_entry_get(id))
+		ret = flow_entry_destroy(id & FLOW_ID_IDX_MASK);
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return ret;
+}
+
+int
+vnf_flow_destroy_owner(enum vnf_flow_owner owner)
+{
+	uint32_t idx, next;
+	int nb = 0;
+
+	if (entries == NULL || owner >= VNF_FLOW_OWNER_MAX)
+		return 0;
+	rte_spinlock_recursive_lock(&registry_lock);
+	for (idx = owner_head[owner]; idx; idx = next) {
+		next = entries[idx].next;
+		if (!flow_entry_destroy(idx))
+			nb++;
+		/*
+		 * Pulling async completions may have released the next
+		 * entry, start over, the rules being removed are skipped.
+		 */
+		if (next && (!(entries[next].flags & FLOW_F_USED) ||
+			     entries[next].owner != owner))
+			next = owner_head[owner];
+	}
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return nb;
+}
+
+/* IDs of the rules of an owner, up to max, return how many it has. */
+uint32_t
+vnf_flow_owner_ids(enum vnf_flow_owner owner, uint32_t *ids, uint32_t max)
+{
+	uint32_t idx, nb = 0;
+
+	if (entries == NULL || owner >= VNF_FLOW_OWNER_MAX)
+		return 0;
+	rte_spinlock_recursive_lock(&registry_lock);
+	for (idx = owner_head[owner]; idx && nb < max; idx = entries[idx].next)
+		ids[nb++] = FLOW_ID(entries[idx].gen, idx);
+	nb = owner_count[owner];
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return nb;
+}
+
+int
+vnf_flow_destroy_group(uint16_t port_id, uint32_t group)
+{
+	struct flow_entry *e;
+	uint32_t idx;
+	int nb = 0;
+
+	if (entries == NULL)
+		return 0;
+	rte_spinlock_recursive_lock(&registry_lock);
+	for (idx = 1; idx < next_unused; idx++) {
+		e = &entries[idx];
+		if (!(e->flags & FLOW_F_USED) || e->port_id != port_id ||
+		    e->group != group)
+			continue;
+		if (!flow_entry_destroy(idx))
+			nb++;
+	}
+	rte_spinlock_recursive_unlock(&registry_lock);
+	return nb;
+}
+
+/* Rules of a port which is flushed or closed are gone. */
+void
+vnf_flow_forget_port(uint16_t port_id)
+{
+	uint32_t idx;
+
+	if (entries == NULL)
+		return;
+	rte_spinlock_recursive_lock(&registry_lock);
+	for (idx = 1; idx < next_unused; idx++) {
+		if ((entries[idx].flags & FLOW_F_USED) &&
+		    entries[idx].port_id == port_id)
+			flow_entry_release(idx);
+	}
+	rte_spinlock_recursive_unlock(&registry_lock);
+}
+
+void
+vnf_flow_registry_print(int verbose)
+{
+	const struct flow_entry *e;
+	uint32_t idx;
+	int owner;
+
+	if (entries == NULL)
+		return;
+	rte_spinlock_recursive_lock(&registry_lock);
+	printf("flow registry: %u/%u flows, %zu bytes per flow\n",
+	       nb_used, max_entries, sizeof(*entries));
+	for (owner = 0; owner < VNF_FLOW_OWNER_MAX; owner++) {
+		if (!owner_count[owner])
+			continue;
+		printf("  %-8s %u flows\n", owner_names[owner],
+		       owner_count[owner]);
+		if (!verbose)
+			continue;
+		for (idx = owner_head[owner]; idx; idx = e->next) {
+			e = &entries[idx];
+			printf("    id 0x%08x port %u group %u priority %u "
+			       "cookie 0x%"PRIx64" age %us%s\n",
+			       FLOW_ID(e->gen, idx), e->port_id, e->group,
+			       e->priority, e->cookie,
+			       (uint32_t)((rte_get_timer_cycles() -
+					   start_cycles) /
+					  rte_get_timer_hz()) - e->ctime,
+			       (e->flags & VNF_FLOW_F_PENDING) ?
+			       " pending" : "");
+		}
+	}
+	rte_spinlock_recursive_unlock(&registry_lock);
+}
@@ -0,0 +1,1005 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_mtr.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_ring_elem.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+#include <rte_spinlock.h>
+#include <rte_errno.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_gtp.h>
+
+#include "vnf_examples.h"
+
+/*
+ * PDU sessions, all the rules of a session made in one call from its
+ * tunnels, QFI, rates and idle timeout:
+ * - uplink, in the pdu_ul table: the GTP-U tunnel of the UE counted,
+ *   aged, metered at the UL rate, decapsulated, marked for the software
+ *   and spread on the RSS queues;
+ * - downlink, in the pdu_dl table: the packets to the UE counted, aged,
+ *   metered at the DL rate and encapsulated to the gNB with the DL TEID
+ *   and the QFI in the PDU session container.
+ * What the port doesn't take is left to the software, the flags of the
+ * session tell which: the graph decaps and encaps by mark and meters the
+ * uplink of the mark at the UL rate, the mark handler counts the uplink.
+ * A port in template mode takes the session rules of the async engine,
+ * which have no counter, meter, age nor QFI. A rate, idle timeout or QFI
+ * that neither the port nor the graph applies fails the session. The
+ * async rules are only known inserted once their completion is pulled,
+ * a failed one is then dropped from the session, whose direction goes to
+ * the software, and vnf_session_confirm() reports it.
+ * A session is known by its handle, a generation over its slot as the
+ * flow IDs. The UL TEID and the UE IP are unique on a port, their rules
+ * would overlap. Sessions are created, modified and deleted from any
+ * lcore, a session by one at a time, and the aged ones deleted by the
+ * reclamation alarm, under the lock of the session.
+ * A modify makes the new rules at the other priority of the tables before
+ * destroying the old ones, the packets of the session always hit one.
+ *
+ * testpmd equivalent of a session, UL TEID 1, DL TEID 0x100, UE 2.0.0.1,
+ * QFI 9, 1MBps both ways, 60s idle:
+ * testpmd> add port meter profile srtcm_rfc2697 0 1 1048576 1048576 0
+ * testpmd> create port meter 0 1 1 25 yes 0xFFFF 0 0
+ * testpmd> create port meter 0 2 1 25 yes 0xFFFF 0 0
+ * testpmd> flow create 0 group 3 priority 0 ingress pattern eth / ipv4 /
+ *          udp dst is 2152 / gtp teid is 1 / gtp_psc qfi is 9 /
+ *          ipv4 src is 2.0.0.1 / end actions count / age timeout 60 /
+ *          meter mtr_id 1 / raw_decap index 0 / raw_encap index 1 /
+ *          mark id 2 / rss types ip l3-src-only end / end
+ * testpmd> flow create 0 group 4 priority 0 egress pattern eth /
+ *          ipv4 dst is 2.0.0.1 / end actions count / age timeout 60 /
+ *          meter mtr_id 2 / raw_decap index 1 / raw_encap index 2 / end
+ */
+
+#define SESSION_IDX_BITS 24
+#define SESSION_IDX(id) ((id) & ((1u << SESSION_IDX_BITS) - 1))
+#define SESSION_AGED_BATCH 64
+#define SESSION_MAX_RSS_QUEUES 64
+/* Cookie of a rule, the handle over the priority slot and direction. */
+#define SESSION_COOKIE(id, slot, dir) \
+	VNF_FLOW_COOKIE(VNF_FLOW_OWNER_PDU, \
+			((uint64_t)(id) << 2) | ((slot) << 1) | (dir))
+#define SESSION_COOKIE_ID(cookie) \
+	((uint32_t)(((cookie) & ((1ull << 56) - 1)) >> 2))
+
+enum {
+	SESSION_UL,
+	SESSION_DL,
+	SESSION_DIR_MAX,
+};
+
+enum {
+	SESSION_KEY_TEID,
+	SESSION_KEY_UE,
+};
+
+struct session_key {
+	uint32_t value;
+	uint16_t port_id;
+	uint8_t kind;
+	uint8_t pad;
+};
+
+/* The rule of a direction and what it holds. */
+struct session_rule {
+	uint32_t flow_id;
+	uint32_t mtr_id;
+	uint32_t counter;
+};
+
+struct pdu_session {
+	rte_spinlock_t lock;
+	uint32_t id; /* VNF_SESSION_INVALID when free. */
+	uint32_t gen;
+	uint32_t mark;
+	uint32_t flags;
+	uint8_t slot; /* Priority of the rules. */
+	uint8_t aged; /* Directions reported aged. */
+	/* Failed async rules, bit slot << 1 | dir, set by the completion. */
+	uint32_t failed;
+	struct vnf_session_params params;
+	struct session_rule rules[SESSION_DIR_MAX];
+	uint64_t sw_pkts; /* Uplink seen by the mark handler. */
+	uint64_t sw_bytes;
+	/* Counted by the rule of a direction gone idle. */
+	uint64_t idle_pkts[SESSION_DIR_MAX];
+	uint64_t idle_bytes[SESSION_DIR_MAX];
+} __rte_cache_aligned;
+
+struct session_stats {
+	uint64_t created;
+	uint64_t modified;
+	uint64_t deleted;
+	uint64_t aged;
+	uint64_t failed;
+	uint64_t create_cycles;
+};
+
+static struct pdu_session *sessions;
+static uint32_t nb_sessions;
+static struct rte_ring *free_sessions;
+static struct rte_hash *session_keys;
+static rte_spinlock_t session_keys_lock = RTE_SPINLOCK_INITIALIZER;
+static uint8_t session_age[RTE_MAX_ETHPORTS]; /* Reclamation is ours. */
+static uint16_t rss_queues[SESSION_MAX_RSS_QUEUES];
+static struct rte_flow_action_rss session_rss;
+static struct session_stats stats;
+
+static struct vnf_table_decl session_tables[] = {
+	{
+		.name = "pdu_ul",
+		.purpose = "uplink of the PDU sessions",
+		.miss = "classify",
+		.shape = (const enum rte_flow_item_type[]){
+			RTE_FLOW_ITEM_TYPE_ETH, RTE_FLOW_ITEM_TYPE_IPV4,
+			RTE_FLOW_ITEM_TYPE_UDP, RTE_FLOW_ITEM_TYPE_GTP,
+			RTE_FLOW_ITEM_TYPE_END },
+		.flags = VNF_TABLE_F_INGRESS | VNF_TABLE_F_ENTRY,
+	},
+	{
+		.name = "pdu_dl",
+		.purpose = "downlink of the PDU sessions",
+		.shape = (const enum rte_flow_item_type[]){
+			RTE_FLOW_ITEM_TYPE_ETH, RTE_FLOW_ITEM_TYPE_IPV4,
+			RTE_FLOW_ITEM_TYPE_END },
+		.flags = VNF_TABLE_F_EGRESS | VNF_TABLE_F_ENTRY,
+	},
+};
+
+static const struct vnf_meter_policy session_policy = {
+	.verdict = {
+		[RTE_COLOR_GREEN] = VNF_METER_PASS,
+		[RTE_COLOR_YELLOW] = VNF_METER_PASS,
+		[RTE_COLOR_RED] = VNF_METER_DROP,
+	},
+};
+
+/* The session of a live handle, locked, NULL if gone. */
+static struct pdu_session *
+session_lock(uint32_t id)
+{
+	struct pdu_session *s;
+	uint32_t idx = SESSION_IDX(id);
+
+	if (sessions == NULL || id == VNF_SESSION_INVALID ||
+	    idx >= nb_sessions)
+		return NULL;
+	s = &sessions[idx];
+	rte_spinlock_lock(&s->lock);
+	if (s->id != id) {
+		rte_spinlock_unlock(&s->lock);
+		return NULL;
+	}
+	return s;
+}
+
+/* Keys lock held. Return 1 when added, 0 when the session has it. */
+static int
+session_key_add(uint16_t port_id, uint8_t kind, uint32_t value,
+		uint32_t idx)
+{
+	struct session_key key = {
+		.value = value,
+		.port_id = port_id,
+		.kind = kind,
+	};
+	void *data;
+
+	if (rte_hash_lookup_data(session_keys, &key, &data) >= 0)
+		return (uintptr_t)data == idx ? 0 : -EEXIST;
+	if (rte_hash_add_key_data(session_keys, &key, (void *)(uintptr_t)idx))
+		return -ENOSPC;
+	return 1;
+}
+
+static void
+session_key_del(uint16_t port_id, uint8_t kind, uint32_t value)
+{
+	struct session_key key = {
+		.value = value,
+		.port_id = port_id,
+		.kind = kind,
+	};
+
+	rte_hash_del_key(session_keys, &key);
+}
+
+/* The UL TEID and UE IP of p taken by the session of slot idx. */
+static int
+session_keys_add(const struct vnf_session_params *p, uint32_t idx)
+{
+	int teid, ue;
+
+	rte_spinlock_lock(&session_keys_lock);
+	teid = session_key_add(p->port_id, SESSION_KEY_TEID, p->ul_teid, idx);
+	ue = teid < 0 ? 0 :
+	     session_key_add(p->port_id, SESSION_KEY_UE, p->ue_ip, idx);
+	if (ue < 0 && teid > 0)
+		session_key_del(p->port_id, SESSION_KEY_TEID, p->ul_teid);
+	rte_spinlock_unlock(&session_keys_lock);
+	if (teid < 0)
+		printf("UL TEID %u of port %u is taken\n", p->ul_teid,
+		       p->port_id);
+	else if (ue < 0)
+		printf("UE 0x%08x of port %u is taken\n", p->ue_ip,
+		       p->port_id);
+	return teid < 0 ? teid : RTE_MIN(ue, 0);
+}
+
+/* The keys of old which new doesn't have. */
+static void
+session_keys_del(const struct vnf_session_params *old,
+		 const struct vnf_session_params *new_p)
+{
+	rte_spinlock_lock(&session_keys_lock);
+	if (new_p == NULL || new_p->ul_teid != old->ul_teid)
+		session_key_del(old->port_id, SESSION_KEY_TEID, old->ul_teid);
+	if (new_p == NULL || new_p->ue_ip != old->ue_ip)
+		session_key_del(old->port_id, SESSION_KEY_UE, old->ue_ip);
+	rte_spinlock_unlock(&session_keys_lock);
+}
+
+static void
+session_mark_handler(struct rte_mbuf *m, void *ctx)
+{
+	struct pdu_session *s = ctx;
+
+	__atomic_fetch_add(&s->sw_pkts, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->sw_bytes, m->pkt_len, __ATOMIC_RELAXED);
+}
+
+/* A pool meter of the rate, a one second burst, red dropped. */
+static uint32_t
+session_meter(uint16_t port_id, uint64_t rate)
+{
+	struct rte_mtr_meter_profile profile;
+
+	if (!rate || !vnf_feature_hw(port_id, VNF_FEAT_METER))
+		return VNF_METER_INVALID;
+	memset(&profile, 0, sizeof(profile));
+	profile.alg = RTE_MTR_SRTCM_RFC2697;
+	profile.srtcm_rfc2697.cir = rate;
+	profile.srtcm_rfc2697.cbs = rate;
+	return vnf_meter_alloc(port_id, &profile, &session_policy);
+}
+
+/* The count, age and meter actions of a direction, hardware ones only. */
+static void
+session_rule_actions(struct vnf_flow_builder *fb, const struct pdu_session *s,
+		     const struct vnf_session_params *p,
+		     struct session_rule *rule, int dir, uint32_t *flags)
+{
+	struct rte_flow_action_age age = {
+		.timeout = p->idle_timeout,
+		.context = (void *)(uintptr_t)(((uint64_t)s->id << 1) | dir),
+	};
+	struct rte_flow_action_meter meter;
+
+	vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_COUNT, NULL, 0);
+	*flags |= VNF_SESSION_F_COUNT_HW;
+	if (p->idle_timeout && session_age[p->port_id]) {
+		vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_AGE, &age,
+				sizeof(age));
+		*flags |= VNF_SESSION_F_AGE_HW;
+	}
+	rule->mtr_id = session_meter(p->port_id,
+				     dir == SESSION_UL ? p->ul_mbr : p->dl_mbr);
+	if (rule->mtr_id != VNF_METER_INVALID) {
+		meter.mtr_id = rule->mtr_id;
+		vnf_flow_action(fb, RTE_FLOW_ACTION_TYPE_METER, &meter,
+				sizeof(meter));
+		*flags |= VNF_SESSION_F_METER_HW;
+	}
+}
+
+/*
+ * The outer headers of the downlink: the ones of the encap example to the
+ * gNB with the DL TEID, the QFI in a DL PDU session container if any.
+ */
+static size_t
+session_encap_hdr(uint8_t *buf, const struct vnf_session_params *p)
+{
+	size_t len = gtp_u_encap_hdr_build(buf, p->qfi != 0);
+	struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)
+		(buf + sizeof(struct rte_ether_hdr));
+	struct rte_gtp_hdr *gtp = (struct rte_gtp_hdr *)
+		((uint8_t *)(ip + 1) + sizeof(struct rte_udp_hdr));
+
+	if (p->gnb_ip)
+		ip->dst_addr = rte_cpu_to_be_32(p->gnb_ip);
+	gtp->teid = rte_cpu_to_be_32(p->dl_teid);
+	if (p->qfi) {
+		/* Type 0 for DL PDU Session information, then the QFI. */
+		buf[len - 3] = 0;
+		buf[len - 2] = p->qfi & 0x3f;
+	}
+	return len;
+}
+
+static uint32_t
+session_flow_create(uint16_t port_id, const struct rte_flow_attr *attr,
+		    struct vnf_flow_builder *fb, uint64_t cookie)
+{
+	struct rte_flow_error error;
+
+	if (fb->error) {
+		printf("Session rule of port %u is too large\n", port_id);
+		return VNF_FLOW_ID_INVALID;
+	}
+	if (vnf_flow_create(port_id, attr, fb->items, fb->actions,
+			    VNF_FLOW_OWNER_PDU, cookie, &error) == NULL) {
+		printf("Can't create session rule on port %u: %s\n", port_id,
+		       error.message ? error.message : "(no stated reason)");
+		return VNF_FLOW_ID_INVALID;
+	}
+	return vnf_flow_lookup_cookie(cookie);
+}
+
+static void
+session_rules_destroy(uint16_t port_id, struct session_rule *rules)
+{
+	int dir;
+
+	for (dir = 0; dir < SESSION_DIR_MAX; dir++) {
+		vnf_counter_unregister(rules[dir].counter);
+		if (rules[dir].flow_id != VNF_FLOW_ID_INVALID)
+			vnf_flow_destroy(rules[dir].flow_id);
+		if (rules[dir].mtr_id != VNF_METER_INVALID)
+			vnf_meter_free(port_id, rules[dir].mtr_id);
+		rules[dir].flow_id = VNF_FLOW_ID_INVALID;
+		rules[dir].mtr_id = VNF_METER_INVALID;
+		rules[dir].counter = VNF_COUNTER_INVALID;
+	}
+}
+
+/* Through the session templates of the async engine. */
+static int
+session_rules_async(const struct pdu_session *s,
+		    const struct vnf_session_params *p, uint8_t slot,
+		    struct session_rule *rules, uint32_t *flags)
+{
+	struct vnf_async_session as = {
+		.shape = VNF_ASYNC_DECAP,
+		.teid = p->ul_teid,
+		.ue_ip = p->ue_ip,
+		.mark = s->mark,
+		.cookie = SESSION_COOKIE(s->id, slot, SESSION_UL),
+	};
+
+	rules[SESSION_UL].flow_id = vnf_async_session_add(p->port_id, &as);
+	as.shape = VNF_ASYNC_ENCAP;
+	as.teid = p->dl_teid;
+	as.cookie = SESSION_COOKIE(s->id, slot, SESSION_DL);
+	rules[SESSION_DL].flow_id = vnf_async_session_add(p->port_id, &as);
+	if (rules[SESSION_UL].flow_id == VNF_FLOW_ID_INVALID ||
+	    rules[SESSION_DL].flow_id == VNF_FLOW_ID_INVALID) {
+		session_rules_destroy(p->port_id, rules);
+		return -1;
+	}
+	*flags |= VNF_SESSION_F_UL_HW | VNF_SESSION_F_DL_HW;
+	return 0;
+}
+
+/*
+ * The uplink rule marks, the graph meters it at the UL rate if the port
+ * doesn't. A rate, idle timeout or QFI the rules can't apply fails with
+ * ENOTSUP in rte_errno rather than leaving the session without it.
+ */
+static int
+session_rules_check(const struct pdu_session *s,
+		    const struct vnf_session_params *p,
+		    struct session_rule *rules, uint32_t *flags)
+{
+	if (p->ul_mbr &&
+	    rules[SESSION_UL].flow_id != VNF_FLOW_ID_INVALID &&
+	    rules[SESSION_UL].mtr_id == VNF_METER_INVALID &&
+	    !vnf_graph_meter_set(s->mark, p->ul_mbr, p->ul_mbr))
+		*flags |= VNF_SESSION_F_METER_SW;
+	if ((!p->ul_mbr || rules[SESSION_UL].mtr_id != VNF_METER_INVALID ||
+	     (*flags & VNF_SESSION_F_METER_SW)) &&
+	    (!p->dl_mbr || rules[SESSION_DL].mtr_id != VNF_METER_INVALID) &&
+	    (!p->idle_timeout || (*flags & VNF_SESSION_F_AGE_HW)) &&
+	    (!p->qfi || !vnf_async_template_mode(p->port_id)))
+		return 0;
+	printf("Session rate, idle timeout or QFI not supported on port %u\n",
+	       p->port_id);
+	vnf_graph_meter_set(s->mark, 0, 0);
+	session_rules_destroy(p->port_id, rules);
+	*flags = 0;
+	rte_errno = ENOTSUP;
+	return -1;
+}
+
+/* The rules of p at the priority slot, the missing features to software. */
+static int
+session_rules_create(const struct pdu_session *s,
+		     const struct vnf_session_params *p, uint8_t slot,
+		     struct session_rule *rules, uint32_t *flags)
+{
+	struct rte_flow_attr attr = { .priority = slot };
+	struct rte_flow_item_udp udp = {
+		.hdr = { .dst_port = RTE_BE16(GTP_U_UDP_PORT) },
+	};
+	struct rte_flow_item_udp udp_mask = {
+		.hdr = { .dst_port = RTE_BE16(0xffff) },
+	};
+	struct rte_flow_item_gtp gtp = {
+		.teid = rte_cpu_to_be_32(p->ul_teid),
+	};
+	struct rte_flow_item_gtp gtp_mask = { .teid = RTE_BE32(0xffffffff) };
+	/* UL PDU Session Information with the QFI. */
+	struct rte_flow_item_gtp_psc psc = { .hdr.type = 1, .hdr.qfi = p->qfi };
+	struct rte_flow_item_gtp_psc psc_mask = {
+		.hdr.type = 0xf,
+		.hdr.qfi = 0x3f,
+	};
+	struct rte_flow_item_ipv4 ip, ip_mask;
+	uint8_t encap_hdr[GTP_U_ENCAP_HDR_MAX_LEN];
+	uint16_t port_id = p->port_id;
+	struct vnf_flow_builder *fb;
+	size_t encap_len;
+	int dir;
+
+	for (dir = 0; dir < SESSION_DIR_MAX; dir++) {
+		rules[dir].flow_id = VNF_FLOW_ID_INVALID;
+		rules[dir].mtr_id = VNF_METER_INVALID;
+		rules[dir].counter = VNF_COUNTER_INVALID;
+	}
+	*flags = 0;
+	if (vnf_async_template_mode(port_id)) {
+		if (session_rules_async(s, p, slot, rules, flags))
+			return -1;
+		return session_rules_check(s, p, rules, flags);
+	}
+	encap_len = session_encap_hdr(encap_hdr, p);
+	memset(&ip, 0, sizeof(ip));
+	memset(&ip_mask, 0, sizeof(ip_mask));
+
+	/* Uplink, the decap in software without raw_decap. */
+	if (vnf_feature_hw(port_id, VNF_FEAT_GTP_MATCH)) {
+		fb = vnf_flow_builder_get();
+		vnf_flow_item_eth(fb, NULL, NULL);
+		vnf_flow_item_ipv4_unfragmented(fb);
+		vnf_flow_item_udp(fb, &udp, &udp_mask);
+		vnf_flow_item_gtp(fb, &gtp, &gtp_mask);
+		if (p->qfi)
+			vnf_flow_item_gtp_psc(fb, &psc, &psc_mask);
+		ip.hdr.src_addr = rte_cpu_to_be_32(p->ue_ip);
+		ip_mask.hdr.src_addr = RTE_BE32(0xffffffff);
+		vnf_flow_item_ipv4(fb, &ip, &ip_mask);
+		session_rule_actions(fb, s, p, &rules[SESSION_UL], SESSION_UL,
+				     flags);
+		if (vnf_feature_hw(port_id, VNF_FEAT_RAW_DECAP)) {
+			vnf_flow_action_raw_decap(fb, encap_hdr, encap_len);
+			vnf_flow_action_raw_encap(fb, encap_hdr,
+						  sizeof(struct rte_ether_hdr));
+			*flags |= VNF_SESSION_F_DECAP_HW;
+		}
+		vnf_flow_action_mark(fb, s->mark);
+		vnf_flow_action_rss(fb, &session_rss);
+		attr.group = vnf_table_group("pdu_ul");
+		attr.ingress = 1;
+		rules[SESSION_UL].flow_id = session_flow_create(port_id, &attr,
+				fb, SESSION_COOKIE(s->id, slot, SESSION_UL));
+		if (rules[SESSION_UL].flow_id == VNF_FLOW_ID_INVALID)
+			goto err;
+		*flags |= VNF_SESSION_F_UL_HW;
+	}
+
+	/* Downlink, an egress rule is only worth it for the encap. */
+	if (vnf_feature_hw(port_id, VNF_FEAT_RAW_ENCAP)) {
+		fb = vnf_flow_builder_get();
+		vnf_flow_item_eth(fb, NULL, NULL);
+		memset(&ip, 0, sizeof(ip));
+		memset(&ip_mask, 0, sizeof(ip_mask));
+		ip.hdr.dst_addr = rte_cpu_to_be_32(p->ue_ip);
+		ip_mask.hdr.dst_addr = RTE_BE32(0xffffffff);
+		vnf_flow_item_ipv4(fb, &ip, &ip_mask);
+		session_rule_actions(fb, s, p, &rules[SESSION_DL], SESSION_DL,
+				     flags);
+		vnf_flow_action_raw_decap(fb, encap_hdr,
+					  sizeof(struct rte_ether_hdr));
+		vnf_flow_action_raw_encap(fb, encap_hdr, encap_len);
+		attr.group = vnf_table_group("pdu_dl");
+		attr.ingress = 0;
+		attr.egress = 1;
+		rules[SESSION_DL].flow_id = session_flow_create(port_id, &attr,
+				fb, SESSION_COOKIE(s->id, slot, SESSION_DL));
+		if (rules[SESSION_DL].flow_id == VNF_FLOW_ID_INVALID)
+			goto err;
+		*flags |= VNF_SESSION_F_DL_HW;
+	}
+
+	for (dir = 0; dir < SESSION_DIR_MAX; dir++) {
+		if (rules[dir].flow_id == VNF_FLOW_ID_INVALID)
+			continue;
+		rules[dir].counter = vnf_counter_register_flow(
+					rules[dir].flow_id, 0);
+		/* Recycled by the pool if the rule goes by itself. */
+		if (rules[dir].mtr_id != VNF_METER_INVALID)
+			vnf_meter_bind(port_id, rules[dir].mtr_id,
+				       rules[dir].flow_id);
+	}
+	/* Without a rule there is nothing to count, meter nor age. */
+	if (!(*flags & (VNF_SESSION_F_UL_HW | VNF_SESSION_F_DL_HW)))
+		*flags = 0;
+	return session_rules_check(s, p, rules, flags);
+err:
+	session_rules_destroy(port_id, rules);
+	*flags = 0;
+	return -1;
+}
+
+/*
+ * The rule of an idle direction goes, its count kept, the direction is
+ * left to the software. Called with the session locked.
+ */
+static void
+session_rule_idle(struct pdu_session *s, int dir)
+{
+	struct session_rule *rule = &s->rules[dir];
+	struct vnf_counter_stats cs;
+
+	if (rule->flow_id == VNF_FLOW_ID_INVALID)
+		return;
+	if (!vnf_counter_get(rule->counter, &cs, 0)) {
+		s->idle_pkts[dir] += cs.hits;
+		s->idle_bytes[dir] += cs.bytes;
+	}
+	vnf_counter_unregister(rule->counter);
+	vnf_flow_destroy(rule->flow_id);
+	if (rule->mtr_id != VNF_METER_INVALID)
+		vnf_meter_free(s->params.port_id, rule->mtr_id);
+	rule->flow_id = VNF_FLOW_ID_INVALID;
+	rule->mtr_id = VNF_METER_INVALID;
+	rule->counter = VNF_COUNTER_INVALID;
+	if (dir == SESSION_UL && (s->flags & VNF_SESSION_F_METER_SW))
+		vnf_graph_meter_set(s->mark, 0, 0);
+	s->flags &= dir == SESSION_UL ?
+		    ~(VNF_SESSION_F_UL_HW | VNF_SESSION_F_DECAP_HW |
+		      VNF_SESSION_F_METER_SW) :
+		    ~VNF_SESSION_F_DL_HW;
+}
+
+/* Completion of a session rule, only the failed ones are kept. */
+static void
+session_rule_done(uint64_t cookie, int status)
+{
+	uint32_t id, idx;
+
+	if (!status || sessions == NULL ||
+	    VNF_FLOW_COOKIE_OWNER(cookie) != VNF_FLOW_OWNER_PDU)
+		return;
+	id = SESSION_COOKIE_ID(cookie);
+	idx = SESSION_IDX(id);
+	/* The lock may be held by the flush pulling the completion. */
+	if (idx < nb_sessions &&
+	    __atomic_load_n(&sessions[idx].id, __ATOMIC_ACQUIRE) == id)
+		__atomic_fetch_or(&sessions[idx].failed, 1u << (cookie & 3),
+				  __ATOMIC_RELEASE);
+}
+
+/*
+ * The failed rules of the slot in use, already dropped by the registry,
+ * leave their direction to the software. Called with the session locked,
+ * return the failed directions.
+ */
+static uint32_t
+session_failed_apply(struct pdu_session *s)
+{
+	uint32_t failed = __atomic_exchange_n(&s->failed, 0, __ATOMIC_ACQUIRE);
+	int dir;
+
+	failed = (failed >> (s->slot << 1)) & 3;
+	for (dir = 0; dir < SESSION_DIR_MAX; dir++)
+		if (failed & (1u << dir))
+			session_rule_idle(s, dir);
+	return failed;
+}
+
+/* The slot of a freed mark, once no worker counts in it any more. */
+static void
+session_slot_free(void *ctx)
+{
+	uint32_t idx = (struct pdu_session *)ctx - sessions;
+
+	rte_ring_enqueue_elem(free_sessions, &idx, sizeof(idx));
+}
+
+/*
+ * Create a session, return its handle, VNF_SESSION_INVALID on error,
+ * e.g. UL TEID or UE IP already taken on the port, rte_errno ENOTSUP for
+ * a rate, idle timeout or QFI that can't be applied.
+ */
+uint32_t
+vnf_session_create(const struct vnf_session_params *p)
+{
+	uint64_t start = rte_get_timer_cycles();
+	struct pdu_session *s;
+	uint32_t idx, flags, mark;
+
+	rte_errno = 0;
+	if (sessions == NULL || p->port_id >= RTE_MAX_ETHPORTS ||
+	    !rte_eth_dev_is_valid_port(p->port_id))
+		goto err;
+	if (rte_ring_dequeue_elem(free_sessions, &idx, sizeof(idx))) {
+		/* Maybe some slots only wait for their mark to be released. */
+		vnf_mark_poll();
+		if (rte_ring_dequeue_elem(free_sessions, &idx, sizeof(idx))) {
+			printf("No session left, %u sessions\n", nb_sessions);
+			goto err;
+		}
+	}
+	s = &sessions[idx];
+	if (session_keys_add(p, idx))
+		goto err_free;
+	s->mark = vnf_mark_alloc(session_mark_handler, s);
+	if (s->mark == INVALID_FLOW_MARK)
+		goto err_keys;
+	rte_spinlock_lock(&s->lock);
+	s->gen = (s->gen + 1) & ((1u << (32 - SESSION_IDX_BITS)) - 1);
+	if (s->gen == 0)
+		s->gen = 1;
+	s->id = (s->gen << SESSION_IDX_BITS) | idx;
+	s->params = *p;
+	s->slot = 0;
+	s->aged = 0;
+	s->sw_pkts = 0;
+	s->sw_bytes = 0;
+	__atomic_store_n(&s->failed, 0, __ATOMIC_RELAXED);
+	memset(s->idle_pkts, 0, sizeof(s->idle_pkts));
+	memset(s->idle_bytes, 0, sizeof(s->idle_bytes));
+	if (session_rules_create(s, p, s->slot, s->rules, &flags)) {
+		s->id = VNF_SESSION_INVALID;
+		mark = s->mark;
+		s->mark = INVALID_FLOW_MARK;
+		rte_spinlock_unlock(&s->lock);
+		session_keys_del(p, NULL);
+		vnf_mark_free(mark, session_slot_free);
+		goto err;
+	}
+	s->flags = flags;
+	rte_spinlock_unlock(&s->lock);
+	__atomic_fetch_add(&stats.created, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats.create_cycles,
+			   rte_get_timer_cycles() - start, __ATOMIC_RELAXED);
+	return s->id;
+err_keys:
+	session_keys_del(p, NULL);
+err_free:
+	rte_ring_enqueue_elem(free_sessions, &idx, sizeof(idx));
+err:
+	__atomic_fetch_add(&stats.failed, 1, __ATOMIC_RELAXED);
+	return VNF_SESSION_INVALID;
+}
+
+/*
+ * Give the session the parameters of p, on the same port. The rules of
+ * the new parameters are made before the old ones go; on a port in
+ * template mode the old rules go first, the templates take one rule per
+ * match, and are made again if the new ones fail. -ENOTSUP for a rate,
+ * idle timeout or QFI that can't be applied.
+ */
+int
+vnf_session_modify(uint32_t id, const struct vnf_session_params *p)
+{
+	struct session_rule rules[SESSION_DIR_MAX];
+	struct pdu_session *s;
+	uint32_t flags;
+	uint8_t slot;
+	int ret;
+
+	s = session_lock(id);
+	if (s == NULL)
+		return -ENOENT;
+	session_failed_apply(s);
+	if (p->port_id != s->params.port_id) {
+		rte_spinlock_unlock(&s->lock);
+		return -EINVAL;
+	}
+	ret = session_keys_add(p, SESSION_IDX(id));
+	if (ret) {
+		rte_spinlock_unlock(&s->lock);
+		return ret;
+	}
+	/* The rules being removed keep their cookie until completed. */
+	slot = s->slot ^ 1;
+	rte_errno = 0;
+	if (vnf_async_template_mode(p->port_id)) {
+		session_rules_destroy(p->port_id, s->rules);
+		s->flags = 0;
+	}
+	if (session_rules_create(s, p, slot, rules, &flags)) {
+		ret = rte_errno == ENOTSUP ? -ENOTSUP : -EIO;
+		/*
+		 * The old rules went first, they are made again once their
+		 * removal completed and freed their cookies.
+		 */
+		if (vnf_async_template_mode(p->port_id) &&
+		    (vnf_async_flush(p->port_id) ||
+		     session_rules_create(s, &s->params, s->slot, s->rules,
+					  &s->flags)))
+			printf("Session %u of port %u left without rules\n", id,
+			       p->port_id);
+		else if (s->flags & VNF_SESSION_F_METER_SW)
+			vnf_graph_meter_set(s->mark, s->params.ul_mbr,
+					    s->params.ul_mbr);
+		session_keys_del(p, &s->params);
+		rte_spinlock_unlock(&s->lock);
+		__atomic_fetch_add(&stats.failed, 1, __ATOMIC_RELAXED);
+		return ret;
+	}
+	if (!(flags & VNF_SESSION_F_METER_SW))
+		vnf_graph_meter_set(s->mark, 0, 0);
+	session_rules_destroy(p->port_id, s->rules);
+	session_keys_del(&s->params, p);
+	memcpy(s->rules, rules, sizeof(rules));
+	s->params = *p;
+	s->flags = flags;
+	s->slot = slot;
+	s->aged = 0;
+	rte_spinlock_unlock(&s->lock);
+	__atomic_fetch_add(&stats.modified, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Called with the session locked, the lock is released. */
+static void
+session_release(struct pdu_session *s)
+{
+	uint32_t mark = s->mark;
+
+	session_rules_destroy(s->params.port_id, s->rules);
+	vnf_graph_meter_set(mark, 0, 0);
+	session_keys_del(&s->params, NULL);
+	s->mark = INVALID_FLOW_MARK;
+	s->id = VNF_SESSION_INVALID;
+	rte_spinlock_unlock(&s->lock);
+	/* The slot is reused once the mark handler can't see it. */
+	vnf_mark_free(mark, session_slot_free);
+}
+
+int
+vnf_session_delete(uint32_t id)
+{
+	struct pdu_session *s;
+
+	s = session_lock(id);
+	if (s == NULL)
+		return -ENOENT;
+	session_release(s);
+	__atomic_fetch_add(&stats.deleted, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/*
+ * Once the completions of its rules were pulled (vnf_async_flush()),
+ * -EIO if a rule of the session wasn't inserted, its direction left to
+ * the software.
+ */
+int
+vnf_session_confirm(uint32_t id)
+{
+	struct pdu_session *s;
+	uint32_t failed;
+	uint16_t port_id;
+
+	s = session_lock(id);
+	if (s == NULL)
+		return -ENOENT;
+	failed = session_failed_apply(s);
+	port_id = s->params.port_id;
+	rte_spinlock_unlock(&s->lock);
+	if (failed)
+		printf("Session %u rules not inserted on port %u\n", id,
+		       port_id);
+	return failed ? -EIO : 0;
+}
+
+/* Hardware counters where there is a rule, the mark handler otherwise. */
+int
+vnf_session_stats_get(uint32_t id, struct vnf_session_stats *ss)
+{
+	struct vnf_counter_stats cs;
+	struct pdu_session *s;
+
+	s = session_lock(id);
+	if (s == NULL)
+		return -ENOENT;
+	session_failed_apply(s);
+	memset(ss, 0, sizeof(*ss));
+	ss->flags = s->flags;
+	ss->ul_pkts = s->idle_pkts[SESSION_UL];
+	ss->ul_bytes = s->idle_bytes[SESSION_UL];
+	ss->dl_pkts = s->idle_pkts[SESSION_DL];
+	ss->dl_bytes = s->idle_bytes[SESSION_DL];
+	if (!vnf_counter_get(s->rules[SESSION_UL].counter, &cs, 0)) {
+		ss->ul_pkts += cs.hits;
+		ss->ul_bytes += cs.bytes;
+	} else {
+		ss->ul_pkts += s->sw_pkts;
+		ss->ul_bytes += s->sw_bytes;
+	}
+	if (!vnf_counter_get(s->rules[SESSION_DL].counter, &cs, 0)) {
+		ss->dl_pkts += cs.hits;
+		ss->dl_bytes += cs.bytes;
+	}
+	rte_spinlock_unlock(&s->lock);
+	return 0;
+}
+
+int
+vnf_session_params_get(uint32_t id, struct vnf_session_params *p)
+{
+	struct pdu_session *s;
+
+	s = session_lock(id);
+	if (s == NULL)
+		return -ENOENT;
+	*p = s->params;
+	rte_spinlock_unlock(&s->lock);
+	return 0;
+}
+
+/*
+ * Aged rules of the sessions, all of them gone or going: a session goes
+ * once all its aging rules aged, otherwise the rule of the idle direction
+ * goes and traffic left in the other one keeps the session.
+ */
+static uint16_t
+session_reclaim(uint16_t port_id, void *contexts[], uint16_t nb, void *arg)
+{
+	struct pdu_session *s;
+	uint64_t ctx;
+	uint8_t all;
+	uint16_t i;
+
+	RTE_SET_USED(arg);
+	RTE_SET_USED(port_id);
+	for (i = 0; i < nb; i++) {
+		ctx = (uintptr_t)contexts[i];
+		s = session_lock(ctx >> 1);
+		if (s == NULL)
+			continue;
+		session_failed_apply(s);
+		s->aged |= 1 << (ctx & 1);
+		all = (s->rules[SESSION_UL].flow_id != VNF_FLOW_ID_INVALID) |
+		      (s->rules[SESSION_DL].flow_id != VNF_FLOW_ID_INVALID) << 1;
+		if ((s->aged & all) != all) {
+			session_rule_idle(s, ctx & 1);
+			rte_spinlock_unlock(&s->lock);
+			continue;
+		}
+		session_release(s);
+		__atomic_fetch_add(&stats.aged, 1, __ATOMIC_RELAXED);
+	}
+	return nb;
+}
+
+/*
+ * Up to nb sessions spread on the RSS queues. The tables are declared
+ * here, before vnf_table_install() makes their jumps.
+ */
+int
+vnf_session_init(uint32_t nb, uint32_t nb_queues, const uint16_t *queues)
+{
+	struct rte_hash_parameters hash_params = {
+		.name = "vnf_session_keys",
+		.entries = 2 * nb,
+		.key_len = sizeof(struct session_key),
+		.hash_func = rte_hash_crc,
+		.socket_id = (int)rte_socket_id(),
+	};
+	uint16_t port_id;
+	uint32_t i;
+
+	if (sessions)
+		return 0;
+	if (nb == 0 || nb >= 1u << SESSION_IDX_BITS)
+		return -1;
+	for (i = 0; i < RTE_DIM(session_tables); i++) {
+		session_tables[i].size = nb;
+		if (vnf_table_declare(&session_tables[i]) ==
+		    VNF_TABLE_INVALID)
+			return -1;
+	}
+	sessions = rte_zmalloc("vnf_sessions", sizeof(*sessions) * nb,
+			       RTE_CACHE_LINE_SIZE);
+	free_sessions = rte_ring_create_elem("vnf_free_sessions",
+					     sizeof(uint32_t), nb,
+					     rte_socket_id(), RING_F_EXACT_SZ);
+	session_keys = rte_hash_create(&hash_params);
+	if (sessions == NULL || free_sessions == NULL ||
+	    session_keys == NULL) {
+		printf("Cannot allocate %u sessions\n", nb);
+		vnf_session_close();
+		return -1;
+	}
+	nb_sessions = nb;
+	vnf_async_set_done_cb(session_rule_done);
+	for (i = 0; i < nb; i++) {
+		rte_spinlock_init(&sessions[i].lock);
+		rte_ring_enqueue_elem(free_sessions, &i, sizeof(i));
+	}
+	nb_queues = RTE_MIN(nb_queues, SESSION_MAX_RSS_QUEUES);
+	memcpy(rss_queues, queues, sizeof(*queues) * nb_queues);
+	memset(&session_rss, 0, sizeof(session_rss));
+	session_rss.level = 0; /* Only the inner header is left. */
+	session_rss.types = RTE_ETH_RSS_IP | RTE_ETH_RSS_L3_SRC_ONLY;
+	session_rss.queue = rss_queues;
+	session_rss.queue_num = nb_queues;
+	/* The age example has the reclamation of its port otherwise. */
+	RTE_ETH_FOREACH_DEV(port_id)
+		session_age[port_id] =
+			vnf_feature_hw(port_id, VNF_FEAT_AGE) &&
+			!vnf_flow_reclaim_init(port_id, SESSION_AGED_BATCH,
+					       session_reclaim, NULL);
+	return 0;
+}
+
+void
+vnf_session_close(void)
+{
+	uint16_t port_id;
+	uint32_t i;
+
+	RTE_ETH_FOREACH_DEV(port_id) {
+		if (session_age[port_id])
+			vnf_flow_reclaim_close(port_id);
+		session_age[port_id] = 0;
+	}
+	for (i = 0; sessions && i < nb_sessions; i++) {
+		rte_spinlock_lock(&sessions[i].lock);
+		if (sessions[i].id != VNF_SESSION_INVALID)
+			session_release(&sessions[i]);
+		else
+			rte_spinlock_unlock(&sessions[i].lock);
+	}
+	/* The slots come back to the ring before it goes. */
+	vnf_mark_flush();
+	rte_hash_free(session_keys);
+	rte_ring_free(free_sessions);
+	rte_free(sessions);
+	session_keys = NULL;
+	free_sessions = NULL;
+	sessions = NULL;
+	nb_sessions = 0;
+}
+
+void
+vnf_session_print(void)
+{
+	uint64_t created = __atomic_load_n(&stats.created, __ATOMIC_RELAXED);
+	uint64_t cycles = __atomic_load_n(&stats.create_cycles,
+					  __ATOMIC_RELAXED);
+
+	if (sessions == NULL)
+		return;
+	printf(":: sessions: %u in use, %" PRIu64 " created, %" PRIu64
+	       " modified, %" PRIu64 " deleted, %" PRIu64 " aged, %" PRIu64
+	       " failed", nb_sessions - rte_ring_count(free_sessions),
+	       created, stats.modified, stats.deleted, stats.aged,
+	       stats.failed);
+	if (created)
+		printf(", %.0f creations/s per lcore",
+		       (double)created * rte_get_timer_hz() /
+		       (cycles ? cycles : 1));
+	printf("\n");
+}
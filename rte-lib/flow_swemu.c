@@ -0,0 +1,1989 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/queue.h>
+
+#include <rte_ethdev.h>
+#include <rte_errno.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_rwlock.h>
+#include <rte_spinlock.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_tcp.h>
+#include <rte_gtp.h>
+#include <rte_thash.h>
+#include <rte_meter.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Software rte_flow of a port, to run the rule programs of the examples on
+ * net_ring or net_pcap ports. Rules are kept per domain and group, sorted
+ * by priority then creation order, and run on each packet from a Rx
+ * callback (transfer then ingress) and a Tx callback (egress): first rule
+ * matching in the group wins, JUMP goes on in another group, a miss in any
+ * group ends the domain with the packet delivered as it is.
+ *
+ * Emulated: items eth, vlan, ipv4, ipv6, udp, tcp, gtp, gtp_psc, tag, meta
+ * and mark; actions jump, mark, flag, set_tag, set_meta, queue, rss, drop,
+ * raw_decap, raw_encap, count, age, meter, sample, modify_field, port_id
+ * and represented_port, and indirect ones of these but age, sample and
+ * modify_field. Anything else is refused with ENOTSUP, as a PMD does for
+ * what it can't offload.
+ *
+ * A packet is never moved to another queue: QUEUE and RSS only set the RSS
+ * hash, the mark and the metadata, and the packet is given to the queue it
+ * was read from. A queue index past the Rx queues is a hairpin queue, the
+ * packet is sent back on the port. Meters are srTCM with the profile of
+ * the meter example, red packets dropped, rte_mtr is not emulated. There
+ * is no template API, the async engine falls back to rte_flow_create.
+ */
+
+#define SWEMU_MAX_ITEMS 12
+#define SWEMU_MAX_ACTIONS 16
+#define SWEMU_MAX_HDR 40 /* ipv6, the longest header matched. */
+#define SWEMU_MAX_RAW 128
+#define SWEMU_MAX_RSS_QUEUES 16
+#define SWEMU_RSS_KEY_LEN 40
+#define SWEMU_MAX_LAYERS 12
+#define SWEMU_MAX_TAGS 8
+#define SWEMU_MAX_JUMPS 16
+#define SWEMU_MAX_METERS 64
+#define SWEMU_MAX_CALLBACKS 4
+#define SWEMU_GTPU_PORT 2152
+#define SWEMU_GTP_PSC_TYPE 0x85
+
+enum swemu_domain {
+	SWEMU_INGRESS,
+	SWEMU_EGRESS,
+	SWEMU_TRANSFER,
+	SWEMU_DOMAIN_MAX,
+};
+
+static const char * const swemu_domain_name[SWEMU_DOMAIN_MAX] = {
+	"ingress", "egress", "transfer",
+};
+
+/* How a domain let go of a packet. */
+enum swemu_fate {
+	SWEMU_FATE_NONE, /* No rule or no fate, next domain or delivered. */
+	SWEMU_FATE_QUEUE, /* Delivered to the application. */
+	SWEMU_FATE_PORT, /* Sent on a port. */
+	SWEMU_FATE_DROP,
+};
+
+struct swemu_item {
+	enum rte_flow_item_type type;
+	uint16_t len; /* Bytes matched, 0 matches any. */
+	uint8_t spec[SWEMU_MAX_HDR]; /* Already masked. */
+	uint8_t mask[SWEMU_MAX_HDR];
+};
+
+struct swemu_field {
+	enum rte_flow_field_id id;
+	uint32_t level;
+};
+
+struct swemu_action {
+	enum rte_flow_action_type type;
+	union {
+		uint32_t group; /* JUMP */
+		uint32_t id; /* MARK, METER */
+		uint16_t queue; /* QUEUE */
+		uint16_t port; /* PORT_ID, REPRESENTED_PORT */
+		struct {
+			uint8_t index;
+			uint32_t data;
+			uint32_t mask;
+		} tag; /* SET_TAG, SET_META */
+		struct {
+			uint16_t size;
+			uint8_t data[SWEMU_MAX_RAW];
+		} raw; /* RAW_DECAP, RAW_ENCAP */
+		struct {
+			uint64_t types;
+			uint32_t level;
+			uint16_t queue_num;
+			uint16_t queue[SWEMU_MAX_RSS_QUEUES];
+			uint8_t key[SWEMU_RSS_KEY_LEN];
+		} rss;
+		struct {
+			uint32_t timeout;
+			void *context;
+		} age;
+		struct {
+			uint32_t ratio;
+			uint8_t first; /* Sub actions in the rule actions. */
+			uint8_t nb;
+		} sample;
+		struct {
+			enum rte_flow_modify_op op;
+			struct swemu_field dst;
+			struct swemu_field src;
+			uint32_t width;
+			uint32_t value; /* src VALUE or POINTER. */
+		} modify;
+		struct rte_flow_action_handle *handle; /* INDIRECT */
+	};
+};
+
+/* Indirect action, run in place of INDIRECT by the rules using it. */
+struct rte_flow_action_handle {
+	LIST_ENTRY(rte_flow_action_handle) next;
+	struct swemu_action action;
+	uint32_t refs; /* Rules using it. */
+	uint64_t hits;
+	uint64_t bytes;
+};
+
+struct swemu_group;
+
+struct rte_flow {
+	TAILQ_ENTRY(rte_flow) next;
+	struct swemu_group *group;
+	uint32_t priority;
+	uint32_t id; /* Creation order, for the statistics. */
+	uint8_t nb_items;
+	uint8_t nb_actions; /* Top level actions, sample ones follow. */
+	struct swemu_item items[SWEMU_MAX_ITEMS];
+	struct swemu_action actions[SWEMU_MAX_ACTIONS];
+	uint64_t hits;
+	uint64_t bytes;
+	uint64_t last_hit; /* TSC of the last hit, for AGE. */
+	uint64_t age_cycles; /* 0 without AGE. */
+	void *age_context;
+	uint32_t sampled; /* Hits counted for SAMPLE ratio. */
+	uint8_t aged;
+};
+
+TAILQ_HEAD(swemu_rule_list, rte_flow);
+
+struct swemu_group {
+	LIST_ENTRY(swemu_group) next;
+	enum swemu_domain domain;
+	uint32_t id;
+	struct swemu_rule_list rules;
+	uint64_t misses;
+};
+
+struct swemu_meter {
+	uint32_t id;
+	struct rte_meter_srtcm m;
+	uint64_t pkts[RTE_COLORS];
+};
+
+struct swemu_callback {
+	rte_eth_dev_cb_fn fn;
+	void *arg;
+};
+
+struct swemu_port {
+	uint16_t port_id;
+	uint16_t nb_rxq;
+	uint16_t nb_txq;
+	rte_rwlock_t lock;
+	LIST_HEAD(, swemu_group) groups;
+	LIST_HEAD(, rte_flow_action_handle) handles;
+	uint32_t nb_rules;
+	uint32_t next_id;
+	struct rte_meter_srtcm_profile profile;
+	rte_spinlock_t meter_lock; /* Meters are shared by the queues. */
+	struct swemu_meter meters[SWEMU_MAX_METERS];
+	uint32_t nb_meters;
+	uint64_t next_age_check;
+	uint32_t nb_aged;
+	struct swemu_callback aged_cb[SWEMU_MAX_CALLBACKS];
+	const struct rte_eth_rxtx_callback **rx_cb;
+	const struct rte_eth_rxtx_callback **tx_cb;
+	uint64_t dropped;
+	uint64_t sent;
+};
+
+/* Copies made by SAMPLE, given to the application after the burst. */
+struct swemu_clones {
+	struct rte_mbuf **m;
+	uint16_t nb;
+	uint16_t max;
+};
+
+/* A packet going through the rules, with the metadata set on the way. */
+struct swemu_pkt {
+	struct rte_mbuf *m;
+	uint32_t tags[SWEMU_MAX_TAGS];
+	uint32_t meta;
+	uint32_t mark;
+	uint8_t has_mark;
+	uint8_t has_flag;
+	uint8_t has_meta;
+	uint8_t parsed;
+	uint8_t nb_layers;
+	uint16_t queue;
+	uint16_t port; /* Target of SWEMU_FATE_PORT. */
+	struct {
+		enum rte_flow_item_type type;
+		uint16_t off;
+	} layers[SWEMU_MAX_LAYERS];
+};
+
+static struct swemu_port *swemu_ports[RTE_MAX_ETHPORTS];
+
+/* Default Toeplitz key, as most PMDs. */
+static const uint8_t swemu_rss_key[SWEMU_RSS_KEY_LEN] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+static struct swemu_port *
+swemu_port_get(uint16_t port_id, struct rte_flow_error *error)
+{
+	struct swemu_port *sp = NULL;
+
+	if (port_id < RTE_MAX_ETHPORTS)
+		sp = swemu_ports[port_id];
+	if (sp == NULL)
+		rte_flow_error_set(error, ENODEV,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "no software flow on port");
+	return sp;
+}
+
+/* Header length matched for an item and its default mask. */
+static int
+swemu_item_hdr(enum rte_flow_item_type type, const void **mask)
+{
+	switch (type) {
+	case RTE_FLOW_ITEM_TYPE_ETH:
+		*mask = &rte_flow_item_eth_mask;
+		return sizeof(struct rte_ether_hdr);
+	case RTE_FLOW_ITEM_TYPE_VLAN:
+		*mask = &rte_flow_item_vlan_mask;
+		return sizeof(struct rte_vlan_hdr);
+	case RTE_FLOW_ITEM_TYPE_IPV4:
+		*mask = &rte_flow_item_ipv4_mask;
+		return sizeof(struct rte_ipv4_hdr);
+	case RTE_FLOW_ITEM_TYPE_IPV6:
+		*mask = &rte_flow_item_ipv6_mask;
+		return sizeof(struct rte_ipv6_hdr);
+	case RTE_FLOW_ITEM_TYPE_UDP:
+		*mask = &rte_flow_item_udp_mask;
+		return sizeof(struct rte_udp_hdr);
+	case RTE_FLOW_ITEM_TYPE_TCP:
+		*mask = &rte_flow_item_tcp_mask;
+		return sizeof(struct rte_tcp_hdr);
+	case RTE_FLOW_ITEM_TYPE_GTP:
+		*mask = &rte_flow_item_gtp_mask;
+		return sizeof(struct rte_gtp_hdr);
+	case RTE_FLOW_ITEM_TYPE_GTP_PSC:
+		*mask = &rte_flow_item_gtp_psc_mask;
+		return sizeof(struct rte_gtp_psc_generic_hdr);
+	default:
+		return -1;
+	}
+}
+
+static int
+swemu_compile_item(struct swemu_item *it, const struct rte_flow_item *item,
+		   struct rte_flow_error *error)
+{
+	const struct rte_flow_item_tag *tag;
+	const struct rte_flow_item_meta *meta;
+	const struct rte_flow_item_mark *mark;
+	const void *mask = NULL;
+	const uint8_t *spec;
+	uint32_t data, data_mask;
+	int len, i;
+
+	if (item->last)
+		return -rte_flow_error_set(error, ENOTSUP,
+					   RTE_FLOW_ERROR_TYPE_ITEM_LAST, item,
+					   "ranges are not emulated");
+	it->type = item->type;
+	switch (item->type) {
+	case RTE_FLOW_ITEM_TYPE_VOID:
+		return 0;
+	case RTE_FLOW_ITEM_TYPE_TAG:
+		tag = item->spec;
+		data_mask = item->mask ?
+			((const struct rte_flow_item_tag *)item->mask)->data :
+			rte_flow_item_tag_mask.data;
+		if (tag == NULL)
+			return 0;
+		if (tag->index >= SWEMU_MAX_TAGS)
+			return -rte_flow_error_set(error, ENOTSUP,
+					RTE_FLOW_ERROR_TYPE_ITEM_SPEC, item,
+					"tag index too large");
+		it->len = 1;
+		it->spec[0] = tag->index;
+		data = tag->data & data_mask;
+		memcpy(&it->spec[4], &data, sizeof(data));
+		memcpy(&it->mask[4], &data_mask, sizeof(data_mask));
+		return 0;
+	case RTE_FLOW_ITEM_TYPE_META:
+		meta = item->spec;
+		data_mask = item->mask ?
+			((const struct rte_flow_item_meta *)item->mask)->data :
+			rte_flow_item_meta_mask.data;
+		if (meta == NULL)
+			return 0;
+		it->len = 1;
+		data = meta->data & data_mask;
+		memcpy(&it->spec[4], &data, sizeof(data));
+		memcpy(&it->mask[4], &data_mask, sizeof(data_mask));
+		return 0;
+	case RTE_FLOW_ITEM_TYPE_MARK:
+		mark = item->spec;
+		data_mask = item->mask ?
+			((const struct rte_flow_item_mark *)item->mask)->id :
+			UINT32_MAX;
+		if (mark == NULL)
+			return 0;
+		it->len = 1;
+		data = mark->id & data_mask;
+		memcpy(&it->spec[4], &data, sizeof(data));
+		memcpy(&it->mask[4], &data_mask, sizeof(data_mask));
+		return 0;
+	default:
+		break;
+	}
+	len = swemu_item_hdr(item->type, &mask);
+	if (len < 0)
+		return -rte_flow_error_set(error, ENOTSUP,
+					   RTE_FLOW_ERROR_TYPE_ITEM, item,
+					   "item is not emulated");
+	if (item->spec == NULL)
+		return 0;
+	/* The rte_flow_item_* start with the header they match. */
+	spec = item->spec;
+	if (item->mask)
+		mask = item->mask;
+	it->len = len;
+	for (i = 0; i < len; i++) {
+		it->mask[i] = ((const uint8_t *)mask)[i];
+		it->spec[i] = spec[i] & it->mask[i];
+	}
+	return 0;
+}
+
+/* Bits of a modified field, 0 if the field is not emulated. */
+static uint32_t
+swemu_field_bits(enum rte_flow_field_id id)
+{
+	switch (id) {
+	case RTE_FLOW_FIELD_GTP_TEID:
+	case RTE_FLOW_FIELD_IPV4_SRC:
+	case RTE_FLOW_FIELD_IPV4_DST:
+	case RTE_FLOW_FIELD_TAG:
+	case RTE_FLOW_FIELD_META:
+		return 32;
+	case RTE_FLOW_FIELD_MARK:
+		return 24;
+	case RTE_FLOW_FIELD_UDP_PORT_SRC:
+	case RTE_FLOW_FIELD_UDP_PORT_DST:
+	case RTE_FLOW_FIELD_TCP_PORT_SRC:
+	case RTE_FLOW_FIELD_TCP_PORT_DST:
+		return 16;
+	case RTE_FLOW_FIELD_IPV4_TTL:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+static int
+swemu_field_is_hdr(enum rte_flow_field_id id)
+{
+	return id != RTE_FLOW_FIELD_TAG && id != RTE_FLOW_FIELD_META &&
+	       id != RTE_FLOW_FIELD_MARK;
+}
+
+/* Immediate value, in the byte order of the destination field. */
+static uint32_t
+swemu_field_value(const uint8_t *value, enum rte_flow_field_id dst)
+{
+	uint32_t bits = swemu_field_bits(dst);
+	uint32_t v = 0, i;
+
+	if (!swemu_field_is_hdr(dst)) {
+		memcpy(&v, value, sizeof(v));
+		return v;
+	}
+	for (i = 0; i < bits / 8; i++)
+		v = v << 8 | value[i];
+	return v;
+}
+
+static int
+swemu_compile_modify(struct swemu_action *a,
+		     const struct rte_flow_action *action,
+		     struct rte_flow_error *error)
+{
+	const struct rte_flow_action_modify_field *conf = action->conf;
+	uint32_t bits = swemu_field_bits(conf->dst.field);
+
+	if (bits == 0 || conf->dst.offset || conf->width == 0 ||
+	    conf->width > bits ||
+	    (conf->operation != RTE_FLOW_MODIFY_SET &&
+	     conf->operation != RTE_FLOW_MODIFY_ADD &&
+	     conf->operation != RTE_FLOW_MODIFY_SUB))
+		goto unsupported;
+	a->modify.op = conf->operation;
+	a->modify.dst.id = conf->dst.field;
+	a->modify.dst.level = conf->dst.level;
+	a->modify.src.id = conf->src.field;
+	a->modify.width = conf->width;
+	switch (conf->src.field) {
+	case RTE_FLOW_FIELD_VALUE:
+		a->modify.value = swemu_field_value(conf->src.value,
+						    conf->dst.field);
+		return 0;
+	case RTE_FLOW_FIELD_POINTER:
+		a->modify.value = swemu_field_value(conf->src.pvalue,
+						    conf->dst.field);
+		return 0;
+	default:
+		if (swemu_field_bits(conf->src.field) < conf->width ||
+		    conf->src.offset)
+			goto unsupported;
+		a->modify.src.level = conf->src.level;
+		return 0;
+	}
+unsupported:
+	return -rte_flow_error_set(error, ENOTSUP,
+				   RTE_FLOW_ERROR_TYPE_ACTION_CONF, action,
+				   "modify_field is not emulated");
+}
+
+static int
+swemu_compile_action(struct rte_flow *rule, struct swemu_action *a,
+		     const struct rte_flow_action *action,
+		     struct rte_flow_error *error);
+
+/* Sample actions go after the top level ones. */
+static int
+swemu_compile_sample(struct rte_flow *rule, struct swemu_action *a,
+		     const struct rte_flow_action *action,
+		     uint8_t *nb, struct rte_flow_error *error)
+{
+	const struct rte_flow_action_sample *conf = action->conf;
+	const struct rte_flow_action *sub;
+	int ret;
+
+	a->sample.ratio = conf->ratio ? conf->ratio : 1;
+	a->sample.first = *nb;
+	for (sub = conf->actions; sub->type != RTE_FLOW_ACTION_TYPE_END;
+	     sub++) {
+		if (sub->type == RTE_FLOW_ACTION_TYPE_VOID)
+			continue;
+		if (sub->type == RTE_FLOW_ACTION_TYPE_SAMPLE ||
+		    sub->type == RTE_FLOW_ACTION_TYPE_JUMP ||
+		    *nb >= SWEMU_MAX_ACTIONS)
+			return -rte_flow_error_set(error, ENOTSUP,
+					RTE_FLOW_ERROR_TYPE_ACTION, sub,
+					"sample action is not emulated");
+		ret = swemu_compile_action(rule, &rule->actions[*nb], sub,
+					   error);
+		if (ret)
+			return ret;
+		(*nb)++;
+	}
+	a->sample.nb = *nb - a->sample.first;
+	return 0;
+}
+
+static int
+swemu_compile_action(struct rte_flow *rule, struct swemu_action *a,
+		     const struct rte_flow_action *action,
+		     struct rte_flow_error *error)
+{
+	const struct rte_flow_action_set_tag *set_tag;
+	const struct rte_flow_action_set_meta *set_meta;
+	const struct rte_flow_action_raw_encap *encap;
+	const struct rte_flow_action_raw_decap *decap;
+	const struct rte_flow_action_rss *rss;
+	const struct rte_flow_action_age *age;
+	uint32_t i;
+
+	a->type = action->type;
+	switch (action->type) {
+	case RTE_FLOW_ACTION_TYPE_JUMP:
+		a->group = ((const struct rte_flow_action_jump *)
+			    action->conf)->group;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_MARK:
+		a->id = ((const struct rte_flow_action_mark *)
+			 action->conf)->id;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_METER:
+		a->id = ((const struct rte_flow_action_meter *)
+			 action->conf)->mtr_id;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_QUEUE:
+		a->queue = ((const struct rte_flow_action_queue *)
+			    action->conf)->index;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_PORT_ID:
+		a->port = ((const struct rte_flow_action_port_id *)
+			   action->conf)->id;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_REPRESENTED_PORT:
+		a->port = ((const struct rte_flow_action_ethdev *)
+			   action->conf)->port_id;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_SET_TAG:
+		set_tag = action->conf;
+		if (set_tag->index >= SWEMU_MAX_TAGS)
+			break;
+		a->tag.index = set_tag->index;
+		a->tag.data = set_tag->data & set_tag->mask;
+		a->tag.mask = set_tag->mask;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_SET_META:
+		set_meta = action->conf;
+		a->tag.data = set_meta->data & set_meta->mask;
+		a->tag.mask = set_meta->mask;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_RAW_DECAP:
+		decap = action->conf;
+		a->raw.size = decap->size;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_RAW_ENCAP:
+		encap = action->conf;
+		if (encap->size > SWEMU_MAX_RAW || encap->data == NULL)
+			break;
+		a->raw.size = encap->size;
+		memcpy(a->raw.data, encap->data, encap->size);
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_RSS:
+		rss = action->conf;
+		if (rss->queue_num == 0 ||
+		    rss->queue_num > SWEMU_MAX_RSS_QUEUES ||
+		    (rss->key_len && rss->key_len != SWEMU_RSS_KEY_LEN))
+			break;
+		a->rss.types = rss->types ? rss->types : RTE_ETH_RSS_IP;
+		a->rss.level = rss->level;
+		a->rss.queue_num = rss->queue_num;
+		for (i = 0; i < rss->queue_num; i++)
+			a->rss.queue[i] = rss->queue[i];
+		memcpy(a->rss.key, rss->key_len ? rss->key : swemu_rss_key,
+		       SWEMU_RSS_KEY_LEN);
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_AGE:
+		age = action->conf;
+		rule->age_cycles = (uint64_t)age->timeout * rte_get_tsc_hz();
+		rule->age_context = age->context ? age->context : rule;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_MODIFY_FIELD:
+		return swemu_compile_modify(a, action, error);
+	case RTE_FLOW_ACTION_TYPE_INDIRECT:
+		if (action->conf == NULL)
+			break;
+		a->handle = (struct rte_flow_action_handle *)(uintptr_t)
+			    action->conf;
+		return 0;
+	case RTE_FLOW_ACTION_TYPE_VOID:
+	case RTE_FLOW_ACTION_TYPE_FLAG:
+	case RTE_FLOW_ACTION_TYPE_DROP:
+	case RTE_FLOW_ACTION_TYPE_COUNT:
+		return 0;
+	default:
+		break;
+	}
+	return -rte_flow_error_set(error, ENOTSUP, RTE_FLOW_ERROR_TYPE_ACTION,
+				   action, "action is not emulated");
+}
+
+static int
+swemu_compile(struct rte_flow *rule, const struct rte_flow_item pattern[],
+	      const struct rte_flow_action actions[],
+	      struct rte_flow_error *error)
+{
+	const struct rte_flow_action *action;
+	uint8_t nb = 0;
+	int ret;
+
+	for (; pattern->type != RTE_FLOW_ITEM_TYPE_END; pattern++) {
+		if (pattern->type == RTE_FLOW_ITEM_TYPE_VOID)
+			continue;
+		if (rule->nb_items == SWEMU_MAX_ITEMS)
+			return -rte_flow_error_set(error, ENOTSUP,
+					RTE_FLOW_ERROR_TYPE_ITEM, pattern,
+					"too many items");
+		ret = swemu_compile_item(&rule->items[rule->nb_items],
+					 pattern, error);
+		if (ret)
+			return ret;
+		rule->nb_items++;
+	}
+	/* Top level first, the sample sub actions are put after them. */
+	for (action = actions; action->type != RTE_FLOW_ACTION_TYPE_END;
+	     action++)
+		if (++nb > SWEMU_MAX_ACTIONS)
+			break;
+	if (nb > SWEMU_MAX_ACTIONS)
+		return -rte_flow_error_set(error, ENOTSUP,
+					   RTE_FLOW_ERROR_TYPE_ACTION, actions,
+					   "too many actions");
+	rule->nb_actions = nb;
+	for (action = actions; action->type != RTE_FLOW_ACTION_TYPE_END;
+	     action++) {
+		struct swemu_action *a = &rule->actions[action - actions];
+
+		if (action->type == RTE_FLOW_ACTION_TYPE_SAMPLE) {
+			a->type = action->type;
+			ret = swemu_compile_sample(rule, a, action, &nb, error);
+		} else {
+			ret = swemu_compile_action(rule, a, action, error);
+		}
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static enum swemu_domain
+swemu_attr_domain(const struct rte_flow_attr *attr)
+{
+	if (attr->transfer)
+		return SWEMU_TRANSFER;
+	return attr->egress ? SWEMU_EGRESS : SWEMU_INGRESS;
+}
+
+static struct swemu_group *
+swemu_group_find(struct swemu_port *sp, enum swemu_domain domain,
+		 uint32_t id)
+{
+	struct swemu_group *g;
+
+	LIST_FOREACH(g, &sp->groups, next)
+		if (g->domain == domain && g->id == id)
+			return g;
+	return NULL;
+}
+
+static struct swemu_group *
+swemu_group_get(struct swemu_port *sp, enum swemu_domain domain,
+		uint32_t id)
+{
+	struct swemu_group *g = swemu_group_find(sp, domain, id);
+
+	if (g)
+		return g;
+	g = rte_zmalloc("vnf_swemu_group", sizeof(*g), 0);
+	if (g == NULL)
+		return NULL;
+	g->domain = domain;
+	g->id = id;
+	TAILQ_INIT(&g->rules);
+	LIST_INSERT_HEAD(&sp->groups, g, next);
+	return g;
+}
+
+static int
+swemu_validate(uint16_t port_id, const struct rte_flow_attr *attr,
+	       const struct rte_flow_item pattern[],
+	       const struct rte_flow_action actions[],
+	       struct rte_flow_error *error)
+{
+	struct rte_flow *rule;
+	int ret;
+
+	RTE_SET_USED(attr);
+	if (swemu_port_get(port_id, error) == NULL)
+		return -ENODEV;
+	rule = rte_zmalloc("vnf_swemu_rule", sizeof(*rule), 0);
+	if (rule == NULL)
+		return -rte_flow_error_set(error, ENOMEM,
+					   RTE_FLOW_ERROR_TYPE_HANDLE, NULL,
+					   "no memory for rule");
+	ret = swemu_compile(rule, pattern, actions, error);
+	rte_free(rule);
+	return ret;
+}
+
+/* Rules hold the indirect actions they use. */
+static void
+swemu_rule_refs(struct rte_flow *rule, int delta)
+{
+	uint32_t i;
+
+	for (i = 0; i < SWEMU_MAX_ACTIONS; i++)
+		if (rule->actions[i].type == RTE_FLOW_ACTION_TYPE_INDIRECT)
+			rule->actions[i].handle->refs += delta;
+}
+
+static struct rte_flow *
+swemu_create(uint16_t port_id, const struct rte_flow_attr *attr,
+	     const struct rte_flow_item pattern[],
+	     const struct rte_flow_action actions[],
+	     struct rte_flow_error *error)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, error);
+	struct rte_flow *rule, *pos;
+	struct swemu_group *g;
+
+	if (sp == NULL)
+		return NULL;
+	rule = rte_zmalloc("vnf_swemu_rule", sizeof(*rule), 0);
+	if (rule == NULL) {
+		rte_flow_error_set(error, ENOMEM, RTE_FLOW_ERROR_TYPE_HANDLE,
+				   NULL, "no memory for rule");
+		return NULL;
+	}
+	if (swemu_compile(rule, pattern, actions, error)) {
+		rte_free(rule);
+		return NULL;
+	}
+	rule->priority = attr->priority;
+	rule->last_hit = rte_get_tsc_cycles();
+	rte_rwlock_write_lock(&sp->lock);
+	g = swemu_group_get(sp, swemu_attr_domain(attr), attr->group);
+	if (g == NULL) {
+		rte_rwlock_write_unlock(&sp->lock);
+		rte_free(rule);
+		rte_flow_error_set(error, ENOMEM, RTE_FLOW_ERROR_TYPE_HANDLE,
+				   NULL, "no memory for group");
+		return NULL;
+	}
+	rule->group = g;
+	rule->id = sp->next_id++;
+	swemu_rule_refs(rule, 1);
+	/* Same priority, the older rule matches first. */
+	TAILQ_FOREACH(pos, &g->rules, next)
+		if (pos->priority > rule->priority)
+			break;
+	if (pos)
+		TAILQ_INSERT_BEFORE(pos, rule, next);
+	else
+		TAILQ_INSERT_TAIL(&g->rules, rule, next);
+	sp->nb_rules++;
+	rte_rwlock_write_unlock(&sp->lock);
+	return rule;
+}
+
+static int
+swemu_destroy(uint16_t port_id, struct rte_flow *flow,
+	      struct rte_flow_error *error)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, error);
+
+	if (sp == NULL)
+		return -ENODEV;
+	rte_rwlock_write_lock(&sp->lock);
+	TAILQ_REMOVE(&flow->group->rules, flow, next);
+	swemu_rule_refs(flow, -1);
+	if (flow->aged)
+		sp->nb_aged--;
+	sp->nb_rules--;
+	rte_rwlock_write_unlock(&sp->lock);
+	rte_free(flow);
+	return 0;
+}
+
+static int
+swemu_flush(uint16_t port_id, struct rte_flow_error *error)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, error);
+	struct swemu_group *g;
+	struct rte_flow *rule;
+
+	if (sp == NULL)
+		return -ENODEV;
+	rte_rwlock_write_lock(&sp->lock);
+	while ((g = LIST_FIRST(&sp->groups)) != NULL) {
+		while ((rule = TAILQ_FIRST(&g->rules)) != NULL) {
+			TAILQ_REMOVE(&g->rules, rule, next);
+			swemu_rule_refs(rule, -1);
+			rte_free(rule);
+		}
+		LIST_REMOVE(g, next);
+		rte_free(g);
+	}
+	sp->nb_rules = 0;
+	sp->nb_aged = 0;
+	rte_rwlock_write_unlock(&sp->lock);
+	return 0;
+}
+
+static int
+swemu_info_get(uint16_t port_id, struct rte_flow_port_info *port_info,
+	       struct rte_flow_queue_info *queue_info,
+	       struct rte_flow_error *error)
+{
+	RTE_SET_USED(port_info);
+	RTE_SET_USED(queue_info);
+	if (swemu_port_get(port_id, error) == NULL)
+		return -ENODEV;
+	return -rte_flow_error_set(error, ENOTSUP,
+				   RTE_FLOW_ERROR_TYPE_UNSPECIFIED, NULL,
+				   "no template API in software flow");
+}
+
+static int
+swemu_query(uint16_t port_id, struct rte_flow *flow,
+	    const struct rte_flow_action *action, void *data,
+	    struct rte_flow_error *error)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, error);
+	struct rte_flow_query_count *count = data;
+	struct rte_flow_query_age *age = data;
+	uint64_t idle;
+
+	if (sp == NULL)
+		return -ENODEV;
+	for (; action->type != RTE_FLOW_ACTION_TYPE_END; action++) {
+		switch (action->type) {
+		case RTE_FLOW_ACTION_TYPE_COUNT:
+			count->hits_set = 1;
+			count->bytes_set = 1;
+			count->hits = flow->hits;
+			count->bytes = flow->bytes;
+			if (count->reset) {
+				flow->hits = 0;
+				flow->bytes = 0;
+			}
+			return 0;
+		case RTE_FLOW_ACTION_TYPE_AGE:
+			if (flow->age_cycles == 0)
+				break;
+			idle = (rte_get_tsc_cycles() - flow->last_hit) /
+			       rte_get_tsc_hz();
+			memset(age, 0, sizeof(*age));
+			age->aged = flow->aged;
+			age->sec_since_last_hit_valid = 1;
+			age->sec_since_last_hit = RTE_MIN(idle, 0xffffffULL);
+			return 0;
+		default:
+			break;
+		}
+	}
+	return -rte_flow_error_set(error, ENOTSUP, RTE_FLOW_ERROR_TYPE_ACTION,
+				   action, "query is not emulated");
+}
+
+/* Aged rules stay reported until destroyed, as mlx5 does. */
+static int
+swemu_get_aged_flows(uint16_t port_id, void **contexts, uint32_t nb_contexts,
+		     struct rte_flow_error *error)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, error);
+	struct swemu_group *g;
+	struct rte_flow *rule;
+	uint32_t n = 0;
+
+	if (sp == NULL)
+		return -ENODEV;
+	rte_rwlock_read_lock(&sp->lock);
+	if (nb_contexts == 0) {
+		n = sp->nb_aged;
+		goto out;
+	}
+	LIST_FOREACH(g, &sp->groups, next) {
+		TAILQ_FOREACH(rule, &g->rules, next) {
+			if (!rule->aged)
+				continue;
+			contexts[n++] = rule->age_context;
+			if (n == nb_contexts)
+				goto out;
+		}
+	}
+out:
+	rte_rwlock_read_unlock(&sp->lock);
+	return n;
+}
+
+/* Only RTE_ETH_EVENT_FLOW_AGED is raised here, the rest goes to ethdev. */
+static int
+swemu_callback_register(uint16_t port_id, enum rte_eth_event_type event,
+			rte_eth_dev_cb_fn cb_fn, void *cb_arg)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, NULL);
+	int i;
+
+	if (sp == NULL || event != RTE_ETH_EVENT_FLOW_AGED)
+		return rte_eth_dev_callback_register(port_id, event, cb_fn,
+						     cb_arg);
+	for (i = 0; i < SWEMU_MAX_CALLBACKS; i++) {
+		if (sp->aged_cb[i].fn == NULL) {
+			sp->aged_cb[i].arg = cb_arg;
+			sp->aged_cb[i].fn = cb_fn;
+			return 0;
+		}
+	}
+	return -ENOSPC;
+}
+
+/* The action of an indirect one, in place of a rule action. */
+static int
+swemu_compile_handle(struct swemu_action *a,
+		     const struct rte_flow_action *action,
+		     struct rte_flow_error *error)
+{
+	struct rte_flow scratch;
+
+	switch (action->type) {
+	case RTE_FLOW_ACTION_TYPE_AGE:
+	case RTE_FLOW_ACTION_TYPE_SAMPLE:
+	case RTE_FLOW_ACTION_TYPE_MODIFY_FIELD:
+	case RTE_FLOW_ACTION_TYPE_INDIRECT:
+		return -rte_flow_error_set(error, ENOTSUP,
+					   RTE_FLOW_ERROR_TYPE_ACTION, action,
+					   "indirect action is not emulated");
+	default:
+		memset(a, 0, sizeof(*a));
+		return swemu_compile_action(&scratch, a, action, error);
+	}
+}
+
+static struct rte_flow_action_handle *
+swemu_action_handle_create(uint16_t port_id,
+			   const struct rte_flow_indir_action_conf *conf,
+			   const struct rte_flow_action *action,
+			   struct rte_flow_error *error)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, error);
+	struct rte_flow_action_handle *h;
+
+	RTE_SET_USED(conf);
+	if (sp == NULL)
+		return NULL;
+	h = rte_zmalloc("vnf_swemu_handle", sizeof(*h), 0);
+	if (h == NULL) {
+		rte_flow_error_set(error, ENOMEM, RTE_FLOW_ERROR_TYPE_HANDLE,
+				   NULL, "no memory for indirect action");
+		return NULL;
+	}
+	if (swemu_compile_handle(&h->action, action, error)) {
+		rte_free(h);
+		return NULL;
+	}
+	rte_rwlock_write_lock(&sp->lock);
+	LIST_INSERT_HEAD(&sp->handles, h, next);
+	rte_rwlock_write_unlock(&sp->lock);
+	return h;
+}
+
+static int
+swemu_action_handle_destroy(uint16_t port_id,
+			    struct rte_flow_action_handle *handle,
+			    struct rte_flow_error *error)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, error);
+
+	if (sp == NULL)
+		return -ENODEV;
+	rte_rwlock_write_lock(&sp->lock);
+	if (handle->refs) {
+		rte_rwlock_write_unlock(&sp->lock);
+		return -rte_flow_error_set(error, EBUSY,
+					   RTE_FLOW_ERROR_TYPE_HANDLE, handle,
+					   "indirect action in use");
+	}
+	LIST_REMOVE(handle, next);
+	rte_rwlock_write_unlock(&sp->lock);
+	rte_free(handle);
+	return 0;
+}
+
+/* update is an action of the same type, all rules see it at once. */
+static int
+swemu_action_handle_update(uint16_t port_id,
+			   struct rte_flow_action_handle *handle,
+			   const void *update, struct rte_flow_error *error)
+{
+	struct swemu_port *sp = swemu_port_get(port_id, error);
+	const struct rte_flow_action *action = update;
+	struct swemu_action a;
+	int ret;
+
+	if (sp == NULL)
+		return -ENODEV;
+	if (action->type != handle->action.type)
+		return -rte_flow_error_set(error, EINVAL,
+					   RTE_FLOW_ERROR_TYPE_ACTION, action,
+					   "indirect action type can't change");
+	ret = swemu_compile_handle(&a, action, error);
+	if (ret)
+		return ret;
+	rte_rwlock_write_lock(&sp->lock);
+	handle->action = a;
+	rte_rwlock_write_unlock(&sp->lock);
+	return 0;
+}
+
+static int
+swemu_action_handle_query(uint16_t port_id,
+			  const struct rte_flow_action_handle *handle,
+			  void *data, struct rte_flow_error *error)
+{
+	struct rte_flow_query_count *count = data;
+
+	if (swemu_port_get(port_id, error) == NULL)
+		return -ENODEV;
+	if (handle->action.type != RTE_FLOW_ACTION_TYPE_COUNT)
+		return -rte_flow_error_set(error, ENOTSUP,
+					   RTE_FLOW_ERROR_TYPE_HANDLE, handle,
+					   "query is not emulated");
+	count->hits_set = 1;
+	count->bytes_set = 1;
+	count->hits = handle->hits;
+	count->bytes = handle->bytes;
+	return 0;
+}
+
+static const struct vnf_flow_ops swemu_flow_ops = {
+	.name = "swemu",
+	.validate = swemu_validate,
+	.create = swemu_create,
+	.destroy = swemu_destroy,
+	.flush = swemu_flush,
+	.info_get = swemu_info_get,
+	.query = swemu_query,
+	.get_aged_flows = swemu_get_aged_flows,
+	.callback_register = swemu_callback_register,
+	.action_handle_create = swemu_action_handle_create,
+	.action_handle_destroy = swemu_action_handle_destroy,
+	.action_handle_update = swemu_action_handle_update,
+	.action_handle_query = swemu_action_handle_query,
+};
+
+static int
+swemu_layer_add(struct swemu_pkt *p, enum rte_flow_item_type type,
+		uint32_t off, uint32_t len)
+{
+	if (p->nb_layers == SWEMU_MAX_LAYERS || off + len > p->m->data_len)
+		return -1;
+	p->layers[p->nb_layers].type = type;
+	p->layers[p->nb_layers].off = off;
+	p->nb_layers++;
+	return 0;
+}
+
+/* IP and what it carries, GTP-U tunnels included. */
+static void
+swemu_parse_l3(struct swemu_pkt *p, uint32_t off, int ipv4, int inner)
+{
+	const struct rte_ipv4_hdr *ip4;
+	const struct rte_ipv6_hdr *ip6;
+	const struct rte_udp_hdr *udp;
+	const struct rte_gtp_hdr *gtp;
+	const uint8_t *ext;
+	uint8_t proto, next;
+
+	if (ipv4) {
+		if (swemu_layer_add(p, RTE_FLOW_ITEM_TYPE_IPV4, off,
+				    sizeof(*ip4)))
+			return;
+		ip4 = rte_pktmbuf_mtod_offset(p->m, const void *, off);
+		proto = ip4->next_proto_id;
+		off += rte_ipv4_hdr_len(ip4);
+	} else {
+		if (swemu_layer_add(p, RTE_FLOW_ITEM_TYPE_IPV6, off,
+				    sizeof(*ip6)))
+			return;
+		ip6 = rte_pktmbuf_mtod_offset(p->m, const void *, off);
+		proto = ip6->proto;
+		off += sizeof(*ip6);
+	}
+	if (proto == IPPROTO_TCP) {
+		swemu_layer_add(p, RTE_FLOW_ITEM_TYPE_TCP, off,
+				sizeof(struct rte_tcp_hdr));
+		return;
+	}
+	if (proto != IPPROTO_UDP ||
+	    swemu_layer_add(p, RTE_FLOW_ITEM_TYPE_UDP, off, sizeof(*udp)))
+		return;
+	udp = rte_pktmbuf_mtod_offset(p->m, const void *, off);
+	off += sizeof(*udp);
+	if (inner || udp->dst_port != RTE_BE16(SWEMU_GTPU_PORT) ||
+	    swemu_layer_add(p, RTE_FLOW_ITEM_TYPE_GTP, off, sizeof(*gtp)))
+		return;
+	gtp = rte_pktmbuf_mtod_offset(p->m, const void *, off);
+	off += sizeof(*gtp);
+	if (gtp->gtp_hdr_info & 0x07) {
+		/* Sequence number, N-PDU and next extension type. */
+		if (off + 4 > p->m->data_len)
+			return;
+		next = *rte_pktmbuf_mtod_offset(p->m, const uint8_t *,
+						off + 3);
+		off += 4;
+		while (next) {
+			if (off + 4 > p->m->data_len)
+				return;
+			ext = rte_pktmbuf_mtod_offset(p->m, const uint8_t *,
+						      off);
+			if (ext[0] == 0 || off + ext[0] * 4 > p->m->data_len)
+				return;
+			if (next == SWEMU_GTP_PSC_TYPE &&
+			    swemu_layer_add(p, RTE_FLOW_ITEM_TYPE_GTP_PSC,
+					    off, ext[0] * 4))
+				return;
+			next = ext[ext[0] * 4 - 1];
+			off += ext[0] * 4;
+		}
+	}
+	if (gtp->msg_type != 0xff || off >= p->m->data_len)
+		return;
+	ext = rte_pktmbuf_mtod_offset(p->m, const uint8_t *, off);
+	if ((ext[0] >> 4) == 4)
+		swemu_parse_l3(p, off, 1, 1);
+	else if ((ext[0] >> 4) == 6)
+		swemu_parse_l3(p, off, 0, 1);
+}
+
+/* Headers are looked for in the first segment only. */
+static void
+swemu_parse(struct swemu_pkt *p)
+{
+	const struct rte_ether_hdr *eth;
+	const struct rte_vlan_hdr *vlan;
+	uint32_t off = sizeof(*eth);
+	uint16_t type;
+
+	p->nb_layers = 0;
+	p->parsed = 1;
+	if (swemu_layer_add(p, RTE_FLOW_ITEM_TYPE_ETH, 0, sizeof(*eth)))
+		return;
+	eth = rte_pktmbuf_mtod(p->m, const struct rte_ether_hdr *);
+	type = eth->ether_type;
+	while (type == RTE_BE16(RTE_ETHER_TYPE_VLAN) ||
+	       type == RTE_BE16(RTE_ETHER_TYPE_QINQ)) {
+		if (swemu_layer_add(p, RTE_FLOW_ITEM_TYPE_VLAN, off,
+				    sizeof(*vlan)))
+			return;
+		vlan = rte_pktmbuf_mtod_offset(p->m, const void *, off);
+		type = vlan->eth_proto;
+		off += sizeof(*vlan);
+	}
+	if (type == RTE_BE16(RTE_ETHER_TYPE_IPV4))
+		swemu_parse_l3(p, off, 1, 0);
+	else if (type == RTE_BE16(RTE_ETHER_TYPE_IPV6))
+		swemu_parse_l3(p, off, 0, 0);
+}
+
+static int
+swemu_match(const struct rte_flow *rule, struct swemu_pkt *p)
+{
+	const struct swemu_item *it;
+	const uint8_t *hdr;
+	uint32_t l = 0, data, mask, i, j;
+
+	if (!p->parsed)
+		swemu_parse(p);
+	for (i = 0; i < rule->nb_items; i++) {
+		it = &rule->items[i];
+		memcpy(&data, &it->spec[4], sizeof(data));
+		memcpy(&mask, &it->mask[4], sizeof(mask));
+		switch (it->type) {
+		case RTE_FLOW_ITEM_TYPE_VOID:
+			continue;
+		case RTE_FLOW_ITEM_TYPE_TAG:
+			if (it->len && (p->tags[it->spec[0]] & mask) != data)
+				return 0;
+			continue;
+		case RTE_FLOW_ITEM_TYPE_META:
+			if (it->len && (p->meta & mask) != data)
+				return 0;
+			continue;
+		case RTE_FLOW_ITEM_TYPE_MARK:
+			if (!p->has_mark || (it->len &&
+					     (p->mark & mask) != data))
+				return 0;
+			continue;
+		default:
+			break;
+		}
+		/* VLAN and PSC are left out of most patterns. */
+		while (l < p->nb_layers && p->layers[l].type != it->type &&
+		       (p->layers[l].type == RTE_FLOW_ITEM_TYPE_VLAN ||
+			p->layers[l].type == RTE_FLOW_ITEM_TYPE_GTP_PSC))
+			l++;
+		if (l == p->nb_layers || p->layers[l].type != it->type)
+			return 0;
+		hdr = rte_pktmbuf_mtod_offset(p->m, const uint8_t *,
+					      p->layers[l].off);
+		for (j = 0; j < it->len; j++)
+			if ((hdr[j] & it->mask[j]) != it->spec[j])
+				return 0;
+		l++;
+	}
+	return 1;
+}
+
+/* Offset of the nth layer of a type, level 2 being the inner one. */
+static int
+swemu_layer_off(struct swemu_pkt *p, enum rte_flow_item_type type,
+		uint32_t level)
+{
+	uint32_t n = level > 1 ? 2 : 1, l;
+
+	if (!p->parsed)
+		swemu_parse(p);
+	for (l = 0; l < p->nb_layers; l++)
+		if (p->layers[l].type == type && --n == 0)
+			return p->layers[l].off;
+	return -1;
+}
+
+/* Header field location, NULL if the packet does not have it. */
+static uint8_t *
+swemu_field_ptr(struct swemu_pkt *p, const struct swemu_field *f)
+{
+	enum rte_flow_item_type type;
+	uint32_t delta;
+	int off;
+
+	switch (f->id) {
+	case RTE_FLOW_FIELD_GTP_TEID:
+		type = RTE_FLOW_ITEM_TYPE_GTP;
+		delta = offsetof(struct rte_gtp_hdr, teid);
+		break;
+	case RTE_FLOW_FIELD_IPV4_SRC:
+		type = RTE_FLOW_ITEM_TYPE_IPV4;
+		delta = offsetof(struct rte_ipv4_hdr, src_addr);
+		break;
+	case RTE_FLOW_FIELD_IPV4_DST:
+		type = RTE_FLOW_ITEM_TYPE_IPV4;
+		delta = offsetof(struct rte_ipv4_hdr, dst_addr);
+		break;
+	case RTE_FLOW_FIELD_IPV4_TTL:
+		type = RTE_FLOW_ITEM_TYPE_IPV4;
+		delta = offsetof(struct rte_ipv4_hdr, time_to_live);
+		break;
+	case RTE_FLOW_FIELD_UDP_PORT_SRC:
+		type = RTE_FLOW_ITEM_TYPE_UDP;
+		delta = offsetof(struct rte_udp_hdr, src_port);
+		break;
+	case RTE_FLOW_FIELD_UDP_PORT_DST:
+		type = RTE_FLOW_ITEM_TYPE_UDP;
+		delta = offsetof(struct rte_udp_hdr, dst_port);
+		break;
+	case RTE_FLOW_FIELD_TCP_PORT_SRC:
+		type = RTE_FLOW_ITEM_TYPE_TCP;
+		delta = offsetof(struct rte_tcp_hdr, src_port);
+		break;
+	case RTE_FLOW_FIELD_TCP_PORT_DST:
+		type = RTE_FLOW_ITEM_TYPE_TCP;
+		delta = offsetof(struct rte_tcp_hdr, dst_port);
+		break;
+	default:
+		return NULL;
+	}
+	off = swemu_layer_off(p, type, f->level);
+	if (off < 0)
+		return NULL;
+	return rte_pktmbuf_mtod_offset(p->m, uint8_t *, off + delta);
+}
+
+static int
+swemu_field_read(struct swemu_pkt *p, const struct swemu_field *f,
+		 uint32_t *v)
+{
+	uint32_t bits = swemu_field_bits(f->id), i;
+	const uint8_t *ptr;
+
+	switch (f->id) {
+	case RTE_FLOW_FIELD_TAG:
+		*v = p->tags[f->level % SWEMU_MAX_TAGS];
+		return 0;
+	case RTE_FLOW_FIELD_META:
+		*v = p->meta;
+		return 0;
+	case RTE_FLOW_FIELD_MARK:
+		*v = p->mark;
+		return 0;
+	default:
+		break;
+	}
+	ptr = swemu_field_ptr(p, f);
+	if (ptr == NULL)
+		return -1;
+	*v = 0;
+	for (i = 0; i < bits / 8; i++)
+		*v = *v << 8 | ptr[i];
+	return 0;
+}
+
+/* IPv4 and L4 checksums are made again, the UDP one dropped. */
+static void
+swemu_cksum_fix(struct swemu_pkt *p)
+{
+	struct rte_ipv4_hdr *ip;
+	struct rte_udp_hdr *udp;
+	struct rte_tcp_hdr *tcp;
+	uint32_t l;
+
+	for (l = 0; l < p->nb_layers; l++) {
+		switch (p->layers[l].type) {
+		case RTE_FLOW_ITEM_TYPE_IPV4:
+			ip = rte_pktmbuf_mtod_offset(p->m, void *,
+						     p->layers[l].off);
+			ip->hdr_checksum = 0;
+			ip->hdr_checksum = rte_ipv4_cksum(ip);
+			break;
+		case RTE_FLOW_ITEM_TYPE_UDP:
+			udp = rte_pktmbuf_mtod_offset(p->m, void *,
+						      p->layers[l].off);
+			udp->dgram_cksum = 0;
+			break;
+		case RTE_FLOW_ITEM_TYPE_TCP:
+			if (l == 0 || p->m->nb_segs > 1 ||
+			    p->layers[l - 1].type != RTE_FLOW_ITEM_TYPE_IPV4)
+				break;
+			ip = rte_pktmbuf_mtod_offset(p->m, void *,
+						     p->layers[l - 1].off);
+			tcp = rte_pktmbuf_mtod_offset(p->m, void *,
+						      p->layers[l].off);
+			tcp->cksum = 0;
+			tcp->cksum = rte_ipv4_udptcp_cksum(ip, tcp);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static int
+swemu_field_write(struct swemu_pkt *p, const struct swemu_field *f,
+		  uint32_t v)
+{
+	uint32_t bits = swemu_field_bits(f->id), i;
+	uint8_t *ptr;
+
+	switch (f->id) {
+	case RTE_FLOW_FIELD_TAG:
+		p->tags[f->level % SWEMU_MAX_TAGS] = v;
+		return 0;
+	case RTE_FLOW_FIELD_META:
+		p->meta = v;
+		p->has_meta = 1;
+		return 0;
+	case RTE_FLOW_FIELD_MARK:
+		p->mark = v;
+		p->has_mark = 1;
+		return 0;
+	default:
+		break;
+	}
+	ptr = swemu_field_ptr(p, f);
+	if (ptr == NULL)
+		return -1;
+	for (i = bits / 8; i > 0; i--) {
+		ptr[i - 1] = v & 0xff;
+		v >>= 8;
+	}
+	if (f->id != RTE_FLOW_FIELD_GTP_TEID)
+		swemu_cksum_fix(p);
+	return 0;
+}
+
+/* The width lower bits of the field are changed. */
+static void
+swemu_modify(struct swemu_pkt *p, const struct swemu_action *a)
+{
+	uint32_t mask = a->modify.width == 32 ? UINT32_MAX :
+			(1u << a->modify.width) - 1;
+	uint32_t dst, src, res;
+
+	if (swemu_field_read(p, &a->modify.dst, &dst))
+		return;
+	if (a->modify.src.id == RTE_FLOW_FIELD_VALUE ||
+	    a->modify.src.id == RTE_FLOW_FIELD_POINTER)
+		src = a->modify.value;
+	else if (swemu_field_read(p, &a->modify.src, &src))
+		return;
+	switch (a->modify.op) {
+	case RTE_FLOW_MODIFY_ADD:
+		res = dst + src;
+		break;
+	case RTE_FLOW_MODIFY_SUB:
+		res = dst - src;
+		break;
+	default:
+		res = src;
+		break;
+	}
+	swemu_field_write(p, &a->modify.dst, (dst & ~mask) | (res & mask));
+}
+
+/*
+ * Tunnel decap, raw_decap larger than L2, takes off all up to the inner
+ * IP whatever the size, as mlx5 L3 decap. Otherwise size bytes go.
+ */
+static int
+swemu_raw_decap(struct swemu_pkt *p, uint16_t size)
+{
+	int l2 = swemu_layer_off(p, RTE_FLOW_ITEM_TYPE_IPV4, 0);
+	int inner;
+
+	if (l2 < 0)
+		l2 = swemu_layer_off(p, RTE_FLOW_ITEM_TYPE_IPV6, 0);
+	if (swemu_layer_off(p, RTE_FLOW_ITEM_TYPE_GTP, 0) >= 0 &&
+	    l2 >= 0 && size > l2) {
+		inner = swemu_layer_off(p, RTE_FLOW_ITEM_TYPE_IPV4, 2);
+		if (inner < 0)
+			inner = swemu_layer_off(p, RTE_FLOW_ITEM_TYPE_IPV6, 2);
+		if (inner >= 0)
+			size = inner;
+	}
+	if (rte_pktmbuf_adj(p->m, size) == NULL)
+		return -1;
+	p->parsed = 0;
+	return 0;
+}
+
+/* Lengths and checksum of a pushed eth / ipv4 / udp / gtp header. */
+static void
+swemu_encap_fix(struct rte_mbuf *m, uint16_t size)
+{
+	struct rte_ether_hdr *eth = rte_pktmbuf_mtod(m, void *);
+	struct rte_ipv4_hdr *ip;
+	struct rte_udp_hdr *udp;
+	struct rte_gtp_hdr *gtp;
+	uint32_t off = sizeof(*eth);
+
+	if (size < off + sizeof(*ip) ||
+	    eth->ether_type != RTE_BE16(RTE_ETHER_TYPE_IPV4))
+		return;
+	ip = rte_pktmbuf_mtod_offset(m, void *, off);
+	ip->total_length = rte_cpu_to_be_16(m->pkt_len - off);
+	ip->hdr_checksum = 0;
+	ip->hdr_checksum = rte_ipv4_cksum(ip);
+	off += rte_ipv4_hdr_len(ip);
+	if (ip->next_proto_id != IPPROTO_UDP || size < off + sizeof(*udp))
+		return;
+	udp = rte_pktmbuf_mtod_offset(m, void *, off);
+	udp->dgram_len = rte_cpu_to_be_16(m->pkt_len - off);
+	udp->dgram_cksum = 0;
+	off += sizeof(*udp);
+	if (udp->dst_port != RTE_BE16(SWEMU_GTPU_PORT) ||
+	    size < off + sizeof(*gtp))
+		return;
+	gtp = rte_pktmbuf_mtod_offset(m, void *, off);
+	gtp->plen = rte_cpu_to_be_16(m->pkt_len - off - sizeof(*gtp));
+}
+
+static int
+swemu_raw_encap(struct swemu_pkt *p, const struct swemu_action *a)
+{
+	char *hdr = rte_pktmbuf_prepend(p->m, a->raw.size);
+
+	if (hdr == NULL)
+		return -1;
+	memcpy(hdr, a->raw.data, a->raw.size);
+	swemu_encap_fix(p->m, a->raw.size);
+	p->parsed = 0;
+	return 0;
+}
+
+/* Toeplitz on the IPv4 addresses and ports of the given level. */
+static void
+swemu_rss(struct swemu_pkt *p, const struct swemu_action *a)
+{
+	const struct rte_ipv4_hdr *ip;
+	const struct rte_udp_hdr *l4;
+	uint32_t tuple[3], len = 0, hash;
+	int off, l4_off;
+
+	off = swemu_layer_off(p, RTE_FLOW_ITEM_TYPE_IPV4, a->rss.level);
+	if (off >= 0) {
+		ip = rte_pktmbuf_mtod_offset(p->m, const void *, off);
+		if (!(a->rss.types & RTE_ETH_RSS_L3_DST_ONLY))
+			tuple[len++] = rte_be_to_cpu_32(ip->src_addr);
+		if (!(a->rss.types & RTE_ETH_RSS_L3_SRC_ONLY))
+			tuple[len++] = rte_be_to_cpu_32(ip->dst_addr);
+		l4_off = off + rte_ipv4_hdr_len(ip);
+		if ((a->rss.types & (RTE_ETH_RSS_UDP | RTE_ETH_RSS_TCP)) &&
+		    (ip->next_proto_id == IPPROTO_UDP ||
+		     ip->next_proto_id == IPPROTO_TCP) &&
+		    l4_off + 4 <= p->m->data_len) {
+			/* Ports are at the same place in UDP and TCP. */
+			l4 = rte_pktmbuf_mtod_offset(p->m, const void *,
+						     l4_off);
+			tuple[len++] = rte_be_to_cpu_16(l4->src_port) << 16 |
+				       rte_be_to_cpu_16(l4->dst_port);
+		}
+	}
+	hash = len ? rte_softrss(tuple, len, a->rss.key) : 0;
+	p->m->hash.rss = hash;
+	p->m->ol_flags |= RTE_MBUF_F_RX_RSS_HASH;
+	p->queue = a->rss.queue[hash % a->rss.queue_num];
+}
+
+/* Meters are made on first use, with the meter example profile. */
+static enum rte_color
+swemu_meter(struct swemu_port *sp, uint32_t id, struct rte_mbuf *m)
+{
+	struct swemu_meter *mtr = NULL;
+	enum rte_color color;
+	uint32_t i;
+
+	rte_spinlock_lock(&sp->meter_lock);
+	for (i = 0; i < sp->nb_meters; i++) {
+		if (sp->meters[i].id == id) {
+			mtr = &sp->meters[i];
+			break;
+		}
+	}
+	if (mtr == NULL) {
+		if (sp->nb_meters == SWEMU_MAX_METERS) {
+			rte_spinlock_unlock(&sp->meter_lock);
+			return RTE_COLOR_GREEN;
+		}
+		mtr = &sp->meters[sp->nb_meters];
+		mtr->id = id;
+		rte_meter_srtcm_config(&mtr->m, &sp->profile);
+		sp->nb_meters++;
+	}
+	color = rte_meter_srtcm_color_blind_check(&mtr->m, &sp->profile,
+						  rte_get_tsc_cycles(),
+						  m->pkt_len);
+	mtr->pkts[color]++;
+	rte_spinlock_unlock(&sp->meter_lock);
+	return color;
+}
+
+static int
+swemu_send(struct swemu_port *sp, struct swemu_pkt *p)
+{
+	struct swemu_port *dst;
+
+	if (p->port >= RTE_MAX_ETHPORTS || swemu_ports[p->port] == NULL)
+		return -1;
+	dst = swemu_ports[p->port];
+	if (rte_eth_tx_burst(p->port, p->queue % dst->nb_txq, &p->m, 1) == 0)
+		return -1;
+	sp->sent++;
+	return 0;
+}
+
+static enum swemu_fate
+swemu_actions_run(struct swemu_port *sp, struct rte_flow *rule,
+		  struct swemu_pkt *p, uint32_t first, uint32_t nb,
+		  uint32_t *jump, struct swemu_clones *clones);
+
+/* The copy goes through the sample actions, the packet goes on. */
+static void
+swemu_sample(struct swemu_port *sp, struct rte_flow *rule,
+	     const struct swemu_pkt *p, const struct swemu_action *a,
+	     struct swemu_clones *clones)
+{
+	struct swemu_pkt copy;
+	enum swemu_fate fate;
+	uint32_t jump;
+
+	if (++rule->sampled < a->sample.ratio)
+		return;
+	rule->sampled = 0;
+	copy = *p;
+	copy.m = rte_pktmbuf_copy(p->m, p->m->pool, 0, UINT32_MAX);
+	if (copy.m == NULL)
+		return;
+	copy.parsed = 0;
+	fate = swemu_actions_run(sp, rule, &copy, a->sample.first,
+				 a->sample.nb, &jump, NULL);
+	if (fate == SWEMU_FATE_PORT && swemu_send(sp, &copy) == 0)
+		return;
+	if (fate == SWEMU_FATE_PORT || fate == SWEMU_FATE_DROP ||
+	    clones == NULL || clones->nb == clones->max)
+		rte_pktmbuf_free(copy.m);
+	else
+		clones->m[clones->nb++] = copy.m;
+}
+
+static enum swemu_fate
+swemu_actions_run(struct swemu_port *sp, struct rte_flow *rule,
+		  struct swemu_pkt *p, uint32_t first, uint32_t nb,
+		  uint32_t *jump, struct swemu_clones *clones)
+{
+	enum swemu_fate fate = SWEMU_FATE_NONE;
+	const struct swemu_action *a;
+	uint32_t i;
+
+	for (i = first; i < first + nb; i++) {
+		a = &rule->actions[i];
+		if (a->type == RTE_FLOW_ACTION_TYPE_INDIRECT) {
+			__atomic_fetch_add(&a->handle->hits, 1,
+					   __ATOMIC_RELAXED);
+			__atomic_fetch_add(&a->handle->bytes, p->m->pkt_len,
+					   __ATOMIC_RELAXED);
+			a = &a->handle->action;
+		}
+		switch (a->type) {
+		case RTE_FLOW_ACTION_TYPE_JUMP:
+			*jump = a->group;
+			break;
+		case RTE_FLOW_ACTION_TYPE_MARK:
+			p->mark = a->id;
+			p->has_mark = 1;
+			break;
+		case RTE_FLOW_ACTION_TYPE_FLAG:
+			p->has_flag = 1;
+			break;
+		case RTE_FLOW_ACTION_TYPE_SET_TAG:
+			p->tags[a->tag.index] = (p->tags[a->tag.index] &
+						 ~a->tag.mask) | a->tag.data;
+			break;
+		case RTE_FLOW_ACTION_TYPE_SET_META:
+			p->meta = (p->meta & ~a->tag.mask) | a->tag.data;
+			p->has_meta = 1;
+			break;
+		case RTE_FLOW_ACTION_TYPE_QUEUE:
+			p->queue = a->queue;
+			fate = SWEMU_FATE_QUEUE;
+			break;
+		case RTE_FLOW_ACTION_TYPE_RSS:
+			swemu_rss(p, a);
+			fate = SWEMU_FATE_QUEUE;
+			break;
+		case RTE_FLOW_ACTION_TYPE_DROP:
+			return SWEMU_FATE_DROP;
+		case RTE_FLOW_ACTION_TYPE_RAW_DECAP:
+			if (swemu_raw_decap(p, a->raw.size))
+				return SWEMU_FATE_DROP;
+			break;
+		case RTE_FLOW_ACTION_TYPE_RAW_ENCAP:
+			if (swemu_raw_encap(p, a))
+				return SWEMU_FATE_DROP;
+			break;
+		case RTE_FLOW_ACTION_TYPE_METER:
+			if (swemu_meter(sp, a->id, p->m) == RTE_COLOR_RED)
+				return SWEMU_FATE_DROP;
+			break;
+		case RTE_FLOW_ACTION_TYPE_SAMPLE:
+			swemu_sample(sp, rule, p, a, clones);
+			break;
+		case RTE_FLOW_ACTION_TYPE_MODIFY_FIELD:
+			swemu_modify(p, a);
+			break;
+		case RTE_FLOW_ACTION_TYPE_PORT_ID:
+		case RTE_FLOW_ACTION_TYPE_REPRESENTED_PORT:
+			p->port = a->port;
+			fate = SWEMU_FATE_PORT;
+			break;
+		default:
+			break;
+		}
+	}
+	return fate;
+}
+
+/* Rules of a domain from group 0 until a fate, a miss or no jump. */
+static enum swemu_fate
+swemu_domain_run(struct swemu_port *sp, enum swemu_domain domain,
+		 struct swemu_pkt *p, struct swemu_clones *clones)
+{
+	struct swemu_group *g = swemu_group_find(sp, domain, 0);
+	enum swemu_fate fate;
+	struct rte_flow *rule;
+	uint32_t jumps, jump;
+	uint64_t now = 0;
+
+	for (jumps = 0; g && jumps < SWEMU_MAX_JUMPS; jumps++) {
+		TAILQ_FOREACH(rule, &g->rules, next)
+			if (swemu_match(rule, p))
+				break;
+		if (rule == NULL) {
+			g->misses++;
+			return SWEMU_FATE_NONE;
+		}
+		__atomic_fetch_add(&rule->hits, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&rule->bytes, p->m->pkt_len,
+				   __ATOMIC_RELAXED);
+		if (rule->age_cycles) {
+			if (now == 0)
+				now = rte_get_tsc_cycles();
+			rule->last_hit = now;
+		}
+		jump = UINT32_MAX;
+		fate = swemu_actions_run(sp, rule, p, 0, rule->nb_actions,
+					 &jump, clones);
+		if (fate != SWEMU_FATE_NONE || jump == UINT32_MAX)
+			return fate;
+		g = swemu_group_find(sp, domain, jump);
+	}
+	return SWEMU_FATE_NONE;
+}
+
+/* Once a second, rules idle past their timeout are reported. */
+static uint32_t
+swemu_age_check(struct swemu_port *sp)
+{
+	uint64_t now = rte_get_tsc_cycles();
+	uint64_t next = sp->next_age_check;
+	struct swemu_group *g;
+	struct rte_flow *rule;
+	uint32_t nb = 0;
+
+	/* One queue does the check. */
+	if (now < next ||
+	    !__atomic_compare_exchange_n(&sp->next_age_check, &next,
+					 now + rte_get_tsc_hz(), 0,
+					 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return 0;
+	LIST_FOREACH(g, &sp->groups, next) {
+		TAILQ_FOREACH(rule, &g->rules, next) {
+			if (rule->age_cycles == 0 || rule->aged ||
+			    now - rule->last_hit < rule->age_cycles)
+				continue;
+			rule->aged = 1;
+			nb++;
+		}
+	}
+	if (nb)
+		__atomic_fetch_add(&sp->nb_aged, nb, __ATOMIC_RELAXED);
+	return nb;
+}
+
+static void
+swemu_pkt_init(struct swemu_pkt *p, struct rte_mbuf *m, uint16_t queue)
+{
+	memset(p, 0, offsetof(struct swemu_pkt, layers));
+	p->m = m;
+	p->queue = queue;
+}
+
+/* What the application sees of the rules, as a NIC gives it. */
+static void
+swemu_rx_metadata(struct swemu_pkt *p)
+{
+	struct rte_mbuf *m = p->m;
+
+	if (p->has_mark) {
+		m->hash.fdir.hi = p->mark;
+		m->ol_flags |= RTE_MBUF_F_RX_FDIR | RTE_MBUF_F_RX_FDIR_ID;
+	} else if (p->has_flag) {
+		m->ol_flags |= RTE_MBUF_F_RX_FDIR;
+	}
+	if (p->has_meta && rte_flow_dynf_metadata_avail()) {
+		*RTE_FLOW_DYNF_METADATA(m) = p->meta;
+		m->ol_flags |= rte_flow_dynf_metadata_mask;
+	}
+}
+
+static uint16_t
+swemu_rx(uint16_t port_id, uint16_t queue, struct rte_mbuf *pkts[],
+	 uint16_t nb_pkts, uint16_t max_pkts, void *user_param)
+{
+	struct swemu_port *sp = user_param;
+	struct rte_mbuf *copies[nb_pkts ? nb_pkts : 1];
+	struct swemu_clones clones = {
+		.m = copies,
+		.max = nb_pkts,
+	};
+	uint16_t i, j, nb_rx = 0;
+	enum swemu_fate fate;
+	struct swemu_pkt p;
+	uint32_t aged;
+
+	RTE_SET_USED(port_id);
+	rte_rwlock_read_lock(&sp->lock);
+	aged = swemu_age_check(sp);
+	for (i = 0; i < nb_pkts; i++) {
+		swemu_pkt_init(&p, pkts[i], queue);
+		fate = swemu_domain_run(sp, SWEMU_TRANSFER, &p, &clones);
+		if (fate == SWEMU_FATE_NONE)
+			fate = swemu_domain_run(sp, SWEMU_INGRESS, &p, &clones);
+		/* Past the Rx queues are the hairpin ones. */
+		if (fate == SWEMU_FATE_QUEUE && p.queue >= sp->nb_rxq) {
+			p.port = sp->port_id;
+			fate = SWEMU_FATE_PORT;
+		}
+		if (fate == SWEMU_FATE_PORT && swemu_send(sp, &p) == 0)
+			continue;
+		if (fate == SWEMU_FATE_PORT || fate == SWEMU_FATE_DROP) {
+			rte_pktmbuf_free(p.m);
+			sp->dropped++;
+			continue;
+		}
+		swemu_rx_metadata(&p);
+		pkts[nb_rx++] = p.m;
+	}
+	rte_rwlock_read_unlock(&sp->lock);
+	for (j = 0; j < clones.nb; j++) {
+		if (nb_rx < max_pkts)
+			pkts[nb_rx++] = copies[j];
+		else
+			rte_pktmbuf_free(copies[j]);
+	}
+	for (j = 0; aged && j < SWEMU_MAX_CALLBACKS; j++)
+		if (sp->aged_cb[j].fn)
+			sp->aged_cb[j].fn(sp->port_id, RTE_ETH_EVENT_FLOW_AGED,
+					  sp->aged_cb[j].arg, NULL);
+	return nb_rx;
+}
+
+static uint16_t
+swemu_tx(uint16_t port_id, uint16_t queue, struct rte_mbuf *pkts[],
+	 uint16_t nb_pkts, void *user_param)
+{
+	struct swemu_port *sp = user_param;
+	uint16_t i, nb_tx = 0;
+	enum swemu_fate fate;
+	struct swemu_pkt p;
+
+	RTE_SET_USED(port_id);
+	rte_rwlock_read_lock(&sp->lock);
+	for (i = 0; i < nb_pkts; i++) {
+		swemu_pkt_init(&p, pkts[i], queue);
+		if (rte_flow_dynf_metadata_avail() &&
+		    (p.m->ol_flags & RTE_MBUF_DYNFLAG_TX_METADATA)) {
+			p.meta = *RTE_FLOW_DYNF_METADATA(p.m);
+			p.has_meta = 1;
+		}
+		fate = swemu_domain_run(sp, SWEMU_EGRESS, &p, NULL);
+		if (fate == SWEMU_FATE_DROP) {
+			rte_pktmbuf_free(p.m);
+			sp->dropped++;
+			continue;
+		}
+		pkts[nb_tx++] = p.m;
+	}
+	rte_rwlock_read_unlock(&sp->lock);
+	return nb_tx;
+}
+
+/*
+ * Put the software flow on a port, after its queues are set up: rules of
+ * the port are run on every packet received or sent.
+ */
+int
+vnf_flow_swemu_attach(uint16_t port_id)
+{
+	struct rte_meter_srtcm_params params = {
+		.cir = 10 * 1024,
+		.cbs = 10 * 1024,
+		.ebs = 0,
+	};
+	struct rte_eth_dev_info dev_info;
+	struct swemu_port *sp;
+	uint16_t q;
+
+	if (port_id >= RTE_MAX_ETHPORTS || swemu_ports[port_id] ||
+	    rte_eth_dev_info_get(port_id, &dev_info)) {
+		printf("Can't attach software flow to port %u\n", port_id);
+		return -1;
+	}
+	sp = rte_zmalloc("vnf_swemu_port", sizeof(*sp), RTE_CACHE_LINE_SIZE);
+	if (sp == NULL)
+		goto nomem;
+	sp->port_id = port_id;
+	sp->nb_rxq = dev_info.nb_rx_queues;
+	sp->nb_txq = dev_info.nb_tx_queues ? dev_info.nb_tx_queues : 1;
+	rte_rwlock_init(&sp->lock);
+	rte_spinlock_init(&sp->meter_lock);
+	LIST_INIT(&sp->groups);
+	LIST_INIT(&sp->handles);
+	rte_meter_srtcm_profile_config(&sp->profile, &params);
+	sp->rx_cb = rte_zmalloc("vnf_swemu_cb", sizeof(*sp->rx_cb) *
+				(sp->nb_rxq + sp->nb_txq), 0);
+	if (sp->rx_cb == NULL)
+		goto nomem;
+	sp->tx_cb = sp->rx_cb + sp->nb_rxq;
+	swemu_ports[port_id] = sp;
+	for (q = 0; q < sp->nb_rxq; q++) {
+		sp->rx_cb[q] = rte_eth_add_rx_callback(port_id, q, swemu_rx,
+						       sp);
+		if (sp->rx_cb[q] == NULL)
+			goto cb_error;
+	}
+	for (q = 0; q < dev_info.nb_tx_queues; q++) {
+		sp->tx_cb[q] = rte_eth_add_tx_callback(port_id, q, swemu_tx,
+						       sp);
+		if (sp->tx_cb[q] == NULL)
+			goto cb_error;
+	}
+	vnf_flow_ops_set(port_id, &swemu_flow_ops);
+	printf(":: software flow on port %u, %u Rx %u Tx queues\n",
+	       port_id, sp->nb_rxq, dev_info.nb_tx_queues);
+	return 0;
+cb_error:
+	printf("Cannot add software flow callbacks on port %u: %s\n",
+	       port_id, rte_strerror(rte_errno));
+	vnf_flow_swemu_detach(port_id);
+	return -1;
+nomem:
+	printf("Cannot allocate software flow of port %u\n", port_id);
+	rte_free(sp);
+	return -1;
+}
+
+/* The port must be stopped, no packet may be in the callbacks. */
+void
+vnf_flow_swemu_detach(uint16_t port_id)
+{
+	struct swemu_port *sp = port_id < RTE_MAX_ETHPORTS ?
+				swemu_ports[port_id] : NULL;
+	struct rte_flow_action_handle *h;
+	uint16_t q;
+
+	if (sp == NULL)
+		return;
+	for (q = 0; q < sp->nb_rxq; q++)
+		if (sp->rx_cb[q])
+			rte_eth_remove_rx_callback(port_id, q, sp->rx_cb[q]);
+	for (q = 0; q < sp->nb_txq; q++)
+		if (sp->tx_cb[q])
+			rte_eth_remove_tx_callback(port_id, q, sp->tx_cb[q]);
+	swemu_flush(port_id, NULL);
+	while ((h = LIST_FIRST(&sp->handles)) != NULL) {
+		LIST_REMOVE(h, next);
+		rte_free(h);
+	}
+	vnf_flow_ops_set(port_id, NULL);
+	swemu_ports[port_id] = NULL;
+	rte_free(sp->rx_cb);
+	rte_free(sp);
+}
+
+int
+vnf_flow_swemu_attached(uint16_t port_id)
+{
+	return port_id < RTE_MAX_ETHPORTS && swemu_ports[port_id] != NULL;
+}
+
+/* Hits of every rule, in group then match order, and of the meters. */
+void
+vnf_flow_swemu_stats_print(uint16_t port_id)
+{
+	struct swemu_port *sp = port_id < RTE_MAX_ETHPORTS ?
+				swemu_ports[port_id] : NULL;
+	struct swemu_group *g;
+	struct rte_flow *rule;
+	uint32_t i;
+
+	if (sp == NULL)
+		return;
+	rte_rwlock_read_lock(&sp->lock);
+	printf(":: software flow port %u: %u rules, %"PRIu64" sent, "
+	       "%"PRIu64" dropped\n", port_id, sp->nb_rules, sp->sent,
+	       sp->dropped);
+	LIST_FOREACH(g, &sp->groups, next) {
+		printf("   %s group %u: %"PRIu64" misses\n",
+		       swemu_domain_name[g->domain], g->id, g->misses);
+		TAILQ_FOREACH(rule, &g->rules, next)
+			printf("      rule %u prio %u: %"PRIu64" pkts "
+			       "%"PRIu64" bytes%s\n", rule->id,
+			       rule->priority, rule->hits, rule->bytes,
+			       rule->aged ? " aged" : "");
+	}
+	for (i = 0; i < sp->nb_meters; i++)
+		printf("   meter %u: green %"PRIu64" yellow %"PRIu64
+		       " red %"PRIu64"\n", sp->meters[i].id,
+		       sp->meters[i].pkts[RTE_COLOR_GREEN],
+		       sp->meters[i].pkts[RTE_COLOR_YELLOW],
+		       sp->meters[i].pkts[RTE_COLOR_RED]);
+	rte_rwlock_read_unlock(&sp->lock);
+}
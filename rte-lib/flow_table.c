@@ -0,0 +1,362 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Table topology of the application. Tables are declared by name with
+ * their purpose, the domains of their rules, the item types their rules
+ * start with and the number of rules expected, and get a group. The root
+ * table only holds the jumps to the entry tables, each table the jump of
+ * its misses, all installed by vnf_table_install(): the rules of the
+ * modules go in the non-root groups, the fast insertion path of the PMDs.
+ * Modules create their rules in a table by name, a rule off the declared
+ * shape or over the size is counted, not refused.
+ * Declared on the control path before the rules, not locked. Rules are
+ * counted atomically, the flow program creates them from all lcores.
+ *
+ * testpmd equivalent of the default topology:
+ * testpmd> flow create 0 group 0 priority 1 transfer pattern eth / end
+ *          actions jump group 1 / end
+ * testpmd> flow create 0 group 0 priority 1 ingress pattern eth / end
+ *          actions jump group 1 / end
+ * testpmd> flow create 0 group 1 priority 10 transfer pattern eth / end
+ *          actions jump group 4294967294 / end
+ */
+
+#define TABLE_MAX 32
+#define TABLE_SHAPE_MAX 8
+#define TABLE_FIRST_GROUP (FIRST_TABLE + 1) /* Handed out from there. */
+
+struct vnf_table {
+	char name[32];
+	const char *purpose;
+	uint32_t group;
+	uint32_t size;
+	uint32_t flags;
+	int miss; /* Index of the miss table, -1 for the PMD default. */
+	uint16_t nb_shape;
+	enum rte_flow_item_type shape[TABLE_SHAPE_MAX];
+	uint64_t nb_rules;
+	uint64_t off_shape;
+	uint8_t over_size; /* Reported once. */
+};
+
+static const struct vnf_table_decl core_tables[] = {
+	{
+		.name = "root",
+		.purpose = "jumps to the entry tables only",
+		.size = 16,
+		.flags = VNF_TABLE_F_INGRESS | VNF_TABLE_F_EGRESS |
+			 VNF_TABLE_F_TRANSFER,
+	},
+	{
+		.name = "classify",
+		.purpose = "default, hairpin and meter rules",
+		.miss = "miss",
+		.size = 1024,
+		.flags = VNF_TABLE_F_INGRESS | VNF_TABLE_F_TRANSFER |
+			 VNF_TABLE_F_ENTRY,
+	},
+	{
+		.name = "miss",
+		.purpose = "packets no table took",
+		.flags = VNF_TABLE_F_TRANSFER,
+	},
+};
+
+static const uint32_t core_groups[] = { 0, FIRST_TABLE, MISS_TABLE_ID };
+
+static struct vnf_table tables[TABLE_MAX];
+static int nb_tables;
+static uint32_t next_group = TABLE_FIRST_GROUP;
+
+static int
+table_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nb_tables; i++)
+		if (!strcmp(tables[i].name, name))
+			return i;
+	return -1;
+}
+
+static int
+table_add(const struct vnf_table_decl *decl, uint32_t group)
+{
+	struct vnf_table *t;
+	int i;
+
+	if (nb_tables == TABLE_MAX) {
+		printf("Cannot declare table %s, %d tables\n", decl->name,
+		       TABLE_MAX);
+		return -1;
+	}
+	t = &tables[nb_tables];
+	memset(t, 0, sizeof(*t));
+	snprintf(t->name, sizeof(t->name), "%s", decl->name);
+	t->purpose = decl->purpose;
+	t->group = group;
+	t->size = decl->size;
+	t->flags = decl->flags;
+	t->miss = -1;
+	if (decl->miss) {
+		t->miss = table_find(decl->miss);
+		if (t->miss < 0) {
+			printf("Table %s misses to unknown table %s\n",
+			       decl->name, decl->miss);
+			return -1;
+		}
+	}
+	for (i = 0; decl->shape && i < TABLE_SHAPE_MAX &&
+	     decl->shape[i] != RTE_FLOW_ITEM_TYPE_END; i++)
+		t->shape[i] = decl->shape[i];
+	t->nb_shape = i;
+	return nb_tables++;
+}
+
+/* The core tables are there before any module declares its own. */
+static int
+table_core_init(void)
+{
+	unsigned int i;
+
+	if (nb_tables)
+		return 0;
+	for (i = 0; i < RTE_DIM(core_tables); i++)
+		if (table_add(&core_tables[i], core_groups[i]) < 0)
+			return -1;
+	return 0;
+}
+
+/*
+ * Declare a table, return its group, VNF_TABLE_INVALID on error. A table
+ * declared again keeps its group.
+ */
+uint32_t
+vnf_table_declare(const struct vnf_table_decl *decl)
+{
+	int idx;
+
+	if (decl->name == NULL || table_core_init())
+		return VNF_TABLE_INVALID;
+	idx = table_find(decl->name);
+	if (idx >= 0)
+		return tables[idx].group;
+	idx = table_add(decl, next_group);
+	if (idx < 0)
+		return VNF_TABLE_INVALID;
+	next_group++;
+	return tables[idx].group;
+}
+
+uint32_t
+vnf_table_group(const char *name)
+{
+	int idx;
+
+	if (table_core_init())
+		return VNF_TABLE_INVALID;
+	idx = table_find(name);
+	return idx < 0 ? VNF_TABLE_INVALID : tables[idx].group;
+}
+
+/* Rule domains of a table on the port, transfer ones go ingress without it. */
+static uint32_t
+table_domains(uint16_t port_id, const struct vnf_table *t)
+{
+	uint32_t flags = t->flags;
+
+	if ((flags & VNF_TABLE_F_TRANSFER) &&
+	    !vnf_feature_hw(port_id, VNF_FEAT_TRANSFER)) {
+		flags &= ~VNF_TABLE_F_TRANSFER;
+		flags |= VNF_TABLE_F_INGRESS;
+	}
+	return flags & (VNF_TABLE_F_INGRESS | VNF_TABLE_F_EGRESS |
+			VNF_TABLE_F_TRANSFER);
+}
+
+static void
+table_attr_domain(struct rte_flow_attr *attr, uint32_t domain)
+{
+	attr->ingress = domain == VNF_TABLE_F_INGRESS;
+	attr->egress = domain == VNF_TABLE_F_EGRESS;
+	attr->transfer = domain == VNF_TABLE_F_TRANSFER;
+}
+
+/* A jump rule in table t in each domain, pattern given by the builder. */
+static int
+table_jump_create(uint16_t port_id, struct vnf_table *t, uint32_t domains,
+		  uint32_t priority, struct vnf_flow_builder *fb,
+		  uint32_t target)
+{
+	struct rte_flow_attr attr = { .group = t->group, .priority = priority };
+	struct rte_flow_error error;
+	uint32_t domain;
+
+	vnf_flow_action_jump(fb, target);
+	if (vnf_flow_builder_check(fb, &error)) {
+		printf("can't build jump from group %u to %u, port id:%u\n",
+		       t->group, target, port_id);
+		return -1;
+	}
+	for (domain = VNF_TABLE_F_INGRESS; domain <= VNF_TABLE_F_TRANSFER;
+	     domain <<= 1) {
+		if (!(domains & domain))
+			continue;
+		table_attr_domain(&attr, domain);
+		if (vnf_flow_create(port_id, &attr, fb->items, fb->actions,
+				    VNF_FLOW_OWNER_DEFAULT, 0,
+				    &error) == NULL) {
+			printf("can't create jump from group %u to %u, port id:%u, error: %s\n",
+			       t->group, target, port_id, error.message);
+			return -1;
+		}
+		__atomic_fetch_add(&t->nb_rules, 1, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+/*
+ * The jumps of the topology on the port: from the root table to each
+ * entry table if entries is set (isolate mode has its own), from each
+ * table to the one taking its misses.
+ */
+int
+vnf_table_install(uint16_t port_id, int entries)
+{
+	struct vnf_flow_builder fb;
+	struct vnf_table *t;
+	uint32_t domains;
+	int i, j;
+
+	if (table_core_init())
+		return -1;
+	for (i = 0; i < nb_tables && entries; i++) {
+		t = &tables[i];
+		if (!(t->flags & VNF_TABLE_F_ENTRY))
+			continue;
+		vnf_flow_builder_init(&fb);
+		for (j = 0; j < t->nb_shape; j++)
+			vnf_flow_item(&fb, t->shape[j], NULL, NULL, 0);
+		if (!t->nb_shape)
+			vnf_flow_item_eth(&fb, NULL, NULL);
+		/* A shaped entry goes before the catch all ones. */
+		if (table_jump_create(port_id, &tables[0],
+				      table_domains(port_id, t),
+				      t->nb_shape ? 0 : MIN_FLOW_PRIORITY,
+				      &fb, t->group))
+			return -1;
+	}
+	for (i = 0; i < nb_tables; i++) {
+		t = &tables[i];
+		if (t->miss < 0)
+			continue;
+		domains = table_domains(port_id, t) &
+			  table_domains(port_id, &tables[t->miss]);
+		vnf_flow_builder_init(&fb);
+		vnf_flow_item_eth(&fb, NULL, NULL);
+		if (table_jump_create(port_id, t, domains, MAX_FLOW_PRIORITY, &fb,
+				      tables[t->miss].group))
+			return -1;
+	}
+	return 0;
+}
+
+static int
+table_on_shape(const struct vnf_table *t, const struct rte_flow_item *pattern)
+{
+	int i = 0;
+
+	for (; pattern->type != RTE_FLOW_ITEM_TYPE_END && i < t->nb_shape;
+	     pattern++) {
+		if (pattern->type == RTE_FLOW_ITEM_TYPE_VOID)
+			continue;
+		if (pattern->type != t->shape[i++])
+			return 0;
+	}
+	return i == t->nb_shape;
+}
+
+/*
+ * vnf_flow_create in the group of the named table, attr group ignored,
+ * attr priority VNF_FLOW_PRIO_AUTO to be placed by the priority manager.
+ */
+struct rte_flow *
+vnf_table_flow_create(uint16_t port_id, const char *table,
+		      const struct rte_flow_attr *attr,
+		      const struct rte_flow_item pattern[],
+		      const struct rte_flow_action actions[],
+		      enum vnf_flow_owner owner, uint64_t cookie,
+		      struct rte_flow_error *error)
+{
+	struct rte_flow_attr table_attr = *attr;
+	struct vnf_prio_rule *rule;
+	struct rte_flow *flow;
+	struct vnf_table *t;
+	int idx;
+
+	idx = table_core_init() ? -1 : table_find(table);
+	if (idx < 0) {
+		rte_flow_error_set(error, ENOENT, RTE_FLOW_ERROR_TYPE_ATTR,
+				   NULL, "unknown table");
+		return NULL;
+	}
+	t = &tables[idx];
+	table_attr.group = t->group;
+	if (!table_on_shape(t, pattern))
+		__atomic_fetch_add(&t->off_shape, 1, __ATOMIC_RELAXED);
+	/* Refused when it shadows or is shadowed by a rule of the table. */
+	rule = vnf_prio_check(port_id, &table_attr, pattern, actions, error);
+	if (rule == NULL)
+		return NULL;
+	flow = vnf_flow_create(port_id, &table_attr, pattern, actions, owner,
+			       cookie, error);
+	vnf_prio_commit(rule, flow);
+	if (flow == NULL)
+		return NULL;
+	if (__atomic_add_fetch(&t->nb_rules, 1, __ATOMIC_RELAXED) > t->size &&
+	    t->size && !t->over_size) {
+		t->over_size = 1;
+		printf(":: table %s is over its %u rules\n", t->name, t->size);
+	}
+	return flow;
+}
+
+void
+vnf_table_print(void)
+{
+	const struct vnf_table *t;
+	int i;
+
+	if (table_core_init())
+		return;
+	printf(":: table topology\n");
+	for (i = 0; i < nb_tables; i++) {
+		t = &tables[i];
+		printf("  %-12s group %-10u %s%s%s%s rules %" PRIu64 "/%u",
+		       t->name, t->group,
+		       t->flags & VNF_TABLE_F_INGRESS ? "i" : "-",
+		       t->flags & VNF_TABLE_F_EGRESS ? "e" : "-",
+		       t->flags & VNF_TABLE_F_TRANSFER ? "t" : "-",
+		       t->flags & VNF_TABLE_F_ENTRY ? "E" : "-",
+		       t->nb_rules, t->size);
+		if (t->off_shape)
+			printf(", %" PRIu64 " off shape", t->off_shape);
+		if (t->miss >= 0)
+			printf(", miss to %s", tables[t->miss].name);
+		printf(", %s\n", t->purpose ? t->purpose : "");
+	}
+}
@@ -8,69 +8,6 @@
 #include <rte_gtp.h>
 #include "vnf_examples.h"
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
- */
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
 /*
  * create two flows by using tag to connect both.
  * The corresponding testpmd commands:
@@ -92,6 +29,7 @@ create_flow_with_tag(uint16_t port_id)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
@@ -183,35 +121,24 @@ create_flow_with_tag(uint16_t port_id)
 			.type = RTE_FLOW_ACTION_TYPE_END,
 		},
 	};
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L2].spec = NULL;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = NULL;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[L4].spec = NULL;
-	pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_GTP;
-	pattern[TUNNEL].spec = &gtp_spec;
-	pattern[TUNNEL].mask = &gtp_mask;
-	pattern[L3_INNER].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3_INNER].spec = &ipv4_inner;
-	pattern[L3_INNER].mask = &ipv4_mask;
-	pattern[L4_INNER].type = RTE_FLOW_ITEM_TYPE_TCP;
-	pattern[L4_INNER].spec = NULL;
-	pattern[END].type = RTE_FLOW_ITEM_TYPE_END;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	vnf_flow_item_udp(&fb, NULL, NULL);
+	vnf_flow_item_gtp(&fb, &gtp_spec, &gtp_mask);
+	vnf_flow_item_ipv4(&fb, &ipv4_inner, &ipv4_mask);
+	vnf_flow_item_tcp(&fb, NULL, NULL);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, root_actions,
+				       VNF_FLOW_OWNER_TAG, 0, &error);
 	if (!flow) {
 		printf("Can't create tag flow on port: %u, group: %d, error: %s\n",
 				port_id, attr.group, error.message);
 		return flow;
 	}
-	struct rte_flow_item_tag tag = {
-		.data = 0xdeadbeef,
-		.index = 0,
-	};
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_TAG;
-	pattern[L2].spec = &tag;
-	pattern[L2].mask = NULL; /* use default mask. */
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_END;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_tag(&fb, 0, 0xdeadbeef, UINT32_MAX);
 	struct rte_flow_action_queue queue = {
 		.index = 0,
 	};
@@ -233,7 +160,10 @@ create_flow_with_tag(uint16_t port_id)
 		},
 	};
 	attr.group = 1;
-	flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_TAG, 0, &error);
 	if (!flow)
 		printf("Can't create tag flow on port: %u, group: %d, error: %s\n",
 				port_id, attr.group, error.message);
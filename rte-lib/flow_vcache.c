@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_hash_crc.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Rules the port validated, by shape: the attributes, the type and mask
+ * of each item and the type of each action, the values matched and set
+ * are not part of it. Once a shape validated, the next rules of the same
+ * shape go straight to create, the many sessions of an install cost one
+ * driver call each instead of two. Only successes are kept, a rejected
+ * shape is validated again for its error. The cache of a port is dropped
+ * when the port is configured again or its flow ops are changed.
+ * Direct mapped and lock free, lcores installing in parallel race on a
+ * slot at worst, the loser validates once more.
+ */
+
+#define VCACHE_SIZE 1024 /* Shapes per port, a power of 2. */
+#define VCACHE_ITEM_MAX_SIZE 256
+
+struct vcache_port {
+	uint64_t shapes[VCACHE_SIZE]; /* 0 is an empty slot. */
+	uint64_t hits;
+	uint64_t misses;
+};
+
+static struct vcache_port vcache_ports[RTE_MAX_ETHPORTS];
+
+/* The header sizes and the target group change the rule. */
+static uint32_t
+vcache_action_conf(const struct rte_flow_action *action)
+{
+	if (action->conf == NULL)
+		return 0;
+	switch (action->type) {
+	case RTE_FLOW_ACTION_TYPE_RAW_ENCAP:
+		return ((const struct rte_flow_action_raw_encap *)
+			action->conf)->size;
+	case RTE_FLOW_ACTION_TYPE_RAW_DECAP:
+		return ((const struct rte_flow_action_raw_decap *)
+			action->conf)->size;
+	case RTE_FLOW_ACTION_TYPE_JUMP:
+		return ((const struct rte_flow_action_jump *)
+			action->conf)->group;
+	default:
+		return 0;
+	}
+}
+
+/* Two CRCs of the shape, the mask of an item is hashed, not its spec. */
+static uint64_t
+vcache_shape(const struct rte_flow_attr *attr,
+	     const struct rte_flow_item pattern[],
+	     const struct rte_flow_action actions[])
+{
+	uint8_t mask[VCACHE_ITEM_MAX_SIZE];
+	uint32_t lo, hi, conf;
+	uint64_t shape;
+	int len;
+
+	lo = rte_hash_crc_4byte(attr->group, attr->priority);
+	lo = rte_hash_crc_4byte(attr->ingress | attr->egress << 1 |
+				attr->transfer << 2, lo);
+	hi = ~lo;
+	for (; pattern->type != RTE_FLOW_ITEM_TYPE_END; pattern++) {
+		/* A spec without mask takes the default mask of the item. */
+		conf = pattern->type << 2 | !!pattern->spec << 1 |
+		       !!pattern->last;
+		lo = rte_hash_crc_4byte(conf, lo);
+		hi = rte_hash_crc_4byte(conf, hi);
+		if (pattern->spec == NULL || pattern->mask == NULL)
+			continue;
+		len = rte_flow_conv(RTE_FLOW_CONV_OP_ITEM_MASK, mask,
+				    sizeof(mask), pattern, NULL);
+		if (len <= 0)
+			continue;
+		len = RTE_MIN(len, (int)sizeof(mask));
+		lo = rte_hash_crc(mask, len, lo);
+		hi = rte_hash_crc(mask, len, hi);
+	}
+	for (; actions->type != RTE_FLOW_ACTION_TYPE_END; actions++) {
+		conf = vcache_action_conf(actions);
+		lo = rte_hash_crc_4byte(actions->type, lo);
+		lo = rte_hash_crc_4byte(conf, lo);
+		hi = rte_hash_crc_4byte(actions->type, hi);
+		hi = rte_hash_crc_4byte(conf, hi);
+	}
+	shape = (uint64_t)hi << 32 | lo;
+	return shape ? shape : 1;
+}
+
+/* Same as the validate of the flow ops, skipped for a known shape. */
+int
+vnf_flow_validate_cached(uint16_t port_id, const struct rte_flow_attr *attr,
+			 const struct rte_flow_item pattern[],
+			 const struct rte_flow_action actions[],
+			 struct rte_flow_error *error)
+{
+	struct vcache_port *vp;
+	uint64_t shape, *slot;
+	int ret;
+
+	if (port_id >= RTE_MAX_ETHPORTS)
+		return vnf_flow_ops_get(port_id)->validate(port_id, attr,
+							   pattern, actions,
+							   error);
+	vp = &vcache_ports[port_id];
+	shape = vcache_shape(attr, pattern, actions);
+	slot = &vp->shapes[shape & (VCACHE_SIZE - 1)];
+	if (__atomic_load_n(slot, __ATOMIC_RELAXED) == shape) {
+		__atomic_fetch_add(&vp->hits, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	__atomic_fetch_add(&vp->misses, 1, __ATOMIC_RELAXED);
+	ret = vnf_flow_ops_get(port_id)->validate(port_id, attr, pattern,
+						  actions, error);
+	if (ret == 0)
+		__atomic_store_n(slot, shape, __ATOMIC_RELAXED);
+	return ret;
+}
+
+/* The port is configured again or has new flow ops. */
+void
+vnf_flow_vcache_flush(uint16_t port_id)
+{
+	if (port_id >= RTE_MAX_ETHPORTS)
+		return;
+	memset(vcache_ports[port_id].shapes, 0,
+	       sizeof(vcache_ports[port_id].shapes));
+}
+
+void
+vnf_flow_vcache_print(uint16_t port_id)
+{
+	struct vcache_port *vp;
+
+	if (port_id >= RTE_MAX_ETHPORTS)
+		return;
+	vp = &vcache_ports[port_id];
+	if (vp->hits + vp->misses == 0)
+		return;
+	printf(":: port %u validate cache: %" PRIu64 " hits, %" PRIu64
+	       " validated\n", port_id, vp->hits, vp->misses);
+}
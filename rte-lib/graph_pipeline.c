@@ -0,0 +1,550 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_graph.h>
+#include <rte_graph_worker.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_meter.h>
+#include <rte_cycles.h>
+
+#include "vnf_examples.h"
+
+/*
+ * The datapath as rte_graph nodes, one graph instance per worker lcore:
+ *
+ * vnf_eth_rx -> vnf_parse -+-> vnf_session_lookup -> vnf_meter -> vnf_mirror
+ *                          +-> vnf_gtpu_decap                       |
+ *                          +-> vnf_gtpu_encap                       |
+ *                          +-> vnf_drop                             v
+ *                          +----------------------------------> vnf_eth_tx
+ *
+ * The parse node uses the same classification as the burst dispatch, its
+ * edges are in enum vnf_next order. Every node gets a vector of packets and
+ * the graph library keeps per node calls, objects and cycles, printed with
+ * rte_graph_cluster_stats.
+ *
+ * The meter node only meters the marks given a rate by
+ * vnf_graph_meter_set(), e.g. the PDU sessions without a hardware meter,
+ * the packets of the other marks pass. The srTCM profile of a mark is
+ * shared, its state is per lcore and follows a new profile of the mark
+ * from its next packet.
+ */
+
+/* Profile of a mark, gen 0 when the mark is not metered. */
+struct graph_mark_meter {
+	struct rte_meter_srtcm_profile profile;
+	uint32_t gen;
+};
+
+/* State of a mark on one lcore, for the profile of gen. */
+struct graph_lcore_meter {
+	struct rte_meter_srtcm meter;
+	uint32_t gen;
+};
+
+/* State of one worker lcore, shared by the nodes of its graph. */
+struct vnf_graph_lcore {
+	struct vnf_graph_conf conf;
+	rte_graph_t id;
+	struct rte_graph *graph;
+	struct graph_lcore_meter *meters; /* By mark. */
+};
+
+/* Node private data, fits in node->ctx. */
+struct vnf_node_ctx {
+	struct vnf_graph_lcore *lc;
+	uint16_t next_queue; /* Rx node only, next queue to poll. */
+};
+
+static struct vnf_graph_lcore *graph_lcores[RTE_MAX_LCORE];
+/* Graph being created, picked up by the node init callbacks. */
+static struct vnf_graph_lcore *graph_creating;
+static struct graph_mark_meter *mark_meters;
+static uint32_t mark_meter_gen;
+static struct rte_graph_cluster_stats *graph_stats;
+
+#define VNF_NODE_CTX(node) ((struct vnf_node_ctx *)(node)->ctx)
+
+/*
+ * Nodes keeping a next[] array per packet have a single upstream node,
+ * which never passes more than RTE_GRAPH_BURST_SIZE objects.
+ */
+
+enum {
+	SESSION_NEXT_METER,
+	SESSION_NEXT_TX,
+};
+
+enum {
+	METER_NEXT_MIRROR,
+	METER_NEXT_TX,
+	METER_NEXT_DROP,
+};
+
+static int
+vnf_node_init(const struct rte_graph *graph, struct rte_node *node)
+{
+	RTE_SET_USED(graph);
+	RTE_BUILD_BUG_ON(sizeof(struct vnf_node_ctx) > RTE_NODE_CTX_SZ);
+	memset(node->ctx, 0, RTE_NODE_CTX_SZ);
+	VNF_NODE_CTX(node)->lc = graph_creating;
+	return 0;
+}
+
+/* Enqueue runs of packets going to the same edge at once. */
+static void
+vnf_node_enqueue_runs(struct rte_graph *graph, struct rte_node *node,
+		      void **objs, const uint8_t *next, uint16_t nb_objs)
+{
+	uint16_t start = 0, i;
+
+	for (i = 1; i <= nb_objs; i++) {
+		if (i < nb_objs && next[i] == next[start])
+			continue;
+		rte_node_enqueue(graph, node, next[start], &objs[start],
+				 i - start);
+		start = i;
+	}
+}
+
+static uint16_t
+eth_rx_process(struct rte_graph *graph, struct rte_node *node, void **objs,
+	       uint16_t nb_objs)
+{
+	struct vnf_node_ctx *ctx = VNF_NODE_CTX(node);
+	const struct vnf_graph_conf *conf = &ctx->lc->conf;
+	uint16_t queue = conf->rx_queues[ctx->next_queue];
+	uint16_t nb_rx;
+
+	RTE_SET_USED(objs);
+	RTE_SET_USED(nb_objs);
+	/* One queue per walk, the graph is walked in a tight loop. */
+	if (++ctx->next_queue == conf->nb_rx_queues)
+		ctx->next_queue = 0;
+	nb_rx = rte_eth_rx_burst(conf->port_id, queue,
+				 (struct rte_mbuf **)node->objs, node->size);
+	if (!nb_rx)
+		return 0;
+	node->idx = nb_rx;
+	rte_node_next_stream_move(graph, node, 0);
+	return nb_rx;
+}
+
+static struct rte_node_register eth_rx_node = {
+	.process = eth_rx_process,
+	.flags = RTE_NODE_SOURCE_F,
+	.name = "vnf_eth_rx",
+	.init = vnf_node_init,
+	.nb_edges = 1,
+	.next_nodes = {
+		"vnf_parse",
+	},
+};
+RTE_NODE_REGISTER(eth_rx_node);
+
+static uint16_t
+parse_process(struct rte_graph *graph, struct rte_node *node, void **objs,
+	      uint16_t nb_objs)
+{
+	struct rte_mbuf **pkts = (struct rte_mbuf **)objs;
+	uint8_t next[RTE_GRAPH_BURST_SIZE];
+	uint16_t nb_pkts, i;
+
+	vnf_parse_burst(pkts, nb_objs);
+	/* Fragments are held back until their datagram is complete. */
+	nb_pkts = gtp_u_reassemble_burst(pkts, nb_objs, rte_rdtsc());
+	for (i = 0; i < nb_pkts; i++)
+		next[i] = vnf_dispatch_classify(pkts[i]);
+	vnf_node_enqueue_runs(graph, node, objs, next, nb_pkts);
+	return nb_objs;
+}
+
+static struct rte_node_register parse_node = {
+	.process = parse_process,
+	.name = "vnf_parse",
+	.init = vnf_node_init,
+	.nb_edges = VNF_NEXT_MAX,
+	.next_nodes = {
+		[VNF_NEXT_SLOW] = "vnf_eth_tx",
+		[VNF_NEXT_SESSION] = "vnf_session_lookup",
+		[VNF_NEXT_DECAP] = "vnf_gtpu_decap",
+		[VNF_NEXT_ENCAP] = "vnf_gtpu_encap",
+		/* The graph forwards the hairpin, its meter node mirrors. */
+		[VNF_NEXT_HAIRPIN] = "vnf_eth_tx",
+		[VNF_NEXT_MIRROR] = "vnf_session_lookup",
+		[VNF_NEXT_DROP] = "vnf_drop",
+	},
+};
+RTE_NODE_REGISTER(parse_node);
+
+static uint16_t
+gtpu_decap_process(struct rte_graph *graph, struct rte_node *node,
+		   void **objs, uint16_t nb_objs)
+{
+	uint16_t i;
+
+	for (i = 0; i < nb_objs; i++) {
+		if (gtp_u_sw_decap((struct rte_mbuf *)objs[i]))
+			rte_node_enqueue_x1(graph, node, 1, objs[i]);
+		else
+			rte_node_enqueue_x1(graph, node, 0, objs[i]);
+	}
+	return nb_objs;
+}
+
+static struct rte_node_register gtpu_decap_node = {
+	.process = gtpu_decap_process,
+	.name = "vnf_gtpu_decap",
+	.init = vnf_node_init,
+	.nb_edges = 2,
+	.next_nodes = {
+		"vnf_eth_tx",
+		"vnf_drop",
+	},
+};
+RTE_NODE_REGISTER(gtpu_decap_node);
+
+static uint16_t
+gtpu_encap_process(struct rte_graph *graph, struct rte_node *node,
+		   void **objs, uint16_t nb_objs)
+{
+	const struct vnf_graph_conf *conf = &VNF_NODE_CTX(node)->lc->conf;
+	struct rte_mbuf *out[GTP_FRAG_MAX_FRAGS];
+	uint16_t nb_out, i;
+
+	for (i = 0; i < nb_objs; i++) {
+		/* Oversize packets come out as several fragments. */
+		nb_out = gtp_u_encap_fragment((struct rte_mbuf *)objs[i],
+					      conf->mtu, out, RTE_DIM(out));
+		if (nb_out)
+			rte_node_enqueue(graph, node, 0, (void **)out, nb_out);
+	}
+	return nb_objs;
+}
+
+static struct rte_node_register gtpu_encap_node = {
+	.process = gtpu_encap_process,
+	.name = "vnf_gtpu_encap",
+	.init = vnf_node_init,
+	.nb_edges = 1,
+	.next_nodes = {
+		"vnf_eth_tx",
+	},
+};
+RTE_NODE_REGISTER(gtpu_encap_node);
+
+static uint16_t
+session_lookup_process(struct rte_graph *graph, struct rte_node *node,
+		       void **objs, uint16_t nb_objs)
+{
+	uint8_t next[RTE_GRAPH_BURST_SIZE];
+	uint16_t i;
+
+	/* Unknown mark (rule being removed), send it as is. */
+	for (i = 0; i < nb_objs; i++)
+		next[i] = vnf_mark_dispatch((struct rte_mbuf *)objs[i]) ?
+			  SESSION_NEXT_TX : SESSION_NEXT_METER;
+	vnf_node_enqueue_runs(graph, node, objs, next, nb_objs);
+	return nb_objs;
+}
+
+static struct rte_node_register session_lookup_node = {
+	.process = session_lookup_process,
+	.name = "vnf_session_lookup",
+	.init = vnf_node_init,
+	.nb_edges = 2,
+	.next_nodes = {
+		[SESSION_NEXT_METER] = "vnf_meter",
+		[SESSION_NEXT_TX] = "vnf_eth_tx",
+	},
+};
+RTE_NODE_REGISTER(session_lookup_node);
+
+static uint16_t
+meter_process(struct rte_graph *graph, struct rte_node *node, void **objs,
+	      uint16_t nb_objs)
+{
+	struct vnf_graph_lcore *lc = VNF_NODE_CTX(node)->lc;
+	uint8_t next[RTE_GRAPH_BURST_SIZE];
+	uint8_t pass = lc->conf.mirror_port < RTE_MAX_ETHPORTS ?
+		       METER_NEXT_MIRROR : METER_NEXT_TX;
+	uint64_t tsc = rte_rdtsc();
+	struct graph_mark_meter *mm;
+	struct graph_lcore_meter *lm;
+	struct rte_mbuf *m;
+	uint32_t mark, gen;
+	uint16_t i;
+
+	/* Color blind srTCM, the meter of the mark if it has one. */
+	for (i = 0; i < nb_objs; i++) {
+		m = (struct rte_mbuf *)objs[i];
+		next[i] = pass;
+		mark = m->hash.fdir.hi;
+		if (mark_meters == NULL || mark >= VNF_MARK_TABLE_SIZE)
+			continue;
+		mm = &mark_meters[mark];
+		gen = __atomic_load_n(&mm->gen, __ATOMIC_ACQUIRE);
+		if (!gen)
+			continue;
+		lm = &lc->meters[mark];
+		if (lm->gen != gen) {
+			rte_meter_srtcm_config(&lm->meter, &mm->profile);
+			lm->gen = gen;
+		}
+		if (rte_meter_srtcm_color_blind_check(&lm->meter, &mm->profile,
+				tsc, m->pkt_len) == RTE_COLOR_RED)
+			next[i] = METER_NEXT_DROP;
+	}
+	vnf_node_enqueue_runs(graph, node, objs, next, nb_objs);
+	return nb_objs;
+}
+
+static struct rte_node_register meter_node = {
+	.process = meter_process,
+	.name = "vnf_meter",
+	.init = vnf_node_init,
+	.nb_edges = 3,
+	.next_nodes = {
+		[METER_NEXT_MIRROR] = "vnf_mirror",
+		[METER_NEXT_TX] = "vnf_eth_tx",
+		[METER_NEXT_DROP] = "vnf_drop",
+	},
+};
+RTE_NODE_REGISTER(meter_node);
+
+static uint16_t
+mirror_process(struct rte_graph *graph, struct rte_node *node, void **objs,
+	       uint16_t nb_objs)
+{
+	const struct vnf_graph_conf *conf = &VNF_NODE_CTX(node)->lc->conf;
+	struct rte_mbuf *copy;
+	uint16_t i;
+
+	for (i = 0; i < nb_objs; i++) {
+		copy = rte_pktmbuf_copy((struct rte_mbuf *)objs[i], conf->pool,
+					0, UINT32_MAX);
+		if (copy == NULL)
+			continue; /* The original is sent anyway. */
+		copy->port = conf->mirror_port;
+		rte_node_enqueue_x1(graph, node, 0, copy);
+	}
+	rte_node_next_stream_move(graph, node, 0);
+	return nb_objs;
+}
+
+static struct rte_node_register mirror_node = {
+	.process = mirror_process,
+	.name = "vnf_mirror",
+	.init = vnf_node_init,
+	.nb_edges = 1,
+	.next_nodes = {
+		"vnf_eth_tx",
+	},
+};
+RTE_NODE_REGISTER(mirror_node);
+
+static uint16_t
+eth_tx_process(struct rte_graph *graph, struct rte_node *node, void **objs,
+	       uint16_t nb_objs)
+{
+	const struct vnf_graph_conf *conf = &VNF_NODE_CTX(node)->lc->conf;
+	struct rte_mbuf **pkts = (struct rte_mbuf **)objs;
+	uint16_t start = 0, nb_tx, i;
+
+	RTE_SET_USED(graph);
+	/* Packets go back to their own port, one Tx burst per port run. */
+	for (i = 1; i <= nb_objs; i++) {
+		if (i < nb_objs && pkts[i]->port == pkts[start]->port)
+			continue;
+		nb_tx = rte_eth_tx_burst(pkts[start]->port, conf->tx_queue,
+					 &pkts[start], i - start);
+		if (unlikely(nb_tx < i - start))
+			rte_pktmbuf_free_bulk(&pkts[start + nb_tx],
+					      i - start - nb_tx);
+		start = i;
+	}
+	return nb_objs;
+}
+
+static struct rte_node_register eth_tx_node = {
+	.process = eth_tx_process,
+	.name = "vnf_eth_tx",
+	.init = vnf_node_init,
+	.nb_edges = 0,
+};
+RTE_NODE_REGISTER(eth_tx_node);
+
+static uint16_t
+drop_process(struct rte_graph *graph, struct rte_node *node, void **objs,
+	     uint16_t nb_objs)
+{
+	RTE_SET_USED(graph);
+	RTE_SET_USED(node);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
+	return nb_objs;
+}
+
+static struct rte_node_register drop_node = {
+	.process = drop_process,
+	.name = "vnf_drop",
+	.nb_edges = 0,
+};
+RTE_NODE_REGISTER(drop_node);
+
+int
+vnf_graph_create(unsigned int lcore_id, const struct vnf_graph_conf *conf)
+{
+	static const char *node_patterns[] = {"vnf_*"};
+	struct rte_graph_param prm;
+	struct vnf_graph_lcore *lc;
+	char name[RTE_GRAPH_NAMESIZE];
+
+	if (!conf->nb_rx_queues || conf->nb_rx_queues > VNF_GRAPH_MAX_RX_QUEUES) {
+		printf("lcore %u needs 1 to %u Rx queues\n", lcore_id,
+		       VNF_GRAPH_MAX_RX_QUEUES);
+		return -1;
+	}
+	if (vnf_graph_meter_init())
+		return -1;
+	lc = rte_zmalloc_socket("vnf_graph_lcore", sizeof(*lc),
+				RTE_CACHE_LINE_SIZE,
+				rte_lcore_to_socket_id(lcore_id));
+	if (lc != NULL)
+		lc->meters = rte_zmalloc_socket("vnf_graph_meters",
+				sizeof(*lc->meters) * VNF_MARK_TABLE_SIZE,
+				RTE_CACHE_LINE_SIZE,
+				rte_lcore_to_socket_id(lcore_id));
+	if (lc == NULL || lc->meters == NULL) {
+		printf("Cannot allocate graph context for lcore %u\n", lcore_id);
+		rte_free(lc);
+		return -1;
+	}
+	lc->conf = *conf;
+	memset(&prm, 0, sizeof(prm));
+	prm.socket_id = rte_lcore_to_socket_id(lcore_id);
+	prm.nb_node_patterns = RTE_DIM(node_patterns);
+	prm.node_patterns = node_patterns;
+	snprintf(name, sizeof(name), "vnf_worker_%u", lcore_id);
+	graph_creating = lc;
+	lc->id = rte_graph_create(name, &prm);
+	graph_creating = NULL;
+	if (lc->id == RTE_GRAPH_ID_INVALID) {
+		printf("Cannot create graph for lcore %u: %s\n", lcore_id,
+		       rte_strerror(rte_errno));
+		rte_free(lc->meters);
+		rte_free(lc);
+		return -1;
+	}
+	lc->graph = rte_graph_lookup(name);
+	graph_lcores[lcore_id] = lc;
+	return 0;
+}
+
+void
+vnf_graph_walk(void)
+{
+	rte_graph_walk(graph_lcores[rte_lcore_id()]->graph);
+}
+
+void
+vnf_graph_stats_print(void)
+{
+	static const char *graph_patterns[] = {"vnf_worker_*"};
+	struct rte_graph_cluster_stats_param prm;
+
+	if (graph_stats == NULL) {
+		memset(&prm, 0, sizeof(prm));
+		prm.socket_id = SOCKET_ID_ANY;
+		prm.fn = NULL; /* Default printer. */
+		prm.f = stdout;
+		prm.nb_graph_patterns = RTE_DIM(graph_patterns);
+		prm.graph_patterns = graph_patterns;
+		graph_stats = rte_graph_cluster_stats_create(&prm);
+		if (graph_stats == NULL) {
+			printf("Cannot create graph stats\n");
+			return;
+		}
+	}
+	rte_graph_cluster_stats_get(graph_stats, 0);
+}
+
+void
+vnf_graph_destroy(void)
+{
+	unsigned int lcore_id;
+
+	if (graph_stats) {
+		rte_graph_cluster_stats_destroy(graph_stats);
+		graph_stats = NULL;
+	}
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		if (graph_lcores[lcore_id] == NULL)
+			continue;
+		rte_graph_destroy(graph_lcores[lcore_id]->id);
+		rte_free(graph_lcores[lcore_id]->meters);
+		rte_free(graph_lcores[lcore_id]);
+		graph_lcores[lcore_id] = NULL;
+	}
+	rte_free(mark_meters);
+	mark_meters = NULL;
+}
+
+/* The profiles of the marks, before the first vnf_graph_meter_set(). */
+int
+vnf_graph_meter_init(void)
+{
+	if (mark_meters)
+		return 0;
+	mark_meters = rte_zmalloc("vnf_graph_mark_meters",
+				  sizeof(*mark_meters) * VNF_MARK_TABLE_SIZE,
+				  RTE_CACHE_LINE_SIZE);
+	if (mark_meters == NULL) {
+		printf("Cannot allocate the software meters of %u marks\n",
+		       VNF_MARK_TABLE_SIZE);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Meter the packets of mark at rate bytes per second with a burst of
+ * burst bytes, red ones dropped, rate 0 to stop. -ENOTSUP without the
+ * graph. A worker may see a profile being changed for a packet.
+ */
+int
+vnf_graph_meter_set(uint32_t mark, uint64_t rate, uint64_t burst)
+{
+	struct rte_meter_srtcm_params params = {
+		.cir = rate,
+		.cbs = burst,
+		.ebs = 0,
+	};
+	struct graph_mark_meter *mm;
+	uint32_t gen;
+
+	if (mark_meters == NULL)
+		return -ENOTSUP;
+	if (mark < VNF_MARK_FIRST || mark >= VNF_MARK_TABLE_SIZE)
+		return -EINVAL;
+	mm = &mark_meters[mark];
+	__atomic_store_n(&mm->gen, 0, __ATOMIC_RELEASE);
+	if (!rate)
+		return 0;
+	if (rte_meter_srtcm_profile_config(&mm->profile, &params)) {
+		printf("Invalid software meter of mark %u\n", mark);
+		return -EINVAL;
+	}
+	do {
+		gen = __atomic_add_fetch(&mark_meter_gen, 1, __ATOMIC_RELAXED);
+	} while (!gen);
+	__atomic_store_n(&mm->gen, gen, __ATOMIC_RELEASE);
+	return 0;
+}
@@ -0,0 +1,262 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <rte_net.h>
+#include <rte_ethdev.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_gtp.h>
+#include <rte_ip_frag.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+#include <rte_memcpy.h>
+
+#include "vnf_examples.h"
+
+/*
+ * The GTP-U encap flows add 36 (GTP) or 44 (GTP PSC) bytes of outer headers
+ * to every packet. When the result exceeds the egress MTU the NIC can't
+ * fragment it and the packet is lost. Such packets are encapsulated in
+ * software instead, with exactly the same headers as the raw_encap action,
+ * and the outer IPv4 datagram is split with rte_ipv4_fragment_packet.
+ * The payload of the fragments is attached as indirect mbufs, so nothing
+ * is copied but the headers.
+ *
+ * On the decap side non-first fragments have no UDP/GTP header and never
+ * hit the decap flow, and the decap flows only match unfragmented outer
+ * IPv4 so the first fragment misses them too. Fragmented GTP-U is then
+ * reassembled in software, per lcore, and decapsulated in software.
+ */
+
+#define GTP_FRAG_BUCKET_ENTRIES 16
+#define GTP_FRAG_PREFETCH_OFFSET 3
+#define GTP_FRAG_INDIRECT_POOL_SIZE 8192
+#define GTP_FRAG_POOL_CACHE 128
+
+/* Per lcore reassembly state, only touched by its own lcore. */
+struct gtp_frag_lcore {
+	struct rte_ip_frag_tbl *tbl; /* Datagrams being reassembled. */
+	struct rte_ip_frag_death_row dr; /* Mbufs waiting to be freed. */
+	uint64_t next_sweep; /* TSC of the next expired entries sweep. */
+} __rte_cache_aligned;
+
+static struct gtp_frag_lcore frag_lcores[RTE_MAX_LCORE];
+static struct rte_mempool *direct_pool;
+static struct rte_mempool *indirect_pool;
+static uint64_t frag_ttl_cycles;
+
+/* Outer headers of the two encap flows, index 1 is the GTP PSC one. */
+static uint8_t encap_hdr[2][GTP_U_ENCAP_HDR_MAX_LEN];
+static size_t encap_hdr_len[2];
+
+int
+gtp_frag_init(struct rte_mempool *pool, uint32_t max_flows, uint32_t ttl_ms)
+{
+	unsigned int lcore_id;
+	uint32_t nb_buckets;
+
+	direct_pool = pool;
+	/* Indirect mbufs carry no data, only a reference to the original. */
+	indirect_pool = rte_pktmbuf_pool_create("gtp_frag_indirect",
+						GTP_FRAG_INDIRECT_POOL_SIZE,
+						GTP_FRAG_POOL_CACHE, 0, 0,
+						rte_socket_id());
+	if (indirect_pool == NULL) {
+		printf("Cannot create indirect mbuf pool for fragmentation\n");
+		return -1;
+	}
+	frag_ttl_cycles = (rte_get_tsc_hz() + MS_PER_S - 1) / MS_PER_S *
+			  ttl_ms;
+	nb_buckets = rte_align32pow2((max_flows + GTP_FRAG_BUCKET_ENTRIES - 1) /
+				     GTP_FRAG_BUCKET_ENTRIES);
+	/*
+	 * max_flows bounds the number of datagrams in progress per lcore,
+	 * each of them holding at most RTE_LIBRTE_IP_FRAG_MAX_FRAG fragments.
+	 */
+	RTE_LCORE_FOREACH(lcore_id) {
+		frag_lcores[lcore_id].tbl = rte_ip_frag_table_create(nb_buckets,
+				GTP_FRAG_BUCKET_ENTRIES, max_flows,
+				frag_ttl_cycles,
+				rte_lcore_to_socket_id(lcore_id));
+		if (frag_lcores[lcore_id].tbl == NULL) {
+			printf("Cannot create reassembly table for lcore %u\n",
+			       lcore_id);
+			return -1;
+		}
+	}
+	encap_hdr_len[0] = gtp_u_encap_hdr_build(encap_hdr[0], 0);
+	encap_hdr_len[1] = gtp_u_encap_hdr_build(encap_hdr[1], 1);
+	return 0;
+}
+
+/*
+ * Match the packet against the egress encap flows, using the offsets found
+ * by the burst parser.
+ * Return 0 for create_gtp_u_encap_flow, 1 for create_gtp_u_psc_encap_flow
+ * and -1 if the packet is not encapsulated.
+ */
+int
+gtp_u_encap_match(struct rte_mbuf *m)
+{
+	const struct vnf_parse_meta *meta = VNF_PARSE_META(m);
+	const struct rte_ipv4_hdr *ip;
+	const struct rte_udp_hdr *udp;
+
+	if ((meta->flags & (VNF_PARSE_F_UDP | VNF_PARSE_F_GTPU)) !=
+	    VNF_PARSE_F_UDP || meta->l3_off != sizeof(struct rte_ether_hdr))
+		return -1;
+	udp = rte_pktmbuf_mtod_offset(m, const struct rte_udp_hdr *,
+				      meta->l4_off);
+	if (udp->dst_port != RTE_BE16(4000))
+		return -1;
+	ip = rte_pktmbuf_mtod_offset(m, const struct rte_ipv4_hdr *,
+				     meta->l3_off);
+	if (ip->src_addr == RTE_BE32(0x0A0A0A0A) &&
+	    ip->dst_addr == RTE_BE32(0x0B0B0B0B))
+		return 0;
+	if (ip->src_addr == RTE_BE32(0x31313131) &&
+	    ip->dst_addr == RTE_BE32(0x13131313))
+		return 1;
+	return -1;
+}
+
+uint16_t
+gtp_u_encap_fragment(struct rte_mbuf *m, uint16_t mtu,
+		     struct rte_mbuf **out, uint16_t nb_out)
+{
+	struct rte_ether_hdr *eth;
+	struct rte_ipv4_hdr *ip;
+	struct rte_udp_hdr *udp;
+	struct rte_gtp_hdr *gtp;
+	uint32_t outer_len;
+	size_t hdr_len;
+	int32_t nb_frags, i;
+	int psc;
+
+	psc = gtp_u_encap_match(m);
+	if (psc < 0)
+		goto pass;
+	hdr_len = encap_hdr_len[psc] - sizeof(*eth); /* Outer L3 and up. */
+	outer_len = m->pkt_len - sizeof(*eth) + hdr_len;
+	if (outer_len <= mtu)
+		goto pass; /* The egress encap flow does the job. */
+	/*
+	 * Too big for the wire. Replace L2 by the outer headers, the result
+	 * no longer matches the encap flow so it is sent as is.
+	 */
+	if (rte_pktmbuf_adj(m, sizeof(*eth)) == NULL)
+		goto drop;
+	ip = (struct rte_ipv4_hdr *)rte_pktmbuf_prepend(m, hdr_len);
+	if (ip == NULL)
+		goto drop;
+	rte_memcpy(ip, encap_hdr[psc] + sizeof(*eth), hdr_len);
+	ip->total_length = rte_cpu_to_be_16(outer_len);
+	udp = (struct rte_udp_hdr *)(ip + 1);
+	udp->dgram_len = rte_cpu_to_be_16(outer_len - sizeof(*ip));
+	udp->dgram_cksum = 0;
+	gtp = (struct rte_gtp_hdr *)(udp + 1);
+	/* GTP length doesn't include the mandatory header. */
+	gtp->plen = rte_cpu_to_be_16(outer_len - sizeof(*ip) - sizeof(*udp) -
+				     sizeof(*gtp));
+	nb_frags = rte_ipv4_fragment_packet(m, out, nb_out, mtu,
+					    direct_pool, indirect_pool);
+	/* Fragments hold their own reference on the payload. */
+	rte_pktmbuf_free(m);
+	if (nb_frags < 0)
+		return 0;
+	for (i = 0; i < nb_frags; i++) {
+		eth = (struct rte_ether_hdr *)rte_pktmbuf_prepend(out[i],
+								 sizeof(*eth));
+		if (eth == NULL) {
+			rte_pktmbuf_free_bulk(out, nb_frags);
+			return 0;
+		}
+		rte_memcpy(eth, encap_hdr[psc], sizeof(*eth));
+		ip = (struct rte_ipv4_hdr *)(eth + 1);
+		ip->hdr_checksum = 0;
+		ip->hdr_checksum = rte_ipv4_cksum(ip);
+		out[i]->l2_len = sizeof(*eth);
+		out[i]->l3_len = sizeof(*ip);
+	}
+	/* Fragments are not parsed again, they go straight to Tx. */
+	return nb_frags;
+pass:
+	out[0] = m;
+	return 1;
+drop:
+	rte_pktmbuf_free(m);
+	return 0;
+}
+
+/*
+ * Remove eth / ipv4 / udp / gtp [/ extension headers] from a packet which
+ * missed the decap flow (e.g. reassembled) and put back the outer L2, as
+ * the decap flow does in hardware.
+ * The packet must have been parsed.
+ */
+int
+gtp_u_sw_decap(struct rte_mbuf *m)
+{
+	struct vnf_parse_meta *meta = VNF_PARSE_META(m);
+	struct rte_ether_hdr *eth = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
+	struct rte_ether_hdr outer_eth = *eth;
+
+	if (!(meta->flags & VNF_PARSE_F_GTPU))
+		return -1;
+	if (rte_pktmbuf_adj(m, meta->inner_l3_off) == NULL)
+		return -1;
+	eth = (struct rte_ether_hdr *)rte_pktmbuf_prepend(m, sizeof(*eth));
+	outer_eth.ether_type = RTE_BE16(RTE_ETHER_TYPE_IPV4);
+	*eth = outer_eth;
+	m->packet_type = RTE_PTYPE_UNKNOWN;
+	/* The inner packet is what the next stages see. */
+	vnf_parse_pkt(m);
+	return 0;
+}
+
+uint16_t
+gtp_u_reassemble_burst(struct rte_mbuf **pkts, uint16_t nb_pkts,
+		       uint64_t tsc)
+{
+	struct gtp_frag_lcore *lc = &frag_lcores[rte_lcore_id()];
+	struct vnf_parse_meta *meta;
+	struct rte_ipv4_hdr *ip;
+	struct rte_mbuf *m;
+	uint16_t i, n = 0;
+
+	for (i = 0; i < nb_pkts; i++) {
+		m = pkts[i];
+		meta = VNF_PARSE_META(m);
+		if (!(meta->flags & VNF_PARSE_F_IP_FRAG)) {
+			pkts[n++] = m;
+			continue;
+		}
+		if (meta->l3_off > 127) {
+			/* Over the 7 bits of l2_len, stacked VLANs. */
+			rte_pktmbuf_free(m);
+			continue;
+		}
+		ip = rte_pktmbuf_mtod_offset(m, struct rte_ipv4_hdr *,
+					     meta->l3_off);
+		m->l2_len = meta->l3_off;
+		m->l3_len = rte_ipv4_hdr_len(ip);
+		m = rte_ipv4_frag_reassemble_packet(lc->tbl, &lc->dr, m, tsc,
+						    ip);
+		if (m == NULL)
+			continue; /* Datagram not complete yet. */
+		/* Only fragmented GTP-U missed the decap flow. */
+		m->packet_type = RTE_PTYPE_UNKNOWN;
+		vnf_parse_pkt(m);
+		gtp_u_sw_decap(m);
+		pkts[n++] = m;
+	}
+	/* Evict the datagrams whose fragments didn't all show up in time. */
+	if (tsc >= lc->next_sweep) {
+		rte_ip_frag_table_del_expired_entries(lc->tbl, &lc->dr, tsc);
+		lc->next_sweep = tsc + frag_ttl_cycles;
+	}
+	rte_ip_frag_free_death_row(&lc->dr, GTP_FRAG_PREFETCH_OFFSET);
+	return n;
+}
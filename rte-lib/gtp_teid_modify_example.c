@@ -2,8 +2,47 @@
 #include <rte_flow.h>
 #include <rte_errno.h>
 
+#include "vnf_examples.h"
+
 #define MAX_PATTERN_NUM 5
 
+/* Egress chain of the example: tag, then decap/encap, then modify TEID. */
+static const struct vnf_table_decl teid_tables[] = {
+	{
+		.name = "teid_tag",
+		.purpose = "set tag from the IP addresses",
+		.shape = (const enum rte_flow_item_type[]){
+			RTE_FLOW_ITEM_TYPE_ETH, RTE_FLOW_ITEM_TYPE_IPV4,
+			RTE_FLOW_ITEM_TYPE_UDP, RTE_FLOW_ITEM_TYPE_END },
+		.size = 16,
+		.flags = VNF_TABLE_F_EGRESS,
+	},
+	{
+		.name = "teid_encap",
+		.purpose = "GTP-U encapsulation",
+		.size = 1,
+		.flags = VNF_TABLE_F_EGRESS,
+	},
+	{
+		.name = "teid_modify",
+		.purpose = "GTP TEID from the tag",
+		.size = 16,
+		.flags = VNF_TABLE_F_EGRESS,
+	},
+};
+
+/* Before the rules, declared again by each run a table keeps its group. */
+static int
+teid_tables_declare(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < RTE_DIM(teid_tables); i++)
+		if (vnf_table_declare(&teid_tables[i]) == VNF_TABLE_INVALID)
+			return -1;
+	return 0;
+}
+
 struct rte_flow *
 generate_set_tag_flow(uint16_t port_id, uint8_t tag_id, uint32_t tag_value,
 		      uint32_t src_ip, uint32_t src_mask,
@@ -49,18 +88,21 @@ generate_set_tag_flow(uint16_t port_id, uint8_t tag_id, uint32_t tag_value,
 	action[0].type = RTE_FLOW_ACTION_TYPE_SET_TAG;
 	action[0].conf = &tag_spec;
 	/* Jump to next group. */
-	jump_spec.group = 2;
+	jump_spec.group = vnf_table_group("teid_encap");
 	action[1].type = RTE_FLOW_ACTION_TYPE_JUMP;
 	action[1].conf = &jump_spec;
 	/* the final level must be always type end */
 	action[2].type = RTE_FLOW_ACTION_TYPE_END;
 
 	attr.egress = 1;
-	attr.group = 1;
+	attr.group = vnf_table_group("teid_tag");
 
-	int res = rte_flow_validate(port_id, &attr, pattern, action, error);
+	int res = vnf_flow_validate_cached(port_id, &attr, pattern, action,
+					   error);
 	if(!res)
-		flow = rte_flow_create(port_id, &attr, pattern, action, error);
+		flow = vnf_table_flow_create(port_id, "teid_tag", &attr, pattern,
+					     action, VNF_FLOW_OWNER_TEID, 0,
+					     error);
 	return flow;
 }
 
@@ -124,18 +166,21 @@ generate_decap_encap_flow(uint16_t port_id, struct rte_flow_error *error)
 	action[1].type = RTE_FLOW_ACTION_TYPE_RAW_ENCAP;
 	action[1].conf = &encap_spec;
 	/* Jump to next group. */
-	jump_spec.group = 3;
+	jump_spec.group = vnf_table_group("teid_modify");
 	action[2].type = RTE_FLOW_ACTION_TYPE_JUMP;
 	action[2].conf = &jump_spec;
 	/* the final level must be always type end */
 	action[3].type = RTE_FLOW_ACTION_TYPE_END;
 
 	attr.egress = 1;
-	attr.group = 2;
+	attr.group = vnf_table_group("teid_encap");
 
-	int res = rte_flow_validate(port_id, &attr, pattern, action, error);
+	int res = vnf_flow_validate_cached(port_id, &attr, pattern, action,
+					   error);
 	if(!res)
-		flow = rte_flow_create(port_id, &attr, pattern, action, error);
+		flow = vnf_table_flow_create(port_id, "teid_encap", &attr, pattern,
+					     action, VNF_FLOW_OWNER_TEID, 0,
+					     error);
 	return flow;
 }
 
@@ -143,7 +188,7 @@ struct rte_flow *
 generate_modify_gtp_teid_flow(uint16_t port_id, uint16_t tag_id,
 			      struct rte_flow_error *error)
 {
-	struct rte_flow_attr attr;
+	struct rte_flow_attr attr = {0};
 	struct rte_flow_action action[MAX_PATTERN_NUM] = {{0}};
 	struct rte_flow_item pattern[MAX_PATTERN_NUM] = {{0}};
 	struct rte_flow *flow = NULL;
@@ -195,11 +240,14 @@ generate_modify_gtp_teid_flow(uint16_t port_id, uint16_t tag_id,
 	action[1].type = RTE_FLOW_ACTION_TYPE_END;
 
 	attr.egress = 1;
-	attr.group = 3;
+	attr.group = vnf_table_group("teid_modify");
 
-	int res = rte_flow_validate(port_id, &attr, pattern, action, error);
+	int res = vnf_flow_validate_cached(port_id, &attr, pattern, action,
+					   error);
 	if(!res)
-		flow = rte_flow_create(port_id, &attr, pattern, action, error);
+		flow = vnf_table_flow_create(port_id, "teid_modify", &attr, pattern,
+					     action, VNF_FLOW_OWNER_TEID, 0,
+					     error);
 	return flow;
 }
 
@@ -209,6 +257,12 @@ generate_gtp_flows(uint16_t port_id, uint16_t tag_id, uint32_t tag_value,
 		   uint32_t dest_mask, struct rte_flow_error *error)
 {
 	struct rte_flow *flow = NULL;
+
+	if (teid_tables_declare()) {
+		rte_flow_error_set(error, ENOSPC, RTE_FLOW_ERROR_TYPE_ATTR,
+				   NULL, "cannot declare the TEID tables");
+		return rte_errno;
+	}
 	flow = generate_set_tag_flow(port_id, tag_id, tag_value,
 		src_ip, src_mask, dest_ip, dest_mask, error);
 	if (flow == NULL)
@@ -8,75 +8,6 @@
 
 #include "vnf_examples.h"
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	TUNNEL_EXTENSION,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
- */
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL_EXTENSION] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
 /*
  * Match on GTP-U QFI traffic.
  * The corresponding testpmd commands:
@@ -95,6 +26,7 @@ create_gtp_u_qfi_flow(uint16_t port_id)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
@@ -126,15 +58,15 @@ create_gtp_u_qfi_flow(uint16_t port_id)
 			.type = RTE_FLOW_ACTION_TYPE_END,
 		},
 	};
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_spec;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_GTP;
-	pattern[TUNNEL].spec = &gtp_spec;
-	pattern[TUNNEL].mask = &gtp_mask;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_spec, &ipv4_mask);
+	vnf_flow_item_udp(&fb, NULL, NULL);
+	vnf_flow_item_gtp(&fb, &gtp_spec, &gtp_mask);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, root_actions,
+				       VNF_FLOW_OWNER_QFI, 0, &error);
 	if (!flow) {
 		printf("can't create jump flow on root table\n");
 		return -1;
@@ -160,11 +92,13 @@ create_gtp_u_qfi_flow(uint16_t port_id)
 	struct rte_flow_item_gtp_psc gtp_psc_mask = {
 			.hdr.type = 0xF,
 			.hdr.qfi = 0x3F}; /* QFI field is 6 bits. */
-	pattern[TUNNEL_EXTENSION].type = RTE_FLOW_ITEM_TYPE_GTP_PSC;
-	pattern[TUNNEL_EXTENSION].spec = &gtp_psc_spec;
-	pattern[TUNNEL_EXTENSION].mask = &gtp_psc_mask;
+	/* Same pattern as the root flow, plus the QFI. */
+	vnf_flow_item_gtp_psc(&fb, &gtp_psc_spec, &gtp_psc_mask);
 	attr.group = 1; /* GTP PSC only suppot on non-group talbe. */
-	flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_QFI, 0, &error);
 	if (!flow) {
 		printf("can't create flow match on GTP QFI on port: %u, error: %s\n",
 				port_id, error.message);
@@ -3,61 +3,7 @@
 #include <rte_net.h>
 #include <rte_gtp.h>
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
+#include "vnf_examples.h"
 
 static int
 hairpin_port_unbind(uint16_t port_id)
@@ -308,6 +254,7 @@ hairpin_two_ports_flows_create(void)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
@@ -397,11 +344,15 @@ hairpin_two_ports_flows_create(void)
 		},
 	};
 	queue.index = dev_info.nb_rx_queues - 1; /* rx hairpin queue index. */
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_inner;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_TCP;
-	flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+	/* Both sides of the hairpin match the same packets. */
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_inner, &ipv4_mask);
+	vnf_flow_item_tcp(&fb, NULL, NULL);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_HAIRPIN, 0, &error);
 	if (!flow)
 		printf("Can't create hairpin flows on port: %u\n", port_id);
 	/* get peer port id. */
@@ -411,15 +362,6 @@ hairpin_two_ports_flows_create(void)
 	if (pair_port_num < 0)
 		rte_exit(EXIT_FAILURE, "Can't get pair port !");
 	RTE_ASSERT(pair_port_num == 1);
-	/* create pattern to match hairpin flow from hairpin RX queue. */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L2].spec = NULL;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_inner;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_TCP;
-	pattern[L4].spec = NULL;
-	pattern[END].type = RTE_FLOW_ITEM_TYPE_END;
 	/* create actions. */
 	actions[0].type = RTE_FLOW_ACTION_TYPE_RAW_DECAP;
 	actions[0].conf = &decap;
@@ -428,8 +370,10 @@ hairpin_two_ports_flows_create(void)
 	actions[2].type = RTE_FLOW_ACTION_TYPE_END;
 	attr.egress = 1;
 	attr.ingress = 0;
-	flow = rte_flow_create(pair_port_list[0], &attr, pattern, actions,
-			&error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(pair_port_list[0], &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_HAIRPIN, 0, &error);
 	if (!flow)
 		printf("Can't create hairpin flows on pair port: %u, "
 			"error: %s\n", pair_port_list[0], error.message);
@@ -459,6 +403,7 @@ hairpin_one_port_flows_create(void)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
@@ -552,14 +497,15 @@ hairpin_one_port_flows_create(void)
 			.type = RTE_FLOW_ACTION_TYPE_END,
 		},
 	};
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L2].spec = NULL;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L3].spec = &ipv4_inner;
-	pattern[L3].mask = &ipv4_mask;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_TCP;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, &ipv4_inner, &ipv4_mask);
+	vnf_flow_item_tcp(&fb, NULL, NULL);
 	queue.index = dev_info.nb_rx_queues - 1; /* rx hairpin queue index. */
-	flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_HAIRPIN, 0, &error);
 	if (!flow)
 		printf("Can't create hairpin flows on port: %u\n", port_id);
 	return flow;
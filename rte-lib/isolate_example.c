@@ -67,7 +67,7 @@ dpdk_create_isolate_jump_flow(uint16_t port_id, bool transfer) {
 
     /* 3. flow actions */
     memset(&jump, 0, sizeof(struct rte_flow_action_jump));
-    jump.group = FIRST_TABLE;
+    jump.group = vnf_table_group("classify");
     memset(action, 0, sizeof(action));
     action[0].type = RTE_FLOW_ACTION_TYPE_JUMP;
     action[0].conf = &jump;
@@ -75,9 +75,11 @@ dpdk_create_isolate_jump_flow(uint16_t port_id, bool transfer) {
 
     /* 4. create isolate jump flow */
     int ret = 0;
-    ret = rte_flow_validate(port_id, &attr, pattern, action, &error);
+    ret = vnf_flow_validate_cached(port_id, &attr, pattern, action,
+                                   &error);
     if (!ret)
-        flow = rte_flow_create(port_id, &attr, pattern, action, &error);
+        flow = vnf_flow_create(port_id, &attr, pattern, action,
+                               VNF_FLOW_OWNER_ISOLATE, 0, &error);
     if (flow == NULL) {
         rte_exit(EXIT_FAILURE, "create isolate jump flow failed:port_id:%u, transfer:%s, error:%s\n", port_id, transfer ? "true" : "false", error.message);
     } 
@@ -142,7 +144,7 @@ dpdk_create_isolate_gre_jump_flow(uint16_t port_id, bool transfer) {
 
     /* 3. flow actions */
     memset(&jump, 0, sizeof(struct rte_flow_action_jump));
-    jump.group = FIRST_TABLE;
+    jump.group = vnf_table_group("classify");
     memset(action, 0, sizeof(action));
     action[0].type = RTE_FLOW_ACTION_TYPE_JUMP;
     action[0].conf = &jump;
@@ -150,9 +152,11 @@ dpdk_create_isolate_gre_jump_flow(uint16_t port_id, bool transfer) {
 
     /* 4. create isolate jump flow */
     int ret = 0;
-    ret = rte_flow_validate(port_id, &attr, pattern, action, &error);
+    ret = vnf_flow_validate_cached(port_id, &attr, pattern, action,
+                                   &error);
     if (!ret)
-        flow = rte_flow_create(port_id, &attr, pattern, action, &error);
+        flow = vnf_flow_create(port_id, &attr, pattern, action,
+                               VNF_FLOW_OWNER_ISOLATE, 0, &error);
     if (flow == NULL) {
         rte_exit(EXIT_FAILURE, "create isolate gre jump flow failed: port_id:%u, transfer:%s, error:%s\n", port_id, transfer ? "true" : "false", error.message);
     }
@@ -160,23 +164,24 @@ dpdk_create_isolate_gre_jump_flow(uint16_t port_id, bool transfer) {
     return flow;
 }
 
+/* The jumps of one port, transfer then ingress. */
+void
+dpdk_isolate_port_flows_init(uint16_t port_id)
+{
+    if (0 == port_id) {
+        dpdk_create_isolate_gre_jump_flow(port_id, true);
+        dpdk_create_isolate_gre_jump_flow(port_id, false);
+    } else {
+        dpdk_create_isolate_jump_flow(port_id, true);
+        dpdk_create_isolate_jump_flow(port_id, false);
+    }
+}
+
 void 
 dpdk_isolate_flows_init() {
     uint16_t port_id = 0;
 
 	RTE_ETH_FOREACH_DEV(port_id) {
-        if (0 == port_id) {
-            dpdk_create_isolate_gre_jump_flow(port_id, true);
-        } else {
-            dpdk_create_isolate_jump_flow(port_id, true);
-        }
-    }
-
-    RTE_ETH_FOREACH_DEV(port_id) {
-        if (0 == port_id) {
-            dpdk_create_isolate_gre_jump_flow(port_id, false);
-        } else {
-            dpdk_create_isolate_jump_flow(port_id, false);
-        }
+        dpdk_isolate_port_flows_init(port_id);
     }
 }
\ No newline at end of file
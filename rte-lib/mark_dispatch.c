@@ -0,0 +1,263 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_spinlock.h>
+#include <rte_rcu_qsbr.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Every flow which steers packets to the software gets a MARK equal to a
+ * dense index in this table. The worker reads the mark from the mbuf
+ * (hash.fdir.hi) and jumps straight to the per-rule record and handler
+ * through an array lookup, no parsing or classification is needed for
+ * offloaded traffic.
+ * Marks 0 (INVALID_FLOW_MARK) and 1 (HAIRPIN_FLOW_MARK) are reserved.
+ *
+ * A freed mark only gets its handler cleared, its ctx is kept. The mark
+ * and the ctx are given back once all the workers reported a quiescent
+ * state (QSBR), so no worker is still in the handler, and the mark goes
+ * to the tail of a FIFO, the packets still queued with it drained before
+ * another rule takes it.
+ */
+
+#define MARK_RECLAIM_TRIGGER 32 /* Deferred frees reclaimed from there. */
+#define MARK_RECLAIM_MAX 64 /* Deferred frees reclaimed at a time. */
+
+struct vnf_mark_entry {
+	vnf_mark_handler_t handler; /* NULL when the mark is free. */
+	void *ctx; /* Per-rule record, passed to the handler. */
+};
+
+/* A mark waiting for the workers, in the defer queue. */
+struct vnf_mark_defer {
+	vnf_mark_release_t release;
+	void *ctx;
+	uint32_t mark;
+};
+
+static struct vnf_mark_entry *mark_table;
+static uint32_t mark_table_size;
+/* FIFO of free marks, only used on the control path. */
+static uint32_t *free_marks;
+static uint32_t free_head;
+static uint32_t nb_free_marks;
+static rte_spinlock_t mark_lock = RTE_SPINLOCK_INITIALIZER;
+static struct rte_rcu_qsbr *mark_qsbr; /* The workers, by lcore. */
+static struct rte_rcu_qsbr_dq *mark_dq;
+
+static void
+mark_push(uint32_t mark)
+{
+	free_marks[(free_head + nb_free_marks) % mark_table_size] = mark;
+	nb_free_marks++;
+}
+
+/* Deferred frees whose grace period is over. */
+static void
+mark_release(void *p, void *e, unsigned int n)
+{
+	struct vnf_mark_defer *d = e;
+	unsigned int i;
+
+	RTE_SET_USED(p);
+	for (i = 0; i < n; i++) {
+		if (d[i].release)
+			d[i].release(d[i].ctx);
+		rte_spinlock_lock(&mark_lock);
+		mark_push(d[i].mark);
+		rte_spinlock_unlock(&mark_lock);
+	}
+}
+
+int
+vnf_mark_table_init(uint32_t nb_marks)
+{
+	struct rte_rcu_qsbr_dq_parameters params;
+	uint32_t mark;
+	size_t size;
+
+	if (nb_marks <= VNF_MARK_FIRST) {
+		printf("mark table needs more than %u entries\n",
+		       VNF_MARK_FIRST);
+		return -1;
+	}
+	mark_table = rte_zmalloc("vnf_mark_table",
+				 sizeof(*mark_table) * nb_marks,
+				 RTE_CACHE_LINE_SIZE);
+	free_marks = rte_malloc("vnf_free_marks",
+				sizeof(*free_marks) * nb_marks, 0);
+	size = rte_rcu_qsbr_get_memsize(RTE_MAX_LCORE);
+	mark_qsbr = rte_zmalloc("vnf_mark_qsbr", size, RTE_CACHE_LINE_SIZE);
+	if (!mark_table || !free_marks || !mark_qsbr ||
+	    rte_rcu_qsbr_init(mark_qsbr, RTE_MAX_LCORE)) {
+		printf("Cannot allocate mark table of %u entries\n", nb_marks);
+		goto err;
+	}
+	memset(&params, 0, sizeof(params));
+	params.name = "vnf_marks";
+	params.size = nb_marks;
+	params.esize = sizeof(struct vnf_mark_defer);
+	params.trigger_reclaim_limit = MARK_RECLAIM_TRIGGER;
+	params.max_reclaim_size = MARK_RECLAIM_MAX;
+	params.free_fn = mark_release;
+	params.v = mark_qsbr;
+	mark_dq = rte_rcu_qsbr_dq_create(&params);
+	if (mark_dq == NULL) {
+		printf("Cannot create the mark defer queue\n");
+		goto err;
+	}
+	mark_table_size = nb_marks;
+	/* Lowest marks first, so the hot part stays small. */
+	free_head = 0;
+	nb_free_marks = 0;
+	for (mark = VNF_MARK_FIRST; mark < nb_marks; mark++)
+		mark_push(mark);
+	return 0;
+err:
+	rte_free(mark_table);
+	rte_free(free_marks);
+	rte_free(mark_qsbr);
+	mark_table = NULL;
+	free_marks = NULL;
+	mark_qsbr = NULL;
+	return -1;
+}
+
+uint32_t
+vnf_mark_alloc(vnf_mark_handler_t handler, void *ctx)
+{
+	uint32_t mark = INVALID_FLOW_MARK;
+
+	rte_spinlock_lock(&mark_lock);
+	if (!nb_free_marks) {
+		/* Maybe some marks only wait for their grace period. */
+		rte_spinlock_unlock(&mark_lock);
+		rte_rcu_qsbr_dq_reclaim(mark_dq, MARK_RECLAIM_MAX, NULL, NULL,
+					NULL);
+		rte_spinlock_lock(&mark_lock);
+	}
+	if (nb_free_marks) {
+		mark = free_marks[free_head];
+		free_head = (free_head + 1) % mark_table_size;
+		nb_free_marks--;
+		mark_table[mark].ctx = ctx;
+		/* Handler last, the worker checks it before using ctx. */
+		__atomic_store_n(&mark_table[mark].handler, handler,
+				 __ATOMIC_RELEASE);
+	}
+	rte_spinlock_unlock(&mark_lock);
+	if (mark == INVALID_FLOW_MARK)
+		printf("No free mark left in a table of %u entries\n",
+		       mark_table_size);
+	return mark;
+}
+
+/*
+ * The flow using the mark must be destroyed before the mark is freed.
+ * release(ctx), if any, is called once no worker can be in the handler,
+ * ctx must be kept till then.
+ */
+void
+vnf_mark_free(uint32_t mark, vnf_mark_release_t release)
+{
+	struct vnf_mark_defer d;
+
+	if (mark < VNF_MARK_FIRST || mark >= mark_table_size)
+		return;
+	rte_spinlock_lock(&mark_lock);
+	if (mark_table[mark].handler == NULL) {
+		rte_spinlock_unlock(&mark_lock);
+		return;
+	}
+	__atomic_store_n(&mark_table[mark].handler, NULL, __ATOMIC_RELEASE);
+	d.release = release;
+	d.ctx = mark_table[mark].ctx;
+	d.mark = mark;
+	rte_spinlock_unlock(&mark_lock);
+	/* Room for all the marks, only fails on a bug. */
+	if (rte_rcu_qsbr_dq_enqueue(mark_dq, &d)) {
+		rte_rcu_qsbr_synchronize(mark_qsbr, RTE_QSBR_THRID_INVALID);
+		mark_release(NULL, &d, 1);
+	}
+}
+
+/* The deferred frees whose grace period is over, from the main loop. */
+void
+vnf_mark_poll(void)
+{
+	if (mark_dq)
+		rte_rcu_qsbr_dq_reclaim(mark_dq, MARK_RECLAIM_MAX, NULL, NULL,
+					NULL);
+}
+
+/* All the deferred frees, waiting for the workers, before a close. */
+void
+vnf_mark_flush(void)
+{
+	if (mark_dq == NULL)
+		return;
+	rte_rcu_qsbr_synchronize(mark_qsbr, RTE_QSBR_THRID_INVALID);
+	rte_rcu_qsbr_dq_reclaim(mark_dq, mark_table_size, NULL, NULL, NULL);
+}
+
+/* A worker dispatching marks, quiescent out of its bursts. */
+void
+vnf_mark_lcore_online(void)
+{
+	if (mark_qsbr == NULL)
+		return;
+	rte_rcu_qsbr_thread_register(mark_qsbr, rte_lcore_id());
+	rte_rcu_qsbr_thread_online(mark_qsbr, rte_lcore_id());
+}
+
+void
+vnf_mark_lcore_quiescent(void)
+{
+	if (mark_qsbr)
+		rte_rcu_qsbr_quiescent(mark_qsbr, rte_lcore_id());
+}
+
+void
+vnf_mark_lcore_offline(void)
+{
+	if (mark_qsbr == NULL)
+		return;
+	rte_rcu_qsbr_thread_offline(mark_qsbr, rte_lcore_id());
+	rte_rcu_qsbr_thread_unregister(mark_qsbr, rte_lcore_id());
+}
+
+int
+vnf_mark_dispatch(struct rte_mbuf *m)
+{
+	const struct vnf_mark_entry *entry;
+	vnf_mark_handler_t handler;
+	uint32_t mark = m->hash.fdir.hi;
+
+	if (!(m->ol_flags & RTE_MBUF_F_RX_FDIR_ID) ||
+	    unlikely(mark >= mark_table_size))
+		return -1;
+	entry = &mark_table[mark];
+	handler = __atomic_load_n(&entry->handler, __ATOMIC_ACQUIRE);
+	if (unlikely(handler == NULL))
+		return -1; /* Reserved mark or rule being removed. */
+	handler(m, entry->ctx);
+	return 0;
+}
+
+uint16_t
+vnf_mark_dispatch_burst(struct rte_mbuf **pkts, uint16_t nb_pkts,
+			struct rte_mbuf **unmarked)
+{
+	uint16_t i, n = 0;
+
+	for (i = 0; i < nb_pkts; i++)
+		if (vnf_mark_dispatch(pkts[i]))
+			unmarked[n++] = pkts[i];
+	return n;
+}
@@ -9,162 +9,43 @@
 
 #include "vnf_examples.h"
 
+/* Per UE meters, IDs from NETDEV_DPDK_METER_METER_ID. */
+#define METER_POOL_SIZE (1 << 17)
 
-
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
+/*
+ * The meter pool of the port and its first meter, the one of the example
+ * flows: 10KBps, red packets dropped.
  */
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
-static int
-add_meter_profile(uint16_t port_id, uint32_t profile_id,
-		struct rte_mtr_error *error)
+int
+create_meter_policy_profile_meter(uint16_t port_id)
 {
 	struct rte_mtr_meter_profile profile;
+	struct vnf_meter_policy policy = {
+		.verdict = {
+			[RTE_COLOR_GREEN] = VNF_METER_PASS,
+			[RTE_COLOR_YELLOW] = VNF_METER_PASS,
+			[RTE_COLOR_RED] = VNF_METER_DROP,
+		},
+	};
+	uint32_t mtr_id;
 
+	if (vnf_meter_pool_init(port_id, NETDEV_DPDK_METER_METER_ID,
+				METER_POOL_SIZE)) {
+		printf("cannot create meter pool of port %u\n", port_id);
+		return -1;
+	}
 	memset(&profile, 0, sizeof(profile));
 	profile.alg = RTE_MTR_SRTCM_RFC2697; /* the one supported. */
 	profile.srtcm_rfc2697.cir = 10*1024; /* 10KBps. */
 	profile.srtcm_rfc2697.cbs = 10*1024; /* allow burst in 10KB. */
 	profile.srtcm_rfc2697.ebs = 0; /* ignored. */
-
-	return rte_mtr_meter_profile_add(port_id, profile_id, &profile, error);
-}
-
-static void
-add_meter_policy(uint16_t port_id, uint32_t policy_id)
-{
-    const struct rte_flow_action end = { RTE_FLOW_ACTION_TYPE_DROP, NULL };
-    struct rte_mtr_meter_policy_params policy = {
-        .actions[RTE_COLOR_GREEN] = NULL,
-        .actions[RTE_COLOR_YELLOW] = NULL,
-        .actions[RTE_COLOR_RED] = &end,
-    };
-    struct rte_mtr_error error;
-    int rv;
-
-    printf("Creating meter policy %u on port %u\n",
-              policy_id, port_id);
-    rv = rte_mtr_meter_policy_add(port_id, policy_id, &policy, &error);
-    if (rv) {
-        printf("cannot add meter policy, error: %s\n", error.message);
-    }
-}
-
-static int
-create_meter(uint16_t port_id, uint32_t mtr_id, uint32_t profile_id,
-             struct rte_mtr_error *error)
-{
-    struct rte_mtr_params params;
-
-    memset(&params, 0, sizeof params);
-    params.meter_enable = 1;
-    params.use_prev_mtr_color = 0;
-    params.meter_policy_id = NETDEV_DPDK_METER_POLICY_ID;
-    params.meter_profile_id = profile_id;
-    params.dscp_table = NULL; /* no input color. */
-    /* Enable all stats. */
-    params.stats_mask = RTE_MTR_STATS_N_BYTES_GREEN |
-                        RTE_MTR_STATS_N_BYTES_YELLOW |
-                        RTE_MTR_STATS_N_BYTES_RED |
-                        RTE_MTR_STATS_N_BYTES_DROPPED |
-                        RTE_MTR_STATS_N_PKTS_GREEN |
-                        RTE_MTR_STATS_N_PKTS_YELLOW |
-                        RTE_MTR_STATS_N_PKTS_RED |
-                        RTE_MTR_STATS_N_PKTS_DROPPED;
-
-    return rte_mtr_create(port_id, mtr_id,
-                          &params, true, error);
-}
-
-int
-create_meter_policy_profile_meter(uint16_t port_id)
-{
-	int ret;
-	struct rte_eth_dev_info dev_info = { 0 };
-
-	ret = rte_eth_dev_info_get(port_id, &dev_info);
-	if (ret)
-		rte_exit(EXIT_FAILURE, "Error: can't get device info, port id:"
-				" %u\n", port_id);
-
-	struct rte_mtr_error mtr_error;
-	uint32_t profile_id = 0;
-	uint32_t mtr_id = NETDEV_DPDK_METER_METER_ID;
-	if(0 == port_id) {
-		add_meter_policy(port_id, NETDEV_DPDK_METER_POLICY_ID);
-	}
-	
-
-	ret = add_meter_profile(port_id, profile_id, &mtr_error);
-	if (ret) {
-		printf("cannot add meter profile, error: %s\n",
-				mtr_error.message);
-		return ret;
-	}
-	ret = create_meter(port_id, mtr_id, profile_id, &mtr_error);
-	if (ret) {
-		printf("cannot create meter: %u with profile: %u, error: %s\n",
-				mtr_id, profile_id, mtr_error.message);
-		return ret;
+	mtr_id = vnf_meter_alloc(port_id, &profile, &policy);
+	if (mtr_id != NETDEV_DPDK_METER_METER_ID) {
+		printf("cannot create meter %u of port %u\n",
+		       NETDEV_DPDK_METER_METER_ID, port_id);
+		if (mtr_id != VNF_METER_INVALID)
+			vnf_meter_free(port_id, mtr_id);
+		return -1;
 	}
 	return 0;
 }
@@ -177,8 +58,8 @@ create_flow_with_meter_in_transfer(uint16_t port_id)
 
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* holds the flow attributes. */
-				.group = FIRST_TABLE, /* set the rule on the main group. */
 				.transfer = 1,/* rx flow. */
 				.priority = MIN_FLOW_PRIORITY, }; /* add priority to rule
 				to give the decap rule higher priority since
@@ -203,10 +84,14 @@ create_flow_with_meter_in_transfer(uint16_t port_id)
 		},
 	};
 
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_END;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_table_flow_create(port_id, "classify", &attr, fb.items,
+					     root_actions, VNF_FLOW_OWNER_METER, 0,
+					     &error);
 	if (!flow) {
 		printf("can't create jump flow on root table, error: %s\n", error.message);
 		return -1;
@@ -240,6 +125,7 @@ create_flow_with_meter(uint16_t port_id)
 
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* rx flow. */
@@ -274,10 +160,13 @@ create_flow_with_meter(uint16_t port_id)
 			.hdr = {
 				.src_addr = RTE_BE32(0xffffffff)}};
 
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_END;
-	flow = rte_flow_create(port_id, &attr, pattern, root_actions, &error);
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, root_actions,
+				       VNF_FLOW_OWNER_METER, 0, &error);
 	if (!flow) {
 		printf("can't create jump flow on root table, error: %s\n", error.message);
 		return -1;
@@ -303,11 +192,13 @@ create_flow_with_meter(uint16_t port_id)
 		.data = 0xD0A0,
 		.index = 1,
 	};
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_TAG;
-	pattern[L2].spec = &tag;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_END;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item(&fb, RTE_FLOW_ITEM_TYPE_TAG, &tag, NULL, sizeof(tag));
 	attr.group = 1;
-	flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_METER, 0, &error);
 	if (!flow) {
 		printf("can't create flow with meter on port: %u, error: %s\n",
 				 port_id, error.message);
@@ -315,22 +206,3 @@ create_flow_with_meter(uint16_t port_id)
 	}
 	return 0;
 }
-
-int
-get_meter_stats(uint16_t port_id, uint32_t mtr_id)
-{
-    struct rte_mtr_stats mtr_stats;
-    struct rte_mtr_error error;
-    uint64_t stats_mask = 0;
-
-	memset(&mtr_stats, 0x0, sizeof mtr_stats);
-    if (rte_mtr_stats_read(port_id, mtr_id, &mtr_stats,
-                           &stats_mask, 0, &error)) {
-		printf("failed to read meter stats, port_id: %u, mtr_id: %u, error: %s\n", port_id, mtr_id, &error.message);
-        return -1;
-    }
-
-	printf("Meter stats,port id: %u meter id: %u, drop bytes: %llu, drop packets: %llu\n", 
-			port_id, mtr_id, mtr_stats.n_bytes_dropped, mtr_stats.n_pkts_dropped);
-	return 0;
-}
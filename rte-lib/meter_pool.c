@@ -0,0 +1,485 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_mtr.h>
+#include <rte_malloc.h>
+#include <rte_ring.h>
+#include <rte_ring_elem.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+#include <rte_spinlock.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Meters of the ports, one per session for the per UE rate limits.
+ * Meter IDs are taken from a range of the port. A freed ID goes at the
+ * tail of a FIFO, so the longest unused one is taken first and a rule
+ * being removed doesn't see its meter reused at once.
+ * Sessions mostly share a few rates, a profile is added once per content
+ * and refcounted by its meters, a policy once per set of color verdicts.
+ * A meter bound to a rule of the registry is recycled by
+ * vnf_meter_pool_gc() once the rule is gone, e.g. aged out.
+ */
+
+#define METER_PROFILE_MAX 1024 /* Distinct rates per port. */
+#define METER_POLICY_MAX 8
+
+struct meter_profile {
+	struct rte_mtr_meter_profile profile; /* Hash key, padding zeroed. */
+	uint32_t refs;
+};
+
+struct meter_policy {
+	struct vnf_meter_policy policy;
+	uint32_t refs;
+};
+
+struct meter_entry {
+	uint32_t flow_id; /* Bound rule, VNF_FLOW_ID_INVALID if none. */
+	uint16_t profile;
+	uint8_t policy;
+	uint8_t used;
+};
+
+struct meter_pool {
+	rte_spinlock_t lock;
+	uint16_t port_id;
+	uint32_t base;
+	uint32_t nb;
+	uint32_t nb_used;
+	uint32_t nb_profiles;
+	uint64_t profile_shared; /* Meters which found their profile. */
+	uint64_t recycled; /* By the gc. */
+	struct rte_ring *free_ids;
+	struct rte_hash *profile_hash;
+	struct meter_profile profiles[METER_PROFILE_MAX];
+	struct meter_policy policies[METER_POLICY_MAX];
+	struct meter_entry meters[];
+};
+
+static struct meter_pool *meter_pools[RTE_MAX_ETHPORTS];
+
+static struct meter_pool *
+meter_pool_get(uint16_t port_id)
+{
+	return port_id < RTE_MAX_ETHPORTS ? meter_pools[port_id] : NULL;
+}
+
+/*
+ * Profile ID of the content, added to the port if new. The key is copied
+ * field by field for the padding not to make two equal profiles differ.
+ */
+static int
+meter_profile_get(struct meter_pool *mp,
+		  const struct rte_mtr_meter_profile *profile)
+{
+	struct rte_mtr_meter_profile key;
+	struct rte_mtr_error error;
+	void *data;
+	int id;
+
+	memset(&key, 0, sizeof(key));
+	key.alg = profile->alg;
+	key.packet_mode = profile->packet_mode;
+	switch (profile->alg) {
+	case RTE_MTR_SRTCM_RFC2697:
+		key.srtcm_rfc2697 = profile->srtcm_rfc2697;
+		break;
+	case RTE_MTR_TRTCM_RFC2698:
+		key.trtcm_rfc2698 = profile->trtcm_rfc2698;
+		break;
+	case RTE_MTR_TRTCM_RFC4115:
+		key.trtcm_rfc4115 = profile->trtcm_rfc4115;
+		break;
+	default:
+		break;
+	}
+	if (rte_hash_lookup_data(mp->profile_hash, &key, &data) >= 0) {
+		id = (uintptr_t)data;
+		mp->profiles[id].refs++;
+		mp->profile_shared++;
+		return id;
+	}
+	for (id = 0; id < METER_PROFILE_MAX; id++)
+		if (!mp->profiles[id].refs)
+			break;
+	if (id == METER_PROFILE_MAX) {
+		printf("No meter profile left on port %u\n", mp->port_id);
+		return -ENOSPC;
+	}
+	if (rte_mtr_meter_profile_add(mp->port_id, id, &key, &error)) {
+		printf("cannot add meter profile %d, error: %s\n", id,
+		       error.message ? error.message : "(no stated reason)");
+		return -EINVAL;
+	}
+	if (rte_hash_add_key_data(mp->profile_hash, &key,
+				  (void *)(uintptr_t)id)) {
+		rte_mtr_meter_profile_delete(mp->port_id, id, &error);
+		return -ENOSPC;
+	}
+	mp->profiles[id].profile = key;
+	mp->profiles[id].refs = 1;
+	mp->nb_profiles++;
+	return id;
+}
+
+static void
+meter_profile_put(struct meter_pool *mp, uint32_t id)
+{
+	struct rte_mtr_error error;
+
+	if (--mp->profiles[id].refs)
+		return;
+	rte_hash_del_key(mp->profile_hash, &mp->profiles[id].profile);
+	if (rte_mtr_meter_profile_delete(mp->port_id, id, &error))
+		printf("cannot delete meter profile %u, error: %s\n", id,
+		       error.message ? error.message : "(no stated reason)");
+	mp->nb_profiles--;
+}
+
+/* Policy of the verdicts, added to the port if new. */
+static int
+meter_policy_get(struct meter_pool *mp, const struct vnf_meter_policy *policy)
+{
+	static const struct rte_flow_action drop[] = {
+		{ .type = RTE_FLOW_ACTION_TYPE_DROP },
+		{ .type = RTE_FLOW_ACTION_TYPE_END },
+	};
+	struct rte_mtr_meter_policy_params params;
+	struct rte_mtr_error error;
+	int id, free_id = -1, color;
+
+	for (id = 0; id < METER_POLICY_MAX; id++) {
+		if (!mp->policies[id].refs) {
+			if (free_id < 0)
+				free_id = id;
+			continue;
+		}
+		if (!memcmp(&mp->policies[id].policy, policy,
+			    sizeof(*policy))) {
+			mp->policies[id].refs++;
+			return id;
+		}
+	}
+	if (free_id < 0) {
+		printf("No meter policy left on port %u\n", mp->port_id);
+		return -ENOSPC;
+	}
+	memset(&params, 0, sizeof(params));
+	/* No action is the default one, pass the packet. */
+	for (color = 0; color < RTE_COLORS; color++)
+		if (policy->verdict[color] == VNF_METER_DROP)
+			params.actions[color] = drop;
+	printf("Creating meter policy %u on port %u\n",
+	       NETDEV_DPDK_METER_POLICY_ID + free_id, mp->port_id);
+	if (rte_mtr_meter_policy_add(mp->port_id,
+				     NETDEV_DPDK_METER_POLICY_ID + free_id,
+				     &params, &error)) {
+		printf("cannot add meter policy, error: %s\n",
+		       error.message ? error.message : "(no stated reason)");
+		return -EINVAL;
+	}
+	mp->policies[free_id].policy = *policy;
+	mp->policies[free_id].refs = 1;
+	return free_id;
+}
+
+static void
+meter_policy_put(struct meter_pool *mp, uint32_t id)
+{
+	struct rte_mtr_error error;
+
+	if (--mp->policies[id].refs)
+		return;
+	if (rte_mtr_meter_policy_delete(mp->port_id,
+					NETDEV_DPDK_METER_POLICY_ID + id,
+					&error))
+		printf("cannot delete meter policy %u, error: %s\n",
+		       NETDEV_DPDK_METER_POLICY_ID + id,
+		       error.message ? error.message : "(no stated reason)");
+}
+
+/* Pool lock held. */
+static int
+meter_destroy(struct meter_pool *mp, uint32_t idx)
+{
+	struct meter_entry *me = &mp->meters[idx];
+	struct rte_mtr_error error;
+	uint32_t mtr_id = mp->base + idx;
+
+	if (rte_mtr_destroy(mp->port_id, mtr_id, &error)) {
+		printf("cannot destroy meter %u of port %u, error: %s\n",
+		       mtr_id, mp->port_id,
+		       error.message ? error.message : "(no stated reason)");
+		return -EBUSY;
+	}
+	meter_profile_put(mp, me->profile);
+	meter_policy_put(mp, me->policy);
+	memset(me, 0, sizeof(*me));
+	rte_ring_enqueue_elem(mp->free_ids, &idx, sizeof(idx));
+	mp->nb_used--;
+	return 0;
+}
+
+/*
+ * Meter IDs base to base + nb - 1 of the port are given by the pool,
+ * bounded by what the port has.
+ */
+int
+vnf_meter_pool_init(uint16_t port_id, uint32_t base, uint32_t nb)
+{
+	struct rte_mtr_capabilities cap;
+	struct rte_hash_parameters params;
+	struct rte_mtr_error error;
+	char name[RTE_RING_NAMESIZE];
+	struct meter_pool *mp;
+	uint32_t idx;
+
+	if (port_id >= RTE_MAX_ETHPORTS || meter_pools[port_id] || !nb)
+		return -1;
+	memset(&cap, 0, sizeof(cap));
+	if (rte_mtr_capabilities_get(port_id, &cap, &error) == 0 &&
+	    cap.n_max && nb > cap.n_max) {
+		printf("Port %u has %u meters, not %u\n", port_id, cap.n_max,
+		       nb);
+		nb = cap.n_max;
+	}
+	mp = rte_zmalloc("vnf_meter_pool", sizeof(*mp) +
+			 nb * sizeof(mp->meters[0]), RTE_CACHE_LINE_SIZE);
+	if (mp == NULL) {
+		printf("Cannot allocate %u meters of port %u\n", nb, port_id);
+		return -1;
+	}
+	rte_spinlock_init(&mp->lock);
+	mp->port_id = port_id;
+	mp->base = base;
+	mp->nb = nb;
+	snprintf(name, sizeof(name), "vnf_meters_%u", port_id);
+	mp->free_ids = rte_ring_create_elem(name, sizeof(uint32_t), nb,
+					    rte_socket_id(),
+					    RING_F_EXACT_SZ |
+					    RING_F_SP_ENQ | RING_F_SC_DEQ);
+	memset(&params, 0, sizeof(params));
+	snprintf(name, sizeof(name), "vnf_mtr_profiles_%u", port_id);
+	params.name = name;
+	params.entries = METER_PROFILE_MAX;
+	params.key_len = sizeof(struct rte_mtr_meter_profile);
+	params.hash_func = rte_hash_crc;
+	params.socket_id = rte_socket_id();
+	mp->profile_hash = rte_hash_create(&params);
+	if (mp->free_ids == NULL || mp->profile_hash == NULL) {
+		printf("Cannot create meter pool of port %u\n", port_id);
+		rte_ring_free(mp->free_ids);
+		rte_hash_free(mp->profile_hash);
+		rte_free(mp);
+		return -1;
+	}
+	for (idx = 0; idx < nb; idx++)
+		rte_ring_enqueue_elem(mp->free_ids, &idx, sizeof(idx));
+	meter_pools[port_id] = mp;
+	return 0;
+}
+
+/* After the rules of the port are gone. */
+void
+vnf_meter_pool_close(uint16_t port_id)
+{
+	struct meter_pool *mp = meter_pool_get(port_id);
+	uint32_t idx;
+
+	if (mp == NULL)
+		return;
+	rte_spinlock_lock(&mp->lock);
+	for (idx = 0; idx < mp->nb; idx++)
+		if (mp->meters[idx].used)
+			meter_destroy(mp, idx);
+	meter_pools[port_id] = NULL;
+	rte_spinlock_unlock(&mp->lock);
+	rte_ring_free(mp->free_ids);
+	rte_hash_free(mp->profile_hash);
+	rte_free(mp);
+}
+
+/*
+ * New meter of the profile and policy, VNF_METER_INVALID if none is left.
+ * The testpmd commands, for the first one:
+ * testpmd> add port meter profile srtcm_rfc2697 0 0 10240 10240 0
+ * testpmd> add port meter policy 0 25 g_actions end y_actions end
+ *          r_actions drop / end
+ * testpmd> create port meter 0 0 0 25 yes 0xFFFF 0 0
+ */
+uint32_t
+vnf_meter_alloc(uint16_t port_id, const struct rte_mtr_meter_profile *profile,
+		const struct vnf_meter_policy *policy)
+{
+	struct meter_pool *mp = meter_pool_get(port_id);
+	struct rte_mtr_params params;
+	struct rte_mtr_error error;
+	struct meter_entry *me;
+	int profile_id, policy_id;
+	uint32_t idx;
+
+	if (mp == NULL)
+		return VNF_METER_INVALID;
+	rte_spinlock_lock(&mp->lock);
+	if (rte_ring_dequeue_elem(mp->free_ids, &idx, sizeof(idx))) {
+		rte_spinlock_unlock(&mp->lock);
+		/* Take back the meters of the sessions gone. */
+		if (!vnf_meter_pool_gc(port_id))
+			goto full;
+		rte_spinlock_lock(&mp->lock);
+		if (rte_ring_dequeue_elem(mp->free_ids, &idx, sizeof(idx))) {
+			rte_spinlock_unlock(&mp->lock);
+			goto full;
+		}
+	}
+	profile_id = meter_profile_get(mp, profile);
+	if (profile_id < 0)
+		goto err;
+	policy_id = meter_policy_get(mp, policy);
+	if (policy_id < 0) {
+		meter_profile_put(mp, profile_id);
+		goto err;
+	}
+	memset(&params, 0, sizeof(params));
+	params.meter_enable = 1;
+	params.meter_policy_id = NETDEV_DPDK_METER_POLICY_ID + policy_id;
+	params.meter_profile_id = profile_id;
+	params.stats_mask = RTE_MTR_STATS_N_BYTES_GREEN |
+			    RTE_MTR_STATS_N_BYTES_YELLOW |
+			    RTE_MTR_STATS_N_BYTES_RED |
+			    RTE_MTR_STATS_N_BYTES_DROPPED |
+			    RTE_MTR_STATS_N_PKTS_GREEN |
+			    RTE_MTR_STATS_N_PKTS_YELLOW |
+			    RTE_MTR_STATS_N_PKTS_RED |
+			    RTE_MTR_STATS_N_PKTS_DROPPED;
+	if (rte_mtr_create(port_id, mp->base + idx, &params, 1, &error)) {
+		printf("cannot create meter: %u with profile: %d, error: %s\n",
+		       mp->base + idx, profile_id,
+		       error.message ? error.message : "(no stated reason)");
+		meter_policy_put(mp, policy_id);
+		meter_profile_put(mp, profile_id);
+		goto err;
+	}
+	me = &mp->meters[idx];
+	me->flow_id = VNF_FLOW_ID_INVALID;
+	me->profile = profile_id;
+	me->policy = policy_id;
+	me->used = 1;
+	mp->nb_used++;
+	rte_spinlock_unlock(&mp->lock);
+	return mp->base + idx;
+err:
+	rte_ring_enqueue_elem(mp->free_ids, &idx, sizeof(idx));
+	rte_spinlock_unlock(&mp->lock);
+	return VNF_METER_INVALID;
+full:
+	printf("No meter left on port %u, %u meters\n", port_id, mp->nb);
+	return VNF_METER_INVALID;
+}
+
+/* The meter is recycled by the gc once the rule is gone. */
+int
+vnf_meter_bind(uint16_t port_id, uint32_t mtr_id, uint32_t flow_id)
+{
+	struct meter_pool *mp = meter_pool_get(port_id);
+	int ret = -ENOENT;
+
+	if (mp == NULL)
+		return ret;
+	rte_spinlock_lock(&mp->lock);
+	if (mtr_id - mp->base < mp->nb && mp->meters[mtr_id - mp->base].used) {
+		mp->meters[mtr_id - mp->base].flow_id = flow_id;
+		ret = 0;
+	}
+	rte_spinlock_unlock(&mp->lock);
+	return ret;
+}
+
+/* The rules using the meter must be gone. */
+int
+vnf_meter_free(uint16_t port_id, uint32_t mtr_id)
+{
+	struct meter_pool *mp = meter_pool_get(port_id);
+	int ret = -ENOENT;
+
+	if (mp == NULL)
+		return ret;
+	rte_spinlock_lock(&mp->lock);
+	if (mtr_id - mp->base < mp->nb && mp->meters[mtr_id - mp->base].used)
+		ret = meter_destroy(mp, mtr_id - mp->base);
+	rte_spinlock_unlock(&mp->lock);
+	return ret;
+}
+
+/* Free the meters whose bound rule left the registry, return how many. */
+uint32_t
+vnf_meter_pool_gc(uint16_t port_id)
+{
+	struct meter_pool *mp = meter_pool_get(port_id);
+	struct meter_entry *me;
+	uint32_t idx, nb = 0;
+
+	if (mp == NULL)
+		return 0;
+	rte_spinlock_lock(&mp->lock);
+	for (idx = 0; idx < mp->nb; idx++) {
+		me = &mp->meters[idx];
+		if (!me->used || me->flow_id == VNF_FLOW_ID_INVALID ||
+		    vnf_flow_lookup(me->flow_id, NULL))
+			continue;
+		if (!meter_destroy(mp, idx))
+			nb++;
+	}
+	mp->recycled += nb;
+	rte_spinlock_unlock(&mp->lock);
+	return nb;
+}
+
+/* Meter IDs of the pool of the port. */
+int
+vnf_meter_pool_range(uint16_t port_id, uint32_t *base, uint32_t *nb)
+{
+	struct meter_pool *mp = meter_pool_get(port_id);
+
+	if (mp == NULL)
+		return -ENOENT;
+	*base = mp->base;
+	*nb = mp->nb;
+	return 0;
+}
+
+/* Without the lock, for a reader skipping the unused IDs. */
+int
+vnf_meter_used(uint16_t port_id, uint32_t mtr_id)
+{
+	struct meter_pool *mp = meter_pool_get(port_id);
+
+	return mp && mtr_id - mp->base < mp->nb &&
+	       __atomic_load_n(&mp->meters[mtr_id - mp->base].used,
+			       __ATOMIC_RELAXED);
+}
+
+void
+vnf_meter_pool_print(uint16_t port_id)
+{
+	struct meter_pool *mp = meter_pool_get(port_id);
+
+	if (mp == NULL)
+		return;
+	rte_spinlock_lock(&mp->lock);
+	printf(":: port %u meters: %u/%u used, %u profiles, %"PRIu64
+	       " meters sharing a profile, %"PRIu64" recycled\n", port_id,
+	       mp->nb_used, mp->nb, mp->nb_profiles, mp->profile_shared,
+	       mp->recycled);
+	rte_spinlock_unlock(&mp->lock);
+}
@@ -0,0 +1,320 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_mtr.h>
+#include <rte_malloc.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_pause.h>
+#include <rte_service.h>
+#include <rte_service_component.h>
+#include <rte_spinlock.h>
+#include <rte_telemetry.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Stats of the meters of the pools, for the policing rates of the UEs.
+ * An EAL service reads them, a slice every METER_STATS_TICK_MS so that
+ * each meter is read once per period however many there are. It runs on
+ * a service lcore when the EAL has one, else the main lcore runs it from
+ * its loop with vnf_meter_stats_poll(), no lcore is spent on it.
+ * The rates are taken between the last two reads of a meter.
+ */
+
+#define METER_STATS_TICK_MS 10
+#define METER_STATS_TICK_MAX 4096 /* Meter IDs per port and tick. */
+
+struct mstats_meter {
+	struct vnf_meter_stats stats;
+	uint64_t tsc; /* Last read, 0 if never. */
+};
+
+struct mstats_port {
+	uint32_t base;
+	uint32_t nb;
+	uint32_t cursor;
+	struct mstats_meter meters[];
+};
+
+static struct mstats_port *mstats_ports[RTE_MAX_ETHPORTS];
+static uint32_t mstats_service_id;
+static int mstats_registered;
+static int mstats_on_app_lcore; /* No service lcore, polled. */
+static uint32_t mstats_lcore = RTE_MAX_LCORE; /* Service lcore. */
+static uint32_t period_ms;
+static uint64_t next_tick;
+static uint64_t reads;
+static uint64_t read_errors;
+static uint64_t passes; /* All the meters of a port read. */
+static uint64_t max_tick_us;
+static rte_spinlock_t mstats_lock = RTE_SPINLOCK_INITIALIZER;
+
+/* Lock held. */
+static void
+mstats_read(uint16_t port_id, struct mstats_port *mp, uint32_t idx,
+	    uint64_t now)
+{
+	struct mstats_meter *m = &mp->meters[idx];
+	struct vnf_meter_stats *ms = &m->stats;
+	struct rte_mtr_stats stats;
+	struct rte_mtr_error error;
+	uint64_t stats_mask = 0, dt;
+	int color;
+
+	memset(&stats, 0, sizeof(stats));
+	reads++;
+	if (rte_mtr_stats_read(port_id, mp->base + idx, &stats, &stats_mask,
+			       0, &error)) {
+		read_errors++;
+		return;
+	}
+	/* Counts going back are those of a new meter on the same ID. */
+	for (color = 0; color < RTE_COLORS; color++)
+		if (stats.n_pkts[color] < ms->pkts[color])
+			m->tsc = 0;
+	dt = now - m->tsc;
+	for (color = 0; color < RTE_COLORS; color++) {
+		if (m->tsc && dt) {
+			ms->pkts_rate[color] = (stats.n_pkts[color] -
+						ms->pkts[color]) *
+					       rte_get_tsc_hz() / dt;
+			ms->bytes_rate[color] = (stats.n_bytes[color] -
+						 ms->bytes[color]) *
+						rte_get_tsc_hz() / dt;
+		} else {
+			ms->pkts_rate[color] = 0;
+			ms->bytes_rate[color] = 0;
+		}
+		ms->pkts[color] = stats.n_pkts[color];
+		ms->bytes[color] = stats.n_bytes[color];
+	}
+	ms->pkts_dropped = stats.n_pkts_dropped;
+	ms->bytes_dropped = stats.n_bytes_dropped;
+	m->tsc = now;
+}
+
+/* Service callback, a slice of the meters of each port when due. */
+static int32_t
+mstats_run(void *arg)
+{
+	uint64_t now = rte_get_tsc_cycles(), us;
+	struct mstats_port *mp;
+	uint32_t budget, done, ticks;
+	uint16_t port_id;
+
+	RTE_SET_USED(arg);
+	if (now < next_tick)
+		return -EAGAIN;
+	next_tick = now + rte_get_tsc_hz() * METER_STATS_TICK_MS / MS_PER_S;
+	ticks = RTE_MAX(period_ms / METER_STATS_TICK_MS, 1u);
+	rte_spinlock_lock(&mstats_lock);
+	for (port_id = 0; port_id < RTE_MAX_ETHPORTS; port_id++) {
+		mp = mstats_ports[port_id];
+		if (mp == NULL)
+			continue;
+		/* IDs visited, the unused ones are skipped. */
+		budget = RTE_MIN((mp->nb + ticks - 1) / ticks,
+				 (uint32_t)METER_STATS_TICK_MAX);
+		for (done = 0; done < budget && mp->cursor < mp->nb;
+		     done++, mp->cursor++)
+			if (vnf_meter_used(port_id, mp->base + mp->cursor))
+				mstats_read(port_id, mp, mp->cursor, now);
+		if (mp->cursor == mp->nb) {
+			mp->cursor = 0;
+			passes++;
+		}
+	}
+	us = (rte_get_tsc_cycles() - now) * US_PER_S / rte_get_tsc_hz();
+	if (us > max_tick_us)
+		max_tick_us = us;
+	rte_spinlock_unlock(&mstats_lock);
+	return 0;
+}
+
+/* From the loop of the main lcore, runs the service without service lcore. */
+void
+vnf_meter_stats_poll(void)
+{
+	if (mstats_on_app_lcore)
+		rte_service_run_iter_on_app_lcore(mstats_service_id, 0);
+}
+
+int
+vnf_meter_stats_get(uint16_t port_id, uint32_t mtr_id,
+		    struct vnf_meter_stats *ms)
+{
+	struct mstats_port *mp;
+	int ret = -ENOENT;
+
+	if (port_id >= RTE_MAX_ETHPORTS)
+		return ret;
+	rte_spinlock_lock(&mstats_lock);
+	mp = mstats_ports[port_id];
+	if (mp && mtr_id - mp->base < mp->nb &&
+	    mp->meters[mtr_id - mp->base].tsc) {
+		*ms = mp->meters[mtr_id - mp->base].stats;
+		ret = 0;
+	}
+	rte_spinlock_unlock(&mstats_lock);
+	return ret;
+}
+
+static int
+mstats_telemetry(const char *cmd, const char *params, struct rte_tel_data *d)
+{
+	uint64_t nb = 0;
+	uint16_t port_id;
+
+	RTE_SET_USED(cmd);
+	RTE_SET_USED(params);
+	rte_spinlock_lock(&mstats_lock);
+	for (port_id = 0; port_id < RTE_MAX_ETHPORTS; port_id++)
+		if (mstats_ports[port_id])
+			nb += mstats_ports[port_id]->nb;
+	rte_tel_data_start_dict(d);
+	rte_tel_data_add_dict_u64(d, "meter_ids", nb);
+	rte_tel_data_add_dict_u64(d, "period_ms", period_ms);
+	rte_tel_data_add_dict_u64(d, "passes", passes);
+	rte_tel_data_add_dict_u64(d, "reads", reads);
+	rte_tel_data_add_dict_u64(d, "read_errors", read_errors);
+	rte_tel_data_add_dict_u64(d, "max_tick_us", max_tick_us);
+	rte_tel_data_add_dict_u64(d, "service_lcore", !mstats_on_app_lcore);
+	rte_spinlock_unlock(&mstats_lock);
+	return 0;
+}
+
+/* Parameters: port_id,mtr_id */
+static int
+mstats_meter_telemetry(const char *cmd, const char *params,
+		       struct rte_tel_data *d)
+{
+	static const char * const names[RTE_COLORS][4] = {
+		[RTE_COLOR_GREEN] = { "green_pkts", "green_bytes",
+				      "green_pkts_rate", "green_bytes_rate" },
+		[RTE_COLOR_YELLOW] = { "yellow_pkts", "yellow_bytes",
+				       "yellow_pkts_rate", "yellow_bytes_rate" },
+		[RTE_COLOR_RED] = { "red_pkts", "red_bytes",
+				    "red_pkts_rate", "red_bytes_rate" },
+	};
+	struct vnf_meter_stats ms;
+	unsigned long port_id, mtr_id;
+	char *end;
+	int color;
+
+	RTE_SET_USED(cmd);
+	if (params == NULL)
+		return -EINVAL;
+	port_id = strtoul(params, &end, 0);
+	if (*end != ',')
+		return -EINVAL;
+	mtr_id = strtoul(end + 1, NULL, 0);
+	if (port_id >= RTE_MAX_ETHPORTS ||
+	    vnf_meter_stats_get(port_id, mtr_id, &ms))
+		return -EINVAL;
+	rte_tel_data_start_dict(d);
+	for (color = 0; color < RTE_COLORS; color++) {
+		rte_tel_data_add_dict_u64(d, names[color][0], ms.pkts[color]);
+		rte_tel_data_add_dict_u64(d, names[color][1], ms.bytes[color]);
+		rte_tel_data_add_dict_u64(d, names[color][2],
+					  ms.pkts_rate[color]);
+		rte_tel_data_add_dict_u64(d, names[color][3],
+					  ms.bytes_rate[color]);
+	}
+	rte_tel_data_add_dict_u64(d, "dropped_pkts", ms.pkts_dropped);
+	rte_tel_data_add_dict_u64(d, "dropped_bytes", ms.bytes_dropped);
+	return 0;
+}
+
+/*
+ * Read the meters of the pools made so far, each once per period.
+ * Stats are in telemetry as /vnf/meter_stats and /vnf/meter,<port>,<id>.
+ */
+int
+vnf_meter_stats_init(uint32_t period)
+{
+	struct rte_service_spec service;
+	struct mstats_port *mp;
+	uint32_t base, nb, lcore_id;
+	uint16_t port_id;
+
+	if (!period)
+		return -1;
+	period_ms = period;
+	RTE_ETH_FOREACH_DEV(port_id) {
+		if (vnf_meter_pool_range(port_id, &base, &nb))
+			continue;
+		mp = rte_zmalloc("vnf_meter_stats", sizeof(*mp) +
+				 nb * sizeof(mp->meters[0]),
+				 RTE_CACHE_LINE_SIZE);
+		if (mp == NULL) {
+			printf("Cannot allocate stats of %u meters of port "
+			       "%u\n", nb, port_id);
+			vnf_meter_stats_close();
+			return -1;
+		}
+		mp->base = base;
+		mp->nb = nb;
+		mstats_ports[port_id] = mp;
+	}
+	memset(&service, 0, sizeof(service));
+	snprintf(service.name, sizeof(service.name), "vnf_meter_stats");
+	service.callback = mstats_run;
+	service.socket_id = rte_socket_id();
+	if (rte_service_component_register(&service, &mstats_service_id)) {
+		printf("Cannot register meter stats service\n");
+		vnf_meter_stats_close();
+		return -1;
+	}
+	mstats_registered = 1;
+	rte_service_component_runstate_set(mstats_service_id, 1);
+	rte_service_runstate_set(mstats_service_id, 1);
+	if (rte_service_lcore_list(&lcore_id, 1) > 0 &&
+	    rte_service_map_lcore_set(mstats_service_id, lcore_id, 1) == 0) {
+		rte_service_lcore_start(lcore_id);
+		mstats_lcore = lcore_id;
+		printf(":: meter stats on service lcore %u\n", lcore_id);
+	} else {
+		mstats_on_app_lcore = 1;
+		rte_service_set_runstate_mapped_check(mstats_service_id, 0);
+	}
+	rte_telemetry_register_cmd("/vnf/meter_stats", mstats_telemetry,
+			"Meter stats reading. Takes no parameters");
+	rte_telemetry_register_cmd("/vnf/meter", mstats_meter_telemetry,
+			"Meter stats. Parameters: int port_id, int mtr_id");
+	return 0;
+}
+
+/* Before the meter pools are closed. */
+void
+vnf_meter_stats_close(void)
+{
+	uint16_t port_id;
+
+	if (mstats_registered) {
+		rte_service_runstate_set(mstats_service_id, 0);
+		rte_service_component_runstate_set(mstats_service_id, 0);
+		while (rte_service_may_be_active(mstats_service_id) == 1)
+			rte_pause();
+		if (mstats_lcore != RTE_MAX_LCORE)
+			rte_service_map_lcore_set(mstats_service_id,
+						  mstats_lcore, 0);
+		rte_service_component_unregister(mstats_service_id);
+		mstats_registered = 0;
+		mstats_lcore = RTE_MAX_LCORE;
+	}
+	mstats_on_app_lcore = 0;
+	rte_spinlock_lock(&mstats_lock);
+	for (port_id = 0; port_id < RTE_MAX_ETHPORTS; port_id++) {
+		rte_free(mstats_ports[port_id]);
+		mstats_ports[port_id] = NULL;
+	}
+	rte_spinlock_unlock(&mstats_lock);
+}
@@ -0,0 +1,267 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#ifndef _PFCP_H_
+#define _PFCP_H_
+
+/*
+ * The PFCP subset (3GPP TS 29.244) of the control endpoint, pfcp_ctl.c,
+ * and of the SMF stand-in, smf_standin.c: the wire format and the TLV
+ * helpers, without DPDK. Everything is in network order on the wire.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define PFCP_UDP_PORT 8805
+#define PFCP_VERSION 1
+#define PFCP_MSG_MAX 1024
+#define PFCP_HDR_LEN 8 /* Without SEID. */
+#define PFCP_HDR_SEID_LEN 16
+
+/* Message types. */
+#define PFCP_HEARTBEAT_REQ 1
+#define PFCP_HEARTBEAT_RSP 2
+#define PFCP_ASSOC_SETUP_REQ 5
+#define PFCP_ASSOC_SETUP_RSP 6
+#define PFCP_SESS_EST_REQ 50
+#define PFCP_SESS_EST_RSP 51
+#define PFCP_SESS_MOD_REQ 52
+#define PFCP_SESS_MOD_RSP 53
+#define PFCP_SESS_DEL_REQ 54
+#define PFCP_SESS_DEL_RSP 55
+
+/* Information elements, the grouped ones first. */
+#define PFCP_IE_CREATE_PDR 1
+#define PFCP_IE_PDI 2
+#define PFCP_IE_CREATE_FAR 3
+#define PFCP_IE_FORWARDING_PARAMS 4
+#define PFCP_IE_CREATE_URR 6
+#define PFCP_IE_CREATE_QER 7
+#define PFCP_IE_UPDATE_PDR 9
+#define PFCP_IE_UPDATE_FAR 10
+#define PFCP_IE_UPDATE_FORWARDING_PARAMS 11
+#define PFCP_IE_UPDATE_URR 13
+#define PFCP_IE_UPDATE_QER 14
+#define PFCP_IE_CAUSE 19
+#define PFCP_IE_SOURCE_INTERFACE 20
+#define PFCP_IE_F_TEID 21
+#define PFCP_IE_GATE_STATUS 25
+#define PFCP_IE_MBR 26
+#define PFCP_IE_PRECEDENCE 29
+#define PFCP_IE_INACTIVITY_TIME 36
+#define PFCP_IE_DESTINATION_INTERFACE 42
+#define PFCP_IE_APPLY_ACTION 44
+#define PFCP_IE_PDR_ID 56
+#define PFCP_IE_F_SEID 57
+#define PFCP_IE_NODE_ID 60
+#define PFCP_IE_MEASUREMENT_METHOD 62
+#define PFCP_IE_VOLUME_MEASUREMENT 66
+#define PFCP_IE_USAGE_REPORT_DEL 79
+#define PFCP_IE_URR_ID 81
+#define PFCP_IE_OUTER_HDR_CREATION 84
+#define PFCP_IE_UE_IP 93
+#define PFCP_IE_OUTER_HDR_REMOVAL 95
+#define PFCP_IE_RECOVERY_TIME 96
+#define PFCP_IE_FAR_ID 108
+#define PFCP_IE_QER_ID 109
+#define PFCP_IE_QFI 124
+
+/* Cause values. */
+#define PFCP_CAUSE_ACCEPTED 1
+#define PFCP_CAUSE_REJECTED 64
+#define PFCP_CAUSE_NO_SESSION 65
+#define PFCP_CAUSE_IE_MISSING 66
+#define PFCP_CAUSE_IE_INCORRECT 69
+#define PFCP_CAUSE_NO_RESOURCES 75
+#define PFCP_CAUSE_NOT_SUPPORTED 76
+
+#define PFCP_SRC_ACCESS 0 /* Uplink PDR. */
+#define PFCP_SRC_CORE 1 /* Downlink PDR. */
+#define PFCP_OHC_GTPU_IPV4 0x0100 /* Outer header creation description. */
+
+struct pfcp_hdr {
+	uint8_t type;
+	uint8_t has_seid;
+	uint64_t seid;
+	uint32_t seq; /* 24 bits. */
+	const uint8_t *body;
+	uint16_t body_len;
+};
+
+static inline uint8_t *
+pfcp_put16(uint8_t *p, uint16_t v)
+{
+	v = htons(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline uint8_t *
+pfcp_put32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline uint8_t *
+pfcp_put64(uint8_t *p, uint64_t v)
+{
+	p = pfcp_put32(p, (uint32_t)(v >> 32));
+	return pfcp_put32(p, (uint32_t)v);
+}
+
+static inline uint16_t
+pfcp_get16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohs(v);
+}
+
+static inline uint32_t
+pfcp_get32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static inline uint64_t
+pfcp_get64(const uint8_t *p)
+{
+	return ((uint64_t)pfcp_get32(p) << 32) | pfcp_get32(p + 4);
+}
+
+/* The header of a message, its length set by pfcp_msg_end(). */
+static inline uint8_t *
+pfcp_msg_begin(uint8_t *buf, uint8_t type, int has_seid, uint64_t seid,
+	       uint32_t seq)
+{
+	uint8_t *p = buf;
+
+	*p++ = (PFCP_VERSION << 5) | (has_seid ? 1 : 0);
+	*p++ = type;
+	p = pfcp_put16(p, 0);
+	if (has_seid)
+		p = pfcp_put64(p, seid);
+	p = pfcp_put32(p, seq << 8);
+	return p;
+}
+
+static inline uint16_t
+pfcp_msg_end(uint8_t *buf, const uint8_t *end)
+{
+	uint16_t len = end - buf;
+
+	pfcp_put16(buf + 2, len - 4);
+	return len;
+}
+
+/* An IE, its length set by pfcp_ie_end(), grouped ones nest. */
+static inline uint8_t *
+pfcp_ie_begin(uint8_t *p, uint16_t type)
+{
+	p = pfcp_put16(p, type);
+	return pfcp_put16(p, 0);
+}
+
+static inline uint8_t *
+pfcp_ie_end(uint8_t *ie, uint8_t *end)
+{
+	pfcp_put16(ie + 2, end - ie - 4);
+	return end;
+}
+
+static inline uint8_t *
+pfcp_ie_u8(uint8_t *p, uint16_t type, uint8_t v)
+{
+	uint8_t *ie = p;
+
+	p = pfcp_ie_begin(p, type);
+	*p++ = v;
+	return pfcp_ie_end(ie, p);
+}
+
+static inline uint8_t *
+pfcp_ie_u16(uint8_t *p, uint16_t type, uint16_t v)
+{
+	uint8_t *ie = p;
+
+	p = pfcp_ie_begin(p, type);
+	p = pfcp_put16(p, v);
+	return pfcp_ie_end(ie, p);
+}
+
+static inline uint8_t *
+pfcp_ie_u32(uint8_t *p, uint16_t type, uint32_t v)
+{
+	uint8_t *ie = p;
+
+	p = pfcp_ie_begin(p, type);
+	p = pfcp_put32(p, v);
+	return pfcp_ie_end(ie, p);
+}
+
+/* Node ID or F-SEID of an IPv4 node, seid ignored for the Node ID. */
+static inline uint8_t *
+pfcp_ie_node(uint8_t *p, uint16_t type, uint64_t seid, uint32_t ipv4)
+{
+	uint8_t *ie = p;
+
+	p = pfcp_ie_begin(p, type);
+	if (type == PFCP_IE_F_SEID) {
+		*p++ = 0x02; /* V4. */
+		p = pfcp_put64(p, seid);
+	} else {
+		*p++ = 0; /* IPv4 address. */
+	}
+	p = pfcp_put32(p, ipv4);
+	return pfcp_ie_end(ie, p);
+}
+
+/* Return -1 if buf doesn't hold a PFCP message. */
+static inline int
+pfcp_msg_parse(const uint8_t *buf, size_t len, struct pfcp_hdr *h)
+{
+	size_t hdr_len;
+
+	if (len < PFCP_HDR_LEN || (buf[0] >> 5) != PFCP_VERSION)
+		return -1;
+	h->type = buf[1];
+	h->has_seid = buf[0] & 1;
+	hdr_len = h->has_seid ? PFCP_HDR_SEID_LEN : PFCP_HDR_LEN;
+	if (len < hdr_len || (size_t)pfcp_get16(buf + 2) + 4 > len ||
+	    (size_t)pfcp_get16(buf + 2) + 4 < hdr_len)
+		return -1;
+	h->seid = h->has_seid ? pfcp_get64(buf + 4) : 0;
+	h->seq = pfcp_get32(buf + hdr_len - 4) >> 8;
+	h->body = buf + hdr_len;
+	h->body_len = pfcp_get16(buf + 2) + 4 - hdr_len;
+	return 0;
+}
+
+/* Next IE of [*p, end), return 0 at the end, -1 on a truncated IE. */
+static inline int
+pfcp_ie_next(const uint8_t **p, const uint8_t *end, uint16_t *type,
+	     const uint8_t **val, uint16_t *len)
+{
+	if (*p == end)
+		return 0;
+	if (end - *p < 4)
+		return -1;
+	*type = pfcp_get16(*p);
+	*len = pfcp_get16(*p + 2);
+	if (end - *p - 4 < *len)
+		return -1;
+	*val = *p + 4;
+	*p += 4 + *len;
+	return 1;
+}
+
+#endif /* _PFCP_H_ */
@@ -0,0 +1,651 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <rte_common.h>
+#include <rte_malloc.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
+#include <rte_errno.h>
+
+#include "vnf_examples.h"
+#include "pfcp.h"
+
+/*
+ * PFCP-lite control endpoint: a UDP socket on the loopback where a local
+ * SMF, or smf_standin, establishes, modifies and deletes PDU sessions.
+ * The subset of TS 29.244 is one session of the session API per PFCP
+ * session:
+ * - Create PDR, its PDI F-TEID (no CHOOSE), UE IP address and QFI;
+ * - Create FAR, the outer header creation of its forwarding parameters,
+ *   the DL TEID and gNB of the session;
+ * - Create QER, its MBR and QFI;
+ * - Create URR, its inactivity detection time as idle timeout, the volume
+ *   of the session reported in the deletion response;
+ * - the Update ones in a modification, over the session parameters;
+ * - heartbeat and association setup, to keep the SMF happy.
+ * The UP F-SEID is the session handle. No session report is sent, a
+ * session aged out is not found by the next request.
+ *
+ * vnf_pfcp_wait() is the sleep of the main lcore loop. Once a request is
+ * there the ones arriving within the window are taken with it, up to
+ * PFCP_BATCH: their rules are enqueued on the flow queue of the main lcore
+ * (vnf_session_create()) and pushed as one batch by vnf_async_flush(),
+ * then the responses go. An establishment is only accepted once the
+ * completions of its rules were pulled, a session whose rules failed is
+ * deleted and rejected. The latency of a request is from its reception
+ * to its response, rule completion included.
+ */
+
+#define PFCP_BATCH 64
+#define PFCP_RCVBUF (4 << 20) /* Bursts of the SMF. */
+#define PFCP_GROUP_DEPTH 4
+#define PFCP_LAT_BUCKETS 32 /* log2 of microseconds. */
+#define PFCP_NTP_OFFSET 2208988800u /* 1900 to 1970, recovery time. */
+
+/* IEs of a request. */
+#define PFCP_HAVE_F_SEID (1 << 0)
+#define PFCP_HAVE_F_TEID (1 << 1)
+#define PFCP_HAVE_UE_IP (1 << 2)
+
+struct pfcp_req {
+	uint8_t buf[PFCP_MSG_MAX];
+	uint8_t rsp[PFCP_MSG_MAX];
+	struct sockaddr_in peer;
+	uint64_t rx; /* Cycles. */
+	uint32_t id; /* Session established, confirmed after the flush. */
+	uint16_t len;
+	uint16_t rsp_len;
+};
+
+struct pfcp_ies {
+	struct vnf_session_params p;
+	uint64_t cp_seid;
+	uint32_t urr_id;
+	uint32_t present; /* PFCP_HAVE_* */
+};
+
+/* SMF side of a session, at the position of its handle in the hash. */
+struct pfcp_session {
+	uint64_t cp_seid;
+	uint32_t urr_id;
+};
+
+struct pfcp_stats {
+	uint64_t established;
+	uint64_t modified;
+	uint64_t deleted;
+	uint64_t node; /* Heartbeats and association setups. */
+	uint64_t rejected;
+	uint64_t dropped;
+	uint64_t batches;
+	uint64_t requests;
+	uint64_t lat_cycles;
+	uint64_t lat_max;
+	uint64_t hist[PFCP_LAT_BUCKETS];
+	uint64_t first; /* Cycles of the first request and last response. */
+	uint64_t last;
+};
+
+static int pfcp_fd = -1;
+static uint16_t pfcp_port_id;
+static uint64_t pfcp_window; /* Cycles. */
+static uint32_t pfcp_recovery; /* NTP seconds. */
+static struct rte_hash *pfcp_handles;
+static struct pfcp_session *pfcp_sessions;
+static struct pfcp_req pfcp_reqs[PFCP_BATCH];
+static struct pfcp_stats stats;
+
+static uint64_t
+pfcp_get40(const uint8_t *p)
+{
+	return ((uint64_t)p[0] << 32) | pfcp_get32(p + 1);
+}
+
+/* Fill ies from the IEs of [p, end), return a cause on error, 0 otherwise. */
+static int
+pfcp_ies_parse(const uint8_t *p, const uint8_t *end, struct pfcp_ies *ies,
+	       int depth)
+{
+	const uint8_t *val;
+	uint16_t type, len;
+	int ret;
+
+	while ((ret = pfcp_ie_next(&p, end, &type, &val, &len)) > 0) {
+		switch (type) {
+		case PFCP_IE_CREATE_PDR:
+		case PFCP_IE_PDI:
+		case PFCP_IE_CREATE_FAR:
+		case PFCP_IE_FORWARDING_PARAMS:
+		case PFCP_IE_CREATE_URR:
+		case PFCP_IE_CREATE_QER:
+		case PFCP_IE_UPDATE_PDR:
+		case PFCP_IE_UPDATE_FAR:
+		case PFCP_IE_UPDATE_FORWARDING_PARAMS:
+		case PFCP_IE_UPDATE_URR:
+		case PFCP_IE_UPDATE_QER:
+			if (depth == PFCP_GROUP_DEPTH)
+				return PFCP_CAUSE_IE_INCORRECT;
+			ret = pfcp_ies_parse(val, val + len, ies, depth + 1);
+			if (ret)
+				return ret;
+			break;
+		case PFCP_IE_F_SEID:
+			if (len < 9)
+				return PFCP_CAUSE_IE_INCORRECT;
+			ies->cp_seid = pfcp_get64(val + 1);
+			ies->present |= PFCP_HAVE_F_SEID;
+			break;
+		case PFCP_IE_F_TEID:
+			/* The UP chooses nothing, TEID and IPv4 given. */
+			if (len < 5 || (val[0] & 0x04))
+				return PFCP_CAUSE_IE_INCORRECT;
+			ies->p.ul_teid = pfcp_get32(val + 1);
+			ies->present |= PFCP_HAVE_F_TEID;
+			break;
+		case PFCP_IE_UE_IP:
+			if (len < 5 || !(val[0] & 0x02))
+				return PFCP_CAUSE_IE_INCORRECT;
+			ies->p.ue_ip = pfcp_get32(val + 1);
+			ies->present |= PFCP_HAVE_UE_IP;
+			break;
+		case PFCP_IE_QFI:
+			if (len < 1)
+				return PFCP_CAUSE_IE_INCORRECT;
+			ies->p.qfi = val[0] & 0x3f;
+			break;
+		case PFCP_IE_OUTER_HDR_CREATION:
+			if (len < 10 || pfcp_get16(val) != PFCP_OHC_GTPU_IPV4)
+				return PFCP_CAUSE_IE_INCORRECT;
+			ies->p.dl_teid = pfcp_get32(val + 2);
+			ies->p.gnb_ip = pfcp_get32(val + 6);
+			break;
+		case PFCP_IE_MBR:
+			/* Kilobits per second, bytes per second for the meter. */
+			if (len < 10)
+				return PFCP_CAUSE_IE_INCORRECT;
+			ies->p.ul_mbr = pfcp_get40(val) * 125;
+			ies->p.dl_mbr = pfcp_get40(val + 5) * 125;
+			break;
+		case PFCP_IE_INACTIVITY_TIME:
+			if (len < 4)
+				return PFCP_CAUSE_IE_INCORRECT;
+			ies->p.idle_timeout = pfcp_get32(val);
+			break;
+		case PFCP_IE_URR_ID:
+			if (len < 4)
+				return PFCP_CAUSE_IE_INCORRECT;
+			ies->urr_id = pfcp_get32(val);
+			break;
+		default:
+			/* PDR, FAR and QER IDs, precedence, actions... */
+			break;
+		}
+	}
+	return ret < 0 ? PFCP_CAUSE_IE_INCORRECT : 0;
+}
+
+static uint8_t *
+pfcp_ie_recovery(uint8_t *p)
+{
+	return pfcp_ie_u32(p, PFCP_IE_RECOVERY_TIME, pfcp_recovery);
+}
+
+/* Forget the sessions aged out since their establishment. */
+static void
+pfcp_handles_sweep(void)
+{
+	struct vnf_session_params p;
+	const void *key;
+	uint32_t iter = 0;
+	void *data;
+
+	while (rte_hash_iterate(pfcp_handles, &key, &data, &iter) >= 0) {
+		if (vnf_session_params_get(*(const uint32_t *)key, &p) ==
+		    -ENOENT)
+			rte_hash_del_key(pfcp_handles, key);
+	}
+}
+
+static uint8_t *
+pfcp_establish_rsp(uint8_t *p, uint64_t cp_seid, uint32_t seq, uint8_t cause,
+		   uint32_t id)
+{
+	p = pfcp_msg_begin(p, PFCP_SESS_EST_RSP, 1, cp_seid, seq);
+	p = pfcp_ie_node(p, PFCP_IE_NODE_ID, 0, INADDR_LOOPBACK);
+	p = pfcp_ie_u8(p, PFCP_IE_CAUSE, cause);
+	if (id != VNF_SESSION_INVALID)
+		p = pfcp_ie_node(p, PFCP_IE_F_SEID, id, INADDR_LOOPBACK);
+	return p;
+}
+
+static uint8_t *
+pfcp_establish(const struct pfcp_hdr *h, uint8_t *rsp, uint8_t *out,
+	       uint32_t *est)
+{
+	struct pfcp_ies ies;
+	uint8_t *p = rsp;
+	uint8_t cause;
+	uint32_t id = VNF_SESSION_INVALID;
+	int pos;
+
+	memset(&ies, 0, sizeof(ies));
+	ies.p.port_id = pfcp_port_id;
+	cause = pfcp_ies_parse(h->body, h->body + h->body_len, &ies, 0);
+	if (!cause &&
+	    (ies.present & (PFCP_HAVE_F_SEID | PFCP_HAVE_F_TEID |
+			    PFCP_HAVE_UE_IP)) !=
+	    (PFCP_HAVE_F_SEID | PFCP_HAVE_F_TEID | PFCP_HAVE_UE_IP))
+		cause = PFCP_CAUSE_IE_MISSING;
+	if (!cause) {
+		/*
+		 * UL TEID or UE IP taken, out of sessions or rules, a
+		 * rate, inactivity time or QFI the port can't apply.
+		 */
+		id = vnf_session_create(&ies.p);
+		if (id != VNF_SESSION_INVALID)
+			cause = PFCP_CAUSE_ACCEPTED;
+		else if (rte_errno == ENOTSUP)
+			cause = PFCP_CAUSE_NOT_SUPPORTED;
+		else
+			cause = PFCP_CAUSE_REJECTED;
+	}
+	if (id != VNF_SESSION_INVALID) {
+		pos = rte_hash_add_key(pfcp_handles, &id);
+		if (pos == -ENOSPC) {
+			pfcp_handles_sweep();
+			pos = rte_hash_add_key(pfcp_handles, &id);
+		}
+		if (pos < 0) {
+			vnf_session_delete(id);
+			id = VNF_SESSION_INVALID;
+			cause = PFCP_CAUSE_NO_RESOURCES;
+		} else {
+			pfcp_sessions[pos].cp_seid = ies.cp_seid;
+			pfcp_sessions[pos].urr_id = ies.urr_id;
+			stats.established++;
+		}
+	}
+	*out = cause;
+	*est = id;
+	return pfcp_establish_rsp(p, ies.cp_seid, h->seq, cause, id);
+}
+
+/*
+ * The rules of the session of an accepted establishment completed, the
+ * response turns into a rejection if one failed or the flush did.
+ */
+static void
+pfcp_establish_confirm(struct pfcp_req *r, int flushed)
+{
+	uint32_t id = r->id;
+	struct pfcp_hdr h;
+	uint64_t cp_seid;
+	int pos;
+
+	r->id = VNF_SESSION_INVALID;
+	/* The request was parsed by pfcp_handle(). */
+	if (id == VNF_SESSION_INVALID ||
+	    (flushed && vnf_session_confirm(id) != -EIO) ||
+	    pfcp_msg_parse(r->buf, r->len, &h))
+		return;
+	pos = rte_hash_lookup(pfcp_handles, &id);
+	cp_seid = pos >= 0 ? pfcp_sessions[pos].cp_seid : 0;
+	rte_hash_del_key(pfcp_handles, &id);
+	vnf_session_delete(id);
+	r->rsp_len = pfcp_msg_end(r->rsp,
+			pfcp_establish_rsp(r->rsp, cp_seid, h.seq,
+					   PFCP_CAUSE_REJECTED,
+					   VNF_SESSION_INVALID));
+	stats.established--;
+	stats.rejected++;
+}
+
+static uint8_t *
+pfcp_modify(const struct pfcp_hdr *h, uint8_t *rsp, uint8_t *out)
+{
+	uint32_t id = (uint32_t)h->seid;
+	uint64_t cp_seid = 0;
+	struct pfcp_ies ies;
+	uint8_t *p = rsp;
+	uint8_t cause;
+	int pos;
+
+	memset(&ies, 0, sizeof(ies));
+	pos = h->seid > UINT32_MAX ? -ENOENT :
+	      rte_hash_lookup(pfcp_handles, &id);
+	if (pos < 0 || vnf_session_params_get(id, &ies.p)) {
+		cause = PFCP_CAUSE_NO_SESSION;
+		goto out;
+	}
+	cp_seid = pfcp_sessions[pos].cp_seid;
+	ies.cp_seid = cp_seid;
+	ies.urr_id = pfcp_sessions[pos].urr_id;
+	cause = pfcp_ies_parse(h->body, h->body + h->body_len, &ies, 0);
+	if (cause)
+		goto out;
+	switch (vnf_session_modify(id, &ies.p)) {
+	case 0:
+		cause = PFCP_CAUSE_ACCEPTED;
+		pfcp_sessions[pos].cp_seid = ies.cp_seid;
+		pfcp_sessions[pos].urr_id = ies.urr_id;
+		stats.modified++;
+		break;
+	case -ENOENT:
+		cause = PFCP_CAUSE_NO_SESSION;
+		break;
+	case -ENOTSUP:
+		cause = PFCP_CAUSE_NOT_SUPPORTED;
+		break;
+	default:
+		cause = PFCP_CAUSE_REJECTED;
+		break;
+	}
+out:
+	*out = cause;
+	p = pfcp_msg_begin(p, PFCP_SESS_MOD_RSP, 1, cp_seid, h->seq);
+	return pfcp_ie_u8(p, PFCP_IE_CAUSE, cause);
+}
+
+static uint8_t *
+pfcp_usage_report(uint8_t *p, uint32_t urr_id,
+		  const struct vnf_session_stats *ss)
+{
+	uint8_t *report = p, *ie;
+
+	p = pfcp_ie_begin(p, PFCP_IE_USAGE_REPORT_DEL);
+	p = pfcp_ie_u32(p, PFCP_IE_URR_ID, urr_id);
+	ie = p;
+	p = pfcp_ie_begin(p, PFCP_IE_VOLUME_MEASUREMENT);
+	*p++ = 0x07; /* Total, uplink and downlink volumes. */
+	p = pfcp_put64(p, ss->ul_bytes + ss->dl_bytes);
+	p = pfcp_put64(p, ss->ul_bytes);
+	p = pfcp_put64(p, ss->dl_bytes);
+	p = pfcp_ie_end(ie, p);
+	return pfcp_ie_end(report, p);
+}
+
+static uint8_t *
+pfcp_delete(const struct pfcp_hdr *h, uint8_t *rsp, uint8_t *out)
+{
+	uint32_t id = (uint32_t)h->seid;
+	struct pfcp_session sess;
+	struct vnf_session_stats ss;
+	uint8_t *p = rsp;
+	int pos;
+
+	memset(&sess, 0, sizeof(sess));
+	pos = h->seid > UINT32_MAX ? -ENOENT :
+	      rte_hash_lookup(pfcp_handles, &id);
+	if (pos >= 0) {
+		sess = pfcp_sessions[pos];
+		rte_hash_del_key(pfcp_handles, &id);
+	}
+	if (pos < 0 || vnf_session_stats_get(id, &ss) ||
+	    vnf_session_delete(id)) {
+		*out = PFCP_CAUSE_NO_SESSION;
+		p = pfcp_msg_begin(p, PFCP_SESS_DEL_RSP, 1, sess.cp_seid,
+				   h->seq);
+		return pfcp_ie_u8(p, PFCP_IE_CAUSE, PFCP_CAUSE_NO_SESSION);
+	}
+	stats.deleted++;
+	*out = PFCP_CAUSE_ACCEPTED;
+	p = pfcp_msg_begin(p, PFCP_SESS_DEL_RSP, 1, sess.cp_seid, h->seq);
+	p = pfcp_ie_u8(p, PFCP_IE_CAUSE, PFCP_CAUSE_ACCEPTED);
+	if (sess.urr_id)
+		p = pfcp_usage_report(p, sess.urr_id, &ss);
+	return p;
+}
+
+/* Make the response of r, none for what isn't a request of the subset. */
+static void
+pfcp_handle(struct pfcp_req *r)
+{
+	uint8_t cause = PFCP_CAUSE_ACCEPTED;
+	struct pfcp_hdr h;
+	uint8_t *p = NULL;
+
+	r->rsp_len = 0;
+	r->id = VNF_SESSION_INVALID;
+	if (pfcp_msg_parse(r->buf, r->len, &h)) {
+		stats.dropped++;
+		return;
+	}
+	switch (h.type) {
+	case PFCP_HEARTBEAT_REQ:
+		p = pfcp_msg_begin(r->rsp, PFCP_HEARTBEAT_RSP, 0, 0, h.seq);
+		p = pfcp_ie_recovery(p);
+		stats.node++;
+		break;
+	case PFCP_ASSOC_SETUP_REQ:
+		p = pfcp_msg_begin(r->rsp, PFCP_ASSOC_SETUP_RSP, 0, 0, h.seq);
+		p = pfcp_ie_node(p, PFCP_IE_NODE_ID, 0, INADDR_LOOPBACK);
+		p = pfcp_ie_u8(p, PFCP_IE_CAUSE, PFCP_CAUSE_ACCEPTED);
+		p = pfcp_ie_recovery(p);
+		stats.node++;
+		break;
+	case PFCP_SESS_EST_REQ:
+		p = pfcp_establish(&h, r->rsp, &cause, &r->id);
+		break;
+	case PFCP_SESS_MOD_REQ:
+		if (h.has_seid)
+			p = pfcp_modify(&h, r->rsp, &cause);
+		break;
+	case PFCP_SESS_DEL_REQ:
+		if (h.has_seid)
+			p = pfcp_delete(&h, r->rsp, &cause);
+		break;
+	default:
+		break;
+	}
+	if (p == NULL) {
+		stats.dropped++;
+		return;
+	}
+	r->rsp_len = pfcp_msg_end(r->rsp, p);
+	if (cause != PFCP_CAUSE_ACCEPTED)
+		stats.rejected++;
+}
+
+static void
+pfcp_latency(uint64_t cycles)
+{
+	uint64_t us = cycles * US_PER_S / rte_get_timer_hz();
+	uint32_t b = 0;
+
+	while (us >> b && b < PFCP_LAT_BUCKETS - 1)
+		b++;
+	stats.hist[b]++;
+	stats.lat_cycles += cycles;
+	stats.lat_max = RTE_MAX(stats.lat_max, cycles);
+}
+
+/*
+ * Wait up to timeout_ms for requests and serve the ones of a window,
+ * return how many, -1 on a socket error.
+ */
+int
+vnf_pfcp_wait(uint32_t timeout_ms)
+{
+	struct pollfd pfd;
+	struct pfcp_req *r;
+	socklen_t alen;
+	uint64_t start, now;
+	ssize_t len;
+	int n = 0, i, flushed;
+
+	if (pfcp_fd < 0)
+		return 0;
+	pfd.fd = pfcp_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	i = poll(&pfd, 1, (int)timeout_ms);
+	if (i <= 0)
+		return i < 0 && errno != EINTR ? -1 : 0;
+	start = rte_get_timer_cycles();
+	while (n < PFCP_BATCH) {
+		r = &pfcp_reqs[n];
+		alen = sizeof(r->peer);
+		len = recvfrom(pfcp_fd, r->buf, sizeof(r->buf), MSG_DONTWAIT,
+			       (struct sockaddr *)&r->peer, &alen);
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR)
+				break;
+			if (rte_get_timer_cycles() - start >= pfcp_window)
+				break;
+			rte_pause();
+			continue;
+		}
+		r->rx = rte_get_timer_cycles();
+		r->len = (uint16_t)len;
+		n++;
+	}
+	if (!n)
+		return 0;
+	for (i = 0; i < n; i++)
+		pfcp_handle(&pfcp_reqs[i]);
+	/* The rules of the batch, pushed and completed at once. */
+	flushed = !vnf_async_flush(pfcp_port_id);
+	if (!flushed)
+		printf(":: pfcp: flush of %d requests failed on port %u\n", n,
+		       pfcp_port_id);
+	for (i = 0; i < n; i++) {
+		r = &pfcp_reqs[i];
+		pfcp_establish_confirm(r, flushed);
+		if (!r->rsp_len)
+			continue;
+		sendto(pfcp_fd, r->rsp, r->rsp_len, 0,
+		       (struct sockaddr *)&r->peer, sizeof(r->peer));
+		now = rte_get_timer_cycles();
+		pfcp_latency(now - r->rx);
+		stats.last = now;
+	}
+	if (!stats.first)
+		stats.first = pfcp_reqs[0].rx;
+	stats.requests += n;
+	stats.batches++;
+	return n;
+}
+
+/*
+ * Serve the sessions of port_id on the loopback udp_port, nb_sessions at
+ * most, the requests of window_us taken as one batch.
+ */
+int
+vnf_pfcp_init(uint16_t port_id, uint16_t udp_port, uint32_t window_us,
+	      uint32_t nb_sessions)
+{
+	struct rte_hash_parameters hash_params = {
+		.name = "vnf_pfcp_handles",
+		.entries = nb_sessions,
+		.key_len = sizeof(uint32_t),
+		.hash_func = rte_hash_crc,
+		.socket_id = (int)rte_socket_id(),
+	};
+	struct sockaddr_in addr;
+	int rcvbuf = PFCP_RCVBUF;
+
+	if (pfcp_fd >= 0)
+		return 0;
+	pfcp_handles = rte_hash_create(&hash_params);
+	pfcp_sessions = rte_zmalloc("vnf_pfcp_sessions",
+				    sizeof(*pfcp_sessions) * nb_sessions, 0);
+	if (pfcp_handles == NULL || pfcp_sessions == NULL) {
+		printf("Cannot allocate %u PFCP sessions\n", nb_sessions);
+		goto err;
+	}
+	pfcp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (pfcp_fd < 0) {
+		printf("Cannot open PFCP socket: %s\n", strerror(errno));
+		goto err;
+	}
+	setsockopt(pfcp_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(udp_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(pfcp_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		printf("Cannot bind PFCP socket to port %u: %s\n", udp_port,
+		       strerror(errno));
+		goto err;
+	}
+	pfcp_port_id = port_id;
+	pfcp_window = rte_get_timer_hz() * window_us / US_PER_S;
+	pfcp_recovery = (uint32_t)time(NULL) + PFCP_NTP_OFFSET;
+	memset(&stats, 0, sizeof(stats));
+	printf(":: PFCP on 127.0.0.1:%u, port %u, %uus window\n", udp_port,
+	       port_id, window_us);
+	return 0;
+err:
+	vnf_pfcp_close();
+	return -1;
+}
+
+/* The sessions stay, vnf_session_close() deletes them. */
+void
+vnf_pfcp_close(void)
+{
+	if (pfcp_fd >= 0)
+		close(pfcp_fd);
+	pfcp_fd = -1;
+	rte_hash_free(pfcp_handles);
+	rte_free(pfcp_sessions);
+	pfcp_handles = NULL;
+	pfcp_sessions = NULL;
+}
+
+/* Upper bound in microseconds of the latency of a fraction of requests. */
+static uint64_t
+pfcp_percentile(uint64_t total, double fraction)
+{
+	uint64_t sum = 0;
+	uint32_t b;
+
+	for (b = 0; b < PFCP_LAT_BUCKETS; b++) {
+		sum += stats.hist[b];
+		if (sum >= total * fraction)
+			break;
+	}
+	return UINT64_C(1) << b;
+}
+
+void
+vnf_pfcp_print(void)
+{
+	uint64_t hz = rte_get_timer_hz();
+	uint64_t total = 0;
+	uint32_t b;
+
+	if (pfcp_fd < 0 || !stats.requests)
+		return;
+	for (b = 0; b < PFCP_LAT_BUCKETS; b++)
+		total += stats.hist[b];
+	printf(":: pfcp: %" PRIu64 " requests in %" PRIu64
+	       " batches, %" PRIu64 " established, %" PRIu64 " modified, %"
+	       PRIu64 " deleted, %" PRIu64 " rejected, %" PRIu64 " dropped\n",
+	       stats.requests, stats.batches, stats.established,
+	       stats.modified, stats.deleted, stats.rejected, stats.dropped);
+	if (!total)
+		return;
+	printf(":: pfcp: latency avg %.0fus p50 <%" PRIu64 "us p99 <%" PRIu64
+	       "us max %.0fus, %.0f requests/s\n",
+	       (double)stats.lat_cycles * US_PER_S / hz / total,
+	       pfcp_percentile(total, 0.5), pfcp_percentile(total, 0.99),
+	       (double)stats.lat_max * US_PER_S / hz,
+	       (double)total * hz /
+	       (stats.last > stats.first ? stats.last - stats.first : 1));
+}
@@ -0,0 +1,327 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+#include <rte_net.h>
+#include <rte_ethdev.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_tcp.h>
+#include <rte_gtp.h>
+#include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
+#include <rte_mbuf_ptype.h>
+#include <rte_prefetch.h>
+#include <rte_vect.h>
+
+#include "vnf_examples.h"
+
+/*
+ * Burst header parser, run once per burst right after rte_eth_rx_burst.
+ * The offsets of every layer, the TEID and the QFI are saved in a mbuf
+ * dynamic field so the following stages (reassembly, decap, encap, session
+ * lookup) never parse the headers again.
+ * When the NIC reports GTP-U in the packet type, the outer layers are taken
+ * from it. Otherwise the outer eth / ipv4 / udp / gtp headers are checked
+ * with two 16 bytes vector compares and the TEID is byte swapped with a
+ * shuffle; anything else (VLAN, IP options, fragments) goes to the scalar
+ * parser.
+ */
+
+#define PARSE_PREFETCH_OFFSET 4
+#define GTP_PSC_EXT_TYPE 0x85
+#define GTP_VER_PT_MASK 0xf0
+#define GTP_V1_PT 0x30 /* Version 1, protocol type GTP. */
+#define GTP_E_S_PN_MASK 0x07 /* Any of them adds the optional word. */
+#define GTP_MSG_TYPE_GPDU 0xff
+
+/* Plain eth / ipv4 / udp / gtp, no VLAN and no IP option. */
+#define FAST_L3_OFF (sizeof(struct rte_ether_hdr))
+#define FAST_L4_OFF (FAST_L3_OFF + sizeof(struct rte_ipv4_hdr))
+#define FAST_TUN_OFF (FAST_L4_OFF + sizeof(struct rte_udp_hdr))
+#define FAST_INNER_OFF (FAST_TUN_OFF + sizeof(struct rte_gtp_hdr))
+
+int vnf_parse_meta_offset = -1;
+static uint32_t trusted_ptypes[RTE_MAX_ETHPORTS]; /* By Rx port. */
+
+static const struct rte_mbuf_dynfield parse_meta_desc = {
+	.name = "vnf_dynfield_parse_meta",
+	.size = sizeof(struct vnf_parse_meta),
+	.align = __alignof__(struct vnf_parse_meta),
+};
+
+int
+vnf_parse_init(uint16_t port_id)
+{
+	uint32_t ptypes[32];
+	int nb, i;
+
+	if (port_id >= RTE_MAX_ETHPORTS)
+		return -1;
+	if (vnf_parse_meta_offset < 0) {
+		vnf_parse_meta_offset =
+			rte_mbuf_dynfield_register(&parse_meta_desc);
+		if (vnf_parse_meta_offset < 0) {
+			printf("Cannot register parse meta dynfield: %s\n",
+			       rte_strerror(rte_errno));
+			return -1;
+		}
+	}
+	/* Only rely on the packet type if the port reports GTP-U. */
+	nb = rte_eth_dev_get_supported_ptypes(port_id, RTE_PTYPE_ALL_MASK,
+					      ptypes, RTE_DIM(ptypes));
+	trusted_ptypes[port_id] = 0;
+	for (i = 0; i < nb && i < (int)RTE_DIM(ptypes); i++)
+		if ((ptypes[i] & RTE_PTYPE_TUNNEL_MASK) == RTE_PTYPE_TUNNEL_GTPU)
+			trusted_ptypes[port_id] = RTE_PTYPE_L2_MASK |
+						  RTE_PTYPE_L3_MASK |
+						  RTE_PTYPE_L4_MASK |
+						  RTE_PTYPE_TUNNEL_MASK;
+	printf(":: port %u packet type %s used by the parser\n", port_id,
+	       trusted_ptypes[port_id] ? "is" : "isn't");
+	return 0;
+}
+
+/* Walk the GTP optional word and extension headers, the QFI is saved. */
+static int
+parse_gtp(struct rte_mbuf *m, struct vnf_parse_meta *meta, uint32_t off)
+{
+	const struct rte_gtp_hdr *gtp;
+	uint8_t next_ext, ext_len;
+
+	if (m->data_len < off + sizeof(*gtp))
+		return -1;
+	gtp = rte_pktmbuf_mtod_offset(m, const struct rte_gtp_hdr *, off);
+	if ((gtp->gtp_hdr_info & GTP_VER_PT_MASK) != GTP_V1_PT ||
+	    gtp->msg_type != GTP_MSG_TYPE_GPDU)
+		return -1;
+	meta->tun_off = off;
+	meta->teid = rte_be_to_cpu_32(gtp->teid);
+	meta->flags |= VNF_PARSE_F_GTPU;
+	off += sizeof(*gtp);
+	if (gtp->e || gtp->s || gtp->pn) {
+		off += sizeof(struct rte_gtp_hdr_ext_word);
+		if (m->data_len < off)
+			return -1;
+		next_ext = *rte_pktmbuf_mtod_offset(m, uint8_t *, off - 1);
+		while (gtp->e && next_ext) {
+			if (m->data_len < off + 1)
+				return -1;
+			/* Extension length is in 4 octets units. */
+			ext_len = *rte_pktmbuf_mtod_offset(m, uint8_t *, off);
+			if (!ext_len || m->data_len < off + ext_len * 4)
+				return -1;
+			if (next_ext == GTP_PSC_EXT_TYPE) {
+				/* QFI is the low 6 bits of the 3rd octet. */
+				meta->qfi = *rte_pktmbuf_mtod_offset(m,
+						uint8_t *, off + 2) & 0x3f;
+				meta->flags |= VNF_PARSE_F_GTP_PSC;
+			}
+			off += ext_len * 4;
+			next_ext = *rte_pktmbuf_mtod_offset(m, uint8_t *,
+							    off - 1);
+		}
+	}
+	meta->inner_l3_off = off;
+	return 0;
+}
+
+/* Inner ipv4 / udp or tcp after the tunnel. */
+static void
+parse_inner(struct rte_mbuf *m, struct vnf_parse_meta *meta)
+{
+	const struct rte_ipv4_hdr *ip;
+	uint32_t off = meta->inner_l3_off;
+
+	if (m->data_len < off + sizeof(*ip))
+		return;
+	ip = rte_pktmbuf_mtod_offset(m, const struct rte_ipv4_hdr *, off);
+	if ((ip->version_ihl >> 4) != 4 ||
+	    m->data_len < off + rte_ipv4_hdr_len(ip))
+		return;
+	meta->flags |= VNF_PARSE_F_INNER_IPV4;
+	meta->inner_l4_off = off + rte_ipv4_hdr_len(ip);
+	if (ip->next_proto_id == IPPROTO_UDP)
+		meta->flags |= VNF_PARSE_F_INNER_UDP;
+	else if (ip->next_proto_id == IPPROTO_TCP)
+		meta->flags |= VNF_PARSE_F_INNER_TCP;
+}
+
+static void
+parse_scalar(struct rte_mbuf *m, struct vnf_parse_meta *meta)
+{
+	const struct rte_ether_hdr *eth;
+	const struct rte_vlan_hdr *vlan;
+	const struct rte_ipv4_hdr *ip;
+	const struct rte_udp_hdr *udp;
+	uint32_t off = sizeof(*eth);
+	uint16_t ether_type;
+
+	if (m->data_len < off)
+		return;
+	eth = rte_pktmbuf_mtod(m, const struct rte_ether_hdr *);
+	ether_type = eth->ether_type;
+	if (ether_type == RTE_BE16(RTE_ETHER_TYPE_VLAN)) {
+		if (m->data_len < off + sizeof(*vlan))
+			return;
+		vlan = rte_pktmbuf_mtod_offset(m, const struct rte_vlan_hdr *,
+					       off);
+		ether_type = vlan->eth_proto;
+		off += sizeof(*vlan);
+	}
+	if (ether_type != RTE_BE16(RTE_ETHER_TYPE_IPV4) ||
+	    m->data_len < off + sizeof(*ip))
+		return;
+	ip = rte_pktmbuf_mtod_offset(m, const struct rte_ipv4_hdr *, off);
+	meta->l3_off = off;
+	meta->flags |= VNF_PARSE_F_IPV4;
+	if (rte_ipv4_frag_pkt_is_fragmented(ip)) {
+		/* Only the reassembly stage cares about fragments. */
+		meta->flags |= VNF_PARSE_F_IP_FRAG;
+		return;
+	}
+	off += rte_ipv4_hdr_len(ip);
+	meta->l4_off = off;
+	if (ip->next_proto_id == IPPROTO_TCP) {
+		meta->flags |= VNF_PARSE_F_TCP;
+		return;
+	}
+	if (ip->next_proto_id != IPPROTO_UDP ||
+	    m->data_len < off + sizeof(*udp))
+		return;
+	meta->flags |= VNF_PARSE_F_UDP;
+	udp = rte_pktmbuf_mtod_offset(m, const struct rte_udp_hdr *, off);
+	if (udp->dst_port != RTE_BE16(GTP_U_UDP_PORT))
+		return;
+	if (parse_gtp(m, meta, off + sizeof(*udp)) == 0)
+		parse_inner(m, meta);
+}
+
+/* Outer layers from the packet type, the tunnel is still read. */
+static int
+parse_ptype(struct rte_mbuf *m, struct vnf_parse_meta *meta)
+{
+	uint32_t ptype = m->packet_type & trusted_ptypes[m->port];
+
+	if ((ptype & RTE_PTYPE_L2_MASK) != RTE_PTYPE_L2_ETHER ||
+	    (ptype & RTE_PTYPE_L3_MASK) != RTE_PTYPE_L3_IPV4)
+		return -1;
+	meta->l3_off = FAST_L3_OFF;
+	meta->l4_off = FAST_L4_OFF;
+	meta->flags |= VNF_PARSE_F_IPV4;
+	switch (ptype & RTE_PTYPE_L4_MASK) {
+	case RTE_PTYPE_L4_FRAG:
+		meta->flags |= VNF_PARSE_F_IP_FRAG;
+		return 0;
+	case RTE_PTYPE_L4_TCP:
+		meta->flags |= VNF_PARSE_F_TCP;
+		return 0;
+	case RTE_PTYPE_L4_UDP:
+		meta->flags |= VNF_PARSE_F_UDP;
+		break;
+	default:
+		return 0;
+	}
+	if ((ptype & RTE_PTYPE_TUNNEL_MASK) == RTE_PTYPE_TUNNEL_GTPU &&
+	    parse_gtp(m, meta, FAST_TUN_OFF) == 0)
+		parse_inner(m, meta);
+	return 0;
+}
+
+#if defined(RTE_ARCH_X86) && defined(__SSSE3__)
+/*
+ * Check eth type, IPv4 version/IHL, fragment bits and protocol in one
+ * compare on bytes [12, 28), then UDP port, GTP flags and message type on
+ * bytes [34, 50). The TEID is byte swapped by the shuffle.
+ */
+static int
+parse_vector(struct rte_mbuf *m, struct vnf_parse_meta *meta)
+{
+	const __m128i l3_mask = _mm_setr_epi8(
+		-1, -1, /* ether type */
+		-1, 0, 0, 0, 0, 0, /* version/IHL, tos, length, id */
+		0x3f, -1, 0, -1, /* MF and fragment offset, ttl, proto */
+		0, 0, 0, 0);
+	const __m128i l3_val = _mm_setr_epi8(
+		0x08, 0x00,
+		0x45, 0, 0, 0, 0, 0,
+		0, 0, 0, IPPROTO_UDP,
+		0, 0, 0, 0);
+	const __m128i l4_mask = _mm_setr_epi8(
+		0, 0, -1, -1, 0, 0, 0, 0, /* UDP dst port */
+		(char)GTP_VER_PT_MASK, -1, 0, 0, 0, 0, 0, 0);
+	const __m128i l4_val = _mm_setr_epi8(
+		0, 0, (char)(GTP_U_UDP_PORT >> 8), (char)(GTP_U_UDP_PORT & 0xff),
+		0, 0, 0, 0,
+		GTP_V1_PT, (char)GTP_MSG_TYPE_GPDU, 0, 0, 0, 0, 0, 0);
+	const __m128i teid_swap = _mm_setr_epi8(
+		15, 14, 13, 12, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1);
+	const uint8_t *p = rte_pktmbuf_mtod(m, const uint8_t *);
+	__m128i l3, l4;
+
+	if (m->data_len < FAST_INNER_OFF)
+		return -1;
+	l3 = _mm_loadu_si128((const __m128i *)(p + 12));
+	l3 = _mm_cmpeq_epi8(_mm_and_si128(l3, l3_mask), l3_val);
+	if (_mm_movemask_epi8(l3) != 0xffff)
+		return -1;
+	meta->l3_off = FAST_L3_OFF;
+	meta->l4_off = FAST_L4_OFF;
+	meta->flags |= VNF_PARSE_F_IPV4 | VNF_PARSE_F_UDP;
+	l4 = _mm_loadu_si128((const __m128i *)(p + FAST_L4_OFF));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l4, l4_mask),
+					     l4_val)) != 0xffff)
+		return 0; /* UDP but not GTP-U. */
+	if (p[FAST_TUN_OFF] & GTP_E_S_PN_MASK) {
+		/* Extension headers, let the scalar code walk them. */
+		if (parse_gtp(m, meta, FAST_TUN_OFF) == 0)
+			parse_inner(m, meta);
+		return 0;
+	}
+	meta->tun_off = FAST_TUN_OFF;
+	meta->teid = (uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi8(l4,
+							teid_swap));
+	meta->flags |= VNF_PARSE_F_GTPU;
+	meta->inner_l3_off = FAST_INNER_OFF;
+	parse_inner(m, meta);
+	return 0;
+}
+#else
+static int
+parse_vector(struct rte_mbuf *m, struct vnf_parse_meta *meta)
+{
+	RTE_SET_USED(m);
+	RTE_SET_USED(meta);
+	return -1;
+}
+#endif
+
+void
+vnf_parse_pkt(struct rte_mbuf *m)
+{
+	struct vnf_parse_meta *meta = VNF_PARSE_META(m);
+
+	memset(meta, 0, sizeof(*meta));
+	if (trusted_ptypes[m->port] && parse_ptype(m, meta) == 0)
+		return;
+	if (parse_vector(m, meta) == 0)
+		return;
+	parse_scalar(m, meta);
+}
+
+void
+vnf_parse_burst(struct rte_mbuf **pkts, uint16_t nb_pkts)
+{
+	uint16_t i;
+
+	for (i = 0; i < nb_pkts && i < PARSE_PREFETCH_OFFSET; i++)
+		rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+	for (i = 0; i < nb_pkts; i++) {
+		if (i + PARSE_PREFETCH_OFFSET < nb_pkts)
+			rte_prefetch0(rte_pktmbuf_mtod(
+				pkts[i + PARSE_PREFETCH_OFFSET], void *));
+		vnf_parse_pkt(pkts[i]);
+	}
+}
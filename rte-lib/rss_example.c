@@ -8,69 +8,6 @@
 
 #include "vnf_examples.h"
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
- */
-struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
 /* Create RSS on inner source IP. */
 struct rte_flow *
 create_gtp_u_inner_ip_rss_flow(uint16_t port, uint32_t nb_queues,
@@ -78,12 +15,12 @@ create_gtp_u_inner_ip_rss_flow(uint16_t port, uint32_t nb_queues,
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
-				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
-				.priority = 1, }; /* add priority to rule
-				to give the Decap rule higher priority since
-				it is more specific */
+				.priority = VNF_FLOW_PRIO_AUTO, }; /* placed
+				after the decap rule since it is less
+				specific */
 	struct rte_flow_item_gtp gtp_spec = {
 			.msg_type = 255 }; /* The expected value. */
 	struct rte_flow_item_gtp gtp_mask = {
@@ -111,15 +48,17 @@ create_gtp_u_inner_ip_rss_flow(uint16_t port, uint32_t nb_queues,
 	 * make sure that all of the packets from a given user (inner source
 	 * ip) will be routed to the same core.
 	 */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_GTP;
-	pattern[TUNNEL].spec = &gtp_spec;
-	pattern[TUNNEL].mask = &gtp_mask;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	vnf_flow_item_udp(&fb, NULL, NULL);
+	vnf_flow_item_gtp(&fb, &gtp_spec, &gtp_mask);
 
 	/* Create the flow. */
-	flow = rte_flow_create(port, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_table_flow_create(port, "classify", &attr, fb.items,
+					     actions, VNF_FLOW_OWNER_RSS, 0, &error);
 	if (!flow)
 		printf("Can't create the RSS flow on inner ip. %s\n",
 		       error.message);
@@ -128,18 +67,26 @@ create_gtp_u_inner_ip_rss_flow(uint16_t port, uint32_t nb_queues,
 
 }
 
+/* testpmd action_id of the shared RSS. */
+#define SHARED_RSS_ACTION_ID 100
+
+/*
+ * Same RSS for all the GTP-U rules, held once by the PMD. The first call
+ * creates the indirect action, the next ones only refer to it.
+ */
 struct rte_flow *
 create_gtp_u_inner_ip_shared_rss_flow(uint16_t port, uint32_t nb_queues,
 				      uint16_t *queues)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
+	struct rte_flow_action_handle *handle;
 	struct rte_flow_attr attr = { /* Holds the flow attributes. */
-				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* Rx flow. */
-				.priority = 1, }; /* add priority to rule
-				to give the Decap rule higher priority since
-				it is more specific */
+				.priority = VNF_FLOW_PRIO_AUTO, }; /* placed
+				after the decap rule since it is less
+				specific */
 	struct rte_flow_item_gtp gtp_spec = {
 			.msg_type = 255 }; /* The expected value. */
 	struct rte_flow_item_gtp gtp_mask = {
@@ -150,6 +97,10 @@ create_gtp_u_inner_ip_shared_rss_flow(uint16_t port, uint32_t nb_queues,
 			.queue = queues, /* Set the selected target queues. */
 			.queue_num = nb_queues, /* The number of queues. */
 			.types =  RTE_ETH_RSS_IP };
+	struct rte_flow_action rss_action = {
+			.type = RTE_FLOW_ACTION_TYPE_RSS,
+			.conf = &rss };
+	struct rte_flow_indir_action_conf indir_conf = { .ingress = 1 };
 	
 	/* Configure matching on outer ipv4 and GTP-U.
 	 * This case we don't care about specific outer ipv4 or UDP we just 
@@ -160,35 +111,50 @@ create_gtp_u_inner_ip_shared_rss_flow(uint16_t port, uint32_t nb_queues,
 	 * ip) will be routed to the same core.
 	 *
 	 * The corresponding testpmd commands:
-	 * testpmd> flow shared_action 0 create action_id 100
+	 * testpmd> flow indirect_action 0 create action_id 100 ingress
 	 *          action rss level 2 types ip end / end
-	 * testpmd> flow create 0 ingress pattern eth / ipv4 / udp /
+	 * testpmd> flow create 0 group 1 ingress pattern eth / ipv4 / udp /
 	 *          gtp msg_type is 255 / ipv4 / tcp / end
-	 *          actions shared 100 / end
+	 *          actions indirect 100 / end
 	 */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_GTP;
-	pattern[TUNNEL].spec = &gtp_spec;
-	pattern[TUNNEL].mask = &gtp_mask;
-	pattern[L3_INNER].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L4_INNER].type = RTE_FLOW_ITEM_TYPE_TCP;
-
-	struct rte_flow_action actions[] = {
-			[0] = { /* The shared RSS action to be used. */
-				.type = RTE_FLOW_ACTION_TYPE_RSS,
-				.conf = &rss },
-			[1] = { /* End action mast be the last action. */
-				.type = RTE_FLOW_ACTION_TYPE_END,
-				.conf = NULL }
-		};
+	handle = vnf_flow_handle_get(port, SHARED_RSS_ACTION_ID);
+	if (handle == NULL)
+		handle = vnf_flow_handle_create(port, SHARED_RSS_ACTION_ID,
+						&indir_conf, &rss_action);
+	if (handle == NULL)
+		return NULL;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	vnf_flow_item_udp(&fb, NULL, NULL);
+	vnf_flow_item_gtp(&fb, &gtp_spec, &gtp_mask);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	vnf_flow_item_tcp(&fb, NULL, NULL);
+	/* The shared RSS action to be used. */
+	vnf_flow_action_indirect(&fb, handle);
 
 	/* Create the flow. */
-	flow = rte_flow_create(port, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_table_flow_create(port, "classify", &attr, fb.items,
+					     fb.actions, VNF_FLOW_OWNER_RSS, 0, &error);
 	if (!flow)
 		printf("Can't create the RSS flow on inner ip. %s\n",
 		       error.message);
 	
 	return flow;
 }
+
+/*
+ * Spread the rules of the shared RSS over other queues, none of them is
+ * touched.
+ * testpmd> flow indirect_action 0 update 100 action rss queues <queues>
+ *          end / end
+ */
+int
+update_gtp_u_inner_ip_shared_rss(uint16_t port, uint32_t nb_queues,
+				 uint16_t *queues)
+{
+	return vnf_flow_handle_rss_update(port, SHARED_RSS_ACTION_ID, queues,
+					  nb_queues);
+}
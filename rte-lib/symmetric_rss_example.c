@@ -8,90 +8,46 @@
 
 #include "vnf_examples.h"
 
-/* Layer names, to be used inorder to access the relevent item. */
-enum layer_name {
-	L2,
-	L3,
-	L4,
-	TUNNEL,
-	L2_INNER,
-	L3_INNER,
-	L4_INNER,
-	END
-};
-
-/* The pattern list, this list is used inorder to save reallocation of each
- * for each call, RTE_FLOW_TYPE_VOID marks that his item should be ignored
- * and dosn't affect the the matching. Using the void action type allows this
- * list to be shared between number of different flows.
- * RTE_FLOW_TYPE_END marks the last item in the list and must appear.
- * spec = NULL, will result that all traffic that includes header from the
- * selected type will be hit.
- */
-static struct rte_flow_item pattern[] = {
-	[L2] = { /* ETH type is set since we always start from ETH. */
-		.type = RTE_FLOW_ITEM_TYPE_ETH,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[TUNNEL] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L2_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L3_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[L4_INNER] = {
-		.type = RTE_FLOW_ITEM_TYPE_VOID,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-	[END] = {
-		.type = RTE_FLOW_ITEM_TYPE_END,
-		.spec = NULL,
-		.mask = NULL,
-		.last = NULL },
-};
-
 /* create two flows by using symmetric rss key.
  * The corresponding testpmd commands:
  * testpmd> flow create 0 group 0 ingress pattern eth / ipv4 / udp /
  *          gtp msg_type is 255 / ipv4 src is 2.0.0.1 / tcp / end
- *          actions mark id 0x2001 /
+ *          actions mark id <mark> /
  *          rss level 2
  *          key 6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a
  *          key_len 40 types ip l3-src-only end / end
  * testpmd> flow create 0 group 0 ingress pattern eth / ipv4 dst is 2.0.0.1 /
- *          tcp / end actions mark id 0x2001 /
+ *          tcp / end actions mark id <mark> /
  *          rss level 1
  *          key 6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a6d5a
  *          key_len 40 types ip l3-dst-only end / end
  */
 
+/* UE session shared by the Uplink and Downlink flows. */
+struct ue_session {
+	uint32_t ue_ip; /* UE's IP, CPU order. */
+	uint32_t mark; /* Mark set by both flows. */
+	uint64_t pkts; /* Packets seen by the software. */
+};
+
+static struct ue_session ue_session = { .ue_ip = 0x02000001 };
+
+static void
+ue_session_mark_handler(struct rte_mbuf *m, void *ctx)
+{
+	struct ue_session *session = ctx;
+
+	RTE_SET_USED(m);
+	__atomic_fetch_add(&session->pkts, 1, __ATOMIC_RELAXED);
+}
+
 int
 create_symmetric_rss_flow(uint16_t port_id, uint32_t nb_queues,
 		uint16_t *queues)
 {
 	struct rte_flow *flow;
 	struct rte_flow_error error;
+	struct vnf_flow_builder fb;
 	struct rte_flow_attr attr = { /* holds the flow attributes. */
 				.group = 0, /* set the rule on the main group. */
 				.ingress = 1,/* rx flow. */
@@ -115,7 +71,7 @@ create_symmetric_rss_flow(uint16_t port_id, uint32_t nb_queues,
 		0x6D, 0x5A, 0x6D, 0x5A,
 		0x6D, 0x5A, 0x6D, 0x5A,
 	};
-	struct rte_flow_action_mark mark = {.id = 0x2001};
+	struct rte_flow_action_mark mark = {.id = INVALID_FLOW_MARK};
 	struct rte_flow_action_rss rss = {
 			.level = 1, /* rss should be done on inner header. */
 			.queue = queues, /* set the selected target queues. */
@@ -147,13 +103,24 @@ create_symmetric_rss_flow(uint16_t port_id, uint32_t nb_queues,
 	/* configure matching on inner ipv4 src field which is UE's IP.
 	 * RSS on inner IP src and dst with symmetric key.
 	 */
-	pattern[L2].type = RTE_FLOW_ITEM_TYPE_ETH;
-	pattern[L3].type = RTE_FLOW_ITEM_TYPE_IPV4;
-	pattern[L4].type = RTE_FLOW_ITEM_TYPE_UDP;
-	pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_END;
+	vnf_flow_builder_init(&fb);
+	vnf_flow_item_eth(&fb, NULL, NULL);
+	vnf_flow_item_ipv4(&fb, NULL, NULL);
+	vnf_flow_item_udp(&fb, NULL, NULL);
+
+	/* Both directions of the session carry the same mark. */
+	if (ue_session.mark == INVALID_FLOW_MARK)
+		ue_session.mark = vnf_mark_alloc(ue_session_mark_handler,
+						 &ue_session);
+	if (ue_session.mark == INVALID_FLOW_MARK)
+		return -1;
+	mark.id = ue_session.mark;
 
 	/* create the Uplink flow match on UE's IP. */
-	flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+	flow = NULL;
+	if (!vnf_flow_builder_check(&fb, &error))
+		flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+				       VNF_FLOW_OWNER_RSS, 0, &error);
 	if (!flow) {
 		printf("can't create UL symmetric RSS flow on ip. %s\n",
 		       error.message);
@@ -163,17 +130,14 @@ create_symmetric_rss_flow(uint16_t port_id, uint32_t nb_queues,
 	// ipv4_inner.hdr.dst_addr = rte_cpu_to_be_32(0x02000001);
 	// memset(&ipv4_mask.hdr, 0, sizeof(ipv4_mask.hdr));
 	// ipv4_mask.hdr.dst_addr = RTE_BE32(0xFFFFFFFF);
-	// pattern[L3].spec = &ipv4_inner;
-	// pattern[L3].mask = &ipv4_mask;
-	// pattern[L4].type = RTE_FLOW_ITEM_TYPE_TCP;
-	// pattern[L4].spec = NULL;
-	// pattern[TUNNEL].type = RTE_FLOW_ITEM_TYPE_VOID;
-	// pattern[L3_INNER].type = RTE_FLOW_ITEM_TYPE_VOID;
-	// pattern[L4_INNER].type = RTE_FLOW_ITEM_TYPE_VOID;
-	// pattern[END].type = RTE_FLOW_ITEM_TYPE_END;
+	// vnf_flow_builder_init(&fb);
+	// vnf_flow_item_eth(&fb, NULL, NULL);
+	// vnf_flow_item_ipv4(&fb, &ipv4_inner, &ipv4_mask);
+	// vnf_flow_item_tcp(&fb, NULL, NULL);
 	// rss.level = 1;
 	// /* create the Downlink flow match on UE's IP. */
-	// flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+	// flow = vnf_flow_create(port_id, &attr, fb.items, actions,
+	//                        VNF_FLOW_OWNER_RSS, 0, &error);
 	// if (!flow) {
 	// 	printf("can't create DL symmetric RSS flow on inner ip. %s\n",
 	// 	       error.message);
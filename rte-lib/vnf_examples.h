@@ -7,13 +7,22 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <rte_flow.h>
+
+struct rte_mbuf;
+struct rte_mempool;
+
 #define MISS_TABLE_ID    (UINT32_MAX - 1)
 #define MAX_FLOW_PRIORITY 10
 #define MIN_FLOW_PRIORITY 1
 #define INVALID_FLOW_MARK 0
 #define HAIRPIN_FLOW_MARK 1
+/* First mark handed out by the mark table, lower ones are reserved. */
+#define VNF_MARK_FIRST 2
+#define VNF_MARK_TABLE_SIZE (1 << 16)
 
 #define NETDEV_DPDK_METER_PORT_ID 0
 #define NETDEV_DPDK_METER_POLICY_ID 25
@@ -21,11 +30,992 @@ extern "C" {
 
 #define FIRST_TABLE 1
 
+/* Domains of the rules of a table. */
+#define VNF_TABLE_F_INGRESS (1 << 0)
+#define VNF_TABLE_F_EGRESS (1 << 1)
+#define VNF_TABLE_F_TRANSFER (1 << 2)
+#define VNF_TABLE_F_ENTRY (1 << 3) /* Jumped to from the root table. */
+
+#define VNF_TABLE_INVALID UINT32_MAX
+
+struct vnf_table_decl {
+	const char *name;
+	const char *purpose;
+	const char *miss; /* Table of the misses, NULL for the PMD default. */
+	const enum rte_flow_item_type *shape; /* END ended, NULL for any. */
+	uint32_t size; /* Rules expected. */
+	uint32_t flags; /* VNF_TABLE_F_* */
+};
+
+#define GTP_U_UDP_PORT 2152
+/* eth / ipv4 / udp / gtp / extension word / gtp_psc. */
+#define GTP_U_ENCAP_HDR_MAX_LEN 64
+/* Max number of fragments an oversize encapsulated packet is split to. */
+#define GTP_FRAG_MAX_FRAGS 8
+
 //#define ISOLATE_ISOLATE_MODE_DEF    0
 
+/*
+ * Headers found by the burst parser, saved in a mbuf dynamic field. The
+ * offsets are within the first segment, GTP extension headers and IP
+ * options may put them past 255.
+ */
+struct vnf_parse_meta {
+	uint32_t teid; /* GTP-U TEID, CPU order. */
+	uint16_t flags; /* VNF_PARSE_F_*. */
+	uint16_t l2_off;
+	uint16_t l3_off;
+	uint16_t l4_off;
+	uint16_t tun_off; /* GTP-U header. */
+	uint16_t inner_l3_off;
+	uint16_t inner_l4_off;
+	uint8_t qfi; /* Valid with VNF_PARSE_F_GTP_PSC. */
+};
+
+#define VNF_PARSE_F_IPV4 (1 << 0)
+#define VNF_PARSE_F_IP_FRAG (1 << 1)
+#define VNF_PARSE_F_UDP (1 << 2)
+#define VNF_PARSE_F_TCP (1 << 3)
+#define VNF_PARSE_F_GTPU (1 << 4)
+#define VNF_PARSE_F_GTP_PSC (1 << 5)
+#define VNF_PARSE_F_INNER_IPV4 (1 << 6)
+#define VNF_PARSE_F_INNER_UDP (1 << 7)
+#define VNF_PARSE_F_INNER_TCP (1 << 8)
+
+extern int vnf_parse_meta_offset;
+#define VNF_PARSE_META(m) \
+	((struct vnf_parse_meta *)((char *)(m) + vnf_parse_meta_offset))
+
+int
+vnf_parse_init(uint16_t port_id);
+
+void
+vnf_parse_pkt(struct rte_mbuf *m);
+
+void
+vnf_parse_burst(struct rte_mbuf **pkts, uint16_t nb_pkts);
+
+/* Called by the worker for each packet carrying an allocated mark. */
+typedef void (*vnf_mark_handler_t)(struct rte_mbuf *m, void *ctx);
+
+/* Called with the ctx of a freed mark once no worker uses it. */
+typedef void (*vnf_mark_release_t)(void *ctx);
+
+int
+vnf_mark_table_init(uint32_t nb_marks);
+
+uint32_t
+vnf_mark_alloc(vnf_mark_handler_t handler, void *ctx);
+
+void
+vnf_mark_free(uint32_t mark, vnf_mark_release_t release);
+
+void
+vnf_mark_poll(void);
+
+void
+vnf_mark_flush(void);
+
+void
+vnf_mark_lcore_online(void);
+
+void
+vnf_mark_lcore_quiescent(void);
+
+void
+vnf_mark_lcore_offline(void);
+
+int
+vnf_mark_dispatch(struct rte_mbuf *m);
+
+uint16_t
+vnf_mark_dispatch_burst(struct rte_mbuf **pkts, uint16_t nb_pkts,
+			struct rte_mbuf **unmarked);
+
+/* Action resolved for a received packet, one node per action. */
+enum vnf_next {
+	VNF_NEXT_SLOW, /* Software classification. */
+	VNF_NEXT_SESSION, /* Offloaded rule, resolved by its mark. */
+	VNF_NEXT_DECAP, /* GTP-U which missed the decap flow. */
+	VNF_NEXT_ENCAP, /* Matches an egress encap flow. */
+	VNF_NEXT_HAIRPIN, /* Hairpin mark, the port has no hairpin queue. */
+	VNF_NEXT_MIRROR, /* Session copied to the mirror port. */
+	VNF_NEXT_DROP, /* Bad checksum. */
+	VNF_NEXT_MAX,
+};
+
+#define VNF_DISPATCH_BURST_MAX 32
+
+/*
+ * Process a sub-burst of packets sharing the same action. The packets to
+ * send are put in tx, at most GTP_FRAG_MAX_FRAGS per input packet, and
+ * their number is returned. Tx port is taken from mbuf port field.
+ */
+typedef uint16_t (*vnf_node_fn)(struct rte_mbuf **pkts, uint16_t nb_pkts,
+				struct rte_mbuf **tx, uint16_t queue,
+				void *ctx);
+
+int
+vnf_dispatch_init(uint16_t mtu);
+
+enum vnf_next
+vnf_dispatch_classify(struct rte_mbuf *m);
+
+void
+vnf_dispatch_set_node(enum vnf_next next, vnf_node_fn fn, void *ctx);
+
+void
+vnf_dispatch_set_mirror(uint16_t port_id, struct rte_mempool *pool);
+
+uint16_t
+vnf_dispatch_burst(uint16_t queue, struct rte_mbuf **pkts, uint16_t nb_pkts);
+
+uint16_t
+vnf_dispatch_per_pkt(uint16_t queue, struct rte_mbuf **pkts,
+		     uint16_t nb_pkts);
+
+uint16_t
+vnf_dispatch_ab(uint16_t queue, struct rte_mbuf **pkts, uint16_t nb_pkts);
+
+void
+vnf_dispatch_stats_print(void);
+
+#define VNF_GRAPH_MAX_RX_QUEUES 16
+
+/* What the graph of one worker lcore works on. */
+struct vnf_graph_conf {
+	uint16_t port_id; /* Rx port. */
+	uint16_t rx_queues[VNF_GRAPH_MAX_RX_QUEUES];
+	uint16_t nb_rx_queues;
+	uint16_t tx_queue; /* Owned by this lcore, on every port. */
+	uint16_t mtu; /* Egress MTU, for the GTP-U encap fragmentation. */
+	uint16_t mirror_port; /* RTE_MAX_ETHPORTS to disable the mirror. */
+	struct rte_mempool *pool; /* Mirror copies. */
+};
+
+int
+vnf_graph_create(unsigned int lcore_id, const struct vnf_graph_conf *conf);
+
+void
+vnf_graph_walk(void);
+
+void
+vnf_graph_stats_print(void);
+
+void
+vnf_graph_destroy(void);
+
+/* Software meters of the vnf_meter node, by mark. */
+int
+vnf_graph_meter_init(void);
+
+int
+vnf_graph_meter_set(uint32_t mark, uint64_t rate, uint64_t burst);
+
+#define VNF_FLOW_MAX_ITEMS 16
+#define VNF_FLOW_MAX_ACTIONS 16
+#define VNF_FLOW_BUILDER_DATA 2048
+
+/*
+ * Pattern and actions of one rule with the storage of their spec, mask and
+ * conf. Nothing points outside of it, so each thread can build rules in
+ * its own builder, on the stack or from vnf_flow_builder_get(), without
+ * any allocation or lock.
+ */
+struct vnf_flow_builder {
+	struct rte_flow_item items[VNF_FLOW_MAX_ITEMS];
+	struct rte_flow_action actions[VNF_FLOW_MAX_ACTIONS];
+	uint16_t nb_items;
+	uint16_t nb_actions;
+	uint16_t data_len;
+	int error; /* ENOSPC once a helper ran out of room. */
+	uint64_t data[VNF_FLOW_BUILDER_DATA / sizeof(uint64_t)];
+};
+
+void
+vnf_flow_builder_init(struct vnf_flow_builder *fb);
+
+struct vnf_flow_builder *
+vnf_flow_builder_get(void);
+
+void *
+vnf_flow_builder_data(struct vnf_flow_builder *fb, const void *src,
+		      size_t size);
+
+int
+vnf_flow_item(struct vnf_flow_builder *fb, enum rte_flow_item_type type,
+	      const void *spec, const void *mask, size_t size);
+
+/* A NULL spec matches any header of the type. */
+int
+vnf_flow_item_eth(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_eth *spec,
+		  const struct rte_flow_item_eth *mask);
+
+int
+vnf_flow_item_ipv4(struct vnf_flow_builder *fb,
+		   const struct rte_flow_item_ipv4 *spec,
+		   const struct rte_flow_item_ipv4 *mask);
+
+int
+vnf_flow_item_ipv4_unfragmented(struct vnf_flow_builder *fb);
+
+int
+vnf_flow_item_udp(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_udp *spec,
+		  const struct rte_flow_item_udp *mask);
+
+int
+vnf_flow_item_tcp(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_tcp *spec,
+		  const struct rte_flow_item_tcp *mask);
+
+int
+vnf_flow_item_gtp(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_gtp *spec,
+		  const struct rte_flow_item_gtp *mask);
+
+int
+vnf_flow_item_gtp_psc(struct vnf_flow_builder *fb,
+		      const struct rte_flow_item_gtp_psc *spec,
+		      const struct rte_flow_item_gtp_psc *mask);
+
+int
+vnf_flow_item_gre(struct vnf_flow_builder *fb,
+		  const struct rte_flow_item_gre *spec,
+		  const struct rte_flow_item_gre *mask);
+
+int
+vnf_flow_item_tag(struct vnf_flow_builder *fb, uint8_t index, uint32_t data,
+		  uint32_t data_mask);
+
+int
+vnf_flow_item_mark(struct vnf_flow_builder *fb, uint32_t id);
+
+int
+vnf_flow_action(struct vnf_flow_builder *fb, enum rte_flow_action_type type,
+		const void *conf, size_t size);
+
+int
+vnf_flow_action_mark(struct vnf_flow_builder *fb, uint32_t id);
+
+int
+vnf_flow_action_tag(struct vnf_flow_builder *fb, uint8_t index,
+		    uint32_t data, uint32_t mask);
+
+int
+vnf_flow_action_jump(struct vnf_flow_builder *fb, uint32_t group);
+
+int
+vnf_flow_action_queue(struct vnf_flow_builder *fb, uint16_t index);
+
+int
+vnf_flow_action_rss(struct vnf_flow_builder *fb,
+		    const struct rte_flow_action_rss *rss);
+
+int
+vnf_flow_action_raw_decap(struct vnf_flow_builder *fb, const uint8_t *data,
+			  size_t size);
+
+int
+vnf_flow_action_raw_encap(struct vnf_flow_builder *fb, const uint8_t *data,
+			  size_t size);
+
+int
+vnf_flow_action_indirect(struct vnf_flow_builder *fb,
+			 const struct rte_flow_action_handle *handle);
+
+/* Rules of a file in the testpmd flow syntax. */
+int
+vnf_flow_program_load(const char *path);
+
+int
+vnf_flow_program_reconcile(const char *path);
+
+/* An install job, the rules of a table on a port, 0 on success. */
+typedef int (*vnf_install_job_t)(uint16_t port_id, void *arg);
+
+int
+vnf_install_add(const char *name, uint16_t port_id, vnf_install_job_t fn,
+		void *arg);
+
+int
+vnf_install_run(void);
+
+/* Fails if fb ran out of room, to check before creating from fb.items. */
+int
+vnf_flow_builder_check(const struct vnf_flow_builder *fb,
+		       struct rte_flow_error *error);
+
+int
+vnf_flow_builder_validate(uint16_t port, const struct rte_flow_attr *attr,
+			  const struct vnf_flow_builder *fb,
+			  struct rte_flow_error *error);
+
+struct rte_flow *
+vnf_flow_builder_create(uint16_t port, const struct rte_flow_attr *attr,
+			const struct vnf_flow_builder *fb,
+			struct rte_flow_error *error);
+
+/*
+ * Flow API of a port, same prototypes as the rte_flow functions. The
+ * template ones may be NULL when info_get fails.
+ */
+struct vnf_flow_ops {
+	const char *name;
+	int (*validate)(uint16_t port_id, const struct rte_flow_attr *attr,
+			const struct rte_flow_item pattern[],
+			const struct rte_flow_action actions[],
+			struct rte_flow_error *error);
+	struct rte_flow *(*create)(uint16_t port_id,
+				   const struct rte_flow_attr *attr,
+				   const struct rte_flow_item pattern[],
+				   const struct rte_flow_action actions[],
+				   struct rte_flow_error *error);
+	int (*destroy)(uint16_t port_id, struct rte_flow *flow,
+		       struct rte_flow_error *error);
+	int (*flush)(uint16_t port_id, struct rte_flow_error *error);
+	int (*info_get)(uint16_t port_id, struct rte_flow_port_info *port_info,
+			struct rte_flow_queue_info *queue_info,
+			struct rte_flow_error *error);
+	int (*configure)(uint16_t port_id,
+			 const struct rte_flow_port_attr *port_attr,
+			 uint16_t nb_queue,
+			 const struct rte_flow_queue_attr *queue_attr[],
+			 struct rte_flow_error *error);
+	struct rte_flow_pattern_template *(*pattern_template_create)(
+			uint16_t port_id,
+			const struct rte_flow_pattern_template_attr *attr,
+			const struct rte_flow_item pattern[],
+			struct rte_flow_error *error);
+	int (*pattern_template_destroy)(uint16_t port_id,
+			struct rte_flow_pattern_template *pattern_template,
+			struct rte_flow_error *error);
+	struct rte_flow_actions_template *(*actions_template_create)(
+			uint16_t port_id,
+			const struct rte_flow_actions_template_attr *attr,
+			const struct rte_flow_action actions[],
+			const struct rte_flow_action masks[],
+			struct rte_flow_error *error);
+	int (*actions_template_destroy)(uint16_t port_id,
+			struct rte_flow_actions_template *actions_template,
+			struct rte_flow_error *error);
+	struct rte_flow_template_table *(*template_table_create)(
+			uint16_t port_id,
+			const struct rte_flow_template_table_attr *table_attr,
+			struct rte_flow_pattern_template *pattern_templates[],
+			uint8_t nb_pattern_templates,
+			struct rte_flow_actions_template *actions_templates[],
+			uint8_t nb_actions_templates,
+			struct rte_flow_error *error);
+	int (*template_table_destroy)(uint16_t port_id,
+			struct rte_flow_template_table *template_table,
+			struct rte_flow_error *error);
+	struct rte_flow *(*async_create)(uint16_t port_id, uint32_t queue_id,
+			const struct rte_flow_op_attr *op_attr,
+			struct rte_flow_template_table *template_table,
+			const struct rte_flow_item pattern[],
+			uint8_t pattern_template_index,
+			const struct rte_flow_action actions[],
+			uint8_t actions_template_index,
+			void *user_data, struct rte_flow_error *error);
+	int (*async_destroy)(uint16_t port_id, uint32_t queue_id,
+			     const struct rte_flow_op_attr *op_attr,
+			     struct rte_flow *flow, void *user_data,
+			     struct rte_flow_error *error);
+	int (*push)(uint16_t port_id, uint32_t queue_id,
+		    struct rte_flow_error *error);
+	int (*pull)(uint16_t port_id, uint32_t queue_id,
+		    struct rte_flow_op_result res[], uint16_t n_res,
+		    struct rte_flow_error *error);
+	int (*query)(uint16_t port_id, struct rte_flow *flow,
+		     const struct rte_flow_action *action, void *data,
+		     struct rte_flow_error *error);
+	int (*get_aged_flows)(uint16_t port_id, void **contexts,
+			      uint32_t nb_contexts,
+			      struct rte_flow_error *error);
+	/* rte_eth_dev_callback_register, for RTE_ETH_EVENT_FLOW_AGED. */
+	int (*callback_register)(uint16_t port_id,
+				 enum rte_eth_event_type event,
+				 rte_eth_dev_cb_fn cb_fn, void *cb_arg);
+	struct rte_flow_action_handle *(*action_handle_create)(
+			uint16_t port_id,
+			const struct rte_flow_indir_action_conf *conf,
+			const struct rte_flow_action *action,
+			struct rte_flow_error *error);
+	int (*action_handle_destroy)(uint16_t port_id,
+			struct rte_flow_action_handle *handle,
+			struct rte_flow_error *error);
+	int (*action_handle_update)(uint16_t port_id,
+			struct rte_flow_action_handle *handle,
+			const void *update, struct rte_flow_error *error);
+	int (*action_handle_query)(uint16_t port_id,
+			const struct rte_flow_action_handle *handle,
+			void *data, struct rte_flow_error *error);
+};
+
+const struct vnf_flow_ops *
+vnf_flow_ops_get(uint16_t port_id);
+
+void
+vnf_flow_ops_set(uint16_t port_id, const struct vnf_flow_ops *ops);
+
+int
+vnf_flow_validate_cached(uint16_t port_id, const struct rte_flow_attr *attr,
+			 const struct rte_flow_item pattern[],
+			 const struct rte_flow_action actions[],
+			 struct rte_flow_error *error);
+
+void
+vnf_flow_vcache_flush(uint16_t port_id);
+
+void
+vnf_flow_vcache_print(uint16_t port_id);
+
+/* The mock backend has no template API, as a PMD without it. */
+#define VNF_FLOW_MOCK_F_NO_TEMPLATE (1 << 0)
+
+int
+vnf_flow_mock_attach(uint16_t port_id, uint32_t max_rules, uint32_t flags);
+
+void
+vnf_flow_mock_detach(uint16_t port_id);
+
+int
+vnf_flow_mock_stats(uint16_t port_id, uint32_t *nb_rules, uint64_t *bytes);
+
+int
+vnf_flow_swemu_attach(uint16_t port_id);
+
+void
+vnf_flow_swemu_detach(uint16_t port_id);
+
+int
+vnf_flow_swemu_attached(uint16_t port_id);
+
+void
+vnf_flow_swemu_stats_print(uint16_t port_id);
+
+/* Offloads of the app, each runs on the port or in software. */
+enum vnf_feature {
+	VNF_FEAT_GTP_MATCH,
+	VNF_FEAT_RAW_DECAP,
+	VNF_FEAT_RAW_ENCAP,
+	VNF_FEAT_HAIRPIN,
+	VNF_FEAT_SAMPLE,
+	VNF_FEAT_METER,
+	VNF_FEAT_AGE,
+	VNF_FEAT_MODIFY_FIELD,
+	VNF_FEAT_TEMPLATE,
+	VNF_FEAT_TRANSFER,
+	VNF_FEAT_MAX,
+};
+
+enum vnf_path {
+	VNF_PATH_SW, /* Not taken by the port, the software equivalent. */
+	VNF_PATH_HW,
+	VNF_PATH_EMU, /* Taken by the software flow emulation. */
+};
+
+int
+vnf_feature_probe_dev(uint16_t port_id);
+
+int
+vnf_feature_probe_flows(uint16_t port_id);
+
+enum vnf_path
+vnf_feature_path(uint16_t port_id, enum vnf_feature feat);
+
+int
+vnf_feature_hw(uint16_t port_id, enum vnf_feature feat);
+
+void
+vnf_feature_fallback(uint16_t port_id, enum vnf_feature feat);
+
+void
+vnf_feature_graph_set(int on);
+
+void
+vnf_feature_print(void);
+
+/* Module which created a rule, rules are torn down per owner. */
+enum vnf_flow_owner {
+	VNF_FLOW_OWNER_APP,
+	VNF_FLOW_OWNER_DEFAULT,
+	VNF_FLOW_OWNER_DECAP,
+	VNF_FLOW_OWNER_ENCAP,
+	VNF_FLOW_OWNER_RSS,
+	VNF_FLOW_OWNER_HAIRPIN,
+	VNF_FLOW_OWNER_TAG,
+	VNF_FLOW_OWNER_META,
+	VNF_FLOW_OWNER_MIRROR,
+	VNF_FLOW_OWNER_METER,
+	VNF_FLOW_OWNER_QFI,
+	VNF_FLOW_OWNER_AGE,
+	VNF_FLOW_OWNER_COUNTER,
+	VNF_FLOW_OWNER_TEID,
+	VNF_FLOW_OWNER_ISOLATE,
+	VNF_FLOW_OWNER_SESSION,
+	VNF_FLOW_OWNER_PROGRAM,
+	VNF_FLOW_OWNER_PDU,
+	VNF_FLOW_OWNER_MAX,
+};
+
+#define VNF_FLOW_ID_INVALID 0
+/* A flow ID is a generation over the index of its registry entry. */
+#define VNF_FLOW_ID_IDX_BITS 24
+#define VNF_FLOW_ID_IDX(id) ((id) & ((1u << VNF_FLOW_ID_IDX_BITS) - 1))
+
+/* Cookie unique per owner, 0 means no cookie. */
+#define VNF_FLOW_COOKIE(owner, n) \
+	((((uint64_t)(owner) + 1) << 56) | (uint64_t)(n))
+/* Owner of a cookie, VNF_FLOW_OWNER_MAX for no cookie. */
+#define VNF_FLOW_COOKIE_OWNER(cookie) \
+	((cookie) ? (enum vnf_flow_owner)(((cookie) >> 56) - 1) : \
+		    VNF_FLOW_OWNER_MAX)
+
+#define VNF_FLOW_F_ASYNC (1 << 0) /* Created with the template API. */
+#define VNF_FLOW_F_PENDING (1 << 1) /* Insertion not completed yet. */
+#define VNF_FLOW_F_REMOVING (1 << 2) /* Removal not completed yet. */
+
+struct vnf_flow_info {
+	struct rte_flow *flow;
+	uint64_t cookie;
+	uint32_t group;
+	uint32_t priority;
+	uint32_t ctime; /* Seconds since the registry init. */
+	uint16_t port_id;
+	enum vnf_flow_owner owner;
+	uint8_t flags;
+};
+
+int
+vnf_flow_registry_init(uint32_t max_flows);
+
+uint32_t
+vnf_flow_register(uint16_t port_id, const struct rte_flow_attr *attr,
+		  struct rte_flow *flow, enum vnf_flow_owner owner,
+		  uint64_t cookie, uint8_t flags);
+
+int
+vnf_flow_attach(uint32_t id, struct rte_flow *flow);
+
+int
+vnf_flow_unregister(uint32_t id);
+
+uint64_t
+vnf_flow_complete(uint32_t id, int status);
+
+struct rte_flow *
+vnf_flow_create(uint16_t port_id, const struct rte_flow_attr *attr,
+		const struct rte_flow_item pattern[],
+		const struct rte_flow_action actions[],
+		enum vnf_flow_owner owner, uint64_t cookie,
+		struct rte_flow_error *error);
+
+struct rte_flow *
+vnf_flow_lookup(uint32_t id, struct vnf_flow_info *info);
+
+uint32_t
+vnf_flow_lookup_cookie(uint64_t cookie);
+
+int
+vnf_flow_destroy(uint32_t id);
+
+int
+vnf_flow_destroy_owner(enum vnf_flow_owner owner);
+
+uint32_t
+vnf_flow_owner_ids(enum vnf_flow_owner owner, uint32_t *ids, uint32_t max);
+
+int
+vnf_flow_destroy_group(uint16_t port_id, uint32_t group);
+
+void
+vnf_flow_forget_port(uint16_t port_id);
+
+void
+vnf_flow_registry_print(int verbose);
+
+uint32_t
+vnf_table_declare(const struct vnf_table_decl *decl);
+
+uint32_t
+vnf_table_group(const char *name);
+
+int
+vnf_table_install(uint16_t port_id, int entries);
+
+struct rte_flow *
+vnf_table_flow_create(uint16_t port_id, const char *table,
+		      const struct rte_flow_attr *attr,
+		      const struct rte_flow_item pattern[],
+		      const struct rte_flow_action actions[],
+		      enum vnf_flow_owner owner, uint64_t cookie,
+		      struct rte_flow_error *error);
+
+void
+vnf_table_print(void);
+
+/* attr priority of a table rule placed by its specificity. */
+#define VNF_FLOW_PRIO_AUTO UINT32_MAX
+
+struct vnf_prio_rule;
+
+struct vnf_prio_rule *
+vnf_prio_check(uint16_t port_id, struct rte_flow_attr *attr,
+	       const struct rte_flow_item pattern[],
+	       const struct rte_flow_action actions[],
+	       struct rte_flow_error *error);
+
+void
+vnf_prio_commit(struct vnf_prio_rule *rule, struct rte_flow *flow);
+
+void
+vnf_prio_forget(struct rte_flow *flow);
+
+void
+vnf_prio_print(void);
+
+/* Session rule shapes of the template based insertion engine. */
+enum vnf_async_shape {
+	VNF_ASYNC_DECAP, /* GTP-U decap and RSS, as the decap example. */
+	VNF_ASYNC_ENCAP, /* Egress GTP-U encap, as the encap example. */
+	VNF_ASYNC_RSS, /* RSS on the inner IP, as the RSS example. */
+	VNF_ASYNC_SHAPE_MAX,
+};
+
+struct vnf_async_session {
+	enum vnf_async_shape shape;
+	uint32_t teid; /* CPU order. */
+	uint32_t ue_ip; /* CPU order, inner src or encap dst. */
+	uint32_t mark; /* Decap and RSS shapes. */
+	/*
+	 * Registry cookie, 0 for none. The rules of a PDU session cookie
+	 * belong to the session layer, which makes them again, they are
+	 * not checkpointed.
+	 */
+	uint64_t cookie;
+};
+
+/* Completion of an insertion or removal, status 0 on success. */
+typedef void (*vnf_async_done_t)(uint64_t cookie, int status);
+
+int
+vnf_async_configure(uint16_t port_id, uint32_t nb_flows);
+
+int
+vnf_async_start(uint16_t port_id, uint32_t nb_queues, const uint16_t *queues);
+
+int
+vnf_async_template_mode(uint16_t port_id);
+
+void
+vnf_async_set_done_cb(vnf_async_done_t cb);
+
+uint32_t
+vnf_async_session_add(uint16_t port_id, const struct vnf_async_session *s);
+
+/* Called by vnf_flow_destroy, the rule is released on completion. */
+int
+vnf_async_session_del(uint16_t port_id, uint32_t id);
+
+int
+vnf_async_poll(uint16_t port_id);
+
+int
+vnf_async_flush(uint16_t port_id);
+
+uint32_t
+vnf_async_nb_queues(uint16_t port_id);
+
+void
+vnf_async_stats_print(uint16_t port_id);
+
+void
+vnf_async_close(uint16_t port_id);
+
+int
+vnf_flow_checkpoint_open(const char *path, uint32_t nb);
+
+uint32_t
+vnf_flow_checkpoint_pending(void);
+
+void
+vnf_flow_checkpoint_save(uint16_t port_id, uint32_t flow_id,
+			 const struct vnf_async_session *s);
+
+void
+vnf_flow_checkpoint_drop(uint32_t flow_id);
+
+int
+vnf_flow_checkpoint_restore(void);
+
+void
+vnf_flow_checkpoint_close(void);
+
+/*
+ * PDU sessions, the uplink and downlink rules of a session with their
+ * counters, meters and aging in one call, see flow_session.c.
+ */
+#define VNF_SESSION_INVALID 0
+
+#define VNF_SESSION_F_UL_HW (1 << 0) /* Uplink rule. */
+#define VNF_SESSION_F_DL_HW (1 << 1) /* Downlink rule, with the encap. */
+#define VNF_SESSION_F_DECAP_HW (1 << 2)
+#define VNF_SESSION_F_COUNT_HW (1 << 3)
+#define VNF_SESSION_F_METER_HW (1 << 4)
+#define VNF_SESSION_F_AGE_HW (1 << 5)
+#define VNF_SESSION_F_METER_SW (1 << 6) /* Uplink metered by the graph. */
+
+struct vnf_session_params {
+	uint16_t port_id;
+	uint8_t qfi; /* 0 for no PDU session container. */
+	uint32_t ul_teid; /* Local end of the uplink tunnel, CPU order. */
+	uint32_t dl_teid; /* gNB end of the downlink tunnel, CPU order. */
+	uint32_t gnb_ip; /* CPU order, 0 for the one of the encap example. */
+	uint32_t ue_ip; /* CPU order. */
+	uint64_t ul_mbr; /* Bytes per second, 0 for no limit. */
+	uint64_t dl_mbr;
+	uint32_t idle_timeout; /* Seconds, 0 to never age. */
+};
+
+struct vnf_session_stats {
+	uint64_t ul_pkts;
+	uint64_t ul_bytes;
+	uint64_t dl_pkts; /* Only counted with the downlink rule. */
+	uint64_t dl_bytes;
+	uint32_t flags; /* VNF_SESSION_F_* */
+};
+
+int
+vnf_session_init(uint32_t nb, uint32_t nb_queues, const uint16_t *queues);
+
+void
+vnf_session_close(void);
+
+uint32_t
+vnf_session_create(const struct vnf_session_params *p);
+
+int
+vnf_session_modify(uint32_t id, const struct vnf_session_params *p);
+
+int
+vnf_session_delete(uint32_t id);
+
+int
+vnf_session_confirm(uint32_t id);
+
+int
+vnf_session_stats_get(uint32_t id, struct vnf_session_stats *ss);
+
+int
+vnf_session_params_get(uint32_t id, struct vnf_session_params *p);
+
+void
+vnf_session_print(void);
+
+/*
+ * PFCP-lite control endpoint of the PDU sessions, see pfcp_ctl.c.
+ * vnf_pfcp_wait() runs on the main lcore, its flow queue pushes the rules.
+ */
+int
+vnf_pfcp_init(uint16_t port_id, uint16_t udp_port, uint32_t window_us,
+	      uint32_t nb_sessions);
+
+int
+vnf_pfcp_wait(uint32_t timeout_ms);
+
+void
+vnf_pfcp_close(void);
+
+void
+vnf_pfcp_print(void);
+
+/*
+ * Indirect actions of a port, created once and referenced by many rules
+ * with vnf_flow_action_indirect(). id is chosen by the caller, as the
+ * testpmd action_id, below VNF_FLOW_HANDLE_MAX.
+ */
+#define VNF_FLOW_HANDLE_MAX 256
+
+struct rte_flow_action_handle *
+vnf_flow_handle_create(uint16_t port_id, uint32_t id,
+		       const struct rte_flow_indir_action_conf *conf,
+		       const struct rte_flow_action *action);
+
+struct rte_flow_action_handle *
+vnf_flow_handle_get(uint16_t port_id, uint32_t id);
+
+int
+vnf_flow_handle_update(uint16_t port_id, uint32_t id, const void *update);
+
+int
+vnf_flow_handle_rss_update(uint16_t port_id, uint32_t id,
+			   const uint16_t *queues, uint32_t nb_queues);
+
+int
+vnf_flow_handle_age_update(uint16_t port_id, uint32_t id, uint32_t timeout);
+
+int
+vnf_flow_handle_query(uint16_t port_id, uint32_t id, void *data);
+
+int
+vnf_flow_handle_destroy(uint16_t port_id, uint32_t id);
+
+void
+vnf_flow_handle_flush(uint16_t port_id);
+
+uint32_t
+vnf_flow_handle_count(uint16_t port_id);
+
+void
+vnf_flow_handle_print(uint16_t port_id);
+
+/*
+ * Release nb aged rules given by their age context, return how many are
+ * gone or going, the others are given again by a later run.
+ */
+typedef uint16_t (*vnf_flow_reclaim_t)(uint16_t port_id, void *contexts[],
+				       uint16_t nb, void *arg);
+
+struct vnf_flow_reclaim_stats {
+	uint64_t events; /* RTE_ETH_EVENT_FLOW_AGED received. */
+	uint64_t runs;
+	uint64_t batches;
+	uint64_t reclaimed;
+	uint64_t busy; /* Contexts not released, retried. */
+	uint64_t last_latency_us; /* From the event to all released. */
+	uint64_t max_latency_us;
+	uint64_t rate; /* Released per second of reclamation. */
+};
+
+int
+vnf_flow_reclaim_init(uint16_t port_id, uint16_t batch, vnf_flow_reclaim_t fn,
+		      void *arg);
+
+void
+vnf_flow_reclaim_close(uint16_t port_id);
+
+int
+vnf_flow_reclaim_stats(uint16_t port_id, struct vnf_flow_reclaim_stats *stats);
+
+/*
+ * Counters of rules or indirect COUNT actions, queried in the background
+ * once per harvest period by an EAL service, on a service lcore if there
+ * is one, by vnf_counter_harvest_poll() otherwise.
+ */
+#define VNF_COUNTER_INVALID 0
+#define VNF_COUNTER_HISTORY 4 /* Queries the rates are taken over. */
+
+struct vnf_counter_stats {
+	uint64_t key; /* Given at registration. */
+	uint64_t hits;
+	uint64_t bytes;
+	uint64_t hits_rate; /* Per second. */
+	uint64_t bytes_rate;
+	uint64_t age_ms; /* Since the last query. */
+};
+
+int
+vnf_counter_harvest_init(uint32_t nb, uint32_t period_ms);
+
+void
+vnf_counter_harvest_poll(void);
+
+void
+vnf_counter_harvest_close(void);
+
+uint32_t
+vnf_counter_register_flow(uint32_t flow_id, uint64_t key);
+
+uint32_t
+vnf_counter_register_handle(uint16_t port_id, uint32_t handle_id,
+			    uint64_t key);
+
+void
+vnf_counter_unregister(uint32_t counter);
+
+int
+vnf_counter_get(uint32_t counter, struct vnf_counter_stats *cs, int refresh);
+
+/*
+ * Meters allocated per session from a pool of the port, sharing the
+ * profiles and policies of equal content.
+ */
+#define VNF_METER_INVALID UINT32_MAX
+
+enum vnf_meter_verdict {
+	VNF_METER_PASS,
+	VNF_METER_DROP,
+};
+
+struct vnf_meter_policy {
+	uint8_t verdict[RTE_COLORS]; /* enum vnf_meter_verdict per color. */
+};
+
+struct rte_mtr_meter_profile;
+
+int
+vnf_meter_pool_init(uint16_t port_id, uint32_t base, uint32_t nb);
+
+void
+vnf_meter_pool_close(uint16_t port_id);
+
+uint32_t
+vnf_meter_alloc(uint16_t port_id, const struct rte_mtr_meter_profile *profile,
+		const struct vnf_meter_policy *policy);
+
+int
+vnf_meter_bind(uint16_t port_id, uint32_t mtr_id, uint32_t flow_id);
+
+int
+vnf_meter_free(uint16_t port_id, uint32_t mtr_id);
+
+uint32_t
+vnf_meter_pool_gc(uint16_t port_id);
+
+void
+vnf_meter_pool_print(uint16_t port_id);
+
+int
+vnf_meter_pool_range(uint16_t port_id, uint32_t *base, uint32_t *nb);
+
+int
+vnf_meter_used(uint16_t port_id, uint32_t mtr_id);
+
+/*
+ * Stats of the pool meters, read in the background by an EAL service, on
+ * a service lcore if there is one, by vnf_meter_stats_poll() otherwise.
+ */
+struct vnf_meter_stats {
+	uint64_t pkts[RTE_COLORS];
+	uint64_t bytes[RTE_COLORS];
+	uint64_t pkts_dropped;
+	uint64_t bytes_dropped;
+	uint64_t pkts_rate[RTE_COLORS]; /* Per second. */
+	uint64_t bytes_rate[RTE_COLORS];
+};
+
+int
+vnf_meter_stats_init(uint32_t period_ms);
+
+void
+vnf_meter_stats_poll(void);
+
+int
+vnf_meter_stats_get(uint16_t port_id, uint32_t mtr_id,
+		    struct vnf_meter_stats *ms);
+
+void
+vnf_meter_stats_close(void);
+
 int
 create_default_flow();
 
+int
+create_default_port_flow(uint16_t port_id);
+
 struct rte_flow *
 create_gtp_u_decap_rss_flow(uint16_t port, uint32_t nb_queues,
 					     uint16_t *queues);
@@ -40,6 +1030,26 @@ create_gtp_u_encap_flow(uint16_t port);
 struct rte_flow *
 create_gtp_u_psc_encap_flow(uint16_t port);
 
+size_t
+gtp_u_encap_hdr_build(uint8_t *buf, int psc);
+
+int
+gtp_frag_init(struct rte_mempool *pool, uint32_t max_flows, uint32_t ttl_ms);
+
+uint16_t
+gtp_u_encap_fragment(struct rte_mbuf *m, uint16_t mtu,
+		     struct rte_mbuf **out, uint16_t nb_out);
+
+uint16_t
+gtp_u_reassemble_burst(struct rte_mbuf **pkts, uint16_t nb_pkts,
+		       uint64_t tsc);
+
+int
+gtp_u_encap_match(struct rte_mbuf *m);
+
+int
+gtp_u_sw_decap(struct rte_mbuf *m);
+
 int
 sync_nic_tx_flows(uint16_t port);
 
@@ -85,9 +1095,6 @@ create_flow_with_meter_in_transfer(uint16_t port_id);
 int
 create_flow_with_meter(uint16_t port);
 
-int
-get_meter_stats(uint16_t port_id, uint32_t mtr_id);
-
 int
 create_gtp_u_qfi_flow(uint16_t port);
 
@@ -110,6 +1117,11 @@ create_nic_flow_with_mirror(uint16_t port_id, uint16_t mirror2queue,
 struct rte_flow *
 create_gtp_u_inner_ip_shared_rss_flow(uint16_t port, uint32_t nb_queues,
 			       uint16_t *queues);
+
+int
+update_gtp_u_inner_ip_shared_rss(uint16_t port, uint32_t nb_queues,
+				 uint16_t *queues);
+
 int
 create_flow_with_counter(uint16_t port);
 
@@ -124,6 +1136,9 @@ enable_isolate_mode_init();
 
 void 
 dpdk_isolate_flows_init();
+
+void
+dpdk_isolate_port_flows_init(uint16_t port_id);
 #ifdef  __cplusplus
 }
 #endif
@@ -0,0 +1,457 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright 2020 Mellanox Technologies, Ltd
+ */
+
+/*
+ * SMF stand-in of the PFCP-lite control endpoint of vnf_example, see
+ * rte-lib/pfcp_ctl.c. After an association setup, N sessions are
+ * established, modified (--modify) then deleted (unless --keep), with up
+ * to --outstanding requests in flight. Session i has the UL and DL TEID
+ * 0x100000 + i and the UE ip 10.0.0.1 + i, the modification moves its DL
+ * tunnel to TEID 0x200000 + i. For each phase the rate, the end to end
+ * latency percentiles of a request and the rejected and unanswered ones
+ * are printed. No DPDK needed:
+ * ./build/vnf_example [EAL options] -- --pfcp 8805
+ * ./build/smf_standin --sessions 10000 --outstanding 256 --modify
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "rte-lib/pfcp.h"
+
+#define SMF_TEID_BASE 0x100000
+#define SMF_TEID_MODIFIED 0x200000
+#define SMF_UE_IP_BASE ((10<<24) + 1) /* first UE ip = 10.0.0.1 */
+#define SMF_GNB_IP ((192<<24) + (2<<8) + 1) /* 192.0.2.1 */
+#define SMF_TIMEOUT_MS 1000 /* unanswered requests after 1s of silence */
+#define SMF_RCVBUF (4 << 20)
+#define SMF_LAT_PENDING UINT64_MAX
+
+typedef uint16_t (*smf_build_t)(uint8_t *buf, uint32_t i);
+
+static uint16_t server_port = PFCP_UDP_PORT;
+static uint32_t nb_sessions = 1000;
+static uint32_t outstanding = 64;
+static uint8_t qfi = 9;
+static uint64_t mbr_kbps;
+static uint32_t idle_timeout;
+static int do_modify;
+static int keep;
+
+/* UP SEID of each session, latency of its request in flight, in ns. */
+static uint64_t *up_seid;
+static uint64_t *req_start;
+static uint64_t *req_lat;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint8_t *
+ie_f_teid(uint8_t *p, uint32_t teid)
+{
+	uint8_t *ie = p;
+
+	p = pfcp_ie_begin(p, PFCP_IE_F_TEID);
+	*p++ = 0x01; /* V4. */
+	p = pfcp_put32(p, teid);
+	p = pfcp_put32(p, INADDR_LOOPBACK);
+	return pfcp_ie_end(ie, p);
+}
+
+static uint8_t *
+ie_ue_ip(uint8_t *p, uint32_t ip, int dst)
+{
+	uint8_t *ie = p;
+
+	p = pfcp_ie_begin(p, PFCP_IE_UE_IP);
+	*p++ = 0x02 | (dst ? 0x04 : 0); /* V4, destination. */
+	p = pfcp_put32(p, ip);
+	return pfcp_ie_end(ie, p);
+}
+
+static uint8_t *
+ie_ohc(uint8_t *p, uint32_t teid, uint32_t ip)
+{
+	uint8_t *ie = p;
+
+	p = pfcp_ie_begin(p, PFCP_IE_OUTER_HDR_CREATION);
+	p = pfcp_put16(p, PFCP_OHC_GTPU_IPV4);
+	p = pfcp_put32(p, teid);
+	p = pfcp_put32(p, ip);
+	return pfcp_ie_end(ie, p);
+}
+
+static uint8_t *
+ie_mbr(uint8_t *p, uint64_t ul_kbps, uint64_t dl_kbps)
+{
+	uint8_t *ie = p;
+
+	p = pfcp_ie_begin(p, PFCP_IE_MBR);
+	*p++ = (uint8_t)(ul_kbps >> 32);
+	p = pfcp_put32(p, (uint32_t)ul_kbps);
+	*p++ = (uint8_t)(dl_kbps >> 32);
+	p = pfcp_put32(p, (uint32_t)dl_kbps);
+	return pfcp_ie_end(ie, p);
+}
+
+/* Uplink PDR from the gNB, downlink PDR to the UE. */
+static uint8_t *
+ie_create_pdr(uint8_t *p, uint32_t i, int dl)
+{
+	uint8_t *pdr = p, *pdi;
+
+	p = pfcp_ie_begin(p, PFCP_IE_CREATE_PDR);
+	p = pfcp_ie_u16(p, PFCP_IE_PDR_ID, dl ? 2 : 1);
+	p = pfcp_ie_u32(p, PFCP_IE_PRECEDENCE, 100);
+	pdi = p;
+	p = pfcp_ie_begin(p, PFCP_IE_PDI);
+	p = pfcp_ie_u8(p, PFCP_IE_SOURCE_INTERFACE,
+		       dl ? PFCP_SRC_CORE : PFCP_SRC_ACCESS);
+	if (!dl) {
+		p = ie_f_teid(p, SMF_TEID_BASE + i);
+		p = pfcp_ie_u8(p, PFCP_IE_QFI, qfi);
+	}
+	p = ie_ue_ip(p, SMF_UE_IP_BASE + i, dl);
+	p = pfcp_ie_end(pdi, p);
+	if (!dl)
+		p = pfcp_ie_u8(p, PFCP_IE_OUTER_HDR_REMOVAL, 0);
+	p = pfcp_ie_u32(p, PFCP_IE_FAR_ID, dl ? 2 : 1);
+	p = pfcp_ie_u32(p, PFCP_IE_QER_ID, 1);
+	p = pfcp_ie_u32(p, PFCP_IE_URR_ID, 1);
+	return pfcp_ie_end(pdr, p);
+}
+
+/* Forward to the core, or to the gNB through the DL tunnel. */
+static uint8_t *
+ie_far(uint8_t *p, uint16_t type, uint32_t far_id, uint32_t dl_teid)
+{
+	uint8_t *far = p, *fwd;
+
+	p = pfcp_ie_begin(p, type);
+	p = pfcp_ie_u32(p, PFCP_IE_FAR_ID, far_id);
+	if (type == PFCP_IE_CREATE_FAR)
+		p = pfcp_ie_u8(p, PFCP_IE_APPLY_ACTION, 0x02); /* FORW */
+	fwd = p;
+	p = pfcp_ie_begin(p, type == PFCP_IE_CREATE_FAR ?
+			  PFCP_IE_FORWARDING_PARAMS :
+			  PFCP_IE_UPDATE_FORWARDING_PARAMS);
+	p = pfcp_ie_u8(p, PFCP_IE_DESTINATION_INTERFACE,
+		       dl_teid ? PFCP_SRC_ACCESS : PFCP_SRC_CORE);
+	if (dl_teid)
+		p = ie_ohc(p, dl_teid, SMF_GNB_IP);
+	p = pfcp_ie_end(fwd, p);
+	return pfcp_ie_end(far, p);
+}
+
+static uint8_t *
+ie_qer(uint8_t *p, uint16_t type, uint64_t kbps)
+{
+	uint8_t *qer = p;
+
+	p = pfcp_ie_begin(p, type);
+	p = pfcp_ie_u32(p, PFCP_IE_QER_ID, 1);
+	p = pfcp_ie_u8(p, PFCP_IE_GATE_STATUS, 0); /* UL and DL open. */
+	p = ie_mbr(p, kbps, kbps);
+	p = pfcp_ie_u8(p, PFCP_IE_QFI, qfi);
+	return pfcp_ie_end(qer, p);
+}
+
+static uint16_t
+build_assoc(uint8_t *buf, uint32_t i)
+{
+	uint8_t *p;
+
+	p = pfcp_msg_begin(buf, PFCP_ASSOC_SETUP_REQ, 0, 0, i);
+	p = pfcp_ie_node(p, PFCP_IE_NODE_ID, 0, INADDR_LOOPBACK);
+	p = pfcp_ie_u32(p, PFCP_IE_RECOVERY_TIME, (uint32_t)time(NULL));
+	return pfcp_msg_end(buf, p);
+}
+
+static uint16_t
+build_establish(uint8_t *buf, uint32_t i)
+{
+	uint8_t *p, *urr;
+
+	p = pfcp_msg_begin(buf, PFCP_SESS_EST_REQ, 1, 0, i);
+	p = pfcp_ie_node(p, PFCP_IE_NODE_ID, 0, INADDR_LOOPBACK);
+	p = pfcp_ie_node(p, PFCP_IE_F_SEID, i + 1, INADDR_LOOPBACK);
+	p = ie_create_pdr(p, i, 0);
+	p = ie_create_pdr(p, i, 1);
+	p = ie_far(p, PFCP_IE_CREATE_FAR, 1, 0);
+	p = ie_far(p, PFCP_IE_CREATE_FAR, 2, SMF_TEID_BASE + i);
+	p = ie_qer(p, PFCP_IE_CREATE_QER, mbr_kbps);
+	urr = p;
+	p = pfcp_ie_begin(p, PFCP_IE_CREATE_URR);
+	p = pfcp_ie_u32(p, PFCP_IE_URR_ID, 1);
+	p = pfcp_ie_u8(p, PFCP_IE_MEASUREMENT_METHOD, 0x02); /* VOLUM */
+	p = pfcp_ie_u32(p, PFCP_IE_INACTIVITY_TIME, idle_timeout);
+	p = pfcp_ie_end(urr, p);
+	return pfcp_msg_end(buf, p);
+}
+
+/* Handover: the DL tunnel moves, the rate doubles. */
+static uint16_t
+build_modify(uint8_t *buf, uint32_t i)
+{
+	uint8_t *p;
+
+	p = pfcp_msg_begin(buf, PFCP_SESS_MOD_REQ, 1, up_seid[i], i);
+	p = ie_far(p, PFCP_IE_UPDATE_FAR, 2, SMF_TEID_MODIFIED + i);
+	p = ie_qer(p, PFCP_IE_UPDATE_QER, mbr_kbps * 2);
+	return pfcp_msg_end(buf, p);
+}
+
+static uint16_t
+build_delete(uint8_t *buf, uint32_t i)
+{
+	uint8_t *p;
+
+	p = pfcp_msg_begin(buf, PFCP_SESS_DEL_REQ, 1, up_seid[i], i);
+	return pfcp_msg_end(buf, p);
+}
+
+/* Return the cause of the response, 0 without one. */
+static uint8_t
+parse_response(const struct pfcp_hdr *h, uint64_t *seid)
+{
+	const uint8_t *p = h->body, *val;
+	uint8_t cause = 0;
+	uint16_t type, len;
+
+	while (pfcp_ie_next(&p, h->body + h->body_len, &type, &val,
+			    &len) > 0) {
+		if (type == PFCP_IE_CAUSE && len >= 1)
+			cause = val[0];
+		else if (type == PFCP_IE_F_SEID && len >= 9 && seid != NULL)
+			*seid = pfcp_get64(val + 1);
+	}
+	return cause;
+}
+
+static void
+report(const char *op, uint32_t nb, uint32_t answered, uint32_t rejected,
+       uint64_t ns)
+{
+	uint64_t *lat;
+	uint32_t i, n = 0;
+
+	lat = (uint64_t *)malloc(sizeof(*lat) * (nb ? nb : 1));
+	if (lat == NULL)
+		return;
+	for (i = 0; i < nb; i++)
+		if (req_lat[i] != SMF_LAT_PENDING)
+			lat[n++] = req_lat[i];
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+	printf("%-10s %8u %10.0f", op, answered - rejected,
+	       (double)answered * 1E9 / (ns ? ns : 1));
+	if (n)
+		printf(" %8.0f %8.0f %8.0f %8.0f %10.0f", lat[n / 2] / 1E3,
+		       lat[n * 9 / 10] / 1E3, lat[n * 99 / 100] / 1E3,
+		       lat[n * 999 / 1000] / 1E3, lat[n - 1] / 1E3);
+	else
+		printf(" %8s %8s %8s %8s %10s", "-", "-", "-", "-", "-");
+	printf(" %8u %8u\n", rejected, nb - answered);
+	free(lat);
+}
+
+/*
+ * Send the nb requests of build, up to outstanding in flight, and wait
+ * for their rsp_type responses. Return the unanswered ones.
+ */
+static uint32_t
+run_phase(int fd, const char *op, uint32_t nb, smf_build_t build,
+	  uint8_t rsp_type)
+{
+	uint8_t buf[PFCP_MSG_MAX];
+	uint32_t sent = 0, answered = 0, rejected = 0, inflight = 0;
+	uint64_t start = now_ns(), t, seid;
+	struct pollfd pfd;
+	struct pfcp_hdr h;
+	uint16_t len;
+	ssize_t n;
+	uint8_t cause;
+
+	memset(req_lat, 0xff, sizeof(*req_lat) * nb);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (answered < nb) {
+		while (sent < nb && inflight < outstanding) {
+			len = build(buf, sent);
+			req_start[sent] = now_ns();
+			if (send(fd, buf, len, 0) < 0) {
+				printf("Cannot send %s request: %s\n", op,
+				       strerror(errno));
+				return nb - answered;
+			}
+			sent++;
+			inflight++;
+		}
+		if (poll(&pfd, 1, SMF_TIMEOUT_MS) <= 0)
+			break;
+		while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			t = now_ns();
+			if (pfcp_msg_parse(buf, n, &h) || h.type != rsp_type ||
+			    h.seq >= nb || req_lat[h.seq] != SMF_LAT_PENDING)
+				continue;
+			req_lat[h.seq] = t - req_start[h.seq];
+			seid = 0;
+			cause = parse_response(&h, &seid);
+			if (cause != PFCP_CAUSE_ACCEPTED)
+				rejected++;
+			if (rsp_type == PFCP_SESS_EST_RSP)
+				up_seid[h.seq] = seid;
+			answered++;
+			inflight--;
+		}
+	}
+	report(op, nb, answered, rejected, now_ns() - start);
+	return nb - answered;
+}
+
+static void
+usage(const char *prgname)
+{
+	printf("%s [--port PORT] [--sessions N] [--outstanding N] [--qfi Q]\n"
+	       "    [--mbr KBPS] [--idle S] [--modify] [--keep]\n"
+	       "  --port PORT: UDP port of the endpoint on 127.0.0.1,\n"
+	       "               default 8805\n"
+	       "  --sessions N: sessions to establish, default 1000\n"
+	       "  --outstanding N: requests in flight, default 64\n"
+	       "  --qfi Q: QFI of the sessions, default 9\n"
+	       "  --mbr KBPS: UL and DL MBR, default 0 for no meter\n"
+	       "  --idle S: inactivity detection time, default 0 to never age\n"
+	       "  --modify: move the DL tunnel of each session\n"
+	       "  --keep: don't delete the sessions\n",
+	       prgname);
+}
+
+static void
+parse_args(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{"port", required_argument, NULL, 'p'},
+		{"sessions", required_argument, NULL, 's'},
+		{"outstanding", required_argument, NULL, 'o'},
+		{"qfi", required_argument, NULL, 'q'},
+		{"mbr", required_argument, NULL, 'b'},
+		{"idle", required_argument, NULL, 'i'},
+		{"modify", no_argument, NULL, 'm'},
+		{"keep", no_argument, NULL, 'k'},
+		{NULL, 0, NULL, 0},
+	};
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != EOF) {
+		switch (opt) {
+		case 'p':
+			server_port = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			nb_sessions = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			outstanding = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			qfi = (uint8_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			mbr_kbps = strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			idle_timeout = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			do_modify = 1;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	/* The sequence number of a request is its session, 24 bits. */
+	if (!nb_sessions || nb_sessions >= (1 << 24) || !outstanding) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	int rcvbuf = SMF_RCVBUF;
+	int fd;
+
+	parse_args(argc, argv);
+	up_seid = (uint64_t *)calloc(nb_sessions, sizeof(*up_seid));
+	req_start = (uint64_t *)calloc(nb_sessions, sizeof(*req_start));
+	req_lat = (uint64_t *)calloc(nb_sessions, sizeof(*req_lat));
+	if (up_seid == NULL || req_start == NULL || req_lat == NULL) {
+		printf("Cannot allocate %u sessions\n", nb_sessions);
+		return EXIT_FAILURE;
+	}
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		printf("Cannot open socket: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(server_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		printf("Cannot connect to port %u: %s\n", server_port,
+		       strerror(errno));
+		return EXIT_FAILURE;
+	}
+	printf("%-10s %8s %10s %8s %8s %8s %8s %10s %8s %8s\n", "op",
+	       "sessions", "reqs/s", "p50 us", "p90 us", "p99 us",
+	       "p99.9 us", "max us", "rejected", "lost");
+	if (run_phase(fd, "associate", 1, build_assoc, PFCP_ASSOC_SETUP_RSP)) {
+		printf("No PFCP endpoint on port %u\n", server_port);
+		return EXIT_FAILURE;
+	}
+	run_phase(fd, "establish", nb_sessions, build_establish,
+		  PFCP_SESS_EST_RSP);
+	if (do_modify)
+		run_phase(fd, "modify", nb_sessions, build_modify,
+			  PFCP_SESS_MOD_RSP);
+	if (!keep)
+		run_phase(fd, "delete", nb_sessions, build_delete,
+			  PFCP_SESS_DEL_RSP);
+	close(fd);
+	free(up_seid);
+	free(req_start);
+	free(req_lat);
+	return EXIT_SUCCESS;
+}